@@ -0,0 +1,134 @@
+/*
+ * This file is part of ts_ess_earthquake.
+ *
+ * Developed for the Vera C. Rubin Observatory Telescope and Site Systems.
+ * This product includes software developed by the LSST Project
+ * (https://www.lsst.org).
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark of gcrccalc, the CRC of every QDP packet exchanged with the
+ * Q330.
+ *
+ * The CRC of random buffers of every length up to a few packets, at every
+ * alignment, is checked against a copy of the byte at a time loop gcrccalc
+ * replaced, both with the slicing-by-8 tables alone and with the carry-less
+ * multiply path if the CPU has one. The throughput of the three is then
+ * printed for packet sizes seen on the Q330 links. With --check only the CRCs
+ * are checked, which ctest runs.
+ *
+ * Usage: bench_crc [--check | megabytes]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libstrucs.h"
+
+#define MAX_LENGTH 2048
+
+/* Packets of the Q330: ack, status request, small and full data packets and a
+   full memory read. */
+static const int sizes[] = {12, 28, 64, 140, 276, 564, 1012};
+
+/* The loop gcrccalc replaced, kept as the reference. */
+static longint old_crccalc(crc_table_type *crctable, pbyte p, longint len) {
+    longint crc = 0;
+    while (len > 0) {
+        integer temp = ((crc >> 24) ^ *p++) & 255;
+        crc = (crc << 8) ^ crctable->slices[0][temp];
+        len--;
+    }
+    return crc;
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* Seconds to compute the CRC of size byte buffers, total bytes in all. */
+static double time_crc(crc_table_type *table, int use_old, uint8_t *buf, int size, long total) {
+    long count = total / size;
+    longint sink = 0;
+    double t = now();
+    for (long i = 0; i < count; i++) {
+        uint8_t *p = buf + (i % 64) * 16;
+        sink ^= use_old ? old_crccalc(table, p, size) : gcrccalc(table, p, size);
+    }
+    t = now() - t;
+    if (sink == 0x12345678) {
+        printf(" ");
+    }
+    return t;
+}
+
+int main(int argc, char *argv[]) {
+    int check = argc > 1 && strcmp(argv[1], "--check") == 0;
+    long megabytes = argc > 1 && !check ? atol(argv[1]) : 200;
+    if (megabytes < 1) {
+        fprintf(stderr, "Usage: bench_crc [--check | megabytes]\n");
+        return 2;
+    }
+
+    crc_table_type *table = malloc(sizeof(crc_table_type));
+    gcrcinit(table);
+    boolean clmul = table->clmul;
+    uint8_t *buf = malloc(MAX_LENGTH + 64 * 16 + 16);
+    srand(1);
+    for (int i = 0; i < MAX_LENGTH + 64 * 16 + 16; i++) {
+        buf[i] = rand();
+    }
+
+    /* Check that all paths agree on every length and alignment. */
+    for (int len = 0; len <= MAX_LENGTH; len++) {
+        for (int offset = 0; offset < 16; offset++) {
+            longint ref = old_crccalc(table, buf + offset, len);
+            table->clmul = FALSE;
+            longint tables = gcrccalc(table, buf + offset, len);
+            table->clmul = clmul;
+            if (tables != ref || gcrccalc(table, buf + offset, len) != ref) {
+                fprintf(stderr, "CRC differs for %d bytes at offset %d.\n", len, offset);
+                return 1;
+            }
+        }
+    }
+    printf("CRC of 0 to %d bytes at all alignments identical, carry-less multiply %s\n", MAX_LENGTH,
+           clmul ? "available" : "not available");
+    if (check) {
+        return 0;
+    }
+
+    long total = megabytes * 1000000;
+    printf("%6s %12s %12s %12s\n", "bytes", "old MB/s", "tables MB/s", "clmul MB/s");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        double t_old = time_crc(table, 1, buf, sizes[s], total);
+        table->clmul = FALSE;
+        double t_tables = time_crc(table, 0, buf, sizes[s], total);
+        table->clmul = clmul;
+        printf("%6d %12.0f %12.0f", sizes[s], total / t_old * 1e-6, total / t_tables * 1e-6);
+        if (clmul) {
+            printf(" %12.0f", total / time_crc(table, 0, buf, sizes[s], total) * 1e-6);
+        }
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,267 @@
+/*
+ * This file is part of ts_ess_earthquake.
+ *
+ * Developed for the Vera C. Rubin Observatory Telescope and Site Systems.
+ * This product includes software developed by the LSST Project
+ * (https://www.lsst.org).
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark of decompress_blockette, the decoder for the differentially
+ * compressed (DC_COMP) data blockettes of the Q330.
+ *
+ * Each second of a synthetic signal is compressed the way the Q330 does, then
+ * decoded both with decompress_blockette and with a copy of the decoder it
+ * replaced. The outputs are compared and the time per sample of both is
+ * printed. With --check only the outputs are compared, which ctest runs.
+ *
+ * Usage: bench_decompress [--check] [rate [seconds]]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libcompress.h"
+#include "libcvrt.h"
+#include "libsampglob.h"
+#include "libstrucs.h"
+
+#define MAX_WORDS (MAX_RATE + 8)
+
+/* One compressed second: map bits followed by the data words, big endian. */
+typedef struct {
+    longint prev_sample;
+    int blocks;
+    uint8_t map[MAX_WORDS / 4 + 2];
+    uint8_t data[MAX_WORDS * 4];
+} tsecond;
+
+/* Packing choices of the Q330 as samples, bits, map code and high bits. */
+static const int packings[7][4] = {{7, 4, 3, 2}, {6, 5, 3, 1}, {5, 6, 3, 0}, {4, 8, 1, 0},
+                                   {3, 10, 2, 3}, {2, 15, 2, 2}, {1, 30, 2, 1}};
+
+static void store_be32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/* Compress count samples with the densest packing that fits each word. */
+static void compress_second(const longint *samples, int count, longint prev, tsecond *sec) {
+    int i = 0;
+    memset(sec, 0, sizeof(*sec));
+    sec->prev_sample = prev;
+    while (i < count) {
+        int p;
+        for (p = 0; p < 7; p++) {
+            int n = packings[p][0], bits = packings[p][1];
+            longint limit = (longint)1 << (bits - 1);
+            longint last = i ? samples[i - 1] : prev;
+            int fits = i + n <= count;
+            for (int k = 0; fits && k < n; k++) {
+                longint d = samples[i + k] - (k ? samples[i + k - 1] : last);
+                fits = d >= -limit && d < limit;
+            }
+            if (fits) {
+                break;
+            }
+        }
+        int n = packings[p][0], bits = packings[p][1];
+        uint32_t word = bits == 8 ? 0 : (uint32_t)packings[p][3] << 30;
+        longint last = i ? samples[i - 1] : prev;
+        for (int k = 0; k < n; k++) {
+            uint32_t d = (uint32_t)(samples[i + k] - (k ? samples[i + k - 1] : last));
+            word |= (d & ((1u << bits) - 1)) << (bits * (n - 1 - k));
+        }
+        store_be32(sec->data + sec->blocks * 4, word);
+        sec->map[sec->blocks / 4] |= packings[p][2] << (6 - 2 * (sec->blocks % 4));
+        sec->blocks++;
+        i += n;
+    }
+}
+
+/* The decoder decompress_blockette replaced, kept as the reference. */
+static integer old_decompress(plcq q) {
+    static const struct {
+        integer samps, postshift;
+        longint mask, hibit, neg;
+    } tab[7] = {{4, 8, 255, 128, 256},
+                {1, 0, 1073741823, 536870912, 1073741824},
+                {2, 15, 32767, 16384, 32768},
+                {3, 10, 1023, 512, 1024},
+                {5, 6, 63, 32, 64},
+                {6, 5, 31, 16, 32},
+                {7, 4, 15, 8, 16}};
+    tprecomp *pcmp = &q->precomp;
+    integer ptridx = 0, dblocks = pcmp->blocks, midx = pcmp->mapidx;
+    longint curval = pcmp->prev_sample, unpacked[MAXSAMPPERWORD];
+    pbyte pd = pcmp->pdata, pm = pcmp->pmap;
+    pcmp->block_idx = 0;
+    pcmp->curmap = loadword(&pm);
+    while (dblocks > 0 && ptridx < q->rate) {
+        longint accum = loadlongint(&pd);
+        integer subcode = 0;
+        switch ((pcmp->curmap >> (14 - midx)) & 3) {
+            case 2:
+                subcode = (accum >> 30) & 3;
+                break;
+            case 3:
+                subcode = 4 + ((accum >> 30) & 3);
+                break;
+        }
+        if (subcode > 6) {
+            pcmp->blocks = 0;
+            break;
+        }
+        (*(q->idxbuf))[pcmp->block_idx++] = ptridx;
+        for (integer k = tab[subcode].samps - 1; k >= 0; k--) {
+            longint work = accum & tab[subcode].mask;
+            if (work & tab[subcode].hibit) {
+                work = work - tab[subcode].neg;
+            }
+            unpacked[k] = work;
+            accum = accum >> tab[subcode].postshift;
+        }
+        for (integer k = 0; k < tab[subcode].samps; k++) {
+            curval = curval + unpacked[k];
+            if (ptridx >= q->rate) {
+                pcmp->blocks = 0;
+                break;
+            }
+            (*(q->databuf))[ptridx++] = curval;
+        }
+        dblocks--;
+        midx += 2;
+        if (midx > 14) {
+            midx = 0;
+            pcmp->curmap = loadword(&pm);
+        }
+    }
+    pcmp->prev_value = curval;
+    (*(q->idxbuf))[pcmp->block_idx] = ptridx;
+    pcmp->block_idx = 0;
+    return ptridx;
+}
+
+static void load_second(plcq q, tsecond *sec, longint prev_value) {
+    q->precomp.prev_sample = sec->prev_sample;
+    q->precomp.prev_value = prev_value;
+    q->precomp.pmap = sec->map;
+    q->precomp.pdata = sec->data;
+    q->precomp.blocks = sec->blocks;
+    q->precomp.mapidx = 0;
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[]) {
+    int check = argc > 1 && strcmp(argv[1], "--check") == 0;
+    if (check) {
+        argc--;
+        argv++;
+    }
+    int rate = argc > 1 ? atoi(argv[1]) : 200;
+    int seconds = argc > 2 ? atoi(argv[2]) : 20000;
+    if (rate < 1 || rate > MAX_RATE || seconds < 1) {
+        fprintf(stderr, "Usage: bench_decompress [--check] [rate [seconds]]\n");
+        return 2;
+    }
+
+    /*
+     * A noisy signal with events of growing amplitude, so all packings are
+     * used. Every hundredth second carries a few samples too many, to check
+     * the handling of overruns as well.
+     */
+    tsecond *secs = malloc(seconds * sizeof(tsecond));
+    longint *samples = malloc((rate + 8) * sizeof(longint));
+    longint value = 0;
+    srand(1);
+    for (int s = 0; s < seconds; s++) {
+        longint prev = value;
+        int amplitude = 1 << (s % 29);
+        int count = s % 100 == 99 ? rate + 8 : rate;
+        for (int i = 0; i < count; i++) {
+            value += rand() % (2 * amplitude + 1) - amplitude;
+            if (value > (1 << 28) || value < -(1 << 28)) {
+                value /= 2;
+            }
+            samples[i] = value;
+        }
+        compress_second(samples, count, prev, &secs[s]);
+    }
+
+    pq330 q330 = calloc(1, sizeof(tq330));
+    taqstruc *paqs = calloc(1, sizeof(taqstruc));
+    tlcq *q = calloc(1, sizeof(tlcq));
+    paqs->owner = q330;
+    q->rate = rate;
+    q->databuf = malloc(sizeof(tdataarray));
+    q->idxbuf = malloc(sizeof(tidxarray));
+    tdataarray *ref_data = malloc(sizeof(tdataarray));
+    tidxarray *ref_idx = malloc(sizeof(tidxarray));
+
+    /* Check that both decoders agree on every second. */
+    long total = 0;
+    for (int s = 0; s < seconds; s++) {
+        load_second(q, &secs[s], 0);
+        integer n_old = old_decompress(q);
+        longint prev_old = q->precomp.prev_value;
+        memcpy(ref_data, q->databuf, n_old * sizeof(longint));
+        memcpy(ref_idx, q->idxbuf, sizeof(tidxarray));
+        load_second(q, &secs[s], 0);
+        integer n_new = decompress_blockette(paqs, q);
+        if (n_new != n_old || q->precomp.prev_value != prev_old ||
+            memcmp(ref_data, q->databuf, n_old * sizeof(longint)) != 0 ||
+            memcmp(ref_idx, q->idxbuf, sizeof(tidxarray)) != 0) {
+            fprintf(stderr, "Decoders differ in second %d.\n", s);
+            return 1;
+        }
+        total += n_new;
+    }
+    if (check) {
+        printf("%d seconds at %d sps, %ld samples, outputs identical\n", seconds, rate, total);
+        return 0;
+    }
+
+    double t_old = 0, t_new = 0;
+    for (int round = 0; round < 5; round++) {
+        double t = now();
+        for (int s = 0; s < seconds; s++) {
+            load_second(q, &secs[s], 0);
+            old_decompress(q);
+        }
+        t_old += now() - t;
+        t = now();
+        for (int s = 0; s < seconds; s++) {
+            load_second(q, &secs[s], 0);
+            decompress_blockette(paqs, q);
+        }
+        t_new += now() - t;
+    }
+    printf("%d seconds at %d sps, %ld samples, outputs identical\n", seconds, rate, total);
+    printf("old decoder %.2f ns/sample, table driven %.2f ns/sample, speedup %.2fx\n", t_old / total / 5 * 1e9,
+           t_new / total / 5 * 1e9, t_old / t_new);
+    return 0;
+}
@@ -0,0 +1,233 @@
+/*
+ * This file is part of ts_ess_earthquake.
+ *
+ * Developed for the Vera C. Rubin Observatory Telescope and Site Systems.
+ * This product includes software developed by the LSST Project
+ * (https://www.lsst.org).
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Loopback throughput benchmark of the lib330 netserver sending a backlog.
+ *
+ * Each round connects the clients over loopback, writes a buffer full of
+ * numbered records as fast as possible, as when records held back during an
+ * outage are released, and times how long the clients take to read them.
+ * The records are checked for order and their last byte, and the records and
+ * megabytes per second over all the rounds are printed, with the records
+ * the clients fell too far behind to be sent, the number of times the
+ * netserver skipped ahead for them and the clients it disconnected because a
+ * record it was partly sent was about to be overwritten. Only records that
+ * arrive corrupted or out of order make it fail.
+ *
+ * Usage: bench_netserv [records [clients [sndbuf [port]]]]
+ *
+ * records is the size of the netserver buffer, MAX_NS_BUFFERS by default.
+ * sndbuf sets SO_SNDBUF of the client sockets, 0 leaves the default.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "libclient.h"
+#include "libnetserv.h"
+
+#define ROUNDS 10
+#define READ_RECORDS 128 /* records a client reads at once */
+
+typedef struct {
+    int port;
+    unsigned int last; /* sequence number of the last record written */
+    long records;
+    long skips; /* gaps in the sequence, where the netserver skipped ahead */
+    int closed; /* the netserver disconnected the client before the last record */
+    long bad;   /* records with a wrong last byte or out of order, -1 if the client could not connect */
+} tclient;
+
+static double now_s(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void sleep_ms(long ms) {
+    struct timespec t = {ms / 1000, (ms % 1000) * 1000000};
+    nanosleep(&t, NULL);
+}
+
+static void fill_record(completed_record *rec, unsigned int seq) {
+    memcpy(*rec, &seq, sizeof(seq));
+    for (int i = sizeof(seq); i < LIB_REC_SIZE; i++) {
+        (*rec)[i] = (byte)(seq + i);
+    }
+}
+
+/* Read records until the last one written arrives. */
+static void *client_thread(void *p) {
+    tclient *client = p;
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(client->port);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0 || connect(s, (struct sockaddr *)&sin, sizeof(sin)) != 0) {
+        perror("connect");
+        client->bad = -1;
+        return NULL;
+    }
+    static __thread completed_record buf[READ_RECORDS];
+    size_t have = 0;
+    unsigned int prev = 0;
+    int done = 0;
+    while (!done) {
+        ssize_t n = recv(s, (char *)buf + have, sizeof(buf) - have, 0);
+        if (n <= 0) {
+            client->closed = 1;
+            break;
+        }
+        have += n;
+        size_t whole = have / LIB_REC_SIZE;
+        for (size_t i = 0; i < whole && !done; i++) {
+            if (memcmp(buf[i], "000000", 6) == 0) {
+                continue; /* sync record */
+            }
+            unsigned int seq;
+            memcpy(&seq, buf[i], sizeof(seq));
+            if (buf[i][LIB_REC_SIZE - 1] != (byte)(seq + LIB_REC_SIZE - 1) || (client->records && seq <= prev)) {
+                client->bad++;
+            } else if (client->records && seq != prev + 1) {
+                client->skips++;
+            }
+            prev = seq;
+            client->records++;
+            done = seq == client->last;
+        }
+        have -= whole * LIB_REC_SIZE;
+        memmove(buf, buf[whole], have);
+    }
+    close(s);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 5) {
+        fprintf(stderr, "Usage: bench_netserv [records [clients [sndbuf [port]]]]\n");
+        return 2;
+    }
+    int records = argc > 1 ? atoi(argv[1]) : MAX_NS_BUFFERS;
+    int clients = argc > 2 ? atoi(argv[2]) : 1;
+    int sndbuf = argc > 3 ? atoi(argv[3]) : 0;
+    int port = argc > 4 ? atoi(argv[4]) : 18330;
+    if (records < 2 || records > MAX_NS_BUFFERS || clients < 1 || clients > MAX_NS_CLIENTS) {
+        fprintf(stderr, "records must be 2 to %d and clients 1 to %d.\n", MAX_NS_BUFFERS, MAX_NS_CLIENTS);
+        return 2;
+    }
+
+    tpar_create create;
+    memset(&create, 0, sizeof(create));
+    create.q330id_dataport = LP_TEL1;
+    strcpy(create.q330id_station, "NETS");
+    strcpy(create.host_software, "bench_netserv");
+    create.amini_exponent = 12;
+    create.amini_512highest = -1000;
+    create.mini_separate = 1;
+    tcontext context;
+    lib_create_context(&context, &create);
+    if (create.resp_err != LIBERR_NOERR) {
+        fprintf(stderr, "Could not create the lib330 context, error %d.\n", create.resp_err);
+        return 1;
+    }
+
+    tns_par par;
+    memset(&par, 0, sizeof(par));
+    par.ns_port = port;
+    par.server_number = 1;
+    par.record_count = records;
+    par.stnctx = context;
+    par.nsbuf = malloc(sizeof(tnsbuf));
+    par.max_clients = clients;
+    par.sndbuf = sndbuf;
+    pointer ns = lib_ns_start(&par);
+    if (ns == NULL) {
+        fprintf(stderr, "Could not start the netserver on port %d.\n", port);
+        return 1;
+    }
+
+    unsigned int seq = 0;
+    long total = 0, skips = 0, closed = 0, bad = 0;
+    tns_stats stats;
+    double elapsed = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        tclient client[MAX_NS_CLIENTS];
+        pthread_t thread[MAX_NS_CLIENTS];
+        for (int i = 0; i < clients; i++) {
+            memset(&client[i], 0, sizeof(tclient));
+            client[i].port = port;
+            client[i].last = seq + records - 1;
+            pthread_create(&thread[i], NULL, client_thread, &client[i]);
+        }
+        do { /* until the netserver has accepted them all */
+            sleep_ms(5);
+            lib_ns_stats(ns, &stats);
+        } while (stats.count < clients);
+        double start = now_s();
+        completed_record rec;
+        for (int i = 0; i < records; i++) {
+            fill_record(&rec, seq++);
+            lib_ns_send(ns, &rec);
+        }
+        for (int i = 0; i < clients; i++) {
+            pthread_join(thread[i], NULL);
+        }
+        elapsed += now_s() - start;
+        for (int i = 0; i < clients; i++) {
+            total += client[i].records;
+            skips += client[i].skips;
+            closed += client[i].closed;
+            bad += client[i].bad;
+        }
+        do { /* until the netserver has seen the clients go */
+            sleep_ms(5);
+            lib_ns_stats(ns, &stats);
+        } while (stats.count);
+    }
+
+    printf("%d rounds of %d records to %d clients, sndbuf %d\n", ROUNDS, records, clients, sndbuf);
+    printf("%ld records in %.3f s, %ld dropped in %ld skips and %ld disconnects, %ld bad\n", total, elapsed,
+           (long)ROUNDS * records * clients - total, skips, closed, bad);
+    if (elapsed > 0) {
+        printf("%.0f records/s, %.1f MB/s\n", total / elapsed, total * (double)LIB_REC_SIZE / elapsed * 1e-6);
+    }
+
+    lib_ns_stop(ns);
+    free(par.nsbuf);
+    lib_change_state(context, LIBSTATE_TERM, LIBERR_CLOSED);
+    enum tliberr err;
+    topstat opstat;
+    while (lib_get_state(context, &err, &opstat) != LIBSTATE_TERM) {
+        sleep_ms(10);
+    }
+    lib_destroy_context(&context);
+    return bad ? 1 : 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * This file is part of ts_ess_earthquake.
+ *
+ * Developed for the Vera C. Rubin Observatory Telescope and Site Systems.
+ * This product includes software developed by the LSST Project
+ * (https://www.lsst.org).
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Throughput benchmark of the lib330 data path, from a data port packet to
+ * the one second callback, without a Q330.
+ *
+ * A capture written with lib_capture is replayed by the lib330 thread of a
+ * context that is not registered with any Q330. Each packet goes through the
+ * CRC check and process_data, the sliding window, decompression, the LCQs
+ * and the callbacks, exactly as if it had been read from the data port. The
+ * packets and samples per second and the latency histograms of both stages
+ * are printed when the capture has been replayed.
+ *
+ * Usage: bench_replay capture [speed [decode_thread]]
+ *
+ * A speed of 0, the default, replays as fast as possible, 1 at the rate the
+ * packets were captured and 2 twice as fast.
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libclient.h"
+#include "libmsgs.h"
+#include "libstrucs.h"
+
+static const char *stage_names[REPLAY_STAGES] = {"check", "process"};
+
+static atomic_long onesecs;
+static atomic_long samples;
+
+static void secdata_callback(pointer p) {
+    tonesec_call *data = (tonesec_call *)p;
+    atomic_fetch_add(&onesecs, 1);
+    atomic_fetch_add(&samples, data->rate < 0 ? 1 : data->rate);
+}
+
+static void msg_callback(pointer p) {
+    tmsg_call *msg = (tmsg_call *)p;
+    string95 text;
+    lib_get_msg(msg->code, &text);
+    printf("%s%s\n", text, msg->suffix);
+}
+
+static void sleep_ms(long ms) {
+    struct timespec t = {ms / 1000, (ms % 1000) * 1000000};
+    nanosleep(&t, NULL);
+}
+
+/* Print the buckets in use and the approximate median and 99th percentile. */
+static void print_histogram(const char *name, const longword *latency) {
+    double total = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        total += latency[i];
+    }
+    if (total == 0) {
+        return;
+    }
+    printf("%s latency:\n", name);
+    double below = 0;
+    int p50 = -1, p99 = -1;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        below += latency[i];
+        if (p50 < 0 && below >= total * 0.5) {
+            p50 = i;
+        }
+        if (p99 < 0 && below >= total * 0.99) {
+            p99 = i;
+        }
+        if (latency[i]) {
+            printf("  %10.0f - %10.0f ns %10u %6.2f%%\n", (double)(1UL << i), (double)(1UL << (i + 1)) - 1,
+                   (unsigned int)latency[i], latency[i] * 100.0 / total);
+        }
+    }
+    printf("  median below %.0f ns, 99%% below %.0f ns\n", (double)(1UL << (p50 + 1)),
+           (double)(1UL << (p99 + 1)));
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: bench_replay capture [speed [decode_thread]]\n");
+        return 2;
+    }
+    double speed = argc > 2 ? atof(argv[2]) : 0;
+    int decode_thread = argc > 3 ? atoi(argv[3]) : 0;
+
+    tpar_create create;
+    memset(&create, 0, sizeof(create));
+    create.q330id_dataport = LP_TEL1;
+    strcpy(create.q330id_station, "REPL");
+    strcpy(create.host_software, "bench_replay");
+    create.opt_secfilter = OSF_ALL;
+    create.opt_client_msgs = 10;
+#ifndef OMIT_SEED
+    create.amini_exponent = 12;
+    create.amini_512highest = -1000;
+    create.mini_separate = 1;
+#endif
+    create.call_messages = msg_callback;
+    create.call_secdata = secdata_callback;
+    create.opt_decode_thread = decode_thread;
+    tcontext context;
+    lib_create_context(&context, &create);
+    if (create.resp_err != LIBERR_NOERR) {
+        fprintf(stderr, "Could not create the lib330 context, error %d.\n", create.resp_err);
+        return 1;
+    }
+
+    tpar_register reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.host_mode = HOST_ETH;
+    reg.host_mincmdretry = 5;
+    reg.host_maxcmdretry = 40;
+    enum tliberr err = lib_replay(context, &reg, argv[1], speed);
+    if (err != LIBERR_NOERR) {
+        fprintf(stderr, "Could not replay %s, error %d.\n", argv[1], err);
+        return 1;
+    }
+
+    treplaystat stat;
+    do {
+        sleep_ms(10);
+        lib_get_replaystat(context, &stat);
+    } while (stat.active);
+
+    long nsamples = atomic_load(&samples);
+    printf("%u configurations, %u packets, %u rejected, %.0f bytes in %.3f s\n", (unsigned int)stat.configs,
+           (unsigned int)stat.packets, (unsigned int)stat.rejected, stat.bytes, stat.elapsed);
+    printf("%ld one second records, %ld samples\n", atomic_load(&onesecs), nsamples);
+    if (stat.elapsed > 0) {
+        printf("%.0f packets/s, %.0f samples/s, %.1f MB/s\n", stat.packets / stat.elapsed, nsamples / stat.elapsed,
+               stat.bytes / stat.elapsed * 1e-6);
+    }
+    for (int i = 0; i < REPLAY_STAGES; i++) {
+        if (stat.packets) {
+            printf("%s: %.0f ns per packet\n", stage_names[i], stat.stage_time[i] / stat.packets * 1e9);
+        }
+        print_histogram(stage_names[i], stat.latency[i]);
+    }
+
+    lib_change_state(context, LIBSTATE_TERM, LIBERR_CLOSED);
+    topstat opstat;
+    while (lib_get_state(context, &err, &opstat) != LIBSTATE_TERM) {
+        sleep_ms(10);
+    }
+    lib_destroy_context(&context);
+    return 0;
+}
@@ -7,6 +7,7 @@
 #include "libmseed.h"
 #include "q330.h"
 
+pq330_handle handle;
 tstate state;
 MSRecord *msr = NULL;
 int channels[64];
@@ -17,8 +18,8 @@ void do_sleep(int sleep_time) {
     printf("Wake up.\n");
 }
 
-void q330_aminiseed_callback() {
-    tminiseed aminiseed = get_aminiseed();
+void q330_aminiseed_callback(void *user) {
+    tminiseed aminiseed = get_aminiseed(handle);
     printf("get_aminiseed: station_name='%s' location='%s' chan_number='%d' channel='%s' rate='%d'"
            "timestamp='%f' packet_class='%d' miniseed_action='%d', data_size='%d'.\n",
            aminiseed.station_name, aminiseed.location, aminiseed.chan_number, aminiseed.channel,
@@ -26,15 +27,15 @@ void q330_aminiseed_callback() {
            aminiseed.data_size);
 }
 
-void q330_message_callback() {
-    tmsg message = get_message();
+void q330_message_callback(void *user) {
+    tmsg message = get_message(handle);
     printf("get_message: msgcount='%d' code='%d' timestamp='%u' datatime='%d', message='%s%s'.\n",
            message.msgcount, message.code, message.timestamp, message.datatime, message.result,
            message.suffix);
 }
 
-void q330_miniseed_callback() {
-    tminiseed miniseed = get_miniseed();
+void q330_miniseed_callback(void *user) {
+    tminiseed miniseed = get_miniseed(handle);
     printf("get_miniseed: station_name='%s' location='%s' chan_number='%d' channel='%s' rate='%d'"
            "timestamp='%f' packet_class='%d' miniseed_action='%d', data_size='%d'.\n",
            miniseed.station_name, miniseed.location, miniseed.chan_number, miniseed.channel, miniseed.rate,
@@ -48,8 +49,8 @@ void q330_miniseed_callback() {
     msr_print(msr, 1);
 }
 
-void q330_secdata_callback() {
-    tonesec onesec = get_onesec();
+void q330_secdata_callback(void *user) {
+    tonesec onesec = get_onesec(handle);
     printf("get_onesec: station_name='%s' location='%s' chan_number='%d' channel='%s' padding='%d' rate='%d' "
            "samples='[",
            onesec.station_name, onesec.location, onesec.chan_number, onesec.channel, onesec.padding,
@@ -65,8 +66,8 @@ void q330_secdata_callback() {
     channels[onesec.chan_number] = 1;
 }
 
-void q330_state_callback() {
-    state = get_state();
+void q330_state_callback(void *user) {
+    state = get_state(handle);
     printf("get_state: state_type='%d' station_name='%s' subtype='%d' info='%d' state_name='%s'.\n",
            state.state_type, state.station_name, state.subtype, state.info, state.state_name);
 }
@@ -83,6 +84,7 @@ int main() {
     word baseport = 6330;
 
     tinit qinit;
+    memset(&qinit, 0, sizeof(qinit));
     qinit.serial_id = serial_id;
     strcpy(qinit.hostname, hostname);
     qinit.baseport = baseport;
@@ -92,31 +94,48 @@ int main() {
     qinit.miniseed_callback = q330_miniseed_callback;
     qinit.secdata_callback = q330_secdata_callback;
     qinit.state_callback = q330_state_callback;
-    q330_init(qinit);
+    qinit.assemble_triads = false;
+    qinit.triad_callback = NULL;
+    qinit.user = NULL;
+    qinit.decode_thread = false;
+    qinit.window = 0;      /* keep the window programmed into the Q330 */
+    qinit.ack_count = 0;   /* and its acknowledge settings */
+    qinit.ack_timeout = 0;
+    handle = q330_open(qinit);
+    if (handle == NULL) {
+        printf("Failed to open a Q330 handle.\n");
+        return 1;
+    }
 
-    q330_create_context();
+    q330_create_context(handle);
     do_sleep(short_sleep_time);
-    q330_unregistered_ping();
+    q330_unregistered_ping(handle);
     do_sleep(short_sleep_time);
-    q330_register();
+    q330_register(handle);
 
     while (state.info != LIBSTATE_RUNWAIT) {
         do_sleep(short_sleep_time);
     }
-    q330_change_state(LIBSTATE_RUN);
+    q330_change_state(handle, LIBSTATE_RUN);
     do_sleep(long_sleep_time);
 
-    q330_change_state(LIBSTATE_IDLE);
+    q330_change_state(handle, LIBSTATE_IDLE);
     while (state.info != LIBSTATE_IDLE) {
         do_sleep(short_sleep_time);
     }
-    q330_change_state(LIBSTATE_TERM);
+    q330_change_state(handle, LIBSTATE_TERM);
     while (state.info != LIBSTATE_TERM) {
         do_sleep(short_sleep_time);
     }
-    q330_destroy_context();
+    q330_destroy_context(handle);
 
     for (int i = 0; i < 64; i++) {
         printf("%d: %d\n", i, channels[i]);
     }
+
+    tring_stats stats = q330_get_ring_stats(handle, Q330_STREAM_ONESEC);
+    printf("onesec ring: capacity='%u' count='%u' high_water='%u' pushed='%llu' overruns='%llu'.\n",
+           stats.capacity, stats.count, stats.high_water, (unsigned long long)stats.pushed,
+           (unsigned long long)stats.overruns);
+    q330_close(handle);
 }
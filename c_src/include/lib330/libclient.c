@@ -35,6 +35,11 @@ Edit History:
     9 2009-02-09 rdr Add EP Support.
    10 2010-01-04 rdr Add version for libdss.
    11 2010-03-27 rdr Add Q335 support.
+   12 2026-10-17 ess Add lib_get_recvstat.
+   13 2026-10-17 ess Add lib_capture, lib_replay and lib_get_replaystat.
+   14 2026-10-17 ess Add lib_get_latency_stats and lib_add_latency.
+   15 2026-10-17 ess lib_get_slidestat copies the window status without the mutex.
+   16 2026-10-17 ess Add lib_get_goodput.
 */
 #ifndef q330types_h
 #include "q330types.h"
@@ -51,6 +56,12 @@ Edit History:
 #ifndef libslider_h
 #include "libslider.h"
 #endif
+#ifndef libreplay_h
+#include "libreplay.h"
+#endif
+#ifndef liblatency_h
+#include "liblatency.h"
+#endif
 #ifndef libstats_h
 #include "libstats.h"
 #endif
@@ -166,7 +177,7 @@ begin
   memcpy (retopstat, addr(q330->share.opstat), sizeof(topstat)) ;
   if (q330->libstate == LIBSTATE_RUN)
     then
-      memcpy (addr(retopstat->slidecopy), addr(q330->share.slidestat), sizeof(tslidestat)) ;
+      copy_slidestat (q330, addr(retopstat->slidecopy)) ;
     else
       memset (addr(retopstat->slidecopy), 0, sizeof(tslidestat)) ;
   unlock (q330) ;
@@ -455,19 +466,105 @@ begin
   if (q330 == NIL)
     then
       return LIBERR_INVCTX ;
-  lock (q330) ;
   if (q330->libstate == LIBSTATE_RUN)
     then
       begin
-        memcpy (slidecopy, addr(q330->share.slidestat), sizeof(tslidestat)) ;
+        copy_slidestat (q330, slidecopy) ;
         result = LIBERR_NOERR ;
       end
     else
       result = LIBERR_NOSTAT ;
-  unlock (q330) ;
   return result ;
 end
 
+enum tliberr lib_get_recvstat (tcontext ct, trecvstat *recvstat)
+begin
+  pq330 q330 ;
+
+  q330 = ct ;
+  if (q330 == NIL)
+    then
+      return LIBERR_INVCTX ;
+  lock (q330) ;
+  memcpy (recvstat, addr(q330->recvstat), sizeof(trecvstat)) ;
+  unlock (q330) ;
+  return LIBERR_NOERR ;
+end
+
+enum tliberr lib_get_goodput (tcontext ct, tgoodput *goodput)
+begin
+  pq330 q330 ;
+
+  q330 = ct ;
+  if (q330 == NIL)
+    then
+      return LIBERR_INVCTX ;
+  lock (q330) ;
+  memcpy (goodput, addr(q330->goodput_copy), sizeof(tgoodput)) ;
+  unlock (q330) ;
+  return LIBERR_NOERR ;
+end
+
+enum tliberr lib_capture (tcontext ct, pchar path)
+begin
+  pq330 q330 ;
+
+  q330 = ct ;
+  if (q330 == NIL)
+    then
+      return LIBERR_INVCTX ;
+  return capture_open (q330, path) ;
+end
+
+enum tliberr lib_replay (tcontext ct, tpar_register *rpar, pchar path, double speed)
+begin
+  pq330 q330 ;
+
+  q330 = ct ;
+  if (q330 == NIL)
+    then
+      return LIBERR_INVCTX ;
+  return replay_open (q330, rpar, path, speed) ;
+end
+
+enum tliberr lib_get_replaystat (tcontext ct, treplaystat *replaystat)
+begin
+  pq330 q330 ;
+
+  q330 = ct ;
+  if (q330 == NIL)
+    then
+      return LIBERR_INVCTX ;
+  replay_stat (q330, replaystat) ;
+  return LIBERR_NOERR ;
+end
+
+enum tliberr lib_get_latency_stats (tcontext ct, tlatencystat *latencystat)
+begin
+  pq330 q330 ;
+
+  q330 = ct ;
+  if (q330 == NIL)
+    then
+      return LIBERR_INVCTX ;
+  latency_stat (q330, latencystat) ;
+  return LIBERR_NOERR ;
+end
+
+/* For the client to add the latency of one second data it took from its own queue,
+   slot and recv_time are the latency_slot and recv_time of the tonesec_call */
+enum tliberr lib_add_latency (tcontext ct, integer stage, word slot, double recv_time)
+begin
+  pq330 q330 ;
+
+  q330 = ct ;
+  if (q330 == NIL)
+    then
+      return LIBERR_INVCTX ;
+  record_latency (q330, stage, slot, recv_time) ;
+  return LIBERR_NOERR ;
+end
+
 void lib_send_usermessage (tcontext ct, string79 *umsg)
 begin
   pq330 q330 ;
@@ -691,6 +788,7 @@ static /* typedef'd const */ tmodules modules =
 #endif
     {/*name*/"Q330Types", /*ver*/VER_Q330TYPES},     {/*name*/"Q330IO", /*ver*/VER_Q330IO},
     {/*name*/"Q330Cvrt", /*ver*/VER_Q330CVRT},       {/*name*/"LibPOC", /*ver*/VER_LIBPOC},
+    {/*name*/"LibReplay", /*ver*/VER_LIBREPLAY},     {/*name*/"LibLatency", /*ver*/VER_LIBLATENCY},
     {/*name*/"", /*ver*/0}} ; /* Null name to indicate end of list */
 
 pmodules lib_get_modules (void)
@@ -30,6 +30,15 @@ Edit History:
     7 2008-08-20 rdr Add tcp support.
     8 2009-08-02 rdr Add opt_dss_memory.
     9 2010-03-27 rdr Add Q335 State subtype definitions.
+   10 2026-10-17 ess Add trecvstat and lib_get_recvstat.
+   11 2026-10-17 ess Add opt_decode_thread.
+   12 2026-10-17 ess Add treplaystat, lib_capture, lib_replay and lib_get_replaystat.
+   13 2026-10-17 ess Add latency_slot and recv_time to tonesec_call, tlatencystat,
+                     lib_get_latency_stats, lib_add_latency and lib_latency_floor.
+                     Raise MAX_MODULES for liblatency.
+   14 2026-10-17 ess Add opt_window, opt_ack_cnt and opt_ack_to to tpar_register, tgoodput
+                     and lib_get_goodput.
+   15 2026-10-17 ess Add host_ptr to tpar_create.
 }
 */
 #ifndef libclient_h
@@ -60,9 +69,9 @@ Edit History:
 #define FIRMAXSIZE 400
 #define MAX_DETSTAT 40 /* maximum number that library will return */
 #define MAX_CTRLSTAT 20 /* maximum number that library will return */
-#define MAX_MODULES 31
+#define MAX_MODULES 34
 #else
-#define MAX_MODULES 23
+#define MAX_MODULES 26
 #endif
 
 typedef char string2[3] ;
@@ -129,6 +138,8 @@ typedef struct { /* parameters for lib_create call */
   tcallback call_lowlatency ; /* address of low latency data callback procedure */
   tcallback call_baler ; /* Baler related callbacks */
   pfile_owner file_owner ; /* For continuity file handling */
+  word opt_decode_thread ; /* 1 = decode data packets in a separate thread, not on Windows */
+  pointer host_ptr ; /* opaque pointer for the host, set before any callback is made */
 } tpar_create ;
 typedef struct { /* parameters for lib_register call */
   t64 q330id_auth ; /* authentication code */
@@ -156,6 +167,9 @@ typedef struct { /* parameters for lib_register call */
   word opt_buflevel ; /* terminate connection when buffer level reaches this value if non-zero */
   word opt_q330_cont ; /* Determines how often Q330 continuity is written to disk in minutes */
   word opt_dss_memory ; /* Maximum DSS memory (in KB) if non-zero */
+  word opt_window ; /* data port window to program into the Q330 if non-zero, up to WINWRAP */
+  word opt_ack_cnt ; /* acknowledge every this many packets if non-zero instead of the Q330's value */
+  word opt_ack_to ; /* acknowledge timeout in 0.1 seconds if non-zero instead of the Q330's value */
 } tpar_register ;
 typedef struct { /* format of lib_change_conntiming */
   word opt_conntime ; /* maximum connection time in minutes if non-zero */
@@ -229,6 +243,51 @@ typedef struct { /* operation status */
   longword current_ip ; /* current IP Address of Q330 */
   word current_port ; /* current Q330 UDP Port */
 } topstat ;
+typedef struct { /* data port receive statistics */
+  longword reads ; /* number of reads that returned at least one datagram */
+  longword packets ; /* number of datagrams read */
+  longword largest ; /* most datagrams returned by a single read */
+  longword full ; /* number of reads that filled the whole batch */
+} trecvstat ;
+typedef struct { /* data port goodput, updated about once a second */
+  longword packets ; /* data packets added to the window */
+  longword duplicates ; /* data packets that were already in the window */
+  longword outside ; /* data packets outside of the window */
+  longword dacks ; /* acknowledgements sent */
+  longword immediate ; /* acknowledgements sent at once because a packet went missing or arrived */
+  double bytes ; /* data bytes of the packets added to the window */
+  double received ; /* data bytes of all data packets */
+  double goodput ; /* bytes per second added to the window during the last interval */
+  single efficiency ; /* percent of the bytes received during the last interval added to the window */
+  word window ; /* data port window the Q330 is programmed with */
+} tgoodput ;
+#define REPLAY_STAGES 2
+#define RS_CHECK 0 /* CRC and header */
+#define RS_PROCESS 1 /* process_data, sliding window through decoding and callbacks */
+#define LATENCY_BUCKETS 32 /* bucket i counts latencies of 2^i to 2^(i+1)-1 nanoseconds */
+typedef struct { /* capture replay statistics */
+  boolean active ; /* replay still running */
+  longword configs ; /* configuration records replayed */
+  longword packets ; /* data packets replayed */
+  longword rejected ; /* data packets with a bad CRC */
+  double bytes ; /* bytes in the data packets replayed */
+  double elapsed ; /* seconds since the first record was replayed */
+  double stage_time[REPLAY_STAGES] ; /* total seconds spent in each stage */
+  longword latency[REPLAY_STAGES][LATENCY_BUCKETS] ; /* per packet latency histogram of each stage */
+} treplaystat ;
+#define LATENCY_STAGES 4 /* each measured from the time the data packet was received */
+#define LS_DECODE 0 /* blockette decompressed */
+#define LS_ONESEC 1 /* one second callback */
+#define LS_MINISEED 2 /* miniseed callback */
+#define LS_POP 3 /* one second data taken by the client, see lib_add_latency */
+#define LATENCY_SUB 8 /* bins per power of two, the bin width is at most 1/8 of the latency */
+#define LATENCY_BINS 240 /* one microsecond bins up to LATENCY_SUB, then log-linear up to 2^31 us */
+#define LATENCY_NONE 0xFFFF /* latency_slot of data that did not come from a data packet */
+typedef struct { /* latency histogram of one stage */
+  longword count ; /* number of latencies */
+  longword max ; /* largest latency in microseconds */
+  longword bins[LATENCY_BINS] ; /* bin i starts at lib_latency_floor(i) microseconds */
+} tlatencyhist ;
 typedef struct { /* for 1 second and low latency callback */
   longword total_size ; /* number of bytes in buffer passed */
   tcontext context ;
@@ -249,6 +308,8 @@ typedef struct { /* for 1 second and low latency callback */
   word data_quality_flags ; /* same as in Miniseed */
   byte src_channel ; /* source blockette channel */
   byte src_subchan ; /* source blockette sub-channel */
+  word latency_slot ; /* for lib_add_latency, LATENCY_NONE if not from a data packet */
+  double recv_time ; /* when the data packet completing this second was received, zero if none */
   longint samples[MAX_RATE] ; /* decompressed samples */
 } tonesec_call ;
 #ifndef OMIT_SEED
@@ -391,6 +452,16 @@ typedef struct { /* format of the result */
   tonelcqstat entries[MAX_LCQ] ;
 } tlcqstat ;
 #endif
+typedef struct { /* latencies of one lcq */
+  string2 location ;
+  byte chan_number ; /* channel number according to tokens */
+  string3 channel ;
+  tlatencyhist stages[LATENCY_STAGES] ; /* indexed by LS_xxx */
+} tonelatency ;
+typedef struct { /* format of the result, large enough to allocate rather than put on the stack */
+  integer count ; /* number of valid entries */
+  tonelatency entries[MAX_LCQ] ;
+} tlatencystat ;
 typedef struct { /* format of essential items from tokens */
   string9 station_name ;
   word web_port ; /* web server TCP port */
@@ -432,6 +503,14 @@ extern void lib_ping_request (tcontext ct, tpingreq *ping_req) ;
 extern enum tliberr lib_unregistered_ping (tcontext ct, tpar_register *rpar) ;
 extern word lib_change_verbosity (tcontext ct, word newverb) ;
 extern enum tliberr lib_get_slidestat (tcontext ct, tslidestat *slidecopy) ;
+extern enum tliberr lib_get_recvstat (tcontext ct, trecvstat *recvstat) ;
+extern enum tliberr lib_get_goodput (tcontext ct, tgoodput *goodput) ;
+extern enum tliberr lib_capture (tcontext ct, pchar path) ; /* NIL or empty path to stop */
+extern enum tliberr lib_replay (tcontext ct, tpar_register *rpar, pchar path, double speed) ;
+extern enum tliberr lib_get_replaystat (tcontext ct, treplaystat *replaystat) ;
+extern enum tliberr lib_get_latency_stats (tcontext ct, tlatencystat *latencystat) ;
+extern enum tliberr lib_add_latency (tcontext ct, integer stage, word slot, double recv_time) ;
+extern longword lib_latency_floor (integer bin) ;
 extern void lib_send_usermessage (tcontext ct, string79 *umsg) ;
 extern void lib_poc_received (tcontext ct, tpocmsg *poc) ;
 extern enum tliberr lib_get_commevents (tcontext ct, tcommevents *commevents) ;
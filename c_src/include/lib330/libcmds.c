@@ -57,6 +57,8 @@ Edit History:
    23 2010-05-17 rdr Add sending Q335 Aware flag in C1_RQFGLS.
    24 2013-08-18 rdr Change reboot to lib330_reboot to avoid conflict with some nonsense.
    25 2016-01-26 rdr For CERR_INVREG just keep trying to register.
+   26 2026-10-17 ess Program opt_window into the Q330 when the logical port is loaded
+                     during registration. Update the goodput once a second.
 */
 #ifndef libcmds_h
 #include "libcmds.h"
@@ -739,6 +741,24 @@ begin
   q330->reg_timer = 0 ;
 end
 
+/* If the host wants a different data port window than the Q330 is programmed with
+   then send the changed logical port programming, the mutex must be held */
+static void program_window (pq330 q330)
+begin
+  word w ;
+
+  w = q330->par_register.opt_window ;
+  if (w > WINWRAP)
+    then
+      w = WINWRAP ; /* largest the DACK can acknowledge */
+  if ((w == 0) lor (w == q330->share.log.window))
+    then
+      return ;
+  memcpy (addr(q330->share.newlog), addr(q330->share.log), sizeof(tlog)) ;
+  q330->share.newlog.window = w ;
+  q330->share.log_changed = TRUE ;
+end
+
 /* pb has pointer to packet buffer */
 void lib_command_response (pq330 q330, pbyte pb)
 begin
@@ -989,6 +1009,7 @@ begin
                                 q330->share.log.rsnd_min, q330->share.log.rsnd_max,
                                 q330->share.log.dataseq, s2) ;
                         q330->piggyok = (q330->share.log.flags and LNKFLG_PIGGY) == 0 ;
+                        program_window (q330) ;
                         unlock (q330) ;
                         libmsgadd (q330, LIBMSG_COMBO, "") ;
                         libmsgadd (q330, LIBMSG_WINDOW, addr(s)) ;
@@ -1804,6 +1825,7 @@ begin
     then
       begin /* about 1 second */
         q330->timercnt = 0 ;
+        update_goodput (q330) ;
         if (pc->ctrlrecnt)
           then
             dec(pc->ctrlrecnt) ;
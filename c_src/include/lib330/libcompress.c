@@ -24,6 +24,10 @@ Edit History:
     1 2006-11-28 rdr Remove handling of last_valid. Previous sample should default to
                      zero instead of the first known sample as a cheat for decompressors
                      to avoid emitting an error message.
+    2 2026-10-17 ess Table driven decompress_blockette, with the differences summed
+                     into samples in a single pass over the second.
+    3 2026-10-17 ess compress_block classifies the differences of a block once and
+                     walks the compression table over the mask of entries that fit.
 */
 #ifndef libcompress_h
 #include "libcompress.h"
@@ -47,6 +51,11 @@ Edit History:
 #endif
 #endif
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#define COMPRESS_SSE2
+#include <emmintrin.h>
+#endif
+
 #define B7X4 (2 shl 2) /* level 2 compression code bits, within each block */
 #define B6X5 1
 #define B5X6 0
@@ -66,11 +75,8 @@ typedef struct {
 } compseqtype ;
 typedef compseqtype compseq_table_type[7] ;
 typedef struct {
-  integer samps ;
-  integer postshift ;
-  longint mask ;
-  longint hibit ;
-  longint neg ;
+  integer samps ; /* differences in the word */
+  integer bits ; /* bits per difference */
 } decompbittype ;
 typedef decompbittype decomarray[7] ;
 
@@ -86,15 +92,98 @@ const compseq_table_type compseq =
 #endif
 
 const decomarray decomptab =
-  {{/*samps*/4, /*postshift*/8,  /*mask*/255,        /*hibit*/128,       /*neg*/256},
-   {/*samps*/1, /*postshift*/0,  /*mask*/1073741823, /*hibit*/536870912, /*neg*/1073741824},
-   {/*samps*/2, /*postshift*/15, /*mask*/32767,      /*hibit*/16384,     /*neg*/32768},
-   {/*samps*/3, /*postshift*/10, /*mask*/1023,       /*hibit*/512,       /*neg*/1024},
-   {/*samps*/5, /*postshift*/6,  /*mask*/63,         /*hibit*/32,        /*neg*/64},
-   {/*samps*/6, /*postshift*/5,  /*mask*/31,         /*hibit*/16,        /*neg*/32},
-   {/*samps*/7, /*postshift*/4,  /*mask*/15,         /*hibit*/8,         /*neg*/16}} ;
+  {{/*samps*/4, /*bits*/8},
+   {/*samps*/1, /*bits*/30},
+   {/*samps*/2, /*bits*/15},
+   {/*samps*/3, /*bits*/10},
+   {/*samps*/5, /*bits*/6},
+   {/*samps*/6, /*bits*/5},
+   {/*samps*/7, /*bits*/4}} ;
+/* decomptab index for the two map bits of a block (high) and the two high bits of
+   its data word (low), 7 is not a valid code */
+const byte decompcode[16] =
+  {0, 0, 0, 0, /* map 0 */
+   0, 0, 0, 0, /* map 1, 4 x 8 bits */
+   0, 1, 2, 3, /* map 2, 1 x 30, 2 x 15 or 3 x 10 bits */
+   4, 5, 6, 7} ; /* map 3, 5 x 6, 6 x 5 or 7 x 4 bits */
 
 #ifndef OMIT_SEED
+/* Differences the next MAXSAMPPERWORD samples in the peek buffer into diffs and sc, and
+   returns a mask with bit scan - 1 set for each compseq entry in which all of the first
+   scan differences fit */
+static integer block_fits (pcom_packet pcom)
+begin
+#ifdef COMPRESS_SSE2
+  __m128i lo, hi, prevlo, prevhi, locls, hicls, disc, highest, limit ;
+  integer i, o, fits ;
+
+  /* samples 0 to 3 and 3 to 6, with the ones before them */
+  o = pcom->next_out ;
+  if (o <= PEEKELEMS - MAXSAMPPERWORD)
+    then
+      begin
+        lo = _mm_loadu_si128((__m128i *)addr(pcom->peeks[o])) ;
+        hi = _mm_loadu_si128((__m128i *)addr(pcom->peeks[o + 3])) ;
+        prevhi = _mm_loadu_si128((__m128i *)addr(pcom->peeks[o + 2])) ;
+      end
+    else
+      begin
+        lo = _mm_setr_epi32(pcom->peeks[o], pcom->peeks[(o + 1) and PEEKMASK],
+                            pcom->peeks[(o + 2) and PEEKMASK], pcom->peeks[(o + 3) and PEEKMASK]) ;
+        hi = _mm_setr_epi32(pcom->peeks[(o + 3) and PEEKMASK], pcom->peeks[(o + 4) and PEEKMASK],
+                            pcom->peeks[(o + 5) and PEEKMASK], pcom->peeks[(o + 6) and PEEKMASK]) ;
+        prevhi = _mm_setr_epi32(pcom->peeks[(o + 2) and PEEKMASK], pcom->peeks[(o + 3) and PEEKMASK],
+                                pcom->peeks[(o + 4) and PEEKMASK], pcom->peeks[(o + 5) and PEEKMASK]) ;
+      end
+  prevlo = _mm_or_si128(_mm_slli_si128(lo, 4), _mm_cvtsi32_si128(pcom->last_sample)) ;
+  _mm_storeu_si128((__m128i *)addr(pcom->sc[2]), lo) ;
+  _mm_storeu_si128((__m128i *)addr(pcom->sc[5]), hi) ;
+  lo = _mm_sub_epi32(lo, prevlo) ;
+  hi = _mm_sub_epi32(hi, prevhi) ;
+  _mm_storeu_si128((__m128i *)addr(pcom->diffs[0]), lo) ;
+  _mm_storeu_si128((__m128i *)addr(pcom->diffs[3]), hi) ;
+  lo = _mm_sub_epi32(_mm_xor_si128(lo, _mm_srai_epi32(lo, 31)), _mm_srai_epi32(lo, 31)) ;
+  hi = _mm_sub_epi32(_mm_xor_si128(hi, _mm_srai_epi32(hi, 31)), _mm_srai_epi32(hi, 31)) ;
+  /* class of a difference is the index of the first entry it fits */
+  locls = _mm_setzero_si128() ;
+  hicls = _mm_setzero_si128() ;
+  for (i = 0 ; i < MAXSAMPPERWORD ; i++)
+    begin
+      disc = _mm_set1_epi32(compseq[i].disc) ;
+      locls = _mm_sub_epi32(locls, _mm_cmpgt_epi32(lo, disc)) ;
+      hicls = _mm_sub_epi32(hicls, _mm_cmpgt_epi32(hi, disc)) ;
+    end
+  /* highest class of differences 0 to 3, 3 again and 4 to 6 so far, compared to the entries
+     with scans 1 to 4, 4 and 5 to 7 */
+  highest = _mm_packus_epi16(_mm_packs_epi32(locls, hicls), _mm_setzero_si128()) ;
+  highest = _mm_max_epu8(highest, _mm_slli_si128(highest, 1)) ;
+  highest = _mm_max_epu8(highest, _mm_slli_si128(highest, 2)) ;
+  highest = _mm_max_epu8(highest, _mm_slli_si128(highest, 4)) ;
+  limit = _mm_setr_epi8(6, 5, 4, 3, 3, 2, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0) ;
+  fits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(highest, limit), limit)) ;
+  return (fits and 0x0F) or ((fits shr 1) and 0x70) ;
+#else
+  integer i, cls, fits ;
+  longint value ;
+
+  cls = 0 ; /* first entry all differences so far fit */
+  fits = 0 ;
+  for (i = 0 ; i < MAXSAMPPERWORD ; i++)
+    begin
+      value = pcom->peeks[(pcom->next_out + i) and PEEKMASK] ;
+      pcom->sc[i + 2] = value ;
+      pcom->diffs[i] = value - pcom->sc[i + 1] ;
+      while ((cls < MAXSAMPPERWORD) land (abs(pcom->diffs[i]) > compseq[cls].disc))
+        inc(cls) ;
+      if (cls > 6 - i)
+        then
+          break ; /* neither do any longer scans */
+      fits = fits or (1 shl i) ;
+    end
+  return fits ;
+#endif
+end
+
 void no_previous (paqstruc paqs)
 begin
   plcq q ;
@@ -120,15 +209,13 @@ integer compress_block (paqstruc paqs, plcq q, pcom_packet pcom)
 begin
   integer i ;
   integer block_code ;
-  boolean done ;
   longint samp_1 ;
   longint accum, value ;
-  integer hiscan, ctabw, ctabfit, ctablo ;
+  integer fits, ctablo ;
   const compseqtype *sp ;
   integer t_scan ;
   integer t_shift ;
   longint t_mask ;
-  longint t_disc ;
   pbyte p ;
   string15 s ;
   pq330 q330 ;
@@ -157,13 +244,10 @@ begin
    */
   pcom->sc[1] = pcom->last_sample ;
   /*
-   * now start the scan loop for this block. "hiscan" is the number of differences in
-   * the local difference buffer, which is increased as required.
-   * "ctabfit" is > 0 if a table entry has been found in which all differences fit;
-   * when starting the scan for this block, we don't know what fits.
-   * "ctabw" is the table pointer at entry, which if it necessary to scan beyond, means
-   * that once a fit is found, there is not point in looking backwards to see if any
-   * more will fit.
+   * the differences of the block are classified once, "fits" has bit scan - 1 set for
+   * each table entry in which all of its differences fit. "ctablo" is the first table
+   * entry for which there are enough samples, differences after "peek_total" are not
+   * valid and never looked at.
    */
   if (pcom->peek_total < MAXSAMPPERWORD)
     then
@@ -175,83 +259,32 @@ begin
       end
     else
       ctablo = 0 ;
-  hiscan = 0 ;
-  done = FALSE ;
-  ctabfit = -1 ;
-  ctabw = pcom->ctabx ;
-  repeat
-    sp = addr(compseq[pcom->ctabx]) ;
-    t_scan = sp->scan ;
-    t_disc = sp->disc ;
-    while (hiscan < t_scan)
+  fits = block_fits (pcom) ;
+  if (fits and (1 shl (compseq[pcom->ctabx].scan - 1)))
+    then
       begin
-        value = pcom->peeks[(pcom->next_out + hiscan) and PEEKMASK] ;
-        pcom->sc[hiscan + 2] = value ;
-        pcom->diffs[hiscan] = value - pcom->sc[hiscan + 1] ;
-        inc(hiscan) ;
+        /*
+         * the current table entry is a fit, try smaller storage sizes until one does
+         * not fit or the start of the table has been reached.
+         */
+        while ((pcom->ctabx > ctablo) land (fits and (1 shl (compseq[pcom->ctabx - 1].scan - 1))))
+          dec(pcom->ctabx) ;
+      end
+    else
+      begin
+        /*
+         * go to larger storage sizes until the differences fit. if they do not
+         * even fit the largest, they cannot be compressed.
+         */
+        while ((pcom->ctabx < 6) land ((fits and (1 shl (compseq[pcom->ctabx].scan - 1))) == 0))
+          inc(pcom->ctabx) ;
+        if ((fits and (1 shl (compseq[pcom->ctabx].scan - 1))) == 0)
+          then
+            begin
+              seed2string(q->location, q->seedname, addr(s)) ;
+              libmsgadd(q330, LIBMSG_UNCOMP, addr(s)) ;
+            end
       end
-    for (i = 0 ; i <= t_scan - 1 ; i++)
-      if (abs(pcom->diffs[i]) > t_disc)
-        then
-          begin
-            /*
-             * at least one difference in the scan does not fit. if there has been
-             * no table entry found yet for which the data will fit, go to the
-             * next larger storage size. otherwise, take the one that fits, and
-             * quit scanning. this may be the case if the table is probed toward
-             * the beginning, looking for more efficient fits.
-             */
-            if (ctabfit < 0)
-              then
-                if (pcom->ctabx >= 6)
-                  then
-                    begin
-                      seed2string(q->location, q->seedname, addr(s)) ;
-                      libmsgadd(q330, LIBMSG_UNCOMP, addr(s)) ;
-                      done = TRUE ;
-                    end
-                  else
-                    inc(pcom->ctabx) ;
-              else
-                begin
-                  pcom->ctabx = ctabfit ;
-                  done = TRUE ;
-                end
-            break ;
-          end
-      else if (i == (t_scan - 1))
-        then
-          begin
-            /*
-             * here, all differences within the scan fit. if the table is scanning
-             * toward larger storage sizes, then smaller ones cannot possibly fit,
-             * so the scan is done.
-             */
-            if (pcom->ctabx > ctabw)
-              then
-                done = TRUE ;
-              else
-                /*
-                 * here, note that at least the current table entry is a fit,
-                 * but if the start of the table has not been reached, try scanning
-                 * toward smaller storage sizes. if the smaller storage size won't
-                 * work, the size selected by "ctabfit" will be used (see above).
-                 */
-                if (pcom->ctabx > ctablo)
-                  then
-                    begin
-                      ctabfit = pcom->ctabx ;
-                      pcom->ctabx = pcom->ctabx - 1 ;
-                    end
-                  else
-                    done = TRUE ;
-            break ;
-          end
-   /*
-    * continue scanning this block until a fit is found or the end of the table (maximum storage size)
-    * is hit and the differences still don't fit.
-    */
-  until done) ;
   /*
    * using the selected storage unit, pack the differences into the current block and
    * update various counters and indices
@@ -288,14 +321,47 @@ begin
 end
 #endif
 
+/* Replace count differences by the running sum starting at prev, returns the
+   last sample */
+static longint sum_differences (plong p, integer count, longint prev)
+begin
+  integer i ;
+#ifdef COMPRESS_SSE2
+  __m128i x, carry ;
+
+  carry = _mm_set1_epi32 (prev) ;
+  i = 0 ;
+  while (i <= count - 4)
+    begin
+      x = _mm_loadu_si128 ((__m128i *)addr(p[i])) ;
+      x = _mm_add_epi32 (x, _mm_slli_si128 (x, 4)) ;
+      x = _mm_add_epi32 (x, _mm_slli_si128 (x, 8)) ;
+      x = _mm_add_epi32 (x, carry) ;
+      _mm_storeu_si128 ((__m128i *)addr(p[i]), x) ;
+      carry = _mm_shuffle_epi32 (x, 0xFF) ;
+      incn(i, 4) ;
+    end
+  prev = _mm_cvtsi128_si32 (carry) ;
+#else
+  i = 0 ;
+#endif
+  while (i < count)
+    begin
+      prev = prev + p[i] ;
+      p[i] = prev ;
+      inc(i) ;
+    end
+  return prev ;
+end
+
 integer decompress_blockette (paqstruc paqs, plcq q)
 begin
-  integer ptridx, subcode, k, dblocks, midx ;
-  longint curval, work, accum ;
+  integer ptridx, subcode, k, dblocks, midx, samps, bits ;
+  longint curval, accum, extra ;
   const decompbittype *dcp ;
   pbyte pd, pm ;
+  plong pdest ;
   tprecomp *pcmp ;
-  longint unpacked[MAXSAMPPERWORD] ;
   string95 s ;
   string15 s1 ;
   integer v1, v2 ;
@@ -319,18 +385,13 @@ begin
   midx = pcmp->mapidx ;
   pm = pcmp->pmap ;
   pcmp->curmap = loadword (addr(pm)) ;
+  pdest = (pointer)q->databuf ;
+  extra = 0 ;
+  /* first store the differences, sum_differences turns them into samples */
   while ((dblocks > 0) land (ptridx < q->rate))
     begin
       accum = loadlongint(addr(pd)) ;
-      subcode = 0 ; /* default */
-      switch ((pcmp->curmap shr (14 - midx)) and 3) begin
-        case 2 :
-          subcode = (accum shr 30) and 3 ;
-          break ;
-        case 3 :
-          subcode = 4 + ((accum shr 30) and 3) ;
-          break ;
-      end
+      subcode = decompcode[(((pcmp->curmap shr (14 - midx)) and 3) shl 2) or ((accum shr 30) and 3)] ;
       if (subcode > 6)
         then
           begin /* not a valid subcode */
@@ -340,27 +401,20 @@ begin
       dcp = addr(decomptab[subcode]) ;
       (*(q->idxbuf))[pcmp->block_idx] = ptridx ;
       inc(pcmp->block_idx) ;
-      for (k = dcp->samps - 1 ; k >= 0 ; k--)
-        begin
-          work = accum and dcp->mask ;
-          if (work and dcp->hibit)
-            then
-              work = work - dcp->neg ;
-          unpacked[k] = work ;
-          accum = accum shr dcp->postshift ;
-        end
-      for (k = 0 ; k <= dcp->samps - 1 ; k++)
-        begin
-          curval = curval + unpacked[k] ;
-          if (ptridx >= q->rate)
-            then
-              begin
-                pcmp->blocks = 0 ; /* nothing valid */
-                break ;
-              end
-          (*(q->databuf))[ptridx] = curval ;
-          inc(ptridx) ;
-        end
+      samps = dcp->samps ;
+      bits = dcp->bits ;
+      if ((ptridx + samps) > q->rate)
+        then
+          begin /* more samples than the rate, keep what fits */
+            samps = q->rate - ptridx ;
+            extra = (longint)((longword)accum shl (32 - bits * (dcp->samps - samps))) shr (32 - bits) ;
+            pcmp->blocks = 0 ; /* nothing valid */
+          end
+      /* the first difference is in the highest bits, shift each one to the top and
+         back down to sign extend it */
+      for (k = 0 ; k <= samps - 1 ; k++)
+        pdest[ptridx + k] = (longint)((longword)accum shl (32 - bits * (dcp->samps - k))) shr (32 - bits) ;
+      incn(ptridx, samps) ;
       dec(dblocks) ;
       incn(midx, 2) ;
       if (midx > 14)
@@ -370,6 +424,7 @@ begin
             pcmp->curmap = loadword (addr(pm)) ;
           end
     end
+  curval = sum_differences (pdest, ptridx, curval) + extra ;
   pcmp->prev_value = curval ;
   (*(q->idxbuf))[pcmp->block_idx] = ptridx ;
   pcmp->block_idx = 0 ; /* for build_frames later on */
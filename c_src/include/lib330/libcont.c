@@ -36,6 +36,8 @@ Edit History:
                      instead of using getmem.
     9 2010-07-21 rdr Add high frequency to connection continuity.
    10 2010-07-22 rdr Add updating of thread memory required. 
+   11 2026-10-17 ess Save and restore FIR history with fir_save and fir_load.
+   12 2026-10-17 ess Save and restore IIR history with iir_save and iir_load.
 */
 #ifndef libcont_h
 #include "libcont.h"
@@ -72,6 +74,9 @@ Edit History:
 #ifndef libdetect_h
 #include "libdetect.h"
 #endif
+#ifndef libfilters_h
+#include "libfilters.h"
+#endif
 #endif
 
 #ifdef OMIT_SEED
@@ -892,10 +897,7 @@ begin
                     else
                       points = 1 ;
                   for (i = 1 ; i <= pdest->sects ; i++)
-                    begin
-                      memcpy(addr(pdest->filt[i].x), addr(psrc->flt[i].x), sizeof(tvector)) ;
-                      memcpy(addr(pdest->filt[i].y), addr(psrc->flt[i].y), sizeof(tvector)) ;
-                    end
+                    iir_load (addr(pdest->filt[i]), addr(psrc->flt[i].x), addr(psrc->flt[i].y)) ;
                   memcpy (addr(pdest->out), addr(psrc->outbuf), sizeof(tfloat) * points) ;
                   break ;
                 end
@@ -910,9 +912,7 @@ begin
                 (q->source_fir) land (strcmp(addr(q->source_fir->fname), addr(pfsrc->fn)) == 0))
               then
                 begin
-                  q->fir->fcount = pfsrc->fcnt ;
-                  q->fir->f = (pointer)((pntrint)q->fir->fbuf + pfsrc->foff) ;
-                  memcpy (q->fir->fbuf, addr(pfsrc->fbuffer), q->fir->flen * sizeof(tfloat)) ;
+                  fir_load (q->fir, addr(pfsrc->fbuffer), pfsrc->fcnt) ;
                   q->com->charging = FALSE ; /* not any more */
                   break ;
                 end
@@ -1247,8 +1247,8 @@ begin
             strcpy(addr(pfdest->fn), addr(q->source_fir->fname)) ;
             pfdest->lpad = 0 ;
             pfdest->fcnt = q->fir->fcount ;
-            pfdest->foff = (longint)((pntrint)q->fir->f - (pntrint)q->fir->fbuf) ;
-            memcpy (addr(pfdest->fbuffer), q->fir->fbuf, q->fir->flen * sizeof (tfloat)) ;
+            pfdest->foff = q->fir->fcount * sizeof(tfloat) ;
+            fir_save (q->fir, addr(pfdest->fbuffer)) ;
             pfdest->size = pfdest->size + sizeof(tfloat) * q->fir->flen ;
             pfdest->crc = gcrccalc (addr(q330->crc_table), (pointer)((pntrint)pfdest + 4), pfdest->size - 4) ;
             q330cont_write (q330, pfdest, pfdest->size) ;
@@ -1281,10 +1281,7 @@ begin
           strcpy(addr(pdest->fn), addr(psrc->def->fname)) ;
           pdest->lpad = 0 ;
           for (i = 1 ; i <= psrc->sects ; i++)
-            begin
-              memcpy(addr(pdest->flt[i].x), addr(psrc->filt[i].x), sizeof(tvector)) ;
-              memcpy(addr(pdest->flt[i].y), addr(psrc->filt[i].y), sizeof(tvector)) ;
-            end
+            iir_save (addr(psrc->filt[i]), addr(pdest->flt[i].x), addr(pdest->flt[i].y)) ;
           memcpy (addr(pdest->outbuf), addr(psrc->out), sizeof(tfloat) * points) ;
           pdest->size = pdest->size + sizeof(tfloat) * points ;
           pdest->crc = gcrccalc (addr(q330->crc_table), (pointer)((pntrint)pdest + 4), pdest->size - 4) ;
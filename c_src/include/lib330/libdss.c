@@ -29,6 +29,7 @@ Edit History:
                      report secs since Q330 reboot, not dss server.
     5 2010-01-04 rdr Use fcntl instead of ioctl to set socket non-blocking.
     6 2013-02-02 rdr Set high_socket.
+    7 2026-10-17 ess Increment sock_generation in close_socket.
 */
 #ifndef OMIT_SEED /* Can't use without seed generation */
 #ifndef OMIT_NETWORK /* or without network */
@@ -544,7 +545,10 @@ begin
 #ifdef X86_WIN32
       closesocket (dssstr->q330->dsspath) ;
 #else
-      close (dssstr->q330->dsspath) ;
+      begin
+        close (dssstr->q330->dsspath) ;
+        inc(dssstr->q330->sock_generation) ;
+      end
 #endif
   dssstr->q330->dsspath = INVALID_SOCKET ;
 end
@@ -24,6 +24,13 @@ Edit History:
     1 2007-08-04 rdr Some foolishness to get around gcc-avr32 optimizer bugs.
                      Add underflow detection for multi_section_filter for platforms
                      not corrected configured for "float-to-zero".
+    2 2026-10-17 ess Keep the FIR history in a doubled circular buffer instead of
+                     shifting it for every output sample, and compute the FIR output
+                     with an SSE2 or AVX2 kernel selected at run time.
+    3 2026-10-17 ess Add fir_fill.
+    4 2026-10-17 ess Run the IIR sections in transposed direct form II over blocks of
+                     samples, with denormals flushed by the FPU instead of per-element
+                     checks. The x and y vectors are only kept for continuity.
 }
 */
 #ifndef libfilters_h
@@ -47,6 +54,12 @@ Edit History:
 #include "libseed.h"
 #endif
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#define FIR_SIMD
+#define IIR_FTZ 0x8040 /* MXCSR flush to zero and denormals are zero */
+#include <immintrin.h>
+#endif
+
 typedef double tdec10[200] ;
 typedef double tvlp389[389] ;
 typedef double tulp379[379] ;
@@ -331,23 +344,109 @@ begin
   return NIL ;
 end
 
+static tfloat fir_dot_scalar (pfloat pv, pfloat pc, longint len)
+begin
+  longint i ;
+  tfloat accum ;
+
+  accum = 0.0 ;
+  for (i = 0 ; i <= len - 1 ; i++)
+    accum = pv[i] * pc[i] + accum ;
+  return accum ;
+end
+
+#ifdef FIR_SIMD
+/* SSE2 is part of the x86_64 baseline, no run time check needed */
+static tfloat fir_dot_sse2 (pfloat pv, pfloat pc, longint len)
+begin
+  longint i ;
+  __m128d acc0, acc1 ;
+  double sums[2] ;
+
+  acc0 = _mm_setzero_pd () ;
+  acc1 = _mm_setzero_pd () ;
+  i = 0 ;
+  while (i <= len - 4)
+    begin
+      acc0 = _mm_add_pd (acc0, _mm_mul_pd (_mm_loadu_pd (pv + i), _mm_loadu_pd (pc + i))) ;
+      acc1 = _mm_add_pd (acc1, _mm_mul_pd (_mm_loadu_pd (pv + i + 2), _mm_loadu_pd (pc + i + 2))) ;
+      incn(i, 4) ;
+    end
+  _mm_storeu_pd (sums, _mm_add_pd (acc0, acc1)) ;
+  sums[0] = sums[0] + sums[1] ;
+  while (i < len)
+    begin
+      sums[0] = pv[i] * pc[i] + sums[0] ;
+      inc(i) ;
+    end
+  return sums[0] ;
+end
+
+__attribute__((target("avx2,fma")))
+static tfloat fir_dot_avx2 (pfloat pv, pfloat pc, longint len)
+begin
+  longint i ;
+  __m256d acc0, acc1, acc2, acc3 ;
+  double sums[4] ;
+
+  acc0 = _mm256_setzero_pd () ;
+  acc1 = _mm256_setzero_pd () ;
+  acc2 = _mm256_setzero_pd () ;
+  acc3 = _mm256_setzero_pd () ;
+  i = 0 ;
+  while (i <= len - 16)
+    begin
+      acc0 = _mm256_fmadd_pd (_mm256_loadu_pd (pv + i), _mm256_loadu_pd (pc + i), acc0) ;
+      acc1 = _mm256_fmadd_pd (_mm256_loadu_pd (pv + i + 4), _mm256_loadu_pd (pc + i + 4), acc1) ;
+      acc2 = _mm256_fmadd_pd (_mm256_loadu_pd (pv + i + 8), _mm256_loadu_pd (pc + i + 8), acc2) ;
+      acc3 = _mm256_fmadd_pd (_mm256_loadu_pd (pv + i + 12), _mm256_loadu_pd (pc + i + 12), acc3) ;
+      incn(i, 16) ;
+    end
+  while (i <= len - 4)
+    begin
+      acc0 = _mm256_fmadd_pd (_mm256_loadu_pd (pv + i), _mm256_loadu_pd (pc + i), acc0) ;
+      incn(i, 4) ;
+    end
+  acc0 = _mm256_add_pd (_mm256_add_pd (acc0, acc1), _mm256_add_pd (acc2, acc3)) ;
+  _mm256_storeu_pd (sums, acc0) ;
+  sums[0] = (sums[0] + sums[1]) + (sums[2] + sums[3]) ;
+  while (i < len)
+    begin
+      sums[0] = pv[i] * pc[i] + sums[0] ;
+      inc(i) ;
+    end
+  return sums[0] ;
+end
+#endif
+
+/* Pick the fastest FIR kernel this CPU supports */
+static tfirdot select_fir_dot (void)
+begin
+#ifdef FIR_SIMD
+  __builtin_cpu_init () ;
+  if ((__builtin_cpu_supports ("avx2")) land (__builtin_cpu_supports ("fma")))
+    then
+      return fir_dot_avx2 ;
+  return fir_dot_sse2 ;
+#else
+  return fir_dot_scalar ;
+#endif
+end
+
 pfir_packet create_fir (pq330 q330, pfilter src)
 begin
   pfir_packet pf ;
 
   getbuf (q330, addr(pf), sizeof(tfir_packet)) ;
-  getbuf (q330, addr(pf->fbuf), src->len * sizeof (tfloat)) ;
-  pf->f = pf->fbuf ;
+  getbuf (q330, addr(pf->fbuf), 2 * src->len * sizeof (tfloat)) ;
   pf->fcoef = addr(src->coef) ;
   pf->flen = src->len ;
   pf->fdec = src->dec ;
+  pf->fdot = select_fir_dot () ;
+  pf->fpos = 0 ;
   pf->fcount = 0 ;
   while (pf->fcount < (pf->flen - 1)) /* fill to len-1 */
-    begin
-      *(pf->f) = 0.0 ;
-      inc(pf->f) ;
-      inc(pf->fcount) ;
-    end
+    fir_add (pf, 0.0) ;
   return pf ;
 end
 
@@ -366,10 +465,12 @@ begin
   for (i = 1 ; i <= src->sects ; i++)
     begin
       pf->filt[i].poles = src->filt[i].poles ;
+      pf->filt[i].hpos = 0 ;
       for (j = 0 ; j <= src->filt[i].poles ; j++)
         begin
           pf->filt[i].x[j] = 0.0 ;
           pf->filt[i].y[j] = 0.0 ;
+          pf->filt[i].z[j] = 0.0 ;
           if (i == 1)
             then
               pf->filt[i].a[j] = src->filt[i].a[j] * src->gain ;
@@ -465,31 +566,82 @@ begin
       end
 end
 
-tfloat mac_and_shift (pfir_packet pf)
+/* Add one input sample to the FIR history. Each sample is stored both at fpos and
+   at fpos + flen, so the last flen samples always start at fbuf[fpos] and
+   are contiguous, oldest first, without ever shifting the history */
+void fir_add (pfir_packet pf, tfloat dv)
 begin
-  longint i ;
-  tfloat accum ;
-  pfloat pv, pc ;
 
-  accum = 0.0 ;
-  pv = pf->fbuf ;
-  pc = pf->fcoef ;
-  for (i = 0 ; i <= pf->flen - 1 ; i++)
-    begin
-      accum = (*pv) * (*pc) + accum ;
-      inc(pv) ;
-      inc(pc) ;
-    end
-  pc = pf->fbuf ;
-  pv = pf->fbuf ;
-  incn(pv, pf->fdec) ;
-  for (i = pf->fdec ; i <= pf->flen - 1 ; i++)
+  pf->fbuf[pf->fpos] = dv ;
+  pf->fbuf[pf->fpos + pf->flen] = dv ;
+  inc(pf->fpos) ;
+  if (pf->fpos >= pf->flen)
+    then
+      pf->fpos = 0 ;
+  inc(pf->fcount) ;
+end
+
+/* Add samples to the FIR history until an output sample is due or all count
+   samples are used, returns the number of samples added */
+integer fir_fill (pfir_packet pf, pfloat src, integer count)
+begin
+  integer n, left, run ;
+
+  n = pf->flen - pf->fcount ;
+  if (n > count)
+    then
+      n = count ;
+  left = n ;
+  while (left > 0)
     begin
-      *pc = *pv ;
-      inc(pc) ;
-      inc(pv) ;
+      run = pf->flen - pf->fpos ;
+      if (run > left)
+        then
+          run = left ;
+      memcpy (addr(pf->fbuf[pf->fpos]), src, run * sizeof(tfloat)) ;
+      memcpy (addr(pf->fbuf[pf->fpos + pf->flen]), src, run * sizeof(tfloat)) ;
+      pf->fpos = pf->fpos + run ;
+      if (pf->fpos >= pf->flen)
+        then
+          pf->fpos = 0 ;
+      incn(src, run) ;
+      left = left - run ;
     end
-  return accum ;
+  pf->fcount = pf->fcount + n ;
+  return n ;
+end
+
+/* Returns the FIR output for the last flen samples and consumes fdec of them.
+   The vector kernels sum in a different order than the scalar one, which only
+   changes the rounding of the partial sums, around 1E-15 of the sum of the
+   absolute products, far below the one count resolution of the output samples */
+tfloat fir_mac (pfir_packet pf)
+begin
+
+  decn(pf->fcount, pf->fdec) ;
+  return pf->fdot (addr(pf->fbuf[pf->fpos]), pf->fcoef, pf->flen) ;
+end
+
+/* Copy the last fcount samples, oldest first and padded with zeroes to flen,
+   which is the layout the continuity file has always used */
+void fir_save (pfir_packet pf, pfloat dest)
+begin
+
+  memcpy (dest, addr(pf->fbuf[pf->fpos + pf->flen - pf->fcount]), pf->fcount * sizeof(tfloat)) ;
+  memset (addr(dest[pf->fcount]), 0, (pf->flen - pf->fcount) * sizeof(tfloat)) ;
+end
+
+/* Restore the history saved by fir_save */
+void fir_load (pfir_packet pf, pfloat src, longint count)
+begin
+  longint i ;
+
+  pf->fpos = 0 ;
+  for (i = count ; i <= pf->flen - 1 ; i++)
+    fir_add (pf, 0.0) ;
+  for (i = 0 ; i <= count - 1 ; i++)
+    fir_add (pf, src[i]) ;
+  pf->fcount = count ;
 end
 
 piirdef find_iir (paqstruc paqs, byte num)
@@ -506,65 +658,115 @@ begin
   return NIL ;
 end
 
-static tfloat scalar_product (tvector *a, tvector *b, integer vector_length, integer offset)
+/* Runs count samples in place through one section in transposed direct form II,
+   y = a[0] * x + z[0] and z[k] = a[k + 1] * x + b[k + 1] * y + z[k + 1]. The
+   last poles inputs and outputs also go into the x and y rings, which are only
+   read to write the continuity file. z[poles] is never written and stays zero */
+static void section_block (tiirsection *f, pfloat data, integer count)
 begin
-  integer counter ;
-  double multiply_accum ;
-
-  multiply_accum = 0 ;
-  for (counter = offset ; counter <= (vector_length + offset - 1) ; counter++)
+  integer i, k, poles, last ;
+  double s, out ;
+  pdouble z ;
+
+  poles = f->poles ;
+  z = f->z ;
+  last = count - poles ;
+  for (i = 0 ; i <= count - 1 ; i++)
     begin
-#ifdef CHK_IIR_UNDERFLOW
-    if (fabs((*b)[counter]) < 1.0E-20)
-      (*b)[counter] = 0.0 ;
+      s = data[i] ;
+      out = f->a[0] * s + z[0] ;
+      for (k = 0 ; k <= poles - 1 ; k++)
+        z[k] = f->a[k + 1] * s + f->b[k + 1] * out + z[k + 1] ;
+#if defined(CHK_IIR_UNDERFLOW) && !defined(IIR_FTZ)
+      for (k = 0 ; k <= poles - 1 ; k++)
+        if (fabs(z[k]) < 1.0E-20)
+          then
+            z[k] = 0.0 ;
 #endif
-      multiply_accum = multiply_accum + (*a)[counter] * (*b)[counter] ;
+      data[i] = out ;
+      if (i >= last)
+        then
+          begin
+            f->x[f->hpos] = s ;
+            f->y[f->hpos] = out ;
+            inc(f->hpos) ;
+            if (f->hpos > MAXPOLES)
+              then
+                f->hpos = 0 ;
+          end
     end
-  return multiply_accum ;
 end
 
-static void time_shift (tvector *filter_history, integer length, integer shift)
+/* Filter count samples in place */
+void iir_block (piirfilter resp, pfloat data, integer count)
 begin
-  integer index ;
-
-  length = length - shift ;
-  index = length - 1 ;
-  repeat
-    (*filter_history)[index + shift] = (*filter_history)[index] ;
-    dec(index) ;
-    dec(length) ;
-  until (length == 0)) ;
+  integer sect ;
+#ifdef IIR_FTZ
+  unsigned int csr ;
+
+  csr = _mm_getcsr () ;
+  _mm_setcsr (csr or IIR_FTZ) ;
+#endif
+  for (sect = 1 ; sect <= resp->sects ; sect++)
+    section_block (addr(resp->filt[sect]), data, count) ;
+#ifdef IIR_FTZ
+  _mm_setcsr (csr) ;
+#endif
+#ifdef CHK_IIR_UNDERFLOW
+  for (sect = 0 ; sect <= count - 1 ; sect++)
+    if (fabs(data[sect]) < 1.0E-20)
+      then
+        if (data[sect] > 0)
+          then
+            data[sect] = 1.0E-20 ;
+          else
+            data[sect] = -1.0E-20 ;
+#endif
 end
 
-static double recursive_filter (tiirsection *f, double s)
+double multi_section_filter (piirfilter resp, double s)
 begin
 
-  f->x[0] = s ;
-  f->y[0] = scalar_product (addr(f->x) , addr(f->a) , f->poles+1, 0)
-            + scalar_product (addr(f->y) , addr(f->b) , f->poles, 1) ;
-  time_shift (addr(f->x), f->poles + 1, 1) ;
-  time_shift (addr(f->y), f->poles + 1, 1) ;
-  return f->y[0] ;
+  iir_block (resp, addr(s), 1) ;
+  return s ;
 end
 
-double multi_section_filter (piirfilter resp, double s)
+/* Copy the history of a section, latest first from index 1 with index 0 a copy
+   of index 1, which is the layout the continuity file has always used */
+void iir_save (tiirsection *f, tvector *x, tvector *y)
 begin
-  integer sect ;
+  integer m, slot ;
 
-  if (resp->sects > 0)
-    then
-      for (sect = 1 ; sect <= resp->sects ; sect++)
-        s = recursive_filter (addr(resp->filt[sect]), s) ;
-#ifdef CHK_IIR_UNDERFLOW
-  if (fabs(s) < 1.0E-20)
-    then
-      if (s > 0)
-        then
-          s = 1.0E-20 ;
-        else
-          s = -1.0E-20 ;
-#endif
-  return s ;
+  memset (x, 0, sizeof(tvector)) ;
+  memset (y, 0, sizeof(tvector)) ;
+  for (m = 1 ; m <= f->poles ; m++)
+    begin
+      slot = (f->hpos + MAXPOLES + 1 - m) mod (MAXPOLES + 1) ;
+      (*x)[m] = f->x[slot] ;
+      (*y)[m] = f->y[slot] ;
+    end
+  (*x)[0] = (*x)[1] ;
+  (*y)[0] = (*y)[1] ;
+end
+
+/* Restore the history saved by iir_save and derive the state from it */
+void iir_load (tiirsection *f, tvector *x, tvector *y)
+begin
+  integer j, k, m, slot ;
+
+  f->hpos = 0 ;
+  for (m = 1 ; m <= f->poles ; m++)
+    begin
+      slot = MAXPOLES + 1 - m ;
+      f->x[slot] = (*x)[m] ;
+      f->y[slot] = (*y)[m] ;
+    end
+  for (k = 0 ; k <= f->poles - 1 ; k++)
+    begin
+      f->z[k] = 0.0 ;
+      for (j = k + 1 ; j <= f->poles ; j++)
+        f->z[k] = f->z[k] + f->a[j] * (*x)[j - k] + f->b[j] * (*y)[j - k] ;
+    end
 end
 
 static double factorial (integer npoles, integer index)
@@ -21,6 +21,10 @@ Edit History:
    Ed Date       By  Changes
    -- ---------- --- ---------------------------------------------------
     0 2006-10-11 rdr Created
+    1 2026-10-17 ess Replace mac_and_shift with fir_add and fir_mac, add fir_save
+                     and fir_load.
+    2 2026-10-17 ess Add fir_fill.
+    3 2026-10-17 ess Add iir_block, iir_save and iir_load.
 */
 #ifndef libfilters_h
 /* Flag this file as included */
@@ -44,10 +48,17 @@ extern pfir_packet create_fir (pq330 q330, pfilter src) ;
 extern piirfilter create_iir (pq330 q330, piirdef src, integer points) ;
 extern void average (paqstruc paqs, pavg_packet pavg, tfloat s, tfloat samp, plcq q) ;
 extern void allocate_lcq_filters (paqstruc paqs, plcq q) ;
-extern tfloat mac_and_shift (pfir_packet pf) ;
+extern void fir_add (pfir_packet pf, tfloat dv) ;
+extern integer fir_fill (pfir_packet pf, pfloat src, integer count) ;
+extern tfloat fir_mac (pfir_packet pf) ;
+extern void fir_save (pfir_packet pf, pfloat dest) ;
+extern void fir_load (pfir_packet pf, pfloat src, longint count) ;
 extern pfilter find_fir (paqstruc paqs, byte num) ;
 extern piirdef find_iir (paqstruc paqs, byte num) ;
 extern double multi_section_filter (piirfilter resp, double s) ;
+extern void iir_block (piirfilter resp, pfloat data, integer count) ;
+extern void iir_save (tiirsection *f, tvector *x, tvector *y) ;
+extern void iir_load (tiirsection *f, tvector *x, tvector *y) ;
 extern void calc_section (tsection_base *sect) ;
 extern void bwsectdes (pdouble a, pdouble b, integer npoles, boolean high, tfloat ratio) ;
 #endif
@@ -0,0 +1,238 @@
+/*   Lib330 latency histograms
+     Copyright 2026 Vera C. Rubin Observatory
+
+    This file is part of Lib330
+
+    Lib330 is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Lib330 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Lib330; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+Edit History:
+   Ed Date       By  Changes
+   -- ---------- --- ---------------------------------------------------
+    0 2026-10-17 ess Created
+*/
+#if !defined(X86_WIN32) && !defined(CMEX32)
+#define LATENCY_ATOMIC
+#include <stdatomic.h>
+#endif
+#ifndef liblatency_h
+#include "liblatency.h"
+#endif
+#ifndef libsupport_h
+#include "libsupport.h"
+#endif
+
+#define LATENCY_SUB_BITS 3 /* log2 of LATENCY_SUB */
+
+/* Latencies are recorded by libthread, the decode thread and the client popping one
+   second data, and read by the client, so the counters are atomic where possible.
+   Relaxed ordering is enough since each counter stands on its own. */
+#ifdef LATENCY_ATOMIC
+typedef _Atomic longword tcounter ;
+#define counter_add(c) atomic_fetch_add_explicit (addr(c), 1, memory_order_relaxed)
+#define counter_get(c) atomic_load_explicit (addr(c), memory_order_relaxed)
+#else
+typedef longword tcounter ;
+#define counter_add(c) inc(c)
+#define counter_get(c) (c)
+#endif
+
+typedef struct { /* histogram of one stage */
+  tcounter count ;
+  tcounter max ;
+  tcounter bins[LATENCY_BINS] ;
+} tlathist ;
+typedef struct { /* histograms of one lcq */
+  string2 location ;
+  byte chan_number ;
+  string3 channel ;
+  tlathist stages[LATENCY_STAGES] ;
+} tlatslot ;
+typedef struct {
+#ifdef LATENCY_ATOMIC
+  _Atomic integer count ; /* slots in use, only incremented by libthread once the slot is named */
+#else
+  integer count ;
+#endif
+  tlatslot slots[MAX_LCQ] ;
+} tlatency ;
+typedef tlatency *platency ;
+
+/* Monotonic time in seconds, for the recv_time of packets and the latencies */
+double latency_clock (void)
+begin
+#if defined(X86_WIN32) || defined(CMEX32)
+  return now () ;
+#else
+  struct timespec ts ;
+
+  clock_gettime (CLOCK_MONOTONIC, addr(ts)) ;
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1.0E-9 ;
+#endif
+end
+
+void latency_create (pq330 q330)
+begin
+
+  q330->latency = malloc (sizeof(tlatency)) ;
+  if (q330->latency)
+    then
+      memset (q330->latency, 0, sizeof(tlatency)) ;
+end
+
+void latency_destroy (pq330 q330)
+begin
+
+  free (q330->latency) ;
+  q330->latency = NIL ;
+end
+
+/* Returns the slot of an lcq, which is kept across reconfigurations so the histograms
+   cover the whole life of the context. Only called by libthread while setting up lcqs */
+word latency_slot (pq330 q330, pchar location, pchar channel, byte chan_number)
+begin
+  platency pl ;
+  integer i, count ;
+  tlatslot *ps ;
+
+  pl = q330->latency ;
+  if (pl == NIL)
+    then
+      return LATENCY_NONE ;
+  count = pl->count ;
+  for (i = 0 ; i < count ; i++)
+    begin
+      ps = addr(pl->slots[i]) ;
+      if ((strcmp (ps->location, location) == 0) land (strcmp (ps->channel, channel) == 0))
+        then
+          begin
+            ps->chan_number = chan_number ;
+            return i ;
+          end
+    end
+  if (count >= MAX_LCQ)
+    then
+      return LATENCY_NONE ;
+  ps = addr(pl->slots[count]) ;
+  strcpy (ps->location, location) ;
+  strcpy (ps->channel, channel) ;
+  ps->chan_number = chan_number ;
+#ifdef LATENCY_ATOMIC
+  atomic_store_explicit (addr(pl->count), count + 1, memory_order_release) ;
+#else
+  pl->count = count + 1 ;
+#endif
+  return count ;
+end
+
+/* LATENCY_SUB one microsecond bins, then LATENCY_SUB bins for each power of two */
+static integer latency_bin (longword us)
+begin
+  integer e ;
+
+  if (us < LATENCY_SUB)
+    then
+      return us ;
+#ifdef __GNUC__
+  e = 31 - __builtin_clz (us) ;
+#else
+  e = LATENCY_SUB_BITS ;
+  while ((us shr (e + 1)) != 0)
+    inc(e) ;
+#endif
+  return (e - LATENCY_SUB_BITS + 1) * LATENCY_SUB + ((us shr (e - LATENCY_SUB_BITS)) and (LATENCY_SUB - 1)) ;
+end
+
+longword lib_latency_floor (integer bin)
+begin
+  integer e ;
+
+  if (bin < LATENCY_SUB)
+    then
+      return bin ;
+  e = bin / LATENCY_SUB + LATENCY_SUB_BITS - 1 ;
+  return (longword)(LATENCY_SUB + (bin and (LATENCY_SUB - 1))) shl (e - LATENCY_SUB_BITS) ;
+end
+
+/* Add the time since recv_time to the histogram of a stage, may be called from any thread */
+void record_latency (pq330 q330, integer stage, word slot, double recv_time)
+begin
+  platency pl ;
+  tlathist *ph ;
+  double d ;
+  longword us, cur ;
+
+  pl = q330->latency ;
+  if ((pl == NIL) lor (recv_time == 0) lor (slot >= MAX_LCQ) lor (stage < 0) lor (stage >= LATENCY_STAGES))
+    then
+      return ;
+  d = (latency_clock () - recv_time) * 1.0E6 ;
+  if (d <= 0)
+    then
+      us = 0 ;
+  else if (d >= 4294967295.0)
+    then
+      us = 0xFFFFFFFF ;
+    else
+      us = (longword)d ;
+  ph = addr(pl->slots[slot].stages[stage]) ;
+  counter_add(ph->bins[latency_bin (us)]) ;
+  counter_add(ph->count) ;
+  cur = counter_get(ph->max) ;
+#ifdef LATENCY_ATOMIC
+  while ((us > cur) land
+         (lnot atomic_compare_exchange_weak_explicit (addr(ph->max), addr(cur), us,
+                                                       memory_order_relaxed, memory_order_relaxed))) ;
+#else
+  if (us > cur)
+    then
+      ph->max = us ;
+#endif
+end
+
+void latency_stat (pq330 q330, tlatencystat *stat)
+begin
+  platency pl ;
+  integer i, j, k ;
+  tlatslot *ps ;
+  tonelatency *pone ;
+  tlathist *ph ;
+
+  memset (stat, 0, sizeof(tlatencystat)) ;
+  pl = q330->latency ;
+  if (pl == NIL)
+    then
+      return ;
+#ifdef LATENCY_ATOMIC
+  stat->count = atomic_load_explicit (addr(pl->count), memory_order_acquire) ;
+#else
+  stat->count = pl->count ;
+#endif
+  for (i = 0 ; i < stat->count ; i++)
+    begin
+      ps = addr(pl->slots[i]) ;
+      pone = addr(stat->entries[i]) ;
+      strcpy (pone->location, ps->location) ;
+      strcpy (pone->channel, ps->channel) ;
+      pone->chan_number = ps->chan_number ;
+      for (j = 0 ; j < LATENCY_STAGES ; j++)
+        begin
+          ph = addr(ps->stages[j]) ;
+          pone->stages[j].count = counter_get(ph->count) ;
+          pone->stages[j].max = counter_get(ph->max) ;
+          for (k = 0 ; k < LATENCY_BINS ; k++)
+            pone->stages[j].bins[k] = counter_get(ph->bins[k]) ;
+        end
+    end
+end
@@ -0,0 +1,45 @@
+/*   Lib330 latency histogram headers
+     Copyright 2026 Vera C. Rubin Observatory
+
+    This file is part of Lib330
+
+    Lib330 is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Lib330 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Lib330; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+Edit History:
+   Ed Date       By  Changes
+   -- ---------- --- ---------------------------------------------------
+    0 2026-10-17 ess Created
+*/
+#ifndef liblatency_h
+/* Flag this file as included */
+#define liblatency_h
+#define VER_LIBLATENCY 1
+
+/* Make sure libtypes.h is included */
+#ifndef libtypes_h
+#include "libtypes.h"
+#endif
+#ifndef libstrucs_h
+#include "libstrucs.h"
+#endif
+
+extern double latency_clock (void) ;
+extern void latency_create (pq330 q330) ;
+extern void latency_destroy (pq330 q330) ;
+extern word latency_slot (pq330 q330, pchar location, pchar channel, byte chan_number) ;
+extern void record_latency (pq330 q330, integer stage, word slot, double recv_time) ;
+extern void latency_stat (pq330 q330, tlatencystat *stat) ;
+
+#endif
@@ -34,6 +34,9 @@ Edit History:
    11 2013-08-09 rdr Add conditional compilation to make string parameter to msgadd,
                      libmsgadd and libdataadd a const.
    12 2016-01-26 rdr Change LIBMSG_INVREG to indicate number of seconds.
+   13 2026-10-17 ess Queue messages added without the decoder locked instead of logging
+                     them, dump_msgqueue logs them later.
+   14 2026-10-17 ess Add LIBMSG_REPLAYED and LIBMSG_CAPERR.
 */
 #ifndef libmsgs_h
 #include "libmsgs.h"
@@ -44,6 +47,9 @@ Edit History:
 #ifndef libsupport_h
 #include "libsupport.h"
 #endif
+#ifndef libslider_h
+#include "libslider.h"
+#endif
 
 #ifndef OMIT_SEED
 #ifndef liblogs_h
@@ -115,6 +121,7 @@ begin
         case LIBMSG_BACK : strcpy(s, "Baler Acknowledged by Q330") ; break ;
         case LIBMSG_CONN : strcpy(s, "Connected to TCP Tunnel") ; break ;
         case LIBMSG_Q335 : strcpy(s, "Q335 Architecture Detected") ; break ;
+        case LIBMSG_REPLAYED : strcpy(s, "Capture Replayed: ") ; break ;
       end
       break ;
     case 3 : /* converted Q330 blockettes */
@@ -181,6 +188,7 @@ begin
         case LIBMSG_SEGOVER : strcpy(s, "Segment buffer overflow on ") ; break ;
         case LIBMSG_TCPTUN : strcpy(s, "TCP Tunnelling error: ") ; break ;
         case LIBMSG_HFRATE : strcpy(s, "Sampling Rate mis-match ") ; break ;
+        case LIBMSG_CAPERR : strcpy(s, "Capture File Write Error, Capture Stopped") ; break ;
       end
       break ;
     case 6 :
@@ -264,7 +272,7 @@ begin
         if (lnot q330->nested_log)
           then
             begin
-              if ((client) lor (q330->libstate == LIBSTATE_TERM) lor ((q330->network)[0] == 0) lor
+              if ((client) lor (lnot decoder_locked (q330)) lor (q330->libstate == LIBSTATE_TERM) lor ((q330->network)[0] == 0) lor
                   (paqs->msg_lcq == NIL) lor (paqs->msg_lcq->com->ring == NIL))
                 then
                   begin
@@ -25,6 +25,7 @@ Edit History:
     2 2007-03-05 rdr Add LIBMSG_CONPURGE.
     3 2008-01-09 rdr Add dump_msgqueue and AUXMSG_RECV.
     4 2008-08-19 rdr Add TCP support.
+    5 2026-10-17 ess Add LIBMSG_REPLAYED and LIBMSG_CAPERR.
 */
 #ifndef libmsgs_h
 /* Flag this file as included */
@@ -102,6 +103,7 @@ Edit History:
 #define LIBMSG_BACK 214
 #define LIBMSG_CONN 215
 #define LIBMSG_Q335 216
+#define LIBMSG_REPLAYED 217
 
 #define LIBMSG_GPSSTATUS 300
 #define LIBMSG_DIGPHASE 301
@@ -159,6 +161,7 @@ Edit History:
 #define LIBMSG_SEGOVER 522
 #define LIBMSG_TCPTUN 523
 #define LIBMSG_HFRATE 524
+#define LIBMSG_CAPERR 525
 
 #define LIBMSG_FIXED 600
 #define LIBMSG_GPSIDS 601
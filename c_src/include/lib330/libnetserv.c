@@ -34,6 +34,18 @@ Edit History:
                      on accepted socket.
     7 2013-02-02 rdr Use actual highest socket for select.
     8 2013-08-08 rdr Fix checking for EPIPE in send_netserv_packet.
+    9 2026-10-17 ess Serve up to max_clients clients from one buffer. lib_ns_send no
+                     longer takes the mutex or sends, it publishes head and wakes nsthread
+                     through a pipe. Each client has its own read cursor and the clients take
+                     turns sending everything pending instead of one record per 25ms. Clients
+                     that fall too far behind skip ahead and count the records dropped.
+                     Add lib_ns_stats. read_from_client stops when the socket is empty and
+                     disconnects closed clients, a client refused by the whitelist closes
+                     its own socket rather than the listener.
+   10 2026-10-17 ess Gather up to NS_BURST contiguous records into one sendmsg (WSASend on
+                     Windows) and keep the place in a record a partial send stopped at,
+                     send_netserv_packet sent one record per call and lost partial sends.
+                     Add sndbuf to tns_par to set the client SO_SNDBUF.
 */
 #ifndef OMIT_SEED /* Can't use without seed generation */
 #ifndef OMIT_NETWORK /* or without network */
@@ -41,7 +53,8 @@ Edit History:
 #ifdef X86_WIN32
 #include <io.h>				/* close() */
 #else
-#include <unistd.h>			/* close() */
+#include <unistd.h>			/* close(), pipe() */
+#include <sys/uio.h>			/* struct iovec */
 #endif
 
 #ifndef libnetserv_h
@@ -61,35 +74,68 @@ Edit History:
 #include "libstrucs.h"
 #endif
 
+#if !defined(X86_WIN32) && !defined(CMEX32)
+#define NS_ATOMIC /* head is published without the mutex and a pipe wakes nsthread */
+#include <stdatomic.h>
+#endif
+
+#define NS_BURST 64 /* records sent to one client with one sendmsg before the next gets a turn */
+
+#ifdef X86_WIN32
+typedef WSABUF tnsvec ;
+#else
+typedef struct iovec tnsvec ;
+#endif
+
+typedef struct { /* one connected client */
+  boolean haveclient ; /* slot in use */
+  boolean sockfull ; /* last send failed */
+#ifdef X86_WIN32
+  SOCKET sockpath ;
+#else
+  integer sockpath ;
+#endif
+  struct sockaddr client ;
+  longword next ; /* sequence number of the next record to send */
+  integer offset ; /* bytes of that record already sent */
+  integer syncleft ; /* bytes of the sync record still to send */
+  longword sent ; /* records sent */
+  longword drops ; /* records skipped because the client fell behind */
+  double last_sent ;
+} tnsclient ;
+
 typedef struct {
 #ifdef X86_WIN32
   HANDLE mutex ;
   HANDLE threadhandle ;
   longword threadid ;
 #else
-  pthread_mutex_t mutex ;
+  pthread_mutex_t mutex ; /* protects the clients table for lib_ns_stats */
   pthread_t threadid ;
 #endif
   boolean running ;
-  boolean haveclient ; /* accepted a client */
   boolean sockopen ;
-  boolean sockfull ; /* last send failed */
   boolean terminate ;
   tns_par ns_par ; /* creation parameters */
 #ifdef X86_WIN32
   SOCKET npath ; /* netserv socket */
   struct sockaddr nsockin, nsockout ; /* netserv address descriptors */
-  SOCKET sockpath ;
-  struct sockaddr client ;
 #else
   integer npath ; /* commands socket */
   struct sockaddr nsockin, nsockout ; /* netserv address descriptors */
-  integer sockpath ;
-  struct sockaddr client ;
   integer high_socket ;
 #endif
-  integer nsq_in, nsq_out ;
-  double last_sent ;
+#ifdef NS_ATOMIC
+  _Atomic longword head ; /* sequence number of the next record lib_ns_send writes */
+  atomic_bool wake_pending ; /* a byte was written to wakepipe and not read yet */
+  integer wakepipe[2] ; /* read and write end, lib_ns_send wakes nsthread */
+#else
+  longword head ; /* protected by mutex */
+#endif
+  longword resume ; /* where a new client starts, the furthest any client got */
+  integer max_clients ;
+  integer clientcount ;
+  tnsclient clients[MAX_NS_CLIENTS] ;
   completed_record sync_record ;
 } tnsstr ;
 typedef tnsstr *pnsstr ;
@@ -147,8 +193,64 @@ end
 
 #endif
 
+/* Sequence number of the next record lib_ns_send will write, all before it are complete */
+static longword load_head (pnsstr nsstr)
+begin
+#ifdef NS_ATOMIC
+
+  return atomic_load_explicit (addr(nsstr->head), memory_order_acquire) ;
+#else
+  longword head ;
+
+  qlock (nsstr) ;
+  head = nsstr->head ;
+  qunlock (nsstr) ;
+  return head ;
+#endif
+end
+
+/* Records a client may be behind, the rest of the buffer is a margin lib_ns_send can
+   write into while a record is being sent */
+static longword usable_records (pnsstr nsstr)
+begin
+  longword guard ;
+
+  guard = nsstr->ns_par.record_count div 16 ;
+  if (guard < 1)
+    then
+      guard = 1 ;
+  return nsstr->ns_par.record_count - guard ;
+end
+
+static void close_client (pnsstr nsstr, tnsclient *pc, boolean report)
+begin
+  string63 s ;
+
+#ifdef X86_WIN32
+  closesocket (pc->sockpath) ;
+#else
+  close (pc->sockpath) ;
+#endif
+  if (report)
+    then
+      begin
+        sprintf(s, "netserv[%d] port", nsstr->ns_par.server_number) ;
+        lib_msg_add(nsstr->ns_par.stnctx, AUXMSG_DISCON, 0, addr(s)) ;
+      end
+  qlock (nsstr) ;
+  if ((longint)(pc->next - nsstr->resume) > 0)
+    then
+      nsstr->resume = pc->next ;
+  pc->sockpath = INVALID_SOCKET ;
+  pc->haveclient = FALSE ;
+  pc->sockfull = FALSE ;
+  dec(nsstr->clientcount) ;
+  qunlock (nsstr) ;
+end
+
 static void close_socket (pnsstr nsstr)
 begin
+  integer i ;
 
   nsstr->sockopen = FALSE ;
   if (nsstr->npath != INVALID_SOCKET)
@@ -161,16 +263,10 @@ begin
 #endif
         nsstr->npath = INVALID_SOCKET ;
       end
-  if (nsstr->sockpath != INVALID_SOCKET)
-    then
-      begin
-#ifdef X86_WIN32
-        closesocket (nsstr->sockpath) ;
-#else
-        close (nsstr->sockpath) ;
-#endif
-        nsstr->sockpath = INVALID_SOCKET ;
-      end
+  for (i = 0 ; i < MAX_NS_CLIENTS ; i++)
+    if (nsstr->clients[i].haveclient)
+      then
+        close_client (nsstr, addr(nsstr->clients[i]), FALSE) ;
 #ifndef X86_WIN32
   nsstr->high_socket = 0 ;
 #endif
@@ -262,11 +358,11 @@ begin
 #ifdef X86_WIN32
   flag = 1 ;
   ioctlsocket (nsstr->npath, FIONBIO, addr(flag)) ;
-  err = listen (nsstr->npath, 1) ;
+  err = listen (nsstr->npath, nsstr->max_clients) ;
 #else
   flags = fcntl (nsstr->npath, F_GETFL, 0) ;
   fcntl (nsstr->npath, F_SETFL, flags or O_NONBLOCK) ;
-  err = listen (nsstr->npath, 1) ;
+  err = listen (nsstr->npath, nsstr->max_clients) ;
 #endif
   if (err)
     then
@@ -303,20 +399,32 @@ begin
   integer flags ;
 #endif
   integer bufsize ;
-  longword client_ip ;
+  longword client_ip, head, usable ;
   word client_port ;
   boolean found ;
   string15 hostname ;
   string63 s ;
   struct sockaddr_in *psock ;
   twhitelist *pwhite ;
+  tnsclient *pc ;
 
   lth = sizeof(struct sockaddr) ;
   if (nsstr->npath == INVALID_SOCKET)
     then
       return ;
-  nsstr->sockpath = accept (nsstr->npath, addr(nsstr->client), addr(lth)) ;
-  if (nsstr->sockpath == INVALID_SOCKET)
+  pc = NIL ;
+  for (i = 0 ; i < nsstr->max_clients ; i++)
+    if (lnot nsstr->clients[i].haveclient)
+      then
+        begin
+          pc = addr(nsstr->clients[i]) ;
+          break ;
+        end
+  if (pc == NIL)
+    then
+      return ; /* leave it in the backlog until a client leaves */
+  pc->sockpath = accept (nsstr->npath, addr(pc->client), addr(lth)) ;
+  if (pc->sockpath == INVALID_SOCKET)
     then
       begin
         err =
@@ -342,15 +450,15 @@ begin
       begin
 #ifdef X86_WIN32
         flag = 1 ;
-        ioctlsocket (nsstr->sockpath, FIONBIO, addr(flag)) ;
+        ioctlsocket (pc->sockpath, FIONBIO, addr(flag)) ;
 #else
-        if (nsstr->sockpath > nsstr->high_socket)
+        if (pc->sockpath > nsstr->high_socket)
           then
-            nsstr->high_socket = nsstr->sockpath ;
-        flags = fcntl (nsstr->sockpath, F_GETFL, 0) ;
-        fcntl (nsstr->sockpath, F_SETFL, flags or O_NONBLOCK) ;
+            nsstr->high_socket = pc->sockpath ;
+        flags = fcntl (pc->sockpath, F_GETFL, 0) ;
+        fcntl (pc->sockpath, F_SETFL, flags or O_NONBLOCK) ;
 #endif
-        psock = (pointer) addr(nsstr->client) ;
+        psock = (pointer) addr(pc->client) ;
         showdot (ntohl(psock->sin_addr.s_addr), addr(hostname)) ;
         client_ip = ntohl(psock->sin_addr.s_addr) ;
         client_port = ntohs(psock->sin_port) ;
@@ -372,23 +480,32 @@ begin
                 then
                   begin
 #ifdef X86_WIN32
-                    closesocket (nsstr->npath) ;
+                    closesocket (pc->sockpath) ;
 #else
-                    close (nsstr->npath) ;
+                    close (pc->sockpath) ;
 #endif
-                    nsstr->sockpath = INVALID_SOCKET ;
+                    pc->sockpath = INVALID_SOCKET ;
                     return ;
                   end
             end
         sprintf(s, "\"%s:%d\" to netserv[%d] port", (char *)addr(hostname), client_port, nsstr->ns_par.server_number) ;
         lib_msg_add (nsstr->ns_par.stnctx, AUXMSG_CONN, 0, addr(s)) ;
         lth = sizeof(integer) ;
-        err = getsockopt (nsstr->sockpath, SOL_SOCKET, SO_SNDBUF, addr(bufsize), addr(lth)) ;
-        if ((err == 0) land (bufsize < 30000))
+        if (nsstr->ns_par.sndbuf > 0)
           then
             begin
-              bufsize = 30000 ;
-              setsockopt (nsstr->sockpath, SOL_SOCKET, SO_SNDBUF, addr(bufsize), lth) ;
+              bufsize = nsstr->ns_par.sndbuf ;
+              setsockopt (pc->sockpath, SOL_SOCKET, SO_SNDBUF, addr(bufsize), lth) ;
+            end
+          else
+            begin
+              err = getsockopt (pc->sockpath, SOL_SOCKET, SO_SNDBUF, addr(bufsize), addr(lth)) ;
+              if ((err == 0) land (bufsize < 30000))
+                then
+                  begin
+                    bufsize = 30000 ;
+                    setsockopt (pc->sockpath, SOL_SOCKET, SO_SNDBUF, addr(bufsize), lth) ;
+                  end
             end
 #ifndef X86_WIN32
 #if defined(linux) || defined(solaris)
@@ -396,27 +513,42 @@ begin
 #else
         flags = 1 ;
         lth = sizeof(integer) ;
-        setsockopt (nsstr->sockpath, SOL_SOCKET, SO_NOSIGPIPE, addr(flags), lth) ;
+        setsockopt (pc->sockpath, SOL_SOCKET, SO_NOSIGPIPE, addr(flags), lth) ;
 #endif
 #endif
-        nsstr->haveclient = TRUE ;
-        nsstr->last_sent = now () ;
-        nsstr->sockfull = FALSE ;
+        head = load_head (nsstr) ;
+        usable = usable_records (nsstr) ;
+        qlock (nsstr) ;
+        pc->next = nsstr->resume ; /* what no client has been sent yet */
+        if ((head - pc->next) > usable)
+          then
+            pc->next = head - usable ;
+        pc->offset = 0 ;
+        pc->syncleft = 0 ;
+        pc->sent = 0 ;
+        pc->drops = 0 ;
+        pc->haveclient = TRUE ;
+        inc(nsstr->clientcount) ;
+        qunlock (nsstr) ;
+        pc->last_sent = now () ;
+        pc->sockfull = FALSE ;
       end
 end
 
-static void read_from_client (pnsstr nsstr)
+static void read_from_client (pnsstr nsstr, tnsclient *pc)
 begin
 #define RBUFSIZE 100
   integer err ;
   byte buf[RBUFSIZE] ;
-  string63 s ;
 
   repeat
-    if (lnot nsstr->haveclient)
+    err = recv(pc->sockpath, addr(buf), RBUFSIZE, 0) ;
+    if (err == 0)
       then
-        return ;
-    err = recv(nsstr->sockpath, addr(buf), RBUFSIZE, 0) ;
+        begin /* client closed the connection */
+          close_client (nsstr, pc, TRUE) ;
+          return ;
+        end
     if (err == SOCKET_ERROR)
       then
         begin
@@ -428,46 +560,49 @@ begin
 #endif
           if ((err == ECONNRESET) lor (err == ECONNABORTED))
             then
-              begin
-#ifdef X86_WIN32
-                closesocket (nsstr->sockpath) ;
-#else
-                close (nsstr->sockpath) ;
-#endif
-                sprintf(s, "netserv[%d] port", nsstr->ns_par.server_number) ;
-                lib_msg_add(nsstr->ns_par.stnctx, AUXMSG_DISCON, 0, addr(s)) ;
-                nsstr->haveclient = FALSE ;
-                nsstr->sockfull = FALSE ;
-                return ;
-              end
+              close_client (nsstr, pc, TRUE) ;
+          return ; /* nothing left in buffer */
         end
-  until (err == 0)) ; /* nothing left in buffer */
+  until FALSE) ;
 end
 
-static integer wrap_buffer (integer max, integer i)
+static void set_vector (tnsvec *vec, pointer p, integer lth)
 begin
-  integer j ;
 
-  j = i + 1 ;
-  if (j >= max)
-    then
-      j = 0 ;
-  return j ;
+#ifdef X86_WIN32
+  vec->buf = p ;
+  vec->len = lth ;
+#else
+  vec->iov_base = p ;
+  vec->iov_len = lth ;
+#endif
 end
 
-/* returns TRUE if error */
-static boolean send_netserv_packet (pnsstr nsstr, pointer buf)
+/* returns bytes sent or -1 if none could be */
+static integer send_vector (pnsstr nsstr, tnsclient *pc, tnsvec *vec, integer count)
 begin
   integer err ;
-  string63 s ;
+#ifdef X86_WIN32
+  DWORD lth ;
+#else
+  struct msghdr msg ;
+#endif
 
-  if (lnot nsstr->haveclient)
+#ifdef X86_WIN32
+  if (WSASend (pc->sockpath, vec, count, addr(lth), 0, NIL, NIL) == 0)
     then
-      return TRUE ;
+      err = lth ;
+    else
+      err = SOCKET_ERROR ;
+#else
+  memset (addr(msg), 0, sizeof(struct msghdr)) ;
+  msg.msg_iov = vec ;
+  msg.msg_iovlen = count ;
 #if defined(linux)
-  err = send(nsstr->sockpath, buf, LIB_REC_SIZE, MSG_NOSIGNAL) ;
+  err = sendmsg(pc->sockpath, addr(msg), MSG_NOSIGNAL) ;
 #else
-  err = send(nsstr->sockpath, buf, LIB_REC_SIZE, 0) ;
+  err = sendmsg(pc->sockpath, addr(msg), 0) ;
+#endif
 #endif
   if (err == SOCKET_ERROR)
     then
@@ -480,145 +615,274 @@ begin
 #endif
         if (err == EWOULDBLOCK)
           then
-            begin
-              nsstr->sockfull = TRUE ;
-              return TRUE ;
-            end
+            pc->sockfull = TRUE ;
 #ifdef X86_WIN32
         else if ((err == ECONNRESET) lor (err == ECONNABORTED))
 #else
         else if (err == EPIPE)
 #endif
+          then
+            close_client (nsstr, pc, TRUE) ;
+        return -1 ;
+      end
+  pc->last_sent = now () ;
+  return err ;
+end
+
+/* Send a client up to NS_BURST of the records it has not been sent yet with one sendmsg,
+   or the sync record if sync is TRUE and there are none. The records are contiguous in
+   nsbuf up to where it wraps, so that is at most two vectors after any rest of the sync
+   record. Returns TRUE if anything was sent */
+static boolean send_next_buffers (pnsstr nsstr, tnsclient *pc, boolean sync)
+begin
+  tnsvec vec[3] ;
+  longword head, usable, first, count, run ;
+  integer nvec, total, sent ;
+
+  if ((lnot pc->haveclient) lor (pc->sockfull))
+    then
+      return FALSE ;
+  head = load_head (nsstr) ;
+  usable = usable_records (nsstr) ;
+  if ((pc->offset == 0) land ((head - pc->next) > usable))
+    then
+      begin /* lib_ns_send is about to write over it, skip to the oldest safe record */
+        incn(pc->drops, head - usable - pc->next) ;
+        pc->next = head - usable ;
+      end
+  count = head - pc->next ;
+  if (count > NS_BURST)
+    then
+      count = NS_BURST ;
+  if ((sync) land (count == 0) land (pc->syncleft == 0))
+    then
+      pc->syncleft = LIB_REC_SIZE ;
+  nvec = 0 ;
+  total = 0 ;
+  if (pc->syncleft)
+    then
+      begin
+        set_vector (addr(vec[nvec]), (pbyte)addr(nsstr->sync_record) + LIB_REC_SIZE - pc->syncleft, pc->syncleft) ;
+        inc(nvec) ;
+        incn(total, pc->syncleft) ;
+      end
+  if (count)
+    then
+      begin
+        first = pc->next mod nsstr->ns_par.record_count ;
+        run = nsstr->ns_par.record_count - first ;
+        if (run > count)
+          then
+            run = count ;
+        set_vector (addr(vec[nvec]), (pbyte)addr((*(nsstr->ns_par.nsbuf))[first]) + pc->offset,
+                    run * LIB_REC_SIZE - pc->offset) ;
+        inc(nvec) ;
+        if (count > run)
           then
             begin
-#ifdef X86_WIN32
-              closesocket (nsstr->sockpath) ;
-#else
-              close (nsstr->sockpath) ;
-#endif
-              sprintf(s, "netserv[%d] port", nsstr->ns_par.server_number) ;
-              lib_msg_add(nsstr->ns_par.stnctx, AUXMSG_DISCON, 0, addr(s)) ;
-              nsstr->haveclient = FALSE ;
-              nsstr->sockfull = FALSE ;
+              set_vector (addr(vec[nvec]), addr((*(nsstr->ns_par.nsbuf))[0]), (count - run) * LIB_REC_SIZE) ;
+              inc(nvec) ;
+            end
+        incn(total, count * LIB_REC_SIZE - pc->offset) ;
+      end
+  if (nvec == 0)
+    then
+      return FALSE ;
+  sent = send_vector (nsstr, pc, vec, nvec) ;
+  if (sent <= 0)
+    then
+      return FALSE ;
+  if (sent < total)
+    then
+      pc->sockfull = TRUE ; /* select says when there is room for the rest */
+  if (pc->syncleft)
+    then
+      begin
+        if (sent < pc->syncleft)
+          then
+            begin
+              pc->syncleft = pc->syncleft - sent ;
               return TRUE ;
             end
+        sent = sent - pc->syncleft ;
+        pc->syncleft = 0 ;
       end
-    else
-      nsstr->sockfull = FALSE ;
-  nsstr->last_sent = now () ;
-  return FALSE ;
+  if (sent)
+    then
+      begin
+        first = pc->next ;
+        sent = sent + pc->offset ;
+        incn(pc->next, sent div LIB_REC_SIZE) ;
+        incn(pc->sent, sent div LIB_REC_SIZE) ;
+        pc->offset = sent mod LIB_REC_SIZE ;
+        if ((load_head (nsstr) - first) >= (longword)nsstr->ns_par.record_count)
+          then
+            begin /* written over while it was being sent, the client's stream is corrupt */
+              close_client (nsstr, pc, TRUE) ;
+              return TRUE ;
+            end
+        if ((longint)(pc->next - nsstr->resume) > 0)
+          then
+            nsstr->resume = pc->next ; /* only nsthread writes resume */
+      end
+  return TRUE ;
 end
 
-static void send_next_buffer (pnsstr nsstr)
+void lib_ns_send (pointer ct, pcompleted_record pbuf)
 begin
-  boolean failed ;
+  pnsstr nsstr ;
+  longword head ;
+#ifdef NS_ATOMIC
+  integer err ;
+#endif
 
-  if (lnot nsstr->haveclient)
-    then
-      return ;
-  failed = send_netserv_packet (nsstr, addr((*(nsstr->ns_par.nsbuf))[nsstr->nsq_out])) ;
-  if (lnot failed)
+  nsstr = ct ;
+#ifdef NS_ATOMIC
+  head = atomic_load_explicit (addr(nsstr->head), memory_order_relaxed) ; /* only written here */
+  memcpy(addr((*(nsstr->ns_par.nsbuf))[head mod nsstr->ns_par.record_count]), pbuf, LIB_REC_SIZE) ;
+  atomic_store_explicit (addr(nsstr->head), head + 1, memory_order_release) ;
+  if (lnot atomic_exchange (addr(nsstr->wake_pending), TRUE))
     then
-      nsstr->nsq_out = wrap_buffer(nsstr->ns_par.record_count, nsstr->nsq_out) ; /* sucessful */
+      err = write (nsstr->wakepipe[1], "w", 1) ; /* nsthread clears wake_pending after reading it */
+#else
+  qlock (nsstr) ;
+  head = nsstr->head ;
+  memcpy(addr((*(nsstr->ns_par.nsbuf))[head mod nsstr->ns_par.record_count]), pbuf, LIB_REC_SIZE) ;
+  nsstr->head = head + 1 ;
+  qunlock (nsstr) ;
+#endif
 end
 
-void lib_ns_send (pointer ct, pcompleted_record pbuf)
+void lib_ns_stats (pointer ct, tns_stats *stats)
 begin
   pnsstr nsstr ;
-  integer nq ;
-  boolean wasempty ;
+  tnsclient *pc ;
+  tns_client_stat *ps ;
+  struct sockaddr_in *psock ;
+  longword head ;
+  integer i ;
 
   nsstr = ct ;
+  memset (stats, 0, sizeof(tns_stats)) ;
+  head = load_head (nsstr) ;
+  stats->records = head ;
   qlock (nsstr) ;
-  wasempty = (nsstr->nsq_in == nsstr->nsq_out) ;
-  nq = wrap_buffer (nsstr->ns_par.record_count, nsstr->nsq_in) ; /* next pointer after we insert new record */
-  if (nq == nsstr->nsq_out)
+  for (i = 0 ; i < MAX_NS_CLIENTS ; i++)
+    begin
+      pc = addr(nsstr->clients[i]) ;
+      if (pc->haveclient)
+        then
+          begin
+            ps = addr(stats->clients[stats->count]) ;
+            psock = (pointer) addr(pc->client) ;
+            ps->ip = ntohl(psock->sin_addr.s_addr) ;
+            ps->port = ntohs(psock->sin_port) ;
+            ps->sent = pc->sent ;
+            ps->lag = head - pc->next ;
+            ps->drops = pc->drops ;
+            inc(stats->count) ;
+          end
+    end
+  qunlock (nsstr) ;
+end
+
+/* Wait up to 25ms for connections, client input, room in full sockets or new records,
+   then send every client what it has not been sent yet */
+static void ns_poll (pnsstr nsstr)
+begin
+  fd_set readfds, writefds, exceptfds ;
+  struct timeval timeout ;
+  integer i, res ;
+  tnsclient *pc ;
+  boolean sent ;
+#ifdef NS_ATOMIC
+  byte buf[16] ;
+#endif
+
+  FD_ZERO (addr(readfds)) ;
+  FD_ZERO (addr(writefds)) ;
+  FD_ZERO (addr(exceptfds)) ;
+  if (nsstr->clientcount < nsstr->max_clients)
     then
-      nsstr->nsq_out = wrap_buffer(nsstr->ns_par.record_count, nsstr->nsq_out) ; /* throw away oldest */
-  memcpy(addr((*(nsstr->ns_par.nsbuf))[nsstr->nsq_in]), pbuf, LIB_REC_SIZE) ;
-  nsstr->nsq_in = nq ;
-  if (wasempty)
+      FD_SET (nsstr->npath, addr(readfds)) ; /* waiting for accept */
+#ifdef NS_ATOMIC
+  FD_SET (nsstr->wakepipe[0], addr(readfds)) ; /* lib_ns_send added a record */
+#endif
+  for (i = 0 ; i < MAX_NS_CLIENTS ; i++)
+    begin
+      pc = addr(nsstr->clients[i]) ;
+      if (pc->haveclient)
+        then
+          begin
+            FD_SET (pc->sockpath, addr(readfds)) ; /* client might try to send me something */
+            if (pc->sockfull)
+              then
+                FD_SET (pc->sockpath, addr(writefds)) ; /* buffer was full */
+          end
+    end
+  timeout.tv_sec = 0 ;
+  timeout.tv_usec = 25000 ; /* 25ms timeout */
+#ifdef X86_WIN32
+  res = select (0, addr(readfds), addr(writefds), addr(exceptfds), addr(timeout)) ;
+#else
+  res = select (nsstr->high_socket + 1, addr(readfds), addr(writefds), addr(exceptfds), addr(timeout)) ;
+#endif
+  if (res > 0)
     then
-      send_next_buffer (nsstr) ;
-  qunlock (nsstr) ;
+      begin
+#ifdef NS_ATOMIC
+        if (FD_ISSET (nsstr->wakepipe[0], addr(readfds)))
+          then
+            begin
+              while (read (nsstr->wakepipe[0], addr(buf), sizeof(buf)) == sizeof(buf)) ;
+              atomic_store (addr(nsstr->wake_pending), FALSE) ; /* before head is loaded below */
+            end
+#endif
+        for (i = 0 ; i < MAX_NS_CLIENTS ; i++)
+          begin
+            pc = addr(nsstr->clients[i]) ;
+            if (pc->haveclient)
+              then
+                begin
+                  if (FD_ISSET (pc->sockpath, addr(readfds)))
+                    then
+                      read_from_client (nsstr, pc) ;
+                  if ((pc->haveclient) land (pc->sockfull) land (FD_ISSET (pc->sockpath, addr(writefds))))
+                    then
+                      pc->sockfull = FALSE ;
+                end
+          end
+        if ((nsstr->npath != INVALID_SOCKET) land (FD_ISSET (nsstr->npath, addr(readfds))))
+          then
+            accept_ns_socket (nsstr) ;
+      end
+  repeat /* take turns so one fast client can't hold the others back */
+    sent = FALSE ;
+    for (i = 0 ; i < MAX_NS_CLIENTS ; i++)
+      if (send_next_buffers (nsstr, addr(nsstr->clients[i]), FALSE))
+        then
+          sent = TRUE ;
+  until (lnot sent)) ;
+  for (i = 0 ; i < MAX_NS_CLIENTS ; i++)
+    begin
+      pc = addr(nsstr->clients[i]) ;
+      if ((pc->haveclient) land (lnot pc->sockfull) land (nsstr->ns_par.sync_time) land
+          ((now () - pc->last_sent) >= nsstr->ns_par.sync_time))
+        then
+          send_next_buffers (nsstr, pc, TRUE) ;
+    end
 end
 
 #ifdef X86_WIN32
 unsigned long  __stdcall nsthread (pointer p)
 begin
   pnsstr nsstr ;
-  fd_set readfds, writefds, exceptfds ;
-  struct timeval timeout ;
-  integer res ;
-  boolean sent ;
 
   nsstr = p ;
   repeat
     if (nsstr->sockopen)
       then
-        begin /* wait for socket input or timeout */
-          FD_ZERO (addr(readfds)) ;
-          FD_ZERO (addr(writefds)) ;
-          FD_ZERO (addr(exceptfds)) ;
-          if (lnot nsstr->haveclient)
-            then
-              FD_SET (nsstr->npath, addr(readfds)) ; /* waiting for accept */
-            else
-              begin
-                FD_SET (nsstr->sockpath, addr(readfds)) ; /* client might try to send me something */
-                if (nsstr->sockfull)
-                  then
-                    FD_SET (nsstr->sockpath, addr(writefds)) ; /* buffer was full */
-              end
-          timeout.tv_sec = 0 ;
-          timeout.tv_usec = 25000 ; /* 25ms timeout */
-          res = select (0, addr(readfds), addr(writefds), addr(exceptfds), addr(timeout)) ;
-          if (res > 0)
-            then
-              begin
-                if (FD_ISSET (nsstr->npath, addr(readfds)))
-                  then
-                    accept_ns_socket (nsstr) ;
-                else if (nsstr->haveclient)
-                  then
-                    begin
-                      if (FD_ISSET (nsstr->sockpath, addr(readfds)))
-                        then
-                          read_from_client (nsstr) ;
-                      if ((nsstr->sockfull) land (FD_ISSET (nsstr->sockpath, addr(writefds))))
-                        then
-                          nsstr->sockfull = FALSE ;
-                    end
-              end
-          if (nsstr->haveclient)
-            then
-              begin
-                sent = FALSE ;
-                if (nsstr->sockfull)
-                  then
-                    sleepms (25) ;
-                  else
-                    begin
-                      qlock (nsstr) ;
-                      if (nsstr->nsq_in != nsstr->nsq_out)
-                        then
-                          begin
-                            sent = TRUE ;
-                            send_next_buffer (nsstr) ;
-                          end
-                      qunlock (nsstr) ;
-                      if (lnot sent)
-                        then
-                          begin
-                            if ((nsstr->ns_par.sync_time) land ((now () - nsstr->last_sent) >= nsstr->ns_par.sync_time))
-                              then
-                                send_netserv_packet (nsstr, addr(nsstr->sync_record)) ;
-                              else
-                                sleepms (25) ;
-                          end
-                    end
-              end
-        end
+        ns_poll (nsstr) ;
       else
         sleepms (25) ;
   until nsstr->terminate) ;
@@ -630,78 +894,12 @@ end
 void *nsthread (pointer p)
 begin
   pnsstr nsstr ;
-  fd_set readfds, writefds, exceptfds ;
-  struct timeval timeout ;
-  integer res ;
-  boolean sent ;
 
   nsstr = p ;
   repeat
     if (nsstr->sockopen)
       then
-        begin /* wait for socket input or timeout */
-          FD_ZERO (addr(readfds)) ;
-          FD_ZERO (addr(writefds)) ;
-          FD_ZERO (addr(exceptfds)) ;
-          if (lnot nsstr->haveclient)
-            then
-              FD_SET (nsstr->npath, addr(readfds)) ; /* waiting for accept */
-            else
-              begin
-                FD_SET (nsstr->sockpath, addr(readfds)) ; /* client might try to send me something */
-                if (nsstr->sockfull)
-                  then
-                    FD_SET (nsstr->sockpath, addr(writefds)) ; /* buffer was full */
-              end
-          timeout.tv_sec = 0 ;
-          timeout.tv_usec = 25000 ; /* 25ms timeout */
-          res = select (nsstr->high_socket + 1, addr(readfds), addr(writefds), addr(exceptfds), addr(timeout)) ;
-          if (res > 0)
-            then
-              begin
-                if (FD_ISSET (nsstr->npath, addr(readfds)))
-                  then
-                    accept_ns_socket (nsstr) ;
-                else if (nsstr->haveclient)
-                  then
-                    begin
-                      if (FD_ISSET (nsstr->sockpath, addr(readfds)))
-                        then
-                          read_from_client (nsstr) ;
-                      if ((nsstr->sockfull) land (FD_ISSET (nsstr->sockpath, addr(writefds))))
-                        then
-                          nsstr->sockfull = FALSE ;
-                    end
-              end
-          if (nsstr->haveclient)
-            then
-              begin
-                sent = FALSE ;
-                if (nsstr->sockfull)
-                  then
-                    sleepms (25) ;
-                  else
-                    begin
-                      qlock (nsstr) ;
-                      if (nsstr->nsq_in != nsstr->nsq_out)
-                        then
-                          begin
-                            sent = TRUE ;
-                            send_next_buffer (nsstr) ;
-                          end
-                      qunlock (nsstr) ;
-                      if (lnot sent)
-                        then
-                          begin
-                            if ((nsstr->ns_par.sync_time) land ((now () - nsstr->last_sent) >= nsstr->ns_par.sync_time))
-                              then
-                                send_netserv_packet (nsstr, addr(nsstr->sync_record)) ;
-                              else
-                                sleepms (25) ;
-                          end
-                    end
-              end
-        end
+        ns_poll (nsstr) ;
       else
         sleepms (25) ;
   until nsstr->terminate) ;
@@ -722,6 +920,13 @@ begin
   nsstr = malloc (sizeof(tnsstr)) ;
   memset (nsstr, 0, sizeof(tnsstr)) ;
   memcpy (addr(nsstr->ns_par), nspar, sizeof(tns_par)) ;
+  nsstr->max_clients = nsstr->ns_par.max_clients ;
+  if (nsstr->max_clients < 1)
+    then
+      nsstr->max_clients = 1 ;
+  else if (nsstr->max_clients > MAX_NS_CLIENTS)
+    then
+      nsstr->max_clients = MAX_NS_CLIENTS ;
   memset (nsstr->sync_record,' ', LIB_REC_SIZE) ;
   p = addr(nsstr->sync_record) ;
   for (i = 1 ; i <= 6 ; i++)
@@ -731,14 +936,35 @@ begin
     end
   create_mutex (nsstr) ;
   nsstr->npath = INVALID_SOCKET ;
-  nsstr->sockpath = INVALID_SOCKET ;
+  for (i = 0 ; i < MAX_NS_CLIENTS ; i++)
+    nsstr->clients[i].sockpath = INVALID_SOCKET ;
+#ifdef NS_ATOMIC
+  if (pipe (nsstr->wakepipe))
+    then
+      begin
+        destroy_mutex (nsstr) ;
+        free (nsstr) ;
+        return NIL ;
+      end
+  for (i = 0 ; i <= 1 ; i++)
+    fcntl (nsstr->wakepipe[i], F_SETFL, fcntl (nsstr->wakepipe[i], F_GETFL, 0) or O_NONBLOCK) ;
+#endif
   open_socket (nsstr) ;
   if (lnot nsstr->sockopen)
     then
       begin
+#ifdef NS_ATOMIC
+        close (nsstr->wakepipe[0]) ;
+        close (nsstr->wakepipe[1]) ;
+#endif
         free (nsstr) ;
         return NIL ;
       end
+#ifdef NS_ATOMIC
+  if (nsstr->wakepipe[0] > nsstr->high_socket)
+    then
+      nsstr->high_socket = nsstr->wakepipe[0] ;
+#endif
 #ifdef X86_WIN32
   nsstr->threadhandle = CreateThread (NIL, 0, nsthread, nsstr, 0, addr(nsstr->threadid)) ;
   if (nsstr->threadhandle == NIL)
@@ -748,6 +974,10 @@ begin
 #endif
     then
       begin
+#ifdef NS_ATOMIC
+        close (nsstr->wakepipe[0]) ;
+        close (nsstr->wakepipe[1]) ;
+#endif
         free (nsstr) ;
         return NIL ;
       end
@@ -765,6 +995,10 @@ begin
     sleepms (25) ;
   until (lnot nsstr->running)) ;
   close_socket (nsstr) ;
+#ifdef NS_ATOMIC
+  close (nsstr->wakepipe[0]) ;
+  close (nsstr->wakepipe[1]) ;
+#endif
   destroy_mutex (nsstr) ;
 end
 
@@ -22,6 +22,8 @@ Edit History:
    -- ---------- --- ---------------------------------------------------
     0 2006-09-10 rdr Created
     1 2007-03-07 rdr pbuf declaration fixed for lib_ns_send.
+    2 2026-10-17 ess Add max_clients to tns_par and lib_ns_stats.
+    3 2026-10-17 ess Add sndbuf to tns_par.
 */
 #ifndef libnetserv_h
 /* Flag this file as included */
@@ -40,6 +42,7 @@ Edit History:
 
 #define MAX_NETWHITE 10
 #define MAX_NS_BUFFERS 9800 /* 5.0MB as shown in station manager */
+#define MAX_NS_CLIENTS 8 /* clients served from one buffer */
 
 typedef completed_record tnsbuf[MAX_NS_BUFFERS] ;
 typedef struct {
@@ -54,11 +57,26 @@ typedef struct { /* creation parameters for one netserver */
   pointer stnctx ; /* station context */
   tnsbuf *nsbuf ; /* pointer to circular buffer */
   twhitelist whitelist[MAX_NETWHITE] ;
+  integer max_clients ; /* clients connected at once, 0 is the same as 1 */
+  integer sndbuf ; /* client socket send buffer in bytes, 0 for at least 30000 */
 } tns_par ;
+typedef struct { /* one connected client */
+  longword ip ;
+  word port ;
+  longword sent ; /* records sent */
+  longword lag ; /* records written and not sent yet */
+  longword drops ; /* records skipped because the client fell too far behind */
+} tns_client_stat ;
+typedef struct {
+  integer count ; /* clients connected */
+  longword records ; /* records written by lib_ns_send */
+  tns_client_stat clients[MAX_NS_CLIENTS] ;
+} tns_stats ;
 
 extern pointer lib_ns_start (tns_par *nspar) ;
 extern void lib_ns_stop (pointer ct) ;
 extern void lib_ns_send (pointer ct, pcompleted_record pbuf) ;
+extern void lib_ns_stats (pointer ct, tns_stats *stats) ;
 
 #endif
 #endif
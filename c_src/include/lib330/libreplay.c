@@ -0,0 +1,598 @@
+/*   Lib330 data port capture and replay
+     Copyright 2026 Vera C. Rubin Observatory
+
+    This file is part of Lib330
+
+    Lib330 is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Lib330 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Lib330; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+Edit History:
+   Ed Date       By  Changes
+   -- ---------- --- ---------------------------------------------------
+    0 2026-10-17 ess Created
+    1 2026-10-17 ess Set recv_time of replayed packets for the latency histograms.
+    2 2026-10-17 ess datain is a pointer.
+    3 2026-10-17 ess Pass arrays as pointers to their first element.
+*/
+#ifndef libreplay_h
+#include "libreplay.h"
+#endif
+#ifndef libsupport_h
+#include "libsupport.h"
+#endif
+#ifndef libcvrt_h
+#include "libcvrt.h"
+#endif
+#ifndef q330cvrt_h
+#include "q330cvrt.h"
+#endif
+#ifndef libmsgs_h
+#include "libmsgs.h"
+#endif
+#ifndef libslider_h
+#include "libslider.h"
+#endif
+#ifndef libtokens_h
+#include "libtokens.h"
+#endif
+#ifndef libsampcfg_h
+#include "libsampcfg.h"
+#endif
+#ifndef liblatency_h
+#include "liblatency.h"
+#endif
+
+#define REPLAY_BUFSIZE 65536 /* bytes of the capture file read at once */
+
+typedef struct { /* capture being written */
+  tfile_handle desc ;
+  byte buf[CAPREC_HDR_LTH + CAPREC_MAX] ; /* record being built */
+} tcapture ;
+typedef tcapture *pcapture ;
+
+typedef struct { /* capture being replayed, only used by libthread */
+  tfile_handle desc ;
+  integer remaining ; /* bytes of the file not read yet */
+  integer bufcnt ; /* valid bytes in buf */
+  integer bufidx ; /* next byte to parse in buf */
+  double speed ; /* multiple of the captured rate, zero for as fast as possible */
+  double start ; /* host time the first record was replayed */
+  double first ; /* capture time of the first record */
+  boolean started ; /* first record has been replayed */
+  boolean running ; /* acquisition was started from a configuration record */
+  boolean resync ; /* take the window from the next data packet */
+  boolean pending ; /* rec holds a record that is not due yet */
+  tcaprec rec ;
+  pbyte payload ; /* points into buf */
+  byte buf[REPLAY_BUFSIZE] ;
+  treplaystat stat ; /* protected by mutex */
+} treplay ;
+typedef treplay *preplay ;
+
+static const string95 nosuffix = "" ;
+
+/* Monotonic time in nanoseconds to time the stages of a packet */
+static double stage_clock (void)
+begin
+#if defined(X86_WIN32) || defined(CMEX32)
+  return now () * 1.0E9 ;
+#else
+  struct timespec ts ;
+
+  clock_gettime (CLOCK_MONOTONIC, addr(ts)) ;
+  return (double)ts.tv_sec * 1.0E9 + (double)ts.tv_nsec ;
+#endif
+end
+
+/* Add a latency in nanoseconds to the histogram of a stage, the mutex must be held */
+static void add_latency (treplaystat *stat, integer stage, double ns)
+begin
+  integer bucket ;
+  double limit ;
+
+  stat->stage_time[stage] = stat->stage_time[stage] + ns * 1.0E-9 ;
+  bucket = 0 ;
+  limit = 2.0 ;
+  while ((ns >= limit) land (bucket < (LATENCY_BUCKETS - 1)))
+    begin
+      inc(bucket) ;
+      limit = limit * 2.0 ;
+    end
+  inc(stat->latency[stage][bucket]) ;
+end
+
+static void store_caprec (pbyte *p, word rectype, word length, double time)
+begin
+  longword secs ;
+
+  secs = (longword)time ;
+  storeword (p, rectype) ;
+  storeword (p, length) ;
+  storelongword (p, secs) ;
+  storelongword (p, (longword)((time - secs) * 1.0E6)) ;
+end
+
+/* Write a record, closes the capture if that is not possible. The mutex must be held */
+static void write_caprec (pq330 q330, integer length)
+begin
+  pcapture pc ;
+
+  pc = q330->capture ;
+  if (lib_file_write (q330->par_create.file_owner, pc->desc, addr(pc->buf), CAPREC_HDR_LTH + length))
+    then
+      begin
+        lib_file_close (q330->par_create.file_owner, pc->desc) ;
+        free (pc) ;
+        q330->capture = NIL ;
+        unlock (q330) ;
+        libmsgadd (q330, LIBMSG_CAPERR, addr(nosuffix)) ;
+        lock (q330) ;
+      end
+end
+
+/* Build the configuration record from the state read from the Q330, the mutex must be held */
+static void write_config (pq330 q330)
+begin
+  pcapture pc ;
+  pbyte p ;
+  integer i ;
+
+  pc = q330->capture ;
+  p = pc->buf ;
+  store_caprec (addr(p), CAPREC_CONFIG, CAPREC_CONFIG_LTH + q330->cfgsize, now ()) ;
+  storeblock (addr(p), RAW_FIXED_SIZE, addr(q330->raw_fixed)) ;
+  storeblock (addr(p), RAW_GLOBAL_SIZE, addr(q330->raw_global)) ;
+  storeblock (addr(p), RAW_LOG_SIZE, addr(q330->raw_log)) ;
+  for (i = 0 ; i <= 7 ; i++)
+    storelongword (addr(p), q330->share.sensctrl[i]) ;
+  storeblock (addr(p), q330->cfgsize, q330->cfgbuf) ;
+  write_caprec (q330, CAPREC_CONFIG_LTH + q330->cfgsize) ;
+end
+
+/* Start writing the configuration and the data port packets to path, or stop if path is
+   empty. The configuration is written right away if the tokens have been decoded. */
+enum tliberr capture_open (pq330 q330, pchar path)
+begin
+  pcapture pc ;
+  pbyte p ;
+
+  capture_close (q330) ;
+  if ((path == NIL) lor (path[0] == 0))
+    then
+      return LIBERR_NOERR ;
+  pc = malloc (sizeof(tcapture)) ;
+  pc->desc = lib_file_open (q330->par_create.file_owner, path, LFO_CREATE or LFO_WRITE) ;
+  if (pc->desc == INVALID_FILE_HANDLE)
+    then
+      begin
+        free (pc) ;
+        return LIBERR_PAR ;
+      end
+  p = pc->buf ;
+  storeblock (addr(p), 8, CAPTURE_MAGIC) ;
+  storelongword (addr(p), CAPTURE_VERSION) ;
+  if (lib_file_write (q330->par_create.file_owner, pc->desc, addr(pc->buf), CAPTURE_HDR_LTH))
+    then
+      begin
+        lib_file_close (q330->par_create.file_owner, pc->desc) ;
+        free (pc) ;
+        return LIBERR_PAR ;
+      end
+  lock (q330) ;
+  q330->capture = pc ;
+  if ((q330->libstate == LIBSTATE_RUNWAIT) lor (q330->libstate == LIBSTATE_RUN))
+    then
+      write_config (q330) ;
+  unlock (q330) ;
+  return LIBERR_NOERR ;
+end
+
+void capture_close (pq330 q330)
+begin
+  pcapture pc ;
+
+  lock (q330) ;
+  pc = q330->capture ;
+  q330->capture = NIL ;
+  unlock (q330) ;
+  if (pc)
+    then
+      begin
+        lib_file_close (q330->par_create.file_owner, pc->desc) ;
+        free (pc) ;
+      end
+end
+
+/* Called when the tokens are decoded, before acquisition starts */
+void capture_config (pq330 q330)
+begin
+
+  lock (q330) ;
+  if (q330->capture)
+    then
+      write_config (q330) ;
+  unlock (q330) ;
+end
+
+/* Called with each packet of lth bytes in datain that passed the CRC check */
+void capture_packet (pq330 q330, integer lth)
+begin
+  pcapture pc ;
+  pbyte p ;
+
+  lock (q330) ;
+  pc = q330->capture ;
+  if (pc)
+    then
+      begin
+        p = pc->buf ;
+        store_caprec (addr(p), CAPREC_DATA, lth, now ()) ;
+        memcpy (p, addr(q330->datain->qdp), lth) ;
+        write_caprec (q330, lth) ;
+      end
+  unlock (q330) ;
+end
+
+/* Make at least count bytes available in the buffer, returns FALSE at the end of the file */
+static boolean fill_buffer (pq330 q330, preplay pr, integer count)
+begin
+  integer size ;
+
+  if ((pr->bufcnt - pr->bufidx) >= count)
+    then
+      return TRUE ;
+  memmove (addr(pr->buf), addr(pr->buf[pr->bufidx]), pr->bufcnt - pr->bufidx) ;
+  pr->bufcnt = pr->bufcnt - pr->bufidx ;
+  pr->bufidx = 0 ;
+  size = REPLAY_BUFSIZE - pr->bufcnt ;
+  if (size > pr->remaining)
+    then
+      size = pr->remaining ;
+  if ((size > 0) land
+      (lnot lib_file_read (q330->par_create.file_owner, pr->desc, addr(pr->buf[pr->bufcnt]), size)))
+    then
+      begin
+        pr->bufcnt = pr->bufcnt + size ;
+        pr->remaining = pr->remaining - size ;
+      end
+  return (pr->bufcnt >= count) ;
+end
+
+/* Read the next record into rec, returns FALSE at the end of the file */
+static boolean next_record (pq330 q330, preplay pr)
+begin
+  pbyte p ;
+  longword secs, usecs ;
+
+  if (lnot fill_buffer (q330, pr, CAPREC_HDR_LTH))
+    then
+      return FALSE ;
+  p = addr(pr->buf[pr->bufidx]) ;
+  pr->rec.rectype = loadword (addr(p)) ;
+  pr->rec.length = loadword (addr(p)) ;
+  secs = loadlongword (addr(p)) ;
+  usecs = loadlongword (addr(p)) ;
+  pr->rec.time = secs + usecs * 1.0E-6 ;
+  if ((pr->rec.length > CAPREC_MAX) lor (lnot fill_buffer (q330, pr, CAPREC_HDR_LTH + pr->rec.length)))
+    then
+      return FALSE ;
+  pr->payload = addr(pr->buf[pr->bufidx + CAPREC_HDR_LTH]) ;
+  pr->bufidx = pr->bufidx + CAPREC_HDR_LTH + pr->rec.length ;
+  return TRUE ;
+end
+
+/* Stop acquisition as deregistering would, flushing the LCQ's */
+static void stop_replay_acquisition (pq330 q330, preplay pr)
+begin
+
+  if (lnot pr->running)
+    then
+      return ;
+  pr->running = FALSE ;
+  if (q330->libstate == LIBSTATE_RUN)
+    then
+      begin
+        decoder_lock (q330) ;
+        libmsgadd (q330, LIBMSG_DEALLOC, addr(nosuffix)) ;
+        new_state (q330, LIBSTATE_DEALLOC) ;
+        deallocate_sg (q330->aqstruc) ;
+        q330->link_recv = FALSE ;
+        lock (q330) ;
+        if (q330->share.target_state == LIBSTATE_RUN)
+          then
+            q330->share.target_state = LIBSTATE_IDLE ;
+        unlock (q330) ;
+        new_state (q330, LIBSTATE_IDLE) ;
+        decoder_unlock (q330) ;
+      end
+end
+
+/* Returns TRUE if the client asked acquisition to stop */
+static boolean replay_stopped (pq330 q330, preplay pr)
+begin
+  enum tlibstate state ;
+
+  lock (q330) ;
+  state = q330->share.target_state ;
+  unlock (q330) ;
+  return (pr->running) land ((q330->libstate != LIBSTATE_RUN) lor (state != LIBSTATE_RUN)) ;
+end
+
+/* Set up acquisition as if the configuration had been read from the Q330 */
+static void replay_config (pq330 q330, preplay pr)
+begin
+  pbyte p ;
+
+  stop_replay_acquisition (q330, pr) ;
+  if ((q330->libstate != LIBSTATE_IDLE) lor (pr->rec.length < CAPREC_CONFIG_LTH))
+    then
+      return ;
+  p = pr->payload ;
+  decoder_lock (q330) ;
+  lock (q330) ;
+  memcpy (addr(q330->raw_fixed), p, RAW_FIXED_SIZE) ;
+  loadfix (addr(p), addr(q330->share.fixed)) ;
+  q330->q335 = ((q330->share.fixed.flags and FF_335) != 0) ;
+  memcpy (addr(q330->raw_global), p, RAW_GLOBAL_SIZE) ;
+  loadglob (addr(p), addr(q330->share.global)) ;
+  memcpy (addr(q330->raw_log), p, RAW_LOG_SIZE) ;
+  loadlog (addr(p), addr(q330->share.log)) ;
+  loadsensctrl (addr(p), addr(q330->share.sensctrl)) ;
+  q330->share.log.flags = q330->share.log.flags and not LNKFLG_SAVE ;
+  q330->piggyok = (q330->share.log.flags and LNKFLG_PIGGY) == 0 ;
+  q330->share.target_state = LIBSTATE_RUN ;
+  unlock (q330) ;
+  q330->cfgsize = pr->rec.length - CAPREC_CONFIG_LTH ;
+  memcpy (q330->cfgbuf, p, q330->cfgsize) ;
+  libmsgadd (q330, LIBMSG_COMBO, addr(nosuffix)) ;
+  reset_link (q330) ;
+  new_cfg (q330, make_bitmap(CRB_GLOB) or make_bitmap(CRB_FIX) or
+                 make_bitmap(CRB_LOG) or make_bitmap(CRB_SENSCTRL)) ;
+  new_state (q330, LIBSTATE_DECTOK) ;
+  decode_cfg (q330) ;
+  new_state (q330, LIBSTATE_RUN) ;
+  decoder_unlock (q330) ;
+  pr->running = TRUE ;
+  pr->resync = TRUE ;
+  lock (q330) ;
+  inc(pr->stat.configs) ;
+  unlock (q330) ;
+end
+
+/* Pass a data port packet through the same checks and processing as one read from a socket */
+static void replay_data (pq330 q330, preplay pr)
+begin
+  pbyte p ;
+  longint thiscrc ;
+  double t0, t1, t2 ;
+  boolean good ;
+
+  if ((lnot pr->running) lor (pr->rec.length < QDP_HDR_LTH) lor (pr->rec.length > (QDP_HDR_LTH + MAXDATA)))
+    then
+      return ;
+  t0 = stage_clock () ;
+  q330->recv_time = latency_clock () ;
+  memcpy (addr(q330->datain->qdp), pr->payload, pr->rec.length) ;
+  p = q330->datain->qdp ;
+  thiscrc = gcrccalc (addr(q330->crc_table), (pointer)((pntrint)p + 4), pr->rec.length - 4) ;
+  loadqdphdr (addr(p), addr(q330->recvhdr)) ;
+  good = (thiscrc == q330->recvhdr.crc) ;
+  if ((good) land (pr->resync))
+    then
+      begin
+        pr->resync = FALSE ;
+        q330->last_packet = q330->recvhdr.sequence ;
+      end
+  t1 = stage_clock () ;
+  if (good)
+    then
+      begin
+        q330->status_timer = 0 ; /* the capture stands in for the Q330 */
+        process_data (q330) ;
+        if (q330->pkt_bufs[q330->last_packet and 255]->valid)
+          then
+            drain_decoder (q330) ; /* nothing resends what the decode queue had no room for */
+      end
+  t2 = stage_clock () ;
+  lock (q330) ;
+  if (good)
+    then
+      begin
+        inc(pr->stat.packets) ;
+        pr->stat.bytes = pr->stat.bytes + pr->rec.length ;
+        add_latency (addr(pr->stat), RS_CHECK, t1 - t0) ;
+        add_latency (addr(pr->stat), RS_PROCESS, t2 - t1) ;
+      end
+    else
+      inc(pr->stat.rejected) ;
+  unlock (q330) ;
+end
+
+/* Replay the capture in libthread as if registered with rpar. The context must be idle and
+   is left idle at the end */
+enum tliberr replay_open (pq330 q330, tpar_register *rpar, pchar path, double speed)
+begin
+  preplay pr ;
+  byte hdr[CAPTURE_HDR_LTH] ;
+  pbyte p ;
+  boolean bad ;
+
+  pr = malloc (sizeof(treplay)) ;
+  memset (pr, 0, sizeof(treplay)) ;
+  pr->desc = lib_file_open (q330->par_create.file_owner, path, LFO_OPEN or LFO_READ) ;
+  if (pr->desc == INVALID_FILE_HANDLE)
+    then
+      begin
+        free (pr) ;
+        return LIBERR_PAR ;
+      end
+  pr->remaining = lib_file_size (q330->par_create.file_owner, pr->desc) - CAPTURE_HDR_LTH ;
+  p = hdr ;
+  bad = (pr->remaining < 0) lor (lib_file_read (q330->par_create.file_owner, pr->desc, p, CAPTURE_HDR_LTH)) lor
+        (memcmp (p, CAPTURE_MAGIC, 8) != 0) ;
+  if (lnot bad)
+    then
+      begin
+        incn(p, 8) ;
+        bad = (loadlongword (addr(p)) != CAPTURE_VERSION) ;
+      end
+  if (bad)
+    then
+      begin
+        lib_file_close (q330->par_create.file_owner, pr->desc) ;
+        free (pr) ;
+        return LIBERR_PAR ;
+      end
+  if (speed < 0)
+    then
+      speed = 0 ;
+  pr->speed = speed ;
+  pr->stat.active = TRUE ;
+  lock (q330) ;
+  if ((q330->libstate != LIBSTATE_IDLE) lor (q330->share.target_state != LIBSTATE_IDLE) lor (q330->replay))
+    then
+      begin
+        unlock (q330) ;
+        lib_file_close (q330->par_create.file_owner, pr->desc) ;
+        free (pr) ;
+        return LIBERR_PERM ;
+      end
+  /* the same setup as lib_register_330, but without sockets and staying idle */
+  memset (addr(q330->first_clear), 0, (pntrint)addr(q330->last_clear) - (pntrint)addr(q330->first_clear)) ;
+  memset (addr(q330->share.first_share_clear), 0,
+       (pntrint)addr(q330->share.last_share_clear) - (pntrint)addr(q330->share.first_share_clear)) ;
+  memcpy (addr(q330->par_register), rpar, sizeof(tpar_register)) ;
+  q330->share.opstat.gps_age = -1 ;
+  q330->tcp = FALSE ;
+  q330->usesock = FALSE ;
+  memcpy (addr(q330->station_ident), addr(q330->par_create.q330id_station), sizeof(string9)) ;
+  q330->share.status_interval = 10 ;
+  q330->replay = pr ;
+  unlock (q330) ;
+  return LIBERR_NOERR ;
+end
+
+/* Release the replay, the mutex must not be held */
+void replay_close (pq330 q330)
+begin
+  preplay pr ;
+
+  pr = q330->replay ;
+  if (pr == NIL)
+    then
+      return ;
+  lib_file_close (q330->par_create.file_owner, pr->desc) ;
+  lock (q330) ;
+  q330->replay = NIL ;
+  unlock (q330) ;
+  free (pr) ;
+end
+
+/* Replay records until the next one is not due yet or lib_timer is due, called by
+   libthread instead of waiting for socket input */
+void replay_step (pq330 q330)
+begin
+  preplay pr ;
+  double due, deadline, t ;
+  boolean done ;
+  string95 s ;
+
+  pr = q330->replay ;
+  deadline = q330->last_100ms + MS100 ;
+  done = FALSE ;
+  repeat
+    if (replay_stopped (q330, pr))
+      then
+        begin
+          done = TRUE ;
+          break ;
+        end
+    if (lnot pr->pending)
+      then
+        begin
+          if (lnot next_record (q330, pr))
+            then
+              begin
+                done = TRUE ;
+                break ;
+              end
+          pr->pending = TRUE ;
+          if (lnot pr->started)
+            then
+              begin
+                pr->started = TRUE ;
+                pr->first = pr->rec.time ;
+                pr->start = now () ;
+              end
+        end
+    t = now () ;
+    if (pr->speed > 0)
+      then
+        begin
+          due = pr->start + (pr->rec.time - pr->first) / pr->speed ;
+          if (due > t)
+            then
+              begin /* wait for it, but no longer than until lib_timer is due */
+                if (due > deadline)
+                  then
+                    due = deadline ;
+                if (due > t)
+                  then
+                    sleepms ((integer)((due - t) * 1000.0) + 1) ;
+                continue ;
+              end
+        end
+    pr->pending = FALSE ;
+    switch (pr->rec.rectype) begin
+      case CAPREC_CONFIG :
+        replay_config (q330, pr) ;
+        break ;
+      case CAPREC_DATA :
+        replay_data (q330, pr) ;
+        break ;
+    end
+    lock (q330) ;
+    pr->stat.elapsed = now () - pr->start ;
+    unlock (q330) ;
+  until (now () >= deadline)) ;
+  if (replay_stopped (q330, pr))
+    then
+      done = TRUE ;
+  if (done)
+    then
+      begin
+        stop_replay_acquisition (q330, pr) ;
+        lock (q330) ;
+        pr->stat.active = FALSE ;
+        memcpy (addr(q330->replaystat), addr(pr->stat), sizeof(treplaystat)) ;
+        unlock (q330) ;
+        sprintf(s, "%u Packets in %1.3f Seconds", (unsigned int)pr->stat.packets, pr->stat.elapsed) ;
+        libmsgadd (q330, LIBMSG_REPLAYED, addr(s)) ;
+        replay_close (q330) ;
+      end
+end
+
+void replay_stat (pq330 q330, treplaystat *stat)
+begin
+  preplay pr ;
+
+  lock (q330) ;
+  pr = q330->replay ;
+  if (pr)
+    then
+      memcpy (stat, addr(pr->stat), sizeof(treplaystat)) ;
+    else
+      memcpy (stat, addr(q330->replaystat), sizeof(treplaystat)) ;
+  unlock (q330) ;
+end
@@ -0,0 +1,65 @@
+/*   Lib330 data port capture and replay headers
+     Copyright 2026 Vera C. Rubin Observatory
+
+    This file is part of Lib330
+
+    Lib330 is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Lib330 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Lib330; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+Edit History:
+   Ed Date       By  Changes
+   -- ---------- --- ---------------------------------------------------
+    0 2026-10-17 ess Created
+*/
+#ifndef libreplay_h
+/* Flag this file as included */
+#define libreplay_h
+#define VER_LIBREPLAY 1
+
+/* Make sure libtypes.h is included */
+#ifndef libtypes_h
+#include "libtypes.h"
+#endif
+#ifndef libstrucs_h
+#include "libstrucs.h"
+#endif
+
+/* A capture file starts with CAPTURE_MAGIC followed by the format version as a longword,
+   then holds records of a tcaprec header followed by length bytes. All binary fields
+   are big endian like the QDP packets themselves. */
+#define CAPTURE_MAGIC "Q330CAP" /* eight bytes including the terminating zero */
+#define CAPTURE_VERSION 1
+#define CAPTURE_HDR_LTH 12 /* magic and version */
+#define CAPREC_HDR_LTH 12 /* type, length, seconds and microseconds */
+#define CAPREC_CONFIG 1 /* raw fixed, global and log, sensor control and the DP tokens */
+#define CAPREC_DATA 2 /* QDP packet received on the data port, header included */
+#define CAPREC_CONFIG_LTH (RAW_FIXED_SIZE + RAW_GLOBAL_SIZE + RAW_LOG_SIZE + 32) /* before the tokens */
+#define CAPREC_MAX (CAPREC_CONFIG_LTH + MAXCFG) /* largest record */
+
+typedef struct { /* record header */
+  word rectype ; /* CAPREC_xxx */
+  word length ; /* bytes following the header */
+  double time ; /* seconds since 2000 the record was captured */
+} tcaprec ;
+
+extern enum tliberr capture_open (pq330 q330, pchar path) ;
+extern void capture_close (pq330 q330) ;
+extern void capture_config (pq330 q330) ;
+extern void capture_packet (pq330 q330, integer lth) ;
+extern enum tliberr replay_open (pq330 q330, tpar_register *rpar, pchar path, double speed) ;
+extern void replay_close (pq330 q330) ;
+extern void replay_step (pq330 q330) ;
+extern void replay_stat (pq330 q330, treplaystat *stat) ;
+
+#endif
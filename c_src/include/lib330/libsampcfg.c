@@ -51,6 +51,7 @@ Edit History:
    14 2009-09-07 rdr Fix recursive mutex locking in verify_mapping.
    15 2010-03-27 rdr Q335 support added.
    16 2011-03-17 rdr Setup new gain_bits in LCQ init for deb_flags usage.
+   17 2026-10-17 ess Assign each LCQ a slot for its latency histograms.
 */
 #ifndef libsampcfg_h
 #include "libsampcfg.h"
@@ -58,6 +59,9 @@ Edit History:
 #ifndef libmsgs_h
 #include "libmsgs.h"
 #endif
+#ifndef liblatency_h
+#include "liblatency.h"
+#endif
 #ifndef libslider_h
 #include "libslider.h"
 #endif
@@ -373,6 +377,7 @@ begin
   while (pl)
     begin
       pl->dtsequence = 0 ;
+      pl->latency_slot = latency_slot (q330, pl->slocation, pl->sseedname, pl->lcq_num) ;
       if (pl->rate > 0)
         then
           pl->datasize = pl->rate * sizeof(longint) ;
@@ -674,6 +679,7 @@ begin
 
   q330 = paqs->owner ;
   pl->dtsequence = 0 ;
+  pl->latency_slot = latency_slot (q330, pl->slocation, pl->sseedname, pl->lcq_num) ;
   if (pl->raw_data_source != MESSAGE_STREAM)
     then
       begin
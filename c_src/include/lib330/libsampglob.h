@@ -30,6 +30,9 @@ Edit History:
                      Add gap_offset.
     6 2010-03-27 rdr Add Q335 definitions.
     7 2011-03-17 rdr Add gain_bits to tlcq.
+    8 2026-10-17 ess Tfir_packet history is a doubled circular buffer.
+    9 2026-10-17 ess Add transposed direct form II state to tiirsection.
+   10 2026-10-17 ess Add latency_slot to tlcq.
 */
 #ifndef libsampglob_h
 /* Flag this file as included */
@@ -157,8 +160,10 @@ typedef struct {
   single ratio ; /* ratio * sampling_frequency = corner */
   tvector a ;
   tvector b ;
-  tvector x ;
-  tvector y ;
+  tvector x ; /* ring of the last inputs, for continuity */
+  tvector y ; /* ring of the last outputs, for continuity */
+  tvector z ; /* transposed direct form II state */
+  integer hpos ; /* next slot in the x and y rings */
 } tiirsection ;
 typedef struct tiirfilter {
   struct tiirfilter *link ; /* next filter */
@@ -173,13 +178,15 @@ typedef tiirfilter *piirfilter ;
   Tfir_packet is the actual implementation of one FIR filter on a particular LCQ
 */
 typedef tfloat *pfloat ;
+typedef tfloat (*tfirdot)(pfloat pv, pfloat pc, longint len) ; /* FIR dot product kernel */
 typedef struct {
-  pfloat fbuf ; /* pointer to FIR filter buffer */
-  pfloat f ; /* working ptr into FIR buffer */
+  pfloat fbuf ; /* doubled circular FIR history, 2 * flen samples */
   pfloat fcoef ; /* ptr to floating pnt FIR coefficients */
   longint flen ; /* number of coef in FIR filter */
   longint fdec ; /* number of FIR inp samps per output samp */
   longint fcount ; /* current number of samps in FIR buffer */
+  longint fpos ; /* start of the last flen samples in fbuf */
+  tfirdot fdot ; /* dot product kernel selected for this CPU */
 } tfir_packet ;
 typedef tfir_packet *pfir_packet ;
 /*
@@ -405,6 +412,7 @@ typedef struct tlcq {
   word seg_high ; /* highest segment, zero if not yet known */
   pmergedbuf mergedbuf ; /* continguous version of data from segments, same size as segbuf */
   word onesec_filter ; /* OSF_xxx bits */
+  word latency_slot ; /* index of the latency histograms, LATENCY_NONE if none */
   pidxarray idxbuf ; /* for converting frames into samples */
   pdataarray databuf ; /* raw input data */
   word datasize ; /* size of above structure */
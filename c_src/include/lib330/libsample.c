@@ -37,6 +37,12 @@ Edit History:
    10 2011-03-17 rdr For Q335 new usage of deb_flags.
    11 2011-09-22 rdr In process_mult make sure have first segment, if not then don't
                      call process_lcq.
+   12 2026-10-17 ess Use fir_add and fir_mac instead of mac_and_shift.
+   13 2026-10-17 ess Split process_lcq, derived LCQs get each second of samples from
+                     their source as a block through process_derived.
+   14 2026-10-17 ess Filter pre-compressed data with iir_block.
+   15 2026-10-17 ess Record the latencies of decompression, one second and miniseed
+                     callbacks from the time the data packet was received.
 */
 #ifndef libsample_h
 #include "libsample.h"
@@ -53,6 +59,9 @@ Edit History:
 #ifndef libmsgs_h
 #include "libmsgs.h"
 #endif
+#ifndef liblatency_h
+#include "liblatency.h"
+#endif
 #ifndef libcvrt_h
 #include "libcvrt.h"
 #endif
@@ -260,7 +269,10 @@ begin
   q330->miniseed_call.data_address = addr(pbuf->rec) ;
   if ((dest and SCD_512) land (q->mini_filter) land (q330->par_create.call_minidata))
     then
-      q330->par_create.call_minidata (addr(q330->miniseed_call)) ;
+      begin
+        record_latency (q330, LS_MINISEED, q->latency_slot, q330->proc_recv_time) ;
+        q330->par_create.call_minidata (addr(q330->miniseed_call)) ;
+      end
   if ((dest and SCD_ARCH) land (q->arc.amini_filter) land (q->pack_class != PKC_EVENT) land
       (q->pack_class != PKC_CALIBRATE) land (q330->par_create.call_aminidata))
     then
@@ -608,7 +620,6 @@ begin
               then
                 begin
                   p->fir->fcount = p->fir->flen - 1 ;
-                  p->fir->f = (pointer)((pntrint)p->fir->fbuf + (p->fir->flen - 1) * sizeof(tfloat)) ;
                 end
           end
       set_slip (paqs, p) ; /* recursive */
@@ -617,29 +628,21 @@ begin
 end
 #endif
 
-void process_lcq (paqstruc paqs, plcq q, integer src_samp, tfloat dv)
+/* Checks done for every sample entering an LCQ, returns FALSE if the sample is
+   to be ignored */
+static boolean accept_sample (paqstruc paqs, plcq q, integer src_samp)
 begin
   string95 s ;
   string31 s1, s2 ;
-  volatile integer samples ; /* gcc kept cloberring this without volatile */
-  integer i ;
-  longint dsamp ;        /* temp integer sample */
-  tfloat sf ;
-  plong p1 ;
 #ifndef OMIT_SEED
-  integer used ;
   longint int_time ; /* integer equivalent of sample time */
-  piirfilter pi ;
-  pdownstream_packet down ;
-  pfloat p2 ;
-  tfir_packet *pfir ;
 #endif
   pq330 q330 ;
 
   q330 = paqs->owner ;
   if ((q->raw_data_source == (DC_SPEC + 4)) land (q->delay == 0.0))
     then
-      return ; /* don't have a valid delay value yet */
+      return FALSE ; /* don't have a valid delay value yet */
 #ifndef OMIT_SEED
   q->data_written = FALSE ;
   if (q->slipping)
@@ -650,7 +653,7 @@ begin
           then
             q->slipping = FALSE ;
           else
-            return ;
+            return FALSE ;
       end
   if (paqs->data_timetag < 1)
     then
@@ -678,45 +681,59 @@ begin
         q->last_timetag = paqs->data_timetag ;
         q->dtsequence = paqs->dt_data_sequence ;
       end
+  return TRUE ;
+end
+
+static void finish_lcq (paqstruc paqs, plcq q, integer src_samp, integer count, longint dsamp, tfloat sf) ;
+
+#ifndef OMIT_SEED
+/* Handles one output sample of the FIR filter of a derived LCQ */
+static void decimate_lcq (paqstruc paqs, plcq q, integer src_samp, tfloat sf)
+begin
+  piirfilter pi ;
+  pfloat p2 ;
+
+  q->data_written = FALSE ; /* once per output sample, as when fed through process_lcq */
+  sf = sf * q->firfixing_gain ;
+  q->processed_stream = sf ;
+  pi = q->stream_iir ;
+  while (pi)
+    begin
+      p2 = addr(pi->out) ;
+      *p2 = multi_section_filter (pi, sf) ;
+      pi = pi->link ;
+    end
+  finish_lcq (paqs, q, src_samp, 1, lib_round(sf), sf) ;
+end
+#endif
+
+void process_lcq (paqstruc paqs, plcq q, integer src_samp)
+begin
+  volatile integer samples ; /* gcc kept cloberring this without volatile */
+  integer i ;
+  longint dsamp ;        /* temp integer sample */
+  tfloat sf ;
+  plong p1 ;
+#ifndef OMIT_SEED
+  piirfilter pi ;
+  pfloat p2 ;
+#endif
+  pq330 q330 ;
+
+  if (lnot accept_sample (paqs, q, src_samp))
+    then
+      return ;
   dsamp = 0 ;
   sf = 0.0 ;
 #ifndef OMIT_SEED
   pi = q->stream_iir ;
 #endif
-  if (src_samp > 0) /* only done due to decimation from a higher rate */
+  if (src_samp > 0) /* only done due to decimation from a higher rate, see process_derived */
     then
       begin
         samples = 1 ;
 #ifndef OMIT_SEED
-        pfir = q->fir ;
-        if (pfir)
-          then
-            begin /*this only processes one sample at a time, it's probably <=1hz anyway*/
-              *(pfir->f) = dv ;
-              inc(pfir->f) ;
-              inc(pfir->fcount) ;
-              if (pfir->fcount < pfir->flen)
-                then
-                  return ;
-/*--------------------------------------------------------------------------------------
- This convolution may appear backwards, but for non-symetrical filters, the coefficients
- are defined in the reverse order, to match the reverse order of the input values
----------------------------------------------------------------------------------------*/
-              sf = mac_and_shift (pfir) ;
-              decn(pfir->f, pfir->fdec) ;
-              decn(pfir->fcount, pfir->fdec) ; ;
-              sf = sf * q->firfixing_gain ;
-              q->processed_stream = sf ;
-              dsamp = lib_round(sf) ;
-              while (pi)
-                begin
-                  p2 = addr(pi->out) ;
-                  *p2 = multi_section_filter (pi, sf) ;
-                  pi = pi->link ;
-                end
-            end
-          else
-            return ; /* nothing to */
+        return ; /* nothing to without a FIR filter */
 #endif
       end
   else if (src_samp == 0)
@@ -737,22 +754,111 @@ begin
     else
       begin /* pre-compressed data */
         samples = decompress_blockette (paqs, q) ;
+        q330 = paqs->owner ;
+        record_latency (q330, LS_DECODE, q->latency_slot, q330->proc_recv_time) ;
 #ifndef OMIT_SEED
         while (pi)
           begin
             p1 = (pointer)q->databuf ;
             p2 = addr(pi->out) ;
-            for (i = 1 ; i <= samples ; i++)
-              begin
-                sf = *p1 ; /* convert to floating point */
-                *p2 = multi_section_filter (pi, sf) ;
-                inc(p2) ;
-                inc(p1) ;
-              end
+            for (i = 0 ; i <= samples - 1 ; i++)
+              p2[i] = p1[i] ; /* convert to floating point */
+            iir_block (pi, p2, samples) ;
             pi = pi->link ;
           end
 #endif
       end
+  finish_lcq (paqs, q, src_samp, samples, dsamp, sf) ;
+end
+
+#ifndef OMIT_SEED
+/* Feeds count samples from a higher rate LCQ to derived LCQ q. The samples are
+   copied into the FIR history in runs up to the next output sample, instead of
+   going through process_lcq one sample at a time */
+static void process_derived (paqstruc paqs, plcq q, pfloat inputs, integer count)
+begin
+  integer i ;
+  pfir_packet pfir ;
+
+  pfir = q->fir ;
+  if (pfir == NIL)
+    then
+      begin
+        for (i = 1 ; i <= count ; i++)
+          process_lcq (paqs, q, i) ;
+        return ;
+      end
+  i = 1 ;
+  while ((i <= count) land (lnot accept_sample (paqs, q, i)))
+    inc(i) ;
+  /* once accepted, the rest of the samples are as well */
+  while (i <= count)
+    begin
+      i = i + fir_fill (pfir, addr(inputs[i - 1]), count - i + 1) ;
+/*--------------------------------------------------------------------------------------
+ This convolution may appear backwards, but for non-symetrical filters, the coefficients
+ are defined in the reverse order, to match the reverse order of the input values
+---------------------------------------------------------------------------------------*/
+      if (pfir->fcount >= pfir->flen)
+        then
+          decimate_lcq (paqs, q, i - 1, fir_mac (pfir)) ;
+    end
+end
+
+/* Feeds derived LCQs and averaging from the samples of q */
+static void feed_downstream (paqstruc paqs, plcq q, pfloat inputs, integer count)
+begin
+  integer i ;
+  pfloat p2 ;
+  pdownstream_packet down ;
+
+  down = q->downstream_link ;
+  while (down)
+    begin
+      process_derived (paqs, down->derived_q, inputs, count) ;
+      down = down->link ;
+    end
+  if (q->avg_filt)
+    then
+      begin
+        p2 = addr(q->avg_filt->out) ;
+        for (i = 0 ; i <= count - 1 ; i++)
+          begin
+            average (paqs, q->avg, inputs[i], *p2, q) ;
+            inc(p2) ;
+          end
+      end
+end
+
+/* Feeds derived LCQs and averaging from one second of integer samples */
+static void feed_databuf (paqstruc paqs, plcq q, integer count)
+begin
+  integer i ;
+  plong p1 ;
+  tsinglearray inputs ;
+
+  p1 = (pointer)q->databuf ;
+  for (i = 0 ; i <= count - 1 ; i++)
+    inputs[i] = p1[i] ;
+  feed_downstream (paqs, q, inputs, count) ;
+end
+#endif
+
+/* Processing common to all LCQs once the samples have been filtered, src_samp
+   and count as for process_lcq, dsamp and sf are the decimated sample if src_samp > 0 */
+static void finish_lcq (paqstruc paqs, plcq q, integer src_samp, integer count, longint dsamp, tfloat sf)
+begin
+  string95 s ;
+  string31 s1 ;
+  volatile integer samples ; /* gcc kept cloberring this without volatile */
+  plong p1 ;
+#ifndef OMIT_SEED
+  integer used ;
+#endif
+  pq330 q330 ;
+
+  q330 = paqs->owner ;
+  samples = count ;
 #ifndef OMIT_SEED
   run_detector_chain (paqs, q, paqs->data_timetag) ;
 #endif
@@ -771,37 +877,15 @@ begin
             q->cal_on = q->calstat ;
       end
 #ifndef OMIT_SEED
-/* Process misc. flags that must be processed a sample at a time */
+/* Feed derived LCQs and averaging */
   if ((q->downstream_link) lor (q->avg_filt))
     then
       begin
-        p1 = (pointer)q->databuf ;
-        p2 = NIL ;
-        if (q->avg_filt)
+        if (src_samp > 0)
           then
-            p2 = addr(q->avg_filt->out) ;
-        for (i = 1 ; i <= samples ; i++)
-          begin
-            if (src_samp <= 0)
-              then
-                begin
-                  dsamp = *p1 ;
-                  sf = dsamp ;
-                end
-            down = q->downstream_link ;
-            while (down)
-              begin
-                process_lcq (paqs, down->derived_q, i, sf) ;
-                down = down->link ;
-              end
-            if (q->avg_filt)
-              then
-                begin
-                  average (paqs, q->avg, sf, *p2, q) ;
-                  inc(p2) ;
-                end
-            inc(p1) ;
-          end
+            feed_downstream (paqs, q, addr(sf), 1) ;
+          else
+            feed_databuf (paqs, q, samples) ;
       end
 #endif
   if (q->lcq_opt and LO_NOUT)
@@ -858,6 +942,8 @@ begin
             q330->onesec_call.data_quality_flags = 0 ;
         q330->onesec_call.src_channel = q->raw_data_source ;
         q330->onesec_call.src_subchan = q->raw_data_field ;
+        q330->onesec_call.latency_slot = q->latency_slot ;
+        q330->onesec_call.recv_time = q330->proc_recv_time ;
         if ((samples > 1) land (src_samp < 0))
           then
             memcpy (addr(q330->onesec_call.samples), q->databuf, samples * sizeof(longint)) ;
@@ -883,7 +969,10 @@ begin
 #endif
         if (q->onesec_filter)
           then
-            q330->par_create.call_secdata (addr(q330->onesec_call)) ;
+            begin
+              record_latency (q330, LS_ONESEC, q->latency_slot, q330->proc_recv_time) ;
+              q330->par_create.call_secdata (addr(q330->onesec_call)) ;
+            end
 #ifndef OMIT_SEED
         if (q->com->peek_total < MAXSAMPPERWORD)
           then
@@ -922,7 +1011,10 @@ begin
 #endif
         if (q->onesec_filter)
           then
-            q330->par_create.call_secdata (addr(q330->onesec_call)) ;
+            begin
+              record_latency (q330, LS_ONESEC, q->latency_slot, q330->proc_recv_time) ;
+              q330->par_create.call_secdata (addr(q330->onesec_call)) ;
+            end
       end
 end
 
@@ -1000,7 +1092,7 @@ begin
         return ;
       end
   (*(q->databuf))[0] = data ; /* just one data point */
-  process_lcq (paqs, q, 0, 0.0) ;
+  process_lcq (paqs, q, 0) ;
 end
 
 void process_comp (pq330 q330, pbyte p, integer size)
@@ -1038,7 +1130,7 @@ begin
   pcmp->pdata = psave ; /* data starts here */
   pcmp->blocks = (size - offset) shr 2 ; /* number of 32 bit blocks */
   pcmp->mapidx = 0 ;
-  process_lcq (paqs, q, -1, 0.0) ;
+  process_lcq (paqs, q, -1) ;
 end
 
 void process_mult (pq330 q330, pbyte psave, longword seq)
@@ -1183,7 +1275,7 @@ begin
         q->seg_seq = 0xFFFFFFFF ; /* flag as all used up */
         if (have_first)
           then
-            process_lcq (paqs, q, -1, 0.0) ;
+            process_lcq (paqs, q, -1) ;
       end
   if (q->dholdq)
     then
@@ -1266,5 +1358,5 @@ begin
 #endif
       end
   (*(q->databuf))[0] = data ;
-  process_lcq (paqs, q, 0, 0.0) ;
+  process_lcq (paqs, q, 0) ;
 end
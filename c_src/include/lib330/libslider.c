@@ -43,6 +43,20 @@ Edit History:
    14 2010-12-22 rdr Add Sensor control blockette handling.
    15 2011-02-18 rdr Add handling of FE PLL blockettes.
    16 2013-08-09 rdr Check for missing timing blockette when moving to next second of data.
+   17 2026-10-17 ess Add optional decode thread, when enabled send_dack queues in sequence
+                     packets for it instead of decoding them before acknowledging.
+   18 2026-10-17 ess Keep the time each packet was received, proc_recv_time is set while
+                     decoding it for the latency histograms.
+   19 2026-10-17 ess Keep the valid bits of the window in validmap as packets are added
+                     and consumed instead of rebuilding them from all 256 buffers for
+                     each packet. Build the DACK from validmap and publish slidestat
+                     with a sequence lock.
+   20 2026-10-17 ess Swap the buffer a packet was read into with the window buffer for
+                     its sequence, and with a free slot of the decode queue, instead of
+                     copying the packet.
+   21 2026-10-17 ess Send the DACK at once when a packet goes missing or a missing one
+                     arrives, coalesce the others using opt_ack_cnt and opt_ack_to if set.
+                     Count the goodput.
 */
 #ifndef libtypes_h
 #include "libtypes.h"
@@ -99,12 +113,49 @@ Edit History:
 #endif
 #endif
 
+#if !defined(X86_WIN32) && !defined(CMEX32)
+#define DECODE_THREAD
+#include <stdatomic.h>
+
+#define DECODE_QUEUE_SIZE 256 /* packets queued for the decode thread, a power of two */
+
+typedef struct { /* decode thread state */
+  pthread_t threadid ;
+  pthread_mutex_t mutex ; /* held while decoding or changing acquisition state */
+  pthread_t holder ; /* thread holding mutex, valid if depth > 0 */
+  integer depth ; /* number of nested decoder_lock calls by holder */
+  pthread_mutex_t waitmutex ; /* protects waitcond */
+  pthread_cond_t waitcond ; /* signalled when a packet is queued or stop is set */
+  atomic_bool waiting ; /* decode thread may be waiting for waitcond */
+  atomic_bool stop ; /* set TRUE to terminate the decode thread */
+  _Atomic longword head ; /* next slot to write, owned by the network thread */
+  _Atomic longword tail ; /* next slot to read, owned by the holder of mutex */
+  ppkt_buf slots[DECODE_QUEUE_SIZE] ; /* allocated in start_decoder, swapped with pkt_bufs */
+} tdecoder ;
+typedef tdecoder *pdecoder ;
+#endif
+
+/* Discard all queued packets, the decoder must be locked */
+static void flush_decoder (pq330 q330)
+begin
+#ifdef DECODE_THREAD
+  pdecoder pd ;
+
+  pd = q330->decoder ;
+  if (pd)
+    then
+      atomic_store (addr(pd->tail), atomic_load (addr(pd->head))) ;
+#endif
+end
+
 void allocate_packetbuffers (pq330 q330)
 begin
   integer i ;
 
   for (i = 0 ; i <= 255 ; i++)
     getthrbuf (q330, addr(q330->pkt_bufs[i]), sizeof(tpkt_buf)) ;
+  getthrbuf (q330, addr(q330->recv_pkt), sizeof(tpkt_buf)) ;
+  q330->datain = addr(q330->recv_pkt->buf) ;
 end
 
 static void reset_window (pq330 q330)
@@ -136,6 +187,7 @@ begin
   ppkt_buf pbuf ;
 
   paqs = q330->aqstruc ;
+  flush_decoder (q330) ;
   lock (q330) ;
   q330->last_packet = q330->share.log.dataseq ;
   unlock (q330) ;
@@ -144,12 +196,14 @@ begin
       pbuf = q330->pkt_bufs[i] ;
       pbuf->valid = FALSE ;
     end
+  memset (addr(q330->validmap), 0, sizeof(q330->validmap)) ;
   q330->link_recv = TRUE ;
   q330->lasttime = 0 ;
   paqs->data_timetag = 0.0 ;
   q330->lastseq = 0 ;
   q330->lastfill = 0 ;
   q330->ack_counter = 0 ;
+  q330->ack_gap = FALSE ;
   q330->autowin = FALSE ;
   reset_window (q330) ;
   q330->ack_delay = 0 ;
@@ -271,7 +325,7 @@ const tpwrph pwrph = {"Not Charging", "Bulk", "Absorption", "Float", "Equalizati
 const tgpscold gpscold = {"Command Received", "Reception Timeout",
                       "GPS & RTC out of phase ", "Large time jump"} ;
 
-static void proc_insequence (pq330 q330, integer pktidx)
+static void proc_insequence (pq330 q330, ppkt_buf pbuf)
 begin
   paqstruc paqs ;
   boolean seqgap_occurred ;
@@ -292,7 +346,7 @@ begin
   paqs = q330->aqstruc ;
   seqgap_occurred = FALSE ;
   loops = 0 ;
-  p = addr(q330->pkt_bufs[pktidx]->buf.qdp) ;
+  p = addr(pbuf->buf.qdp) ;
   loadqdphdr (addr(p), addr(qhdr)) ;
   psave = p ;
   lth = qhdr.datalength ;
@@ -1115,6 +1169,209 @@ begin
   end
 end
 
+/* Decode a packet in sequence with proc_recv_time set to when it was received */
+static void decode_insequence (pq330 q330, ppkt_buf pbuf)
+begin
+
+  q330->proc_recv_time = pbuf->recv_time ;
+  proc_insequence (q330, pbuf) ;
+  q330->proc_recv_time = 0 ;
+end
+
+#ifdef DECODE_THREAD
+/* Decode the oldest queued packet, the decoder must be locked */
+static void decode_next (pq330 q330, pdecoder pd)
+begin
+  longword tail ;
+
+  tail = atomic_load (addr(pd->tail)) ;
+  if (tail == atomic_load (addr(pd->head)))
+    then
+      return ;
+  if (q330->libstate == LIBSTATE_RUN)
+    then
+      decode_insequence (q330, pd->slots[tail and (DECODE_QUEUE_SIZE - 1)]) ;
+  atomic_store (addr(pd->tail), tail + 1) ;
+end
+
+static void *decodethread (pointer p)
+begin
+  pq330 q330 ;
+  pdecoder pd ;
+
+  q330 = p ;
+  pd = q330->decoder ;
+  repeat
+    if (atomic_load (addr(pd->tail)) == atomic_load (addr(pd->head)))
+      then
+        begin /* wait for a packet, queue_packet signals if waiting is set */
+          pthread_mutex_lock (addr(pd->waitmutex)) ;
+          atomic_store (addr(pd->waiting), TRUE) ;
+          while ((lnot atomic_load (addr(pd->stop))) land
+                 (atomic_load (addr(pd->tail)) == atomic_load (addr(pd->head))))
+            pthread_cond_wait (addr(pd->waitcond), addr(pd->waitmutex)) ;
+          atomic_store (addr(pd->waiting), FALSE) ;
+          pthread_mutex_unlock (addr(pd->waitmutex)) ;
+        end
+    decoder_lock (q330) ; /* one packet at a time so the network thread can get in between */
+    decode_next (q330, pd) ;
+    decoder_unlock (q330) ;
+  until atomic_load (addr(pd->stop))) ;
+  return NIL ;
+end
+
+/* Move the packet in *ppbuf to the decode queue, *ppbuf gets the free slot buffer it
+   replaces. Returns FALSE if the queue is full */
+static boolean queue_packet (pq330 q330, ppkt_buf *ppbuf)
+begin
+  pdecoder pd ;
+  longword head ;
+  ppkt_buf pbuf ;
+
+  pd = q330->decoder ;
+  head = atomic_load (addr(pd->head)) ;
+  if ((head - atomic_load (addr(pd->tail))) >= DECODE_QUEUE_SIZE)
+    then
+      return FALSE ;
+  pbuf = pd->slots[head and (DECODE_QUEUE_SIZE - 1)] ; /* decoded, tail is past it */
+  pd->slots[head and (DECODE_QUEUE_SIZE - 1)] = *ppbuf ;
+  pbuf->valid = FALSE ;
+  *ppbuf = pbuf ;
+  atomic_store (addr(pd->head), head + 1) ;
+  if (atomic_load (addr(pd->waiting)))
+    then
+      begin
+        pthread_mutex_lock (addr(pd->waitmutex)) ;
+        pthread_cond_signal (addr(pd->waitcond)) ;
+        pthread_mutex_unlock (addr(pd->waitmutex)) ;
+      end
+  return TRUE ;
+end
+#endif
+
+/* Start a thread that decodes the data packets, so decoding, filtering and the client
+   callbacks don't delay acknowledging packets */
+void start_decoder (pq330 q330)
+begin
+#ifdef DECODE_THREAD
+  pdecoder pd ;
+  integer i ;
+
+  pd = malloc (sizeof(tdecoder)) ;
+  memset (pd, 0, sizeof(tdecoder)) ;
+  for (i = 0 ; i < DECODE_QUEUE_SIZE ; i++) /* thread memory, they may end up in pkt_bufs */
+    getthrbuf (q330, addr(pd->slots[i]), sizeof(tpkt_buf)) ;
+  pthread_mutex_init (addr(pd->mutex), NULL) ;
+  pthread_mutex_init (addr(pd->waitmutex), NULL) ;
+  pthread_cond_init (addr(pd->waitcond), NULL) ;
+  q330->decoder = pd ;
+  if (pthread_create (addr(pd->threadid), NULL, decodethread, q330))
+    then
+      begin /* decode in the network thread after all */
+        q330->decoder = NIL ;
+        pthread_cond_destroy (addr(pd->waitcond)) ;
+        pthread_mutex_destroy (addr(pd->waitmutex)) ;
+        pthread_mutex_destroy (addr(pd->mutex)) ;
+        free (pd) ;
+      end
+#endif
+end
+
+/* Stop the decode thread after decoding what is queued */
+void stop_decoder (pq330 q330)
+begin
+#ifdef DECODE_THREAD
+  pdecoder pd ;
+
+  pd = q330->decoder ;
+  if (pd == NIL)
+    then
+      return ;
+  drain_decoder (q330) ;
+  pthread_mutex_lock (addr(pd->waitmutex)) ;
+  atomic_store (addr(pd->stop), TRUE) ;
+  pthread_cond_signal (addr(pd->waitcond)) ;
+  pthread_mutex_unlock (addr(pd->waitmutex)) ;
+  pthread_join (pd->threadid, NULL) ;
+  q330->decoder = NIL ;
+  pthread_cond_destroy (addr(pd->waitcond)) ;
+  pthread_mutex_destroy (addr(pd->waitmutex)) ;
+  pthread_mutex_destroy (addr(pd->mutex)) ;
+  free (pd) ;
+#endif
+end
+
+/* Keep the decode thread out while changing acquisition state, may be nested */
+void decoder_lock (pq330 q330)
+begin
+#ifdef DECODE_THREAD
+  pdecoder pd ;
+
+  pd = q330->decoder ;
+  if (pd == NIL)
+    then
+      return ;
+  if ((pd->depth > 0) land (pthread_equal (pd->holder, pthread_self ())))
+    then
+      begin
+        inc(pd->depth) ;
+        return ;
+      end
+  pthread_mutex_lock (addr(pd->mutex)) ;
+  pd->holder = pthread_self () ;
+  pd->depth = 1 ;
+#endif
+end
+
+void decoder_unlock (pq330 q330)
+begin
+#ifdef DECODE_THREAD
+  pdecoder pd ;
+
+  pd = q330->decoder ;
+  if (pd == NIL)
+    then
+      return ;
+  dec(pd->depth) ;
+  if (pd->depth == 0)
+    then
+      pthread_mutex_unlock (addr(pd->mutex)) ;
+#endif
+end
+
+/* Returns TRUE if the calling thread may change acquisition state */
+boolean decoder_locked (pq330 q330)
+begin
+#ifdef DECODE_THREAD
+  pdecoder pd ;
+
+  pd = q330->decoder ;
+  if (pd == NIL)
+    then
+      return TRUE ;
+  return (pd->depth > 0) land (pthread_equal (pd->holder, pthread_self ())) ;
+#else
+  return TRUE ;
+#endif
+end
+
+/* Decode all queued packets in the calling thread */
+void drain_decoder (pq330 q330)
+begin
+#ifdef DECODE_THREAD
+  pdecoder pd ;
+
+  pd = q330->decoder ;
+  if (pd == NIL)
+    then
+      return ;
+  decoder_lock (q330) ;
+  while (atomic_load (addr(pd->tail)) != atomic_load (addr(pd->head)))
+    decode_next (q330, pd) ;
+  decoder_unlock (q330) ;
+#endif
+end
+
 void dack_out (pq330 q330)
 begin
   pbyte p, pref ;
@@ -1125,6 +1382,7 @@ begin
 
   q330->ack_delay = 0 ;
   q330->piggyok = TRUE ;
+  inc(q330->goodput.dacks) ;
   p = addr(q330->dataout.qdp) ;
   incn(p, 6) ; /* point at length */
   msglth = loadword (addr(p)) + QDP_HDR_LTH ;
@@ -1230,23 +1488,139 @@ begin
 #endif
 end
 
+/* The 32 valid bits of the window starting at buffer index start */
+static longword window_bits (pq330 q330, word start)
+begin
+  integer w, s ;
+
+  w = (start shr 5) and 7 ;
+  s = start and 31 ;
+  if (s == 0)
+    then
+      return q330->validmap[w] ;
+    else
+      return (q330->validmap[w] shr s) or (q330->validmap[(w + 1) and 7] shl (32 - s)) ;
+end
+
+/* Copy the window status for clients, the writer's half of copy_slidestat */
+static void publish_slidestat (pq330 q330)
+begin
+  tslidestat *ps ;
+#ifdef SLIDESTAT_SEQLOCK
+  longword gen ;
+
+  gen = atomic_load_explicit (addr(q330->slide_gen), memory_order_relaxed) ;
+  atomic_store_explicit (addr(q330->slide_gen), gen + 1, memory_order_relaxed) ;
+  atomic_thread_fence (memory_order_release) ;
+#else
+  lock (q330) ;
+#endif
+  ps = addr(q330->share.slidestat) ;
+  ps->low_seq = q330->last_packet - 1 ;
+  ps->latest = q330->recvhdr.sequence ;
+  memcpy (addr(ps->validmap), addr(q330->validmap), sizeof(ps->validmap)) ;
+#ifdef SLIDESTAT_SEQLOCK
+  atomic_store_explicit (addr(q330->slide_gen), gen + 2, memory_order_release) ;
+#else
+  unlock (q330) ;
+#endif
+end
+
+/* Copy the window status last published by libthread, retrying while it is being written */
+void copy_slidestat (pq330 q330, tslidestat *slidecopy)
+begin
+#ifdef SLIDESTAT_SEQLOCK
+  longword gen ;
+
+  repeat
+    gen = atomic_load_explicit (addr(q330->slide_gen), memory_order_acquire) ;
+    memcpy (slidecopy, addr(q330->share.slidestat), sizeof(tslidestat)) ;
+    atomic_thread_fence (memory_order_acquire) ;
+  until ((gen and 1) == 0) land (gen == atomic_load_explicit (addr(q330->slide_gen), memory_order_relaxed))) ;
+#else
+  lock (q330) ;
+  memcpy (slidecopy, addr(q330->share.slidestat), sizeof(tslidestat)) ;
+  unlock (q330) ;
+#endif
+end
+
+/* Returns TRUE if packets are waiting in the window behind a missing one */
+static boolean window_gap (pq330 q330)
+begin
+  integer i ;
+  longword bits ;
+
+  if (q330->pkt_bufs[q330->last_packet and 255]->valid)
+    then
+      return FALSE ; /* not missing, the decode queue was full */
+  bits = 0 ;
+  for (i = 0 ; i <= 7 ; i++)
+    bits = bits or q330->validmap[i] ;
+  return (bits != 0) ;
+end
+
+/* Compute the goodput of the last interval and copy the counters for lib_get_goodput,
+   called about once a second by lib_timer */
+void update_goodput (pq330 q330)
+begin
+  tgoodput *pg ;
+  double t, dt ;
+
+  pg = addr(q330->goodput) ;
+  t = now () ;
+  dt = t - q330->goodput_time ;
+  if ((q330->goodput_time > 0) land (dt > 0))
+    then
+      begin
+        pg->goodput = (pg->bytes - q330->goodput_bytes) / dt ;
+        if (pg->received > q330->goodput_received)
+          then
+            pg->efficiency = 100.0 * (pg->bytes - q330->goodput_bytes) / (pg->received - q330->goodput_received) ;
+          else
+            pg->efficiency = 0 ;
+      end
+  q330->goodput_time = t ;
+  q330->goodput_bytes = pg->bytes ;
+  q330->goodput_received = pg->received ;
+  lock (q330) ;
+  pg->window = q330->share.log.window ;
+  memcpy (addr(q330->goodput_copy), pg, sizeof(tgoodput)) ;
+  unlock (q330) ;
+end
+
 static void send_dack (pq330 q330)
 begin
-  integer i, j, k ;
-  word lowseq, idx ;
+  integer j ;
+  word lowseq, idx, first, cnt, to ;
   tdp_ack pack ;
   pbyte p, pref, psave ;
   integer lth, msglth ;
   ppkt_buf pbuf ;
+  boolean gap ;
 
   q330->ack_timeout = 0 ;
+  first = q330->last_packet ;
   repeat
-    pbuf = q330->pkt_bufs[q330->last_packet and 255] ;
+    idx = q330->last_packet and 255 ;
+    pbuf = q330->pkt_bufs[idx] ;
     if (pbuf->valid)
       then
         begin
-          proc_insequence (q330, q330->last_packet and 255) ;
-          pbuf->valid = FALSE ;
+#ifdef DECODE_THREAD
+          if (q330->decoder)
+            then
+              begin
+                if (lnot queue_packet (q330, addr(q330->pkt_bufs[idx])))
+                  then
+                    break ; /* decode thread is behind, Q330 will resend the rest */
+              end
+            else
+#endif
+              begin
+                decode_insequence (q330, pbuf) ;
+                pbuf->valid = FALSE ;
+              end
+          q330->validmap[idx shr 5] = q330->validmap[idx shr 5] and (not (1 shl (longword)(idx and 31))) ;
           inc(q330->last_packet) ;
         end
       else
@@ -1254,18 +1628,9 @@ begin
   until (q330->libstate != LIBSTATE_RUN)) ;
   lowseq = q330->last_packet - 1 ;
   memset (addr(pack), 0, sizeof(tdp_ack)) ;
-  pack.acks[0] = 1 ; /* last_packet - 1 */
-  idx = q330->last_packet ;
-  for (i = 1 ; i <= WINBUFS - 1 ; i++)
-    begin
-      j = (i shr 5) and 3 ;
-      k = i and 31 ;
-      pbuf = q330->pkt_bufs[idx and 255] ;
-      if (pbuf->valid)
-        then
-          pack.acks[j] = pack.acks[j] or (1 shl (longint)k) ; /*add those in queue*/
-      inc(idx) ;
-    end
+  for (j = 0 ; j <= 3 ; j++) /* bit i is lowseq + i, add those in queue */
+    pack.acks[j] = window_bits (q330, (lowseq + (j shl 5)) and 255) ;
+  pack.acks[0] = pack.acks[0] or 1 ; /* last_packet - 1 */
   p = addr(q330->dataout.qdp) ;
   psave = p ;
   storeqdphdr (addr(p), DT_DACK, 0, 0, lowseq) ;
@@ -1279,26 +1644,42 @@ begin
   p = psave ;
   storelongint (addr(p), gcrccalc (addr(q330->crc_table), (pointer)((pntrint)p + 4), msglth - 4)) ;
   inc(q330->ack_counter) ;
+  gap = window_gap (q330) ;
+  if ((gap != q330->ack_gap) lor ((gap) land (q330->last_packet != first)))
+    then
+      begin /* a packet went missing or a missing one arrived, let the Q330 know now */
+        q330->ack_gap = gap ;
+        q330->ack_counter = 0 ;
+        inc(q330->goodput.immediate) ;
+        dack_out (q330) ;
+        return ;
+      end
   lock (q330) ;
-  if (q330->ack_counter < q330->share.log.ack_cnt)
+  cnt = q330->share.log.ack_cnt ;
+  to = q330->share.log.ack_to ;
+  unlock (q330) ;
+  if (q330->par_register.opt_ack_cnt)
+    then
+      cnt = q330->par_register.opt_ack_cnt ;
+  if (q330->par_register.opt_ack_to)
+    then
+      to = q330->par_register.opt_ack_to ;
+  if (q330->ack_counter < cnt)
     then
       begin
         if (q330->ack_delay == 0)
           then
-            q330->ack_delay = q330->share.log.ack_to ;
-        unlock (q330) ;
+            q330->ack_delay = to ;
         return ;
       end
-  unlock (q330) ;
   q330->ack_counter = 0 ;
   dack_out (q330) ;
 end
 
 void process_data (pq330 q330)
 begin
-  word hw ;
+  word hw, idx ;
   boolean good ;
-  integer i, j, k ;
   string95 s, s1 ;
   ppkt_buf pbuf ;
   pbyte p ;
@@ -1311,6 +1692,7 @@ begin
     then
       return ;
   add_status (q330, AC_PACKETS, 1) ;
+  q330->goodput.received = q330->goodput.received + q330->recvhdr.datalength ;
   hw = q330->last_packet + WINWRAP ;
   good = q330->recvhdr.sequence >= q330->last_packet ;
   if (hw > q330->last_packet)
@@ -1324,7 +1706,7 @@ begin
         packet_time (now(), addr(s)) ;
         command_name (q330->recvhdr.command, addr(s1)) ;
         strcat (s, s1) ;
-        p = (pointer) ((pntrint)(addr(q330->datain.qdp)) + QDP_HDR_LTH) ;
+        p = (pointer) ((pntrint)(addr(q330->datain->qdp)) + QDP_HDR_LTH) ;
         dsn = loadlongword(addr(p)) ;
         sprintf(s1, ", Lth=%d Seq=%d DSN=%d", q330->recvhdr.datalength, q330->recvhdr.sequence,
                 dsn) ;
@@ -1339,25 +1721,28 @@ begin
   if (good)
     then
       begin
-        pbuf = q330->pkt_bufs[q330->recvhdr.sequence and 255] ;
+        idx = q330->recvhdr.sequence and 255 ;
+        pbuf = q330->recv_pkt ; /* the packet stays in the buffer it was read into */
+        q330->recv_pkt = q330->pkt_bufs[idx] ;
+        q330->datain = addr(q330->recv_pkt->buf) ;
+        q330->pkt_bufs[idx] = pbuf ;
+        if (q330->recv_pkt->valid)
+          then
+            inc(q330->goodput.duplicates) ; /* resent before our DACK got there */
+          else
+            begin
+              inc(q330->goodput.packets) ;
+              q330->goodput.bytes = q330->goodput.bytes + q330->recvhdr.datalength ;
+            end
         pbuf->valid = TRUE ;
-        memcpy (addr(pbuf->buf.qdp), addr(q330->datain.qdp), q330->recvhdr.datalength + QDP_HDR_LTH) ;
-        lock (q330) ;
-        memset (addr(q330->share.slidestat), 0, sizeof(tslidestat)) ;
-        q330->share.slidestat.low_seq = q330->last_packet - 1 ;
-        q330->share.slidestat.latest = q330->recvhdr.sequence ;
-        for (i = 0 ; i <= 255 ; i++)
-          begin
-            j = (i shr 5) and 7 ;
-            k = i and 31 ;
-            pbuf = q330->pkt_bufs[i] ;
-            if (pbuf->valid)
-              then
-                q330->share.slidestat.validmap[j] = q330->share.slidestat.validmap[j] or (1 shl (longword)k) ;
-          end
-        unlock (q330) ;
+        pbuf->recv_time = q330->recv_time ;
+        q330->validmap[idx shr 5] = q330->validmap[idx shr 5] or (1 shl (longword)(idx and 31)) ;
+        publish_slidestat (q330) ;
       end
     else
-      add_status (q330, AC_SEQERR, 1) ;
+      begin
+        add_status (q330, AC_SEQERR, 1) ;
+        inc(q330->goodput.outside) ;
+      end
   send_dack (q330) ;
 end
@@ -21,6 +21,9 @@ Edit History:
    Ed Date       By  Changes
    -- ---------- --- ---------------------------------------------------
     0 2006-09-29 rdr Created
+    1 2026-10-17 ess Add decode thread routines.
+    2 2026-10-17 ess Add copy_slidestat.
+    3 2026-10-17 ess Add update_goodput.
 */
 #ifndef libslider_h
 /* Flag this file as included */
@@ -225,5 +228,13 @@ extern void process_data (pq330 q330) ;
 extern void reset_link (pq330 q330) ;
 extern void send_dopen (pq330 q330) ;
 extern void dack_out (pq330 q330) ;
+extern void start_decoder (pq330 q330) ;
+extern void stop_decoder (pq330 q330) ;
+extern void decoder_lock (pq330 q330) ;
+extern void decoder_unlock (pq330 q330) ;
+extern boolean decoder_locked (pq330 q330) ;
+extern void drain_decoder (pq330 q330) ;
+extern void copy_slidestat (pq330 q330, tslidestat *slidecopy) ;
+extern void update_goodput (pq330 q330) ;
 
 #endif
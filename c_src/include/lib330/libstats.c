@@ -23,6 +23,7 @@ Edit History:
     0 2006-09-29 rdr Created
     1 2006-11-23 rdr Communications efficiency status reworked.
     2 2006-11-29 rdr Make sure compiler uses floating point for com. eff. calculations
+    3 2026-10-17 ess One second data from status has no latency_slot or recv_time.
 */
 #ifndef libtypes_h
 #include "libtypes.h"
@@ -123,6 +124,8 @@ begin
             q330->onesec_call.data_quality_flags = 0 ;
         q330->onesec_call.src_channel = q->raw_data_source ;
         q330->onesec_call.src_subchan = q->raw_data_field ;
+        q330->onesec_call.latency_slot = LATENCY_NONE ;
+        q330->onesec_call.recv_time = 0 ;
         q330->onesec_call.samples[0] = val ;
         q330->par_create.call_secdata (addr(q330->onesec_call)) ;
       end
@@ -43,6 +43,15 @@ Edit History:
                      crash caused by buffer overflow past end of memory block).
                      New static getmem() called by getbuf() and getthrbuf() to
                      allocate memory buffers (fixes memory leak in getthrbuf()).
+   14 2026-10-17 ess On Linux wait in libthread with epoll and a timerfd instead of
+                     a 25ms select loop, unless LEGACY_SELECT is defined.
+   15 2026-10-17 ess Start the decode thread if opt_decode_thread is set. libthread locks
+                     the decoder for everything except reading the data port.
+   16 2026-10-17 ess gcrccalc processes eight bytes at a time with slicing-by-8 tables and
+                     folds buffers of 64 bytes or more with PCLMULQDQ where available.
+   17 2026-10-17 ess libthread replays a capture instead of waiting for input while one
+                     is open. Close any capture or replay in lib_destroy_330.
+   18 2026-10-17 ess Allocate the latency histograms with the context.
 */
 /* Make sure libstrucs.h is included */
 #ifndef libstrucs_h
@@ -72,6 +81,15 @@ Edit History:
 #ifndef libmd5_h
 #include "libmd5.h"
 #endif
+#ifndef libslider_h
+#include "libslider.h"
+#endif
+#ifndef libreplay_h
+#include "libreplay.h"
+#endif
+#ifndef liblatency_h
+#include "liblatency.h"
+#endif
 
 #ifndef OMIT_SEED
 #ifndef libfilters_h
@@ -82,7 +100,42 @@ Edit History:
 #endif
 #endif
 
-#define MS100 (0.1)
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CRC_CLMUL
+#include <immintrin.h>
+
+/* x^n mod P for the CRC polynomial P, the folding distances used by gcrc_clmul */
+#define CRC_X576 0x438FB530 /* four blocks plus 64 bits */
+#define CRC_X512 0xA189D4A0 /* four blocks */
+#define CRC_X192 0xCD8519D8 /* one block plus 64 bits */
+#define CRC_X128 0x6AE24DE0 /* one block */
+#define CRC_X96 0x399C31B0
+#define CRC_X64 0xCE7511A8
+#define CRC_MU 0x143636D79LL /* x^64 div P, for the Barrett reduction */
+#define CRC_P33 (0x100000000LL or CRC_POLYNOMIAL)
+#define CRC_CLMUL_MIN 64 /* shorter buffers are faster with the tables */
+#endif
+
+/* On Linux libthread sleeps in epoll until socket input arrives or lib_timer is
+   due rather than polling with select every 25ms, unless built with LEGACY_SELECT */
+#if defined(__linux__) && !defined(LEGACY_SELECT) && !defined(OMIT_NETWORK) && !defined(CMEX32)
+#define USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#define EPOLL_CPATH 0
+#define EPOLL_DPATH 1
+#define EPOLL_DSSPATH 2
+#define EPOLL_SOCKETS 3
+
+typedef struct {
+  integer epfd ; /* epoll instance */
+  integer timerfd ; /* expires when lib_timer is due */
+  integer fds[EPOLL_SOCKETS] ; /* registered sockets, INVALID_SOCKET if none */
+  longword events[EPOLL_SOCKETS] ; /* registered events for each socket */
+  longword generation ; /* sock_generation when the sockets were registered */
+} tepoll_loop ;
+#endif
 
 #ifdef X86_WIN32
 static void create_mutex (pq330 q330)
@@ -259,8 +312,9 @@ end
 
 void gcrcinit (crc_table_type *crctable)
 begin
-  integer count, bits ;
+  integer count, bits, k ;
   longint tdata, accum ;
+  longword prev ;
 
   for (count = 0 ; count <= 255 ; count++)
     begin
@@ -275,23 +329,111 @@ begin
               accum = (accum shl 1) ;
           tdata = tdata shl 1 ;
         end
-      (*crctable)[count] = accum ;
+      crctable->slices[0][count] = accum ;
     end
+  for (k = 1 ; k <= 7 ; k++)
+    for (count = 0 ; count <= 255 ; count++)
+      begin
+        prev = crctable->slices[k - 1][count] ;
+        crctable->slices[k][count] = (prev shl 8) xor crctable->slices[0][prev shr 24] ;
+      end
+#ifdef CRC_CLMUL
+  __builtin_cpu_init () ;
+  crctable->clmul = (__builtin_cpu_supports ("pclmul")) land (__builtin_cpu_supports ("ssse3")) ;
+#else
+  crctable->clmul = FALSE ;
+#endif
+end
+
+#ifdef CRC_CLMUL
+/* Fold acc, the remainder of everything before the next 128+dist bits, over dist bits,
+   k holds x^(dist+64) mod P in the high and x^dist mod P in the low quadword */
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i gcrc_fold (__m128i acc, __m128i k)
+begin
+
+  return _mm_xor_si128 (_mm_clmulepi64_si128 (acc, k, 0x11), _mm_clmulepi64_si128 (acc, k, 0x00)) ;
 end
 
+/* CRC of the first len div 16 blocks of 16 bytes with carry-less multiplies,
+   len must be at least 64. Each block is loaded byte reversed so bit 127 is the
+   first bit of the block, then four accumulators are folded 512 bits at a time */
+__attribute__((target("pclmul,ssse3")))
+static longword gcrc_clmul (longword crc, pbyte p, longint len)
+begin
+  __m128i swap, k4, k1, x0, x1, x2, x3, t ;
+  longint blocks ;
+
+  swap = _mm_setr_epi8 (15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0) ;
+  k4 = _mm_set_epi64x (CRC_X576, CRC_X512) ;
+  k1 = _mm_set_epi64x (CRC_X192, CRC_X128) ;
+  blocks = len div 16 ;
+  x0 = _mm_shuffle_epi8 (_mm_loadu_si128 ((__m128i *)p), swap) ;
+  x1 = _mm_shuffle_epi8 (_mm_loadu_si128 ((__m128i *)(p + 16)), swap) ;
+  x2 = _mm_shuffle_epi8 (_mm_loadu_si128 ((__m128i *)(p + 32)), swap) ;
+  x3 = _mm_shuffle_epi8 (_mm_loadu_si128 ((__m128i *)(p + 48)), swap) ;
+  x0 = _mm_xor_si128 (x0, _mm_set_epi32 ((integer)crc, 0, 0, 0)) ;
+  incn(p, 64) ;
+  decn(blocks, 4) ;
+  while (blocks >= 4)
+    begin
+      x0 = _mm_xor_si128 (gcrc_fold (x0, k4), _mm_shuffle_epi8 (_mm_loadu_si128 ((__m128i *)p), swap)) ;
+      x1 = _mm_xor_si128 (gcrc_fold (x1, k4), _mm_shuffle_epi8 (_mm_loadu_si128 ((__m128i *)(p + 16)), swap)) ;
+      x2 = _mm_xor_si128 (gcrc_fold (x2, k4), _mm_shuffle_epi8 (_mm_loadu_si128 ((__m128i *)(p + 32)), swap)) ;
+      x3 = _mm_xor_si128 (gcrc_fold (x3, k4), _mm_shuffle_epi8 (_mm_loadu_si128 ((__m128i *)(p + 48)), swap)) ;
+      incn(p, 64) ;
+      decn(blocks, 4) ;
+    end
+  x0 = _mm_xor_si128 (gcrc_fold (x0, k1), x1) ;
+  x0 = _mm_xor_si128 (gcrc_fold (x0, k1), x2) ;
+  x0 = _mm_xor_si128 (gcrc_fold (x0, k1), x3) ;
+  while (blocks > 0)
+    begin
+      x0 = _mm_xor_si128 (gcrc_fold (x0, k1), _mm_shuffle_epi8 (_mm_loadu_si128 ((__m128i *)p), swap)) ;
+      incn(p, 16) ;
+      dec(blocks) ;
+    end
+  /* Multiply by x^32 down to 96 and then 64 bits, and reduce that modulo P */
+  t = _mm_xor_si128 (_mm_clmulepi64_si128 (x0, _mm_cvtsi64_si128 (CRC_X96), 0x01),
+                     _mm_slli_si128 (_mm_move_epi64 (x0), 4)) ;
+  t = _mm_xor_si128 (_mm_clmulepi64_si128 (t, _mm_cvtsi64_si128 (CRC_X64), 0x01), _mm_move_epi64 (t)) ;
+  x0 = _mm_clmulepi64_si128 (_mm_srli_epi64 (t, 32), _mm_cvtsi64_si128 (CRC_MU), 0x00) ;
+  x0 = _mm_clmulepi64_si128 (_mm_srli_epi64 (x0, 32), _mm_cvtsi64_si128 (CRC_P33), 0x00) ;
+  return (longword)_mm_cvtsi128_si32 (_mm_xor_si128 (t, x0)) ;
+end
+#endif
+
 longint gcrccalc (crc_table_type *crctable, pbyte p, longint len)
 begin
-  longint crc ;
-  integer temp ;
+  longword crc, hi, lo ;
 
   crc = 0 ;
+#ifdef CRC_CLMUL
+  if ((crctable->clmul) land (len >= CRC_CLMUL_MIN))
+    then
+      begin
+        crc = gcrc_clmul (crc, p, len) ;
+        incn(p, len and (not 15)) ;
+        len = len and 15 ;
+      end
+#endif
+  while (len >= 8)
+    begin
+      hi = crc xor (((longword)p[0] shl 24) or ((longword)p[1] shl 16) or ((longword)p[2] shl 8) or p[3]) ;
+      lo = ((longword)p[4] shl 24) or ((longword)p[5] shl 16) or ((longword)p[6] shl 8) or p[7] ;
+      crc = crctable->slices[7][hi shr 24] xor crctable->slices[6][(hi shr 16) and 255] xor
+            crctable->slices[5][(hi shr 8) and 255] xor crctable->slices[4][hi and 255] xor
+            crctable->slices[3][lo shr 24] xor crctable->slices[2][(lo shr 16) and 255] xor
+            crctable->slices[1][(lo shr 8) and 255] xor crctable->slices[0][lo and 255] ;
+      incn(p, 8) ;
+      decn(len, 8) ;
+    end
   while (len > 0)
     begin
-      temp = ((crc shr 24) xor *p++) and 255 ;
-      crc = (crc shl 8) xor (*crctable)[temp] ;
+      crc = (crc shl 8) xor crctable->slices[0][((crc shr 24) xor *p++) and 255] ;
       dec(len) ;
     end
-  return crc ;
+  return (longint)crc ;
 end
 
 longword baler_callback (pq330 q330, enum tbaler_type btype, longword val)
@@ -437,6 +579,9 @@ begin
       default :
         sleepms (25) ;
     end
+    if (q330->replay)
+      then
+        replay_step (q330) ;
     if (q330->terminate == FALSE)
       then
         begin
@@ -483,172 +628,463 @@ end
 #else
 #ifndef CMEX32
 
-void *libthread (pointer p)
+/* Wait up to 25ms for socket input and process it, the portable loop */
+static void select_step (pq330 q330)
 begin
-  pq330 q330 ;
 #ifndef OMIT_NETWORK
   fd_set readfds, writefds, exceptfds ;
   struct timeval timeout ;
-#endif
   integer res ;
-  double now_, diff ;
-  longint new_ten_sec ;
+#endif
 
-  pthread_detach(pthread_self());
-  q330 = p ;
-  repeat
-    switch (q330->libstate) begin
-      case LIBSTATE_PING :
-      case LIBSTATE_CONN :
-      case LIBSTATE_ANNC :
-      case LIBSTATE_REG :
-      case LIBSTATE_READCFG :
-      case LIBSTATE_READTOK :
-      case LIBSTATE_DECTOK :
-      case LIBSTATE_RUNWAIT :
-      case LIBSTATE_RUN :
-      case LIBSTATE_DEALLOC :
-      case LIBSTATE_DEREG :
+  switch (q330->libstate) begin
+    case LIBSTATE_PING :
+    case LIBSTATE_CONN :
+    case LIBSTATE_ANNC :
+    case LIBSTATE_REG :
+    case LIBSTATE_READCFG :
+    case LIBSTATE_READTOK :
+    case LIBSTATE_DECTOK :
+    case LIBSTATE_RUNWAIT :
+    case LIBSTATE_RUN :
+    case LIBSTATE_DEALLOC :
+    case LIBSTATE_DEREG :
 #ifndef OMIT_NETWORK
-        if (q330->usesock)
-          then
-            begin /* wait for socket input or timeout */
-              FD_ZERO (addr(readfds)) ;
-              FD_ZERO (addr(writefds)) ;
-              FD_ZERO (addr(exceptfds)) ;
-              if (q330->cpath != INVALID_SOCKET)
-                then
-                  begin
-                    if (q330->libstate == LIBSTATE_CONN)
-                      then /* waiting for connection */
-                        FD_SET (q330->cpath, addr(writefds)) ;
-                      else
-                        begin
-                          FD_SET (q330->cpath, addr(readfds)) ;
-                          if ((q330->dpath != INVALID_SOCKET) land (q330->libstate != LIBSTATE_PING))
-                            then
-                              FD_SET (q330->dpath, addr(readfds)) ;
-                        end
-                  end
+      if (q330->usesock)
+        then
+          begin /* wait for socket input or timeout */
+            FD_ZERO (addr(readfds)) ;
+            FD_ZERO (addr(writefds)) ;
+            FD_ZERO (addr(exceptfds)) ;
+            if (q330->cpath != INVALID_SOCKET)
+              then
+                begin
+                  if (q330->libstate == LIBSTATE_CONN)
+                    then /* waiting for connection */
+                      FD_SET (q330->cpath, addr(writefds)) ;
+                    else
+                      begin
+                        FD_SET (q330->cpath, addr(readfds)) ;
+                        if ((q330->dpath != INVALID_SOCKET) land (q330->libstate != LIBSTATE_PING))
+                          then
+                            FD_SET (q330->dpath, addr(readfds)) ;
+                      end
+                end
 #ifndef OMIT_SEED
-              if ((q330->dssstruc) land (q330->dsspath != INVALID_SOCKET))
-                then
-                  FD_SET (q330->dsspath, addr(readfds)) ;
+            if ((q330->dssstruc) land (q330->dsspath != INVALID_SOCKET))
+              then
+                FD_SET (q330->dsspath, addr(readfds)) ;
 #endif
-              timeout.tv_sec = 0 ;
-              timeout.tv_usec = 25000 ; /* 25ms timeout */
-              res = select (q330->high_socket + 1, addr(readfds), addr(writefds), addr(exceptfds), addr(timeout)) ;
-              if ((q330->libstate != LIBSTATE_IDLE) land (res > 0))
-                then
-                  begin
-                    if (q330->libstate == LIBSTATE_CONN)
-                      then
-                        begin
-                          if ((q330->cpath != INVALID_SOCKET) land (FD_ISSET (q330->cpath, addr(writefds))))
-                            then
-                              begin /* connected to tunnel330 */
-                                q330->tcpidx = 0 ;
-                                libmsgadd(q330, LIBMSG_CONN, "") ;
-                                lib_continue_registration (q330) ;
-                              end
-                        end
-                      else
-                        begin
-                          if ((q330->cpath != INVALID_SOCKET) land (FD_ISSET (q330->cpath, addr(readfds))))
-                            then
+            timeout.tv_sec = 0 ;
+            timeout.tv_usec = 25000 ; /* 25ms timeout */
+            res = select (q330->high_socket + 1, addr(readfds), addr(writefds), addr(exceptfds), addr(timeout)) ;
+            if ((q330->libstate != LIBSTATE_IDLE) land (res > 0))
+              then
+                begin
+                  if (q330->libstate == LIBSTATE_CONN)
+                    then
+                      begin
+                        if ((q330->cpath != INVALID_SOCKET) land (FD_ISSET (q330->cpath, addr(writefds))))
+                          then
+                            begin /* connected to tunnel330 */
+                              decoder_lock (q330) ;
+                              q330->tcpidx = 0 ;
+                              libmsgadd(q330, LIBMSG_CONN, "") ;
+                              lib_continue_registration (q330) ;
+                              decoder_unlock (q330) ;
+                            end
+                      end
+                    else
+                      begin
+                        if ((q330->cpath != INVALID_SOCKET) land (FD_ISSET (q330->cpath, addr(readfds))))
+                          then
+                            begin
+                              decoder_lock (q330) ;
                               read_cmd_socket (q330) ;
-                          if ((q330->dpath != INVALID_SOCKET) land (q330->libstate != LIBSTATE_PING) land (FD_ISSET (q330->dpath, addr(readfds))))
-                            then
-                              read_data_socket (q330) ;
+                              decoder_unlock (q330) ;
+                            end
+                        if ((q330->dpath != INVALID_SOCKET) land (q330->libstate != LIBSTATE_PING) land (FD_ISSET (q330->dpath, addr(readfds))))
+                          then
+                            read_data_socket (q330) ;
 #ifndef OMIT_SEED
-                          if ((q330->dssstruc) land (q330->dsspath != INVALID_SOCKET) land
-                              (FD_ISSET (q330->dsspath, addr(readfds))))
-                            then
+                        if ((q330->dssstruc) land (q330->dsspath != INVALID_SOCKET) land
+                            (FD_ISSET (q330->dsspath, addr(readfds))))
+                          then
+                            begin
+                              decoder_lock (q330) ;
                               lib_dss_read (q330->dssstruc) ;
+                              decoder_unlock (q330) ;
+                            end
 #endif
-                        end
-                  end
-            end
+                      end
+                end
+          end
 #endif
 #ifndef OMIT_SERIAL
-        if (q330->usesock == 0)
-          then
-            begin
+      if (q330->usesock == 0)
+        then
+          begin
 #ifndef OMIT_NETWORK
 #ifndef OMIT_SEED
-              if ((q330->dssstruc) land (q330->dsspath != INVALID_SOCKET))
-                then
-                  begin
-                    FD_ZERO (addr(readfds)) ;
-                    FD_ZERO (addr(writefds)) ;
-                    FD_ZERO (addr(exceptfds)) ;
-                    FD_SET (q330->dsspath, addr(readfds)) ;
-                    timeout.tv_sec = 0 ;
-                    timeout.tv_usec = 5000 ; /* 5ms timeout */
-                    res = select (q330->high_socket + 1, addr(readfds), addr(writefds), addr(exceptfds), addr(timeout)) ;
-                    if ((res > 0) land (FD_ISSET (q330->dsspath, addr(readfds))))
-                      then
+            if ((q330->dssstruc) land (q330->dsspath != INVALID_SOCKET))
+              then
+                begin
+                  FD_ZERO (addr(readfds)) ;
+                  FD_ZERO (addr(writefds)) ;
+                  FD_ZERO (addr(exceptfds)) ;
+                  FD_SET (q330->dsspath, addr(readfds)) ;
+                  timeout.tv_sec = 0 ;
+                  timeout.tv_usec = 5000 ; /* 5ms timeout */
+                  res = select (q330->high_socket + 1, addr(readfds), addr(writefds), addr(exceptfds), addr(timeout)) ;
+                  if ((res > 0) land (FD_ISSET (q330->dsspath, addr(readfds))))
+                    then
+                      begin
+                        decoder_lock (q330) ;
                         lib_dss_read (q330->dssstruc) ;
-                  end
+                        decoder_unlock (q330) ;
+                      end
+                end
 #endif
 #endif
-              read_from_serial (q330) ;
-            end
+            decoder_lock (q330) ;
+            read_from_serial (q330) ;
+            decoder_unlock (q330) ;
+          end
 #endif
-        break ;
-      case LIBSTATE_TERM :
-        break ; /* nothing to */
-      case LIBSTATE_IDLE :
-        if (q330->needtosayhello)
-          then
-            begin
-              q330->needtosayhello = FALSE ;
-              libmsgadd (q330, LIBMSG_CREATED, "") ;
-            end
-          else
-            sleepms (25) ;
-        break ;
-      default :
-        sleepms (25) ;
+      break ;
+    case LIBSTATE_TERM :
+      break ; /* nothing to */
+    case LIBSTATE_IDLE :
+      if (q330->needtosayhello)
+        then
+          begin
+            q330->needtosayhello = FALSE ;
+            libmsgadd (q330, LIBMSG_CREATED, "") ;
+          end
+        else
+          sleepms (25) ;
+      break ;
+    default :
+      sleepms (25) ;
+  end
+end
+
+#ifdef USE_EPOLL
+/* Remove the registered sockets from the epoll instance and register the new ones.
+   Sockets are only re-registered when a socket, the events or the socket generation
+   changed, as a closed socket number may be reused by the next socket opened. */
+static void epoll_watch (pq330 q330, tepoll_loop *loop, integer *fds, longword *events)
+begin
+  struct epoll_event ev ;
+  integer i ;
+  boolean changed ;
+
+  changed = (loop->generation != q330->sock_generation) ;
+  for (i = 0 ; i < EPOLL_SOCKETS ; i++)
+    if ((fds[i] != loop->fds[i]) lor (events[i] != loop->events[i]))
+      then
+        changed = TRUE ;
+  if (lnot changed)
+    then
+      return ;
+  for (i = 0 ; i < EPOLL_SOCKETS ; i++)
+    if (loop->fds[i] != INVALID_SOCKET)
+      then
+        epoll_ctl (loop->epfd, EPOLL_CTL_DEL, loop->fds[i], NIL) ; /* fails harmlessly if already closed */
+  for (i = 0 ; i < EPOLL_SOCKETS ; i++)
+    begin
+      loop->fds[i] = INVALID_SOCKET ;
+      loop->events[i] = 0 ;
+      if ((fds[i] != INVALID_SOCKET) land (events[i]))
+        then
+          begin
+            memset (addr(ev), 0, sizeof(struct epoll_event)) ;
+            ev.events = events[i] ;
+            ev.data.fd = fds[i] ;
+            if (epoll_ctl (loop->epfd, EPOLL_CTL_ADD, fds[i], addr(ev)) == 0)
+              then
+                begin
+                  loop->fds[i] = fds[i] ;
+                  loop->events[i] = events[i] ;
+                end
+          end
     end
-    if (q330->terminate == FALSE)
+  loop->generation = q330->sock_generation ;
+end
+
+/* Arm the timer to expire when timer_step will next call lib_timer */
+static void epoll_arm_timer (pq330 q330, tepoll_loop *loop)
+begin
+  struct itimerspec its ;
+  double delay ;
+
+  delay = q330->last_100ms + MS100 - now() ;
+  if (delay < 0.001)
+    then
+      delay = 0.001 ; /* overdue, or the clock changed */
+  else if (delay > MS100)
+    then
+      delay = MS100 ;
+  memset (addr(its), 0, sizeof(struct itimerspec)) ;
+  its.it_value.tv_nsec = (long) (delay * 1.0E9) ;
+  timerfd_settime (loop->timerfd, 0, addr(its), NIL) ;
+end
+
+/* Wait for socket input or until lib_timer is due and process the input */
+static void epoll_step (pq330 q330, tepoll_loop *loop)
+begin
+  struct epoll_event ready[EPOLL_SOCKETS + 1] ;
+  integer fds[EPOLL_SOCKETS] ;
+  longword events[EPOLL_SOCKETS] ;
+  longword got[EPOLL_SOCKETS] ;
+  integer i, j, res ;
+  uint64_t expirations ;
+  boolean active ;
+
+  for (i = 0 ; i < EPOLL_SOCKETS ; i++)
+    begin
+      fds[i] = INVALID_SOCKET ;
+      events[i] = 0 ;
+      got[i] = 0 ;
+    end
+  active = FALSE ;
+  switch (q330->libstate) begin
+    case LIBSTATE_PING :
+    case LIBSTATE_CONN :
+    case LIBSTATE_ANNC :
+    case LIBSTATE_REG :
+    case LIBSTATE_READCFG :
+    case LIBSTATE_READTOK :
+    case LIBSTATE_DECTOK :
+    case LIBSTATE_RUNWAIT :
+    case LIBSTATE_RUN :
+    case LIBSTATE_DEALLOC :
+    case LIBSTATE_DEREG :
+      if (lnot q330->usesock)
+        then
+          begin /* serial connection, not handled here */
+            select_step (q330) ;
+            return ;
+          end
+      active = TRUE ;
+      if (q330->cpath != INVALID_SOCKET)
+        then
+          begin
+            fds[EPOLL_CPATH] = q330->cpath ;
+            if (q330->libstate == LIBSTATE_CONN)
+              then /* waiting for connection */
+                events[EPOLL_CPATH] = EPOLLOUT ;
+              else
+                begin
+                  events[EPOLL_CPATH] = EPOLLIN ;
+                  if ((q330->dpath != INVALID_SOCKET) land (q330->libstate != LIBSTATE_PING))
+                    then
+                      begin
+                        fds[EPOLL_DPATH] = q330->dpath ;
+                        events[EPOLL_DPATH] = EPOLLIN ;
+                      end
+                end
+          end
+#ifndef OMIT_SEED
+      if ((q330->dssstruc) land (q330->dsspath != INVALID_SOCKET))
+        then
+          begin
+            fds[EPOLL_DSSPATH] = q330->dsspath ;
+            events[EPOLL_DSSPATH] = EPOLLIN ;
+          end
+#endif
+      break ;
+    case LIBSTATE_IDLE :
+      if (q330->needtosayhello)
+        then
+          begin
+            q330->needtosayhello = FALSE ;
+            libmsgadd (q330, LIBMSG_CREATED, "") ;
+            return ;
+          end
+      break ;
+    default :
+      break ;
+  end
+  epoll_watch (q330, loop, addr(fds[0]), addr(events[0])) ;
+  epoll_arm_timer (q330, loop) ;
+  res = epoll_wait (loop->epfd, addr(ready[0]), EPOLL_SOCKETS + 1, -1) ;
+  for (i = 0 ; i < res ; i++)
+    if (ready[i].data.fd == loop->timerfd)
       then
         begin
-          now_ = now() ;
-          if ((now_ < 200000000) lor (now_ > 219999999))
-            then
-              res = 5 ;
-          diff = now_ - q330->last_100ms ;
-          if (fabs(diff) > (MS100 * 20)) /* greater than 2 second spread */
-            then
-              q330->last_100ms = now_ + MS100 ; /* clock changed, reset interval */
-          else if (diff >= MS100)
+          if (read (loop->timerfd, addr(expirations), sizeof(uint64_t)) < 0)
             then
-              begin
-                q330->last_100ms = q330->last_100ms + MS100 ;
-                lib_timer (q330) ;
+              expirations = 0 ; /* already consumed */
+        end
+      else
+        for (j = 0 ; j < EPOLL_SOCKETS ; j++)
+          if (ready[i].data.fd == loop->fds[j])
+            then /* errors and hangups are handled by the read, as with select */
+              got[j] = ready[i].events ;
+  if ((lnot active) lor (q330->libstate == LIBSTATE_IDLE))
+    then
+      return ;
+  if (q330->libstate == LIBSTATE_CONN)
+    then
+      begin
+        if ((q330->cpath != INVALID_SOCKET) land (q330->cpath == fds[EPOLL_CPATH]) land (got[EPOLL_CPATH]))
+          then
+            begin /* connected to tunnel330 */
+              decoder_lock (q330) ;
+              q330->tcpidx = 0 ;
+              libmsgadd(q330, LIBMSG_CONN, "") ;
+              lib_continue_registration (q330) ;
+              decoder_unlock (q330) ;
+            end
+      end
+    else
+      begin
+        if ((q330->cpath != INVALID_SOCKET) land (q330->cpath == fds[EPOLL_CPATH]) land (got[EPOLL_CPATH]))
+          then
+            begin
+              decoder_lock (q330) ;
+              read_cmd_socket (q330) ;
+              decoder_unlock (q330) ;
+            end
+        if ((q330->dpath != INVALID_SOCKET) land (q330->libstate != LIBSTATE_PING) land
+            (q330->dpath == fds[EPOLL_DPATH]) land (got[EPOLL_DPATH]))
+          then
+            read_data_socket (q330) ;
 #ifndef OMIT_SEED
-                if ((q330->dssstruc) land (q330->dsspath != INVALID_SOCKET))
-                  then
-                    lib_dss_timer (q330->dssstruc) ;
+        if ((q330->dssstruc) land (q330->dsspath != INVALID_SOCKET) land
+            (q330->dsspath == fds[EPOLL_DSSPATH]) land (got[EPOLL_DSSPATH]))
+          then
+            begin
+              decoder_lock (q330) ;
+              lib_dss_read (q330->dssstruc) ;
+              decoder_unlock (q330) ;
+            end
 #endif
-              end
-          if (q330->terminate == FALSE) /* lib_timer may set terminate */
-            then
-              begin
-                new_ten_sec = lib_round(now_ + q330->zone_adjust) ; /* rounded second */
-                new_ten_sec = new_ten_sec div 10 ; /* integer 10 second value */
-                if ((new_ten_sec > q330->last_ten_sec) lor
-                    (new_ten_sec <= (q330->last_ten_sec - 12)))
-                  then
-                    begin
-                      q330->last_ten_sec = new_ten_sec ;
-                      q330->dpstat_timestamp = new_ten_sec * 10 ; /* into seconds since 2000 */
-                      lib_stats_timer (q330) ;
-                    end
-              end
-        end
+      end
+end
+
+/* Create the epoll instance and the timer, returns FALSE if that is not possible */
+static boolean epoll_open (tepoll_loop *loop)
+begin
+  struct epoll_event ev ;
+  integer i ;
+
+  for (i = 0 ; i < EPOLL_SOCKETS ; i++)
+    begin
+      loop->fds[i] = INVALID_SOCKET ;
+      loop->events[i] = 0 ;
+    end
+  loop->generation = 0 ;
+  loop->timerfd = INVALID_SOCKET ;
+  loop->epfd = epoll_create1 (EPOLL_CLOEXEC) ;
+  if (loop->epfd < 0)
+    then
+      return FALSE ;
+  loop->timerfd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK or TFD_CLOEXEC) ;
+  if (loop->timerfd >= 0)
+    then
+      begin
+        memset (addr(ev), 0, sizeof(struct epoll_event)) ;
+        ev.events = EPOLLIN ;
+        ev.data.fd = loop->timerfd ;
+        if (epoll_ctl (loop->epfd, EPOLL_CTL_ADD, loop->timerfd, addr(ev)) == 0)
+          then
+            return TRUE ;
+        close (loop->timerfd) ;
+      end
+  close (loop->epfd) ;
+  return FALSE ;
+end
+
+static void epoll_close (tepoll_loop *loop)
+begin
+
+  close (loop->timerfd) ;
+  close (loop->epfd) ;
+end
+#endif
+
+/* Run lib_timer every 100ms and lib_stats_timer every ten seconds */
+static void timer_step (pq330 q330)
+begin
+  integer res ;
+  double now_, diff ;
+  longint new_ten_sec ;
+
+  if (q330->terminate == FALSE)
+    then
+      begin
+        now_ = now() ;
+        if ((now_ < 200000000) lor (now_ > 219999999))
+          then
+            res = 5 ;
+        diff = now_ - q330->last_100ms ;
+        if (fabs(diff) > (MS100 * 20)) /* greater than 2 second spread */
+          then
+            q330->last_100ms = now_ + MS100 ; /* clock changed, reset interval */
+        else if (diff >= MS100)
+          then
+            begin
+              q330->last_100ms = q330->last_100ms + MS100 ;
+              lib_timer (q330) ;
+#ifndef OMIT_SEED
+              if ((q330->dssstruc) land (q330->dsspath != INVALID_SOCKET))
+                then
+                  lib_dss_timer (q330->dssstruc) ;
+#endif
+            end
+        if (q330->terminate == FALSE) /* lib_timer may set terminate */
+          then
+            begin
+              new_ten_sec = lib_round(now_ + q330->zone_adjust) ; /* rounded second */
+              new_ten_sec = new_ten_sec div 10 ; /* integer 10 second value */
+              if ((new_ten_sec > q330->last_ten_sec) lor
+                  (new_ten_sec <= (q330->last_ten_sec - 12)))
+                then
+                  begin
+                    q330->last_ten_sec = new_ten_sec ;
+                    q330->dpstat_timestamp = new_ten_sec * 10 ; /* into seconds since 2000 */
+                    lib_stats_timer (q330) ;
+                  end
+            end
+      end
+end
+
+void *libthread (pointer p)
+begin
+  pq330 q330 ;
+#ifdef USE_EPOLL
+  tepoll_loop loop ;
+  boolean use_epoll ;
+#endif
+
+  pthread_detach(pthread_self());
+  q330 = p ;
+#ifdef USE_EPOLL
+  use_epoll = epoll_open (addr(loop)) ;
+#endif
+  repeat
+    if (q330->replay)
+      then
+        replay_step (q330) ;
+#ifdef USE_EPOLL
+    else if (use_epoll)
+      then
+        epoll_step (q330, addr(loop)) ;
+#endif
+      else
+        select_step (q330) ;
+    decoder_lock (q330) ;
+    timer_step (q330) ;
+    decoder_unlock (q330) ;
   until q330->terminate) ;
+#ifdef USE_EPOLL
+  if (use_epoll)
+    then
+      epoll_close (addr(loop)) ;
+#endif
+  stop_decoder (q330) ;
   new_state (q330, LIBSTATE_TERM) ;
   pthread_exit (0) ;
 end
@@ -667,6 +1103,7 @@ begin
   q330 = *ct ;
   memset (q330, 0, sizeof(tq330)) ;
   create_mutex (q330) ;
+  latency_create (q330) ;
   q330->libstate = LIBSTATE_IDLE ;
   q330->share.target_state = LIBSTATE_IDLE ;
   memcpy (addr(q330->par_create), cfg, sizeof(tpar_create)) ;
@@ -731,15 +1168,22 @@ begin
 #ifdef CMEX32
   err = 0 ;
 #else
+  if (q330->par_create.opt_decode_thread)
+    then
+      start_decoder (q330) ;
   err = pthread_attr_init(&attr);
   if (! err) err = pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED);
   if (! err) err = pthread_create(addr(q330->threadid), NULL, libthread, q330) ;
+  if (err)
+    then
+      stop_decoder (q330) ;
 #endif
   if (err)
 #endif
     then
       begin
         cfg->resp_err = LIBERR_THREADERR ;
+        latency_destroy (q330) ;
         free (*ct) ; /* no context */
         *ct = NIL ;
       end
@@ -754,6 +1198,9 @@ begin
 
   q330 = *ct ;
   *ct = NIL ;
+  capture_close (q330) ;
+  replay_close (q330) ;
+  latency_destroy (q330) ;
   destroy_mutex (q330) ;
   pm = q330->memory_head ;
   while (pm)
@@ -821,6 +1268,9 @@ end
 void new_state (pq330 q330, enum tlibstate newstate)
 begin
 
+  if ((q330->libstate == LIBSTATE_RUN) land (newstate != LIBSTATE_RUN))
+    then
+      drain_decoder (q330) ; /* decode what has been acknowledged while still running */
   q330->libstate = newstate ;
   state_callback (q330, ST_STATE, (longword)newstate) ;
 end
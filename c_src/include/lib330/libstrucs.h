@@ -38,6 +38,17 @@ Edit History:
    11 2010-03-27 rdr Add Q335 flag.
    12 2010-05-07 rdr Add comm structure.
    13 2013-02-02 rdr Add high_socket.
+   14 2026-10-17 ess Add sock_generation so libthread's epoll loop notices reopened sockets.
+   15 2026-10-17 ess Add recvstat and recvbatch for batched data port reads.
+   16 2026-10-17 ess Add decoder.
+   17 2026-10-17 ess Add capture, replay and replaystat. Move MS100 here from libstrucs.c.
+   18 2026-10-17 ess Add latency, recv_time and proc_recv_time, tpkt_buf keeps the time
+                     its packet was received.
+   19 2026-10-17 ess Add validmap and slide_gen, slidestat is published by libslider
+                     instead of being protected by mutex.
+   20 2026-10-17 ess datain points into recv_pkt, the spare window buffer data packets are
+                     read into, instead of being a separate buffer.
+   21 2026-10-17 ess Add goodput, goodput_copy and ack_gap.
 }*/
 #ifndef libstrucs_h
 /* Flag this file as included */
@@ -62,9 +73,13 @@ Edit History:
 #endif
 
 #define CMDQSZ 32 /* Maximum size of command queue */
+#define MS100 (0.1) /* lib_timer interval */
 #define MAX_HISTORY 16
 #define MAXCFG 7884 /* actual number of characters allowed */
 #define WINWRAP (WINBUFS - 1)
+#if !defined(X86_WIN32) && !defined(CMEX32)
+#define SLIDESTAT_SEQLOCK /* slidestat is copied without the mutex, see copy_slidestat */
+#endif
 #define SKIPCNT 24
 #define MAXSPREAD 128 /* now that we have the reboot time saved.. */
 #define DEFAULT_MEMORY 131072
@@ -123,6 +138,7 @@ typedef tcfgbuf *pcfgbuf ;
 typedef struct {
   boolean valid ;
   byte spare ;
+  double recv_time ; /* latency_clock when the packet was received */
   tany buf ;
 } tpkt_buf ;
 typedef word tcbuf[10000] ; /* continuity buffer */
@@ -210,7 +226,7 @@ typedef struct { /* shared variables with client. Require mutex protection */
   tuser_message newuser ; /* user message to send */
   tdevs devs ; /* CNP Devices */
   tpingreq pingreq ; /* for pinging Q330 */
-  tslidestat slidestat ; /* sliding window status */
+  tslidestat slidestat ; /* sliding window status, see publish_slidestat */
   word last_share_clear ; /* last address cleared after de-registration */
 } tshare ;
 typedef struct { /* this is the actual context which is hidden from clients */
@@ -246,6 +262,11 @@ typedef struct { /* this is the actual context which is hidden from clients */
   tshare share ; /* variables shared with client */
   pointer aqstruc ; /* opaque pointer to acquisition structures */
   pointer dssstruc ; /* opaque pointer to dss handler */
+  pointer decoder ; /* opaque pointer to decode thread state, NIL if decoding in libthread */
+  pointer capture ; /* opaque pointer to the capture being written, protected by mutex */
+  pointer replay ; /* opaque pointer to the capture being replayed by libthread */
+  treplaystat replaystat ; /* result of the last replay, protected by mutex */
+  pointer latency ; /* opaque pointer to the latency histograms of the lcqs */
   pointer md5buf ; /* opaque pointer to md5 working buffer */
   pointer lastuser ;
   longword msg_count ; /* message count */
@@ -286,12 +307,19 @@ typedef struct { /* this is the actual context which is hidden from clients */
   integer dpath ; /* data socket */
   integer dsspath ; /* dss socket */
   integer high_socket ; /* Highest socket number */
+  longword sock_generation ; /* incremented each time sockets are closed */
   struct sockaddr csockin, csockout ; /* commands socket address descriptors */
   struct sockaddr dsockin, dsockout ; /* data socket address descriptors */
 #endif
   word ctrlport, dataport ; /* currently used control and data ports */
   longword serial_ip ; /* Host serial IP */
-  tany datain, dataout, datasave ;
+  trecvstat recvstat ; /* data port reads, protected by mutex */
+  pointer recvbatch ; /* buffers for reading a batch of datagrams, allocated on first use */
+  ppkt_buf recv_pkt ; /* spare window buffer, process_data swaps it into pkt_bufs */
+  pany datain ; /* buf of recv_pkt, where data packets are read */
+  tany dataout, datasave ;
+  double recv_time ; /* latency_clock when the packet in datain was received */
+  double proc_recv_time ; /* recv_time of the packet proc_insequence is decoding, zero outside of it */
   crc_table_type crc_table ;
   tstate_call state_call ; /* buffer for building state callbacks */
   tmsg_call msg_call ; /* buffer for building message callbacks */
@@ -306,11 +334,20 @@ typedef struct { /* this is the actual context which is hidden from clients */
   string contmsg ; /* any errors from continuity checking */
   string9 station_ident ; /* network-station */
   ppkt_buf pkt_bufs[256] ;
+  longword validmap[8] ; /* bit set for each valid entry of pkt_bufs, only used by libthread */
+#ifdef SLIDESTAT_SEQLOCK
+  _Atomic longword slide_gen ; /* odd while share.slidestat is being written */
+#endif
+  tgoodput goodput ; /* counters, only used by libthread */
+  tgoodput goodput_copy ; /* copied from goodput by update_goodput, protected by mutex */
+  double goodput_time ; /* when update_goodput last ran */
+  double goodput_bytes, goodput_received ; /* goodput.bytes and received at goodput_time */
   /* following are cleared after de-registering */
   word first_clear ; /* first byte to clear */
   integer ack_delay ;
   integer ack_timeout ; /* to send DT_NOP packets */
   word ack_counter ;
+  boolean ack_gap ; /* the last DACK showed a packet missing */
   word timercnt ; /* count up getting one second intervals from 100ms */
   word q330cport ; /* Q330's command port */
   word q330dport ; /* Q330's data port */
@@ -28,6 +28,7 @@ Edit History:
     4 2009-07-30 rdr Move uppercase to libsupport.
     5 2010-03-27 rdr Add Q335 support.
     6 2011-07-24 rdr Fix bug in loading opaque token data.
+    7 2026-10-17 ess Write the configuration to the capture file, if any.
 */
 #ifndef libclient_h
 #include "libclient.h"
@@ -73,6 +74,9 @@ Edit History:
 #ifndef libtokens_h
 #include "libtokens.h"
 #endif
+#ifndef libreplay_h
+#include "libreplay.h"
+#endif
 
 #ifndef OMIT_SEED
 void read_iir (paqstruc paqs, pbyte *p)
@@ -961,6 +965,7 @@ begin
     then
       start_cfgblks (paqs) ;
 #endif
+  capture_config (q330) ;
   new_state (q330, LIBSTATE_RUNWAIT) ;
 end
 
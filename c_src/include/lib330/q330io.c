@@ -41,8 +41,19 @@ Edit History:
    12 2010-01-04 rdr Use fcntl instead of ioctl to set socket non-blocking.
    13 2010-03-27 rdr Add Q335 support.
    14 2010-05-13 rdr Add detection of 127.0.0.1 as additional baler port.
+   15 2026-10-17 ess Increment sock_generation in close_sockets.
+   16 2026-10-17 ess On Linux read up to RECV_BATCH_SIZE datagrams from the data port
+                     with one recvmmsg call.
+   17 2026-10-17 ess Lock the decoder while handling data port errors.
+   18 2026-10-17 ess Pass good data port packets to capture_packet while capturing.
+   19 2026-10-17 ess Set recv_time when data packets are read.
+   20 2026-10-17 ess Read data packets straight into window buffers, datain is a pointer
+                     and the recvmmsg batch swaps its buffers with recv_pkt.
 */
 
+#ifdef __linux__
+#define _GNU_SOURCE /* for recvmmsg */
+#endif
 #ifdef X86_WIN32
 #include <io.h>				/* close(), read(), write() */
 #else
@@ -70,6 +81,12 @@ Edit History:
 #ifndef libclient_h
 #include "libclient.h"
 #endif
+#ifndef libreplay_h
+#include "libreplay.h"
+#endif
+#ifndef liblatency_h
+#include "liblatency.h"
+#endif
 #ifndef q330cvrt_h
 #include "q330cvrt.h"
 #endif
@@ -104,6 +121,15 @@ Edit History:
 #define ESC_ESC 0xDD /* SLIP_ESC|ESC_ESC = 0xDB */
 #endif
 
+#if defined(__linux__) && !defined(OMIT_NETWORK)
+#define USE_RECVMMSG
+typedef struct { /* buffers for reading a batch of datagrams with one recvmmsg call */
+  struct mmsghdr msgs[RECV_BATCH_SIZE] ;
+  struct iovec iovs[RECV_BATCH_SIZE] ;
+  ppkt_buf pkts[RECV_BATCH_SIZE] ; /* exchanged with recv_pkt as each one is processed */
+} trecvbatch ;
+#endif
+
 #define LOOPBACK_PORT 2066 /* For getting C2_BACK */
 
 void close_sockets (pq330 q330)
@@ -133,6 +159,9 @@ begin
 #endif
               q330->dpath = INVALID_SOCKET ;
             end
+#ifndef X86_WIN32
+        inc(q330->sock_generation) ;
+#endif
       end
 #endif
 #ifndef OMIT_SERIAL
@@ -444,7 +473,7 @@ typedef byte tenc[4] ;
   char *pmask ;
   longint thiscrc ;
 
-  psave = (pointer) addr(q330->datain.qdp) ;
+  psave = (pointer) addr(q330->datain->qdp) ;
   pmask = (pointer) psave ;
   /* NOTE: I was unable to find a C routine that would convert hexadecimal string
      to binary AND clearly indicate that the input was not valid, so do the hard way */
@@ -502,7 +531,7 @@ begin
   longint thiscrc ;
   pbyte p ;
 
-  p = addr(q330->datain.qdp) ;
+  p = addr(q330->datain->qdp) ;
   thiscrc = gcrccalc (addr(q330->crc_table), (pointer)((pntrint)p + 4), lth - 4) ;
   loadqdphdr (addr(p), addr(q330->recvhdr)) ;
   if (thiscrc == q330->recvhdr.crc)
@@ -523,12 +552,12 @@ begin
   if (flgs and LNKFLG_BASE96)
     then
       begin /* am expecting encoded */
-        memcpy (addr(q330->datasave.qdp), addr(q330->datain.qdp), plth) ;
+        memcpy (addr(q330->datasave.qdp), addr(q330->datain->qdp), plth) ;
         actual = decode(q330, plth) ; /* convert to binary */
         if (actual < 0)
           then
             begin
-              memcpy (addr(q330->datain.qdp), addr(q330->datasave.qdp), plth) ;
+              memcpy (addr(q330->datain->qdp), addr(q330->datasave.qdp), plth) ;
               actual = check_crc (q330, plth) ;
             end
       end
@@ -543,21 +572,147 @@ begin
     then
       add_status (q330, AC_CHECK, 1) ;
     else
-      process_data (q330) ;
+      begin
+        if (q330->capture)
+          then
+            capture_packet (q330, actual) ;
+        process_data (q330) ;
+      end
 end
 
 #ifndef OMIT_NETWORK
+static void data_socket_error (pq330 q330, integer err)
+begin
+  string95 msg ;
+
+  if (err != EWOULDBLOCK)
+    then
+      if (err == ECONNRESET)
+        then
+          begin
+            purge_cmdq (q330) ;
+            set_liberr (q330, LIBERR_NOTR) ;
+            close_sockets (q330) ;
+            q330->reg_wait_timer = 60 * 10 ;
+            if ((q330->libstate == LIBSTATE_RUNWAIT) lor (q330->libstate == LIBSTATE_RUN))
+              then
+                begin
+                  start_deallocation (q330) ;
+                  libmsgadd (q330, LIBMSG_ROUTEFAULT, "Deallocating and waiting 10 minutes") ;
+                end
+              else
+                begin
+                  new_state (q330, LIBSTATE_WAIT) ;
+                  q330->registered = FALSE ;
+                  libmsgadd (q330, LIBMSG_ROUTEFAULT, "Waiting 10 minutes") ;
+                end
+          end
+        else
+          begin
+            sprintf(msg, "%d", err) ;
+            libmsgadd(q330, LIBMSG_RECVERR, addr(msg)) ;
+            add_status (q330, AC_IOERR, 1) ; /* add one I/O error */
+          end
+end
+
+static void add_recvstat (pq330 q330, integer count)
+begin
+
+  lock (q330) ;
+  inc(q330->recvstat.reads) ;
+  incn(q330->recvstat.packets, count) ;
+  if ((longword)count > q330->recvstat.largest)
+    then
+      q330->recvstat.largest = count ;
+  if (count >= RECV_BATCH_SIZE)
+    then
+      inc(q330->recvstat.full) ;
+  unlock (q330) ;
+end
+
+#ifdef USE_RECVMMSG
+/* Read up to RECV_BATCH_SIZE datagrams with one call and process them in order,
+   returns FALSE if recvmmsg is not available */
+static boolean read_data_batch (pq330 q330)
+begin
+  trecvbatch *pb ;
+  integer i, count, plth, err ;
+  longword generation ;
+  ppkt_buf pbuf ;
+
+  if (q330->recvbatch == NIL)
+    then
+      begin
+        getthrbuf (q330, addr(q330->recvbatch), sizeof(trecvbatch)) ;
+        pb = q330->recvbatch ;
+        memset (pb, 0, sizeof(trecvbatch)) ;
+        for (i = 0 ; i < RECV_BATCH_SIZE ; i++)
+          begin
+            getthrbuf (q330, addr(pb->pkts[i]), sizeof(tpkt_buf)) ;
+            pb->iovs[i].iov_base = addr(pb->pkts[i]->buf.qdp) ;
+            pb->iovs[i].iov_len = QDP_HDR_LTH + MAXDATA96 ;
+            pb->msgs[i].msg_hdr.msg_iov = addr(pb->iovs[i]) ;
+            pb->msgs[i].msg_hdr.msg_iovlen = 1 ;
+          end
+      end
+  pb = q330->recvbatch ;
+  count = recvmmsg (q330->dpath, addr(pb->msgs[0]), RECV_BATCH_SIZE, 0, NIL) ;
+  if (count == SOCKET_ERROR)
+    then
+      begin
+        if (errno == ENOSYS)
+          then
+            return FALSE ;
+        err = errno ;
+        decoder_lock (q330) ;
+        data_socket_error (q330, err) ;
+        decoder_unlock (q330) ;
+        return TRUE ;
+      end
+  if (count > 0)
+    then
+      begin
+        q330->recv_time = latency_clock () ; /* one time for the whole batch */
+        add_recvstat (q330, count) ;
+      end
+  generation = q330->sock_generation ;
+  for (i = 0 ; i < count ; i++)
+    begin
+      if ((q330->dpath == INVALID_SOCKET) lor (q330->sock_generation != generation))
+        then
+          break ; /* socket was closed while processing, the rest is stale */
+      plth = pb->msgs[i].msg_len ;
+      if (plth > 0)
+        then
+          begin
+            pbuf = pb->pkts[i] ; /* make it the buffer process_data keeps */
+            pb->pkts[i] = q330->recv_pkt ;
+            pb->iovs[i].iov_base = addr(pb->pkts[i]->buf.qdp) ;
+            q330->recv_pkt = pbuf ;
+            q330->datain = addr(pbuf->buf) ;
+            add_status (q330, AC_READ, plth + IP_HDR_LTH + UDP_HDR_LTH) ;
+            check_for_encoded (q330, plth) ;
+          end
+    end
+  return TRUE ;
+end
+#endif
+
 void read_data_socket (pq330 q330)
 begin
   socklen_t lth ;
   integer err ;
-  string95 msg ;
 
   if (q330->dpath == INVALID_SOCKET)
     then
       return ;
+#ifdef USE_RECVMMSG
+  if (read_data_batch (q330))
+    then
+      return ;
+#endif
   lth = sizeof(struct sockaddr) ;
-  err = recvfrom (q330->dpath, addr(q330->datain.qdp), QDP_HDR_LTH + MAXDATA96, 0, addr(q330->dsockin), addr(lth)) ;
+  err = recvfrom (q330->dpath, addr(q330->datain->qdp), QDP_HDR_LTH + MAXDATA96, 0, addr(q330->dsockin), addr(lth)) ;
   if (err == SOCKET_ERROR)
     then
       begin
@@ -567,38 +722,15 @@ begin
 #else
                errno ;
 #endif
-        if (err != EWOULDBLOCK)
-          then
-            if (err == ECONNRESET)
-              then
-                begin
-                  purge_cmdq (q330) ;
-                  set_liberr (q330, LIBERR_NOTR) ;
-                  close_sockets (q330) ;
-                  q330->reg_wait_timer = 60 * 10 ;
-                  if ((q330->libstate == LIBSTATE_RUNWAIT) lor (q330->libstate == LIBSTATE_RUN))
-                    then
-                      begin
-                        start_deallocation (q330) ;
-                        libmsgadd (q330, LIBMSG_ROUTEFAULT, "Deallocating and waiting 10 minutes") ;
-                      end
-                    else
-                      begin
-                        new_state (q330, LIBSTATE_WAIT) ;
-                        q330->registered = FALSE ;
-                        libmsgadd (q330, LIBMSG_ROUTEFAULT, "Waiting 10 minutes") ;
-                      end
-                end
-              else
-                begin
-                  sprintf(msg, "%d", err) ;
-                  libmsgadd(q330, LIBMSG_RECVERR, addr(msg)) ;
-                  add_status (q330, AC_IOERR, 1) ; /* add one I/O error */
-                end
+        decoder_lock (q330) ;
+        data_socket_error (q330, err) ;
+        decoder_unlock (q330) ;
       end
   else if (err > 0)
     then
       begin
+        q330->recv_time = latency_clock () ;
+        add_recvstat (q330, 1) ;
         add_status (q330, AC_READ, err + IP_HDR_LTH + UDP_HDR_LTH) ;
         check_for_encoded (q330, err) ;
       end
@@ -619,7 +751,8 @@ begin
   else if ((q330->tcp) land (isdata))
     then
       begin /* this is actually a data packet */
-        memcpy (addr(q330->datain.qdp), addr(q330->commands.cmsgin.qdp), msglth) ; /* where it's expected */
+        q330->recv_time = latency_clock () ;
+        memcpy (addr(q330->datain->qdp), addr(q330->commands.cmsgin.qdp), msglth) ; /* where it's expected */
         check_for_encoded (q330, msglth) ;
       end
     else
@@ -839,7 +972,8 @@ begin
   if (q330->recvudp.u_dst == q330->dataport)
     then
       begin
-        memcpy (addr(q330->datain.qdp), psave, q330->recvudp.u_len - UDP_HDR_LTH) ;
+        q330->recv_time = latency_clock () ;
+        memcpy (addr(q330->datain->qdp), psave, q330->recvudp.u_len - UDP_HDR_LTH) ;
         check_for_encoded (q330, q330->recvudp.u_len - UDP_HDR_LTH) ;
         return ;
       end
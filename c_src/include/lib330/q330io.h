@@ -21,6 +21,7 @@ Edit History:
    Ed Date       By  Changes
    -- ---------- --- ---------------------------------------------------
     0 2006-09-29 rdr Created
+    1 2026-10-17 ess Add RECV_BATCH_SIZE.
 */
 #ifndef q330io_h
 /* Flag this file as included */
@@ -35,6 +36,8 @@ Edit History:
 #include "libstrucs.h"
 #endif
 
+#define RECV_BATCH_SIZE 32 /* maximum number of datagrams read from the data port at once */
+
 extern void close_sockets (pq330 q330) ;
 #ifndef OMIT_NETWORK
 extern boolean open_sockets (pq330 q330, boolean both, boolean fromback) ;
@@ -26,6 +26,8 @@ Edit History:
     3 2009-02-08 rdr Add EP definitions.
     4 2009-04-18 rdr Changes in EP structures.
     5 2010-03-07 rdr Add Q335 support.
+    6 2026-10-17 ess crc_table_type holds the eight tables of a slicing-by-8 CRC and
+                     whether the CPU can fold the CRC with carry-less multiplies.
 */
 #ifndef q330types_h
 /* Flag this file as included */
@@ -154,7 +156,10 @@ Edit History:
 #define NR_TIME 30 /* Not Registered */
 #define CRC_POLYNOMIAL 1443300200
 
-typedef longint crc_table_type[256] ;
+typedef struct {
+  longword slices[8][256] ; /* slices[k][b] is the CRC of byte b followed by k zero bytes */
+  boolean clmul ; /* fold long buffers with PCLMULQDQ */
+} crc_table_type ;
 
 /* IP */
 typedef struct { /* IP Header */
@@ -12,6 +12,11 @@
 #include "libmseed.h"
 #include "packdata.h"
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#define STEIM_SIMD
+#include <emmintrin.h>
+#endif
+
 /* Control for printing debugging information */
 int encodedebug = 0;
 
@@ -158,27 +163,164 @@ int msr_encode_float64(double *input, int samplecount, double *output, int outpu
     return idx;
 } /* End of msr_encode_float64() */
 
-/* Macro to determine number of bits needed to represent VALUE in
- * the following bit widths: 4,5,6,8,10,15,16,30,32 and set RESULT. */
-#define BITWIDTH(VALUE, RESULT)                         \
-    if (VALUE >= -8 && VALUE <= 7)                      \
-        RESULT = 4;                                     \
-    else if (VALUE >= -16 && VALUE <= 15)               \
-        RESULT = 5;                                     \
-    else if (VALUE >= -32 && VALUE <= 31)               \
-        RESULT = 6;                                     \
-    else if (VALUE >= -128 && VALUE <= 127)             \
-        RESULT = 8;                                     \
-    else if (VALUE >= -512 && VALUE <= 511)             \
-        RESULT = 10;                                    \
-    else if (VALUE >= -16384 && VALUE <= 16383)         \
-        RESULT = 15;                                    \
-    else if (VALUE >= -32768 && VALUE <= 32767)         \
-        RESULT = 16;                                    \
-    else if (VALUE >= -536870912 && VALUE <= 536870911) \
-        RESULT = 30;                                    \
-    else                                                \
-        RESULT = 32;
+/* Differences are classified by the number of these bounds their
+ * magnitude reaches, i.e. the widths of 4, 5, 6, 8, 10, 15, 16 and 30
+ * bits they do not fit in.  Class 8 needs all 32 bits. */
+static const int32_t steim_bounds[8] = {8, 16, 32, 128, 512, 16384, 32768, 536870912};
+
+#define STEIM_NODIFF 0xFF /* class past the last difference, fits no packing */
+#define STEIM_CHUNK 512   /* number of differences classified at once */
+
+/* Highest class each packing of 1 to 8 differences holds, the packings
+ * the encoding has at all are in the mask below the limits. */
+static const uint8_t steim1_limits[8] = {8, 6, 0, 3, 0, 0, 0, 0};
+#define STEIM1_PACKINGS 0x0B /* 1x32, 2x16 and 4x8 bits */
+static const uint8_t steim2_limits[8] = {7, 5, 4, 3, 2, 1, 0, 0};
+#define STEIM2_PACKINGS 0x7F /* 1x30, 2x15, 3x10, 4x8, 5x6, 6x5 and 7x4 bits */
+
+/* Differences of the input and their classes, a chunk at a time */
+struct steimdiffs {
+    int32_t diffs[STEIM_CHUNK + 8];
+    uint8_t classes[STEIM_CHUNK + 8];
+    int start; /* Index of diffs[0] in the sequence of differences */
+    int count; /* Number of differences in the chunk */
+};
+
+/************************************************************************
+ * steim_class:
+ *
+ * Return the class of a difference.
+ ************************************************************************/
+static uint8_t steim_class(int32_t diff) {
+    int32_t fold = diff ^ (diff >> 31); /* magnitude, less one if negative */
+    uint8_t diffclass = 0;
+    int bound;
+
+    for (bound = 0; bound < 8; bound++) diffclass += (fold >= steim_bounds[bound]);
+
+    return diffclass;
+} /* End of steim_class() */
+
+/************************************************************************
+ * steim_classify:
+ *
+ * Compute the differences first to first+count-1 of the input and
+ * classify them.  Difference 0 relates the first sample to the one
+ * before it and is diff0.
+ ************************************************************************/
+static void steim_classify(int32_t *input, int first, int count, int32_t diff0, int32_t *diffs,
+                           uint8_t *classes) {
+    int idx = 0;
+
+    if (first == 0 && count > 0) {
+        diffs[0] = diff0;
+        classes[0] = steim_class(diff0);
+        idx = 1;
+    }
+
+#ifdef STEIM_SIMD
+    /* Eight differences at a time, counting the bounds each one reaches */
+    for (; idx + 8 <= count; idx += 8) {
+        const __m128i *in = (const __m128i *)(input + first + idx);
+        const __m128i *prev = (const __m128i *)(input + first + idx - 1);
+        __m128i lo = _mm_sub_epi32(_mm_loadu_si128(in), _mm_loadu_si128(prev));
+        __m128i hi = _mm_sub_epi32(_mm_loadu_si128(in + 1), _mm_loadu_si128(prev + 1));
+        __m128i lofold = _mm_xor_si128(lo, _mm_srai_epi32(lo, 31));
+        __m128i hifold = _mm_xor_si128(hi, _mm_srai_epi32(hi, 31));
+        __m128i locls = _mm_setzero_si128();
+        __m128i hicls = _mm_setzero_si128();
+        __m128i limit;
+        int bound;
+
+        _mm_storeu_si128((__m128i *)(diffs + idx), lo);
+        _mm_storeu_si128((__m128i *)(diffs + idx + 4), hi);
+
+        for (bound = 0; bound < 8; bound++) {
+            limit = _mm_set1_epi32(steim_bounds[bound] - 1);
+            locls = _mm_sub_epi32(locls, _mm_cmpgt_epi32(lofold, limit));
+            hicls = _mm_sub_epi32(hicls, _mm_cmpgt_epi32(hifold, limit));
+        }
+
+        _mm_storel_epi64((__m128i *)(classes + idx),
+                         _mm_packus_epi16(_mm_packs_epi32(locls, hicls), _mm_setzero_si128()));
+    }
+#endif
+
+    for (; idx < count; idx++) {
+        diffs[idx] = (int32_t)((uint32_t)input[first + idx] - (uint32_t)input[first + idx - 1]);
+        classes[idx] = steim_class(diffs[idx]);
+    }
+} /* End of steim_classify() */
+
+/************************************************************************
+ * steim_next_word:
+ *
+ * Make sure the differences of the next word, which starts with
+ * difference next, are classified, reading the next chunk of the input
+ * if fewer than 7 of them are left in the chunk.
+ *
+ * Return the index of difference next in the chunk.
+ ************************************************************************/
+static int steim_next_word(struct steimdiffs *sd, int32_t *input, int samplecount, int next, int32_t diff0) {
+    int idx = next - sd->start;
+    int keep;
+    int count;
+
+    if (idx + 7 <= sd->count || sd->start + sd->count >= samplecount) return idx;
+
+    /* Move the differences left to the beginning and append the next chunk */
+    keep = sd->count - idx;
+    memmove(sd->diffs, sd->diffs + idx, keep * sizeof(int32_t));
+    memmove(sd->classes, sd->classes + idx, keep);
+
+    count = samplecount - (next + keep);
+    if (count > STEIM_CHUNK - keep) count = STEIM_CHUNK - keep;
+
+    steim_classify(input, next + keep, count, diff0, sd->diffs + keep, sd->classes + keep);
+
+    sd->start = next;
+    sd->count = keep + count;
+    memset(sd->classes + sd->count, STEIM_NODIFF, 8);
+
+    return 0;
+} /* End of steim_next_word() */
+
+/************************************************************************
+ * steim_packing:
+ *
+ * Find the packing of the next word, the most differences the classes
+ * of which are all within the limits of one of the packings of the
+ * encoding.
+ *
+ * Return the number of differences to pack, 0 if none fit.
+ ************************************************************************/
+static int steim_packing(const uint8_t *classes, const uint8_t *limits, int packings) {
+#ifdef STEIM_SIMD
+    /* Highest class of the first 1 to 8 differences in a running maximum */
+    __m128i highest = _mm_loadl_epi64((const __m128i *)classes);
+    __m128i limit = _mm_loadl_epi64((const __m128i *)limits);
+    int fits;
+
+    highest = _mm_max_epu8(highest, _mm_slli_si128(highest, 1));
+    highest = _mm_max_epu8(highest, _mm_slli_si128(highest, 2));
+    highest = _mm_max_epu8(highest, _mm_slli_si128(highest, 4));
+
+    fits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(highest, limit), limit)) & packings;
+
+    return (fits) ? 32 - __builtin_clz(fits) : 0;
+#else
+    uint8_t highest = 0;
+    int packing = 0;
+    int idx;
+
+    for (idx = 0; idx < 8; idx++) {
+        if (classes[idx] > highest) highest = classes[idx];
+        if ((packings & (1 << idx)) && highest <= limits[idx]) packing = idx + 1;
+    }
+
+    return packing;
+#endif
+} /* End of steim_packing() */
 
 /************************************************************************
  * msr_encode_steim1:
@@ -197,10 +339,8 @@ int msr_encode_steim1(int32_t *input, int samplecount, int32_t *output, int outp
                       int swapflag) {
     int32_t *frameptr;   /* Frame pointer in output */
     int32_t *Xnp = NULL; /* Reverse integration constant, aka last sample */
-    int32_t diffs[4];
-    int32_t bitwidth[4];
-    int diffcount = 0;
-    int inputidx = 0;
+    struct steimdiffs sd;
+    int32_t *diffs;
     int outputsamples = 0;
     int maxframes = outputlength / 64;
     int packedsamples = 0;
@@ -223,10 +363,8 @@ int msr_encode_steim1(int32_t *input, int samplecount, int32_t *output, int outp
         ms_log(1, "Encoding Steim1 frames, samples: %d, max frames: %d, swapflag: %d\n", samplecount,
                maxframes, swapflag);
 
-    /* Add first difference to buffers */
-    diffs[0] = diff0;
-    BITWIDTH(diffs[0], bitwidth[0]);
-    diffcount = 1;
+    sd.start = 0;
+    sd.count = 0;
 
     for (frameidx = 0; frameidx < maxframes && outputsamples < samplecount; frameidx++) {
         frameptr = output + (16 * frameidx);
@@ -253,32 +391,20 @@ int msr_encode_steim1(int32_t *input, int samplecount, int32_t *output, int outp
         }
 
         for (widx = startnibble; widx < 16 && outputsamples < samplecount; widx++) {
-            if (diffcount < 4) {
-                /* Shift diffs and related bit widths to beginning of buffers */
-                for (idx = 0; idx < diffcount; idx++) {
-                    diffs[idx] = diffs[packedsamples + idx];
-                    bitwidth[idx] = bitwidth[packedsamples + idx];
-                }
+            /* Differences of this word and their classes */
+            idx = steim_next_word(&sd, input, samplecount, outputsamples, diff0);
+            diffs = sd.diffs + idx;
 
-                /* Add new diffs and determine bit width needed to represent */
-                for (idx = diffcount; idx < 4 && inputidx < (samplecount - 1); idx++, inputidx++) {
-                    diffs[idx] = *(input + inputidx + 1) - *(input + inputidx);
-                    BITWIDTH(diffs[idx], bitwidth[idx]);
-                    diffcount++;
-                }
-            }
-
-            /* Determine optimal packing by checking, in-order:
+            /* Determine optimal packing, the first of these that fits:
              * 4 x 8-bit differences
              * 2 x 16-bit differences
              * 1 x 32-bit difference */
+            packedsamples = steim_packing(sd.classes + idx, steim1_limits, STEIM1_PACKINGS);
 
             word = (union dword *)&frameptr[widx];
-            packedsamples = 0;
 
             /* 4 x 8-bit differences */
-            if (diffcount == 4 && bitwidth[0] <= 8 && bitwidth[1] <= 8 && bitwidth[2] <= 8 &&
-                bitwidth[3] <= 8) {
+            if (packedsamples == 4) {
                 if (encodedebug)
                     ms_log(1, "  W%02d: 01=4x8b  %d  %d  %d  %d\n", widx, diffs[0], diffs[1], diffs[2],
                            diffs[3]);
@@ -290,11 +416,9 @@ int msr_encode_steim1(int32_t *input, int samplecount, int32_t *output, int outp
 
                 /* 2-bit nibble is 0b01 (0x1) */
                 frameptr[0] |= 0x1 << (30 - 2 * widx);
-
-                packedsamples = 4;
             }
             /* 2 x 16-bit differences */
-            else if (diffcount >= 2 && bitwidth[0] <= 16 && bitwidth[1] <= 16) {
+            else if (packedsamples == 2) {
                 if (encodedebug) ms_log(1, "  W%02d: 2=2x16b  %d  %d\n", widx, diffs[0], diffs[1]);
 
                 word->d16[0] = diffs[0];
@@ -307,8 +431,6 @@ int msr_encode_steim1(int32_t *input, int samplecount, int32_t *output, int outp
 
                 /* 2-bit nibble is 0b10 (0x2) */
                 frameptr[0] |= 0x2 << (30 - 2 * widx);
-
-                packedsamples = 2;
             }
             /* 1 x 32-bit difference */
             else {
@@ -320,11 +442,8 @@ int msr_encode_steim1(int32_t *input, int samplecount, int32_t *output, int outp
 
                 /* 2-bit nibble is 0b11 (0x3) */
                 frameptr[0] |= 0x3 << (30 - 2 * widx);
-
-                packedsamples = 1;
             }
 
-            diffcount -= packedsamples;
             outputsamples += packedsamples;
         } /* Done with words in frame */
 
@@ -359,10 +478,8 @@ int msr_encode_steim2(int32_t *input, int samplecount, int32_t *output, int outp
                       char *srcname, int swapflag) {
     uint32_t *frameptr;  /* Frame pointer in output */
     int32_t *Xnp = NULL; /* Reverse integration constant, aka last sample */
-    int32_t diffs[7];
-    int32_t bitwidth[7];
-    int diffcount = 0;
-    int inputidx = 0;
+    struct steimdiffs sd;
+    int32_t *diffs;
     int outputsamples = 0;
     int maxframes = outputlength / 64;
     int packedsamples = 0;
@@ -385,10 +502,8 @@ int msr_encode_steim2(int32_t *input, int samplecount, int32_t *output, int outp
         ms_log(1, "Encoding Steim2 frames, samples: %d, max frames: %d, swapflag: %d\n", samplecount,
                maxframes, swapflag);
 
-    /* Add first difference to buffers */
-    diffs[0] = diff0;
-    BITWIDTH(diffs[0], bitwidth[0]);
-    diffcount = 1;
+    sd.start = 0;
+    sd.count = 0;
 
     for (frameidx = 0; frameidx < maxframes && outputsamples < samplecount; frameidx++) {
         frameptr = (uint32_t *)output + (16 * frameidx);
@@ -415,22 +530,11 @@ int msr_encode_steim2(int32_t *input, int samplecount, int32_t *output, int outp
         }
 
         for (widx = startnibble; widx < 16 && outputsamples < samplecount; widx++) {
-            if (diffcount < 7) {
-                /* Shift diffs and related bit widths to beginning of buffers */
-                for (idx = 0; idx < diffcount; idx++) {
-                    diffs[idx] = diffs[packedsamples + idx];
-                    bitwidth[idx] = bitwidth[packedsamples + idx];
-                }
+            /* Differences of this word and their classes */
+            idx = steim_next_word(&sd, input, samplecount, outputsamples, diff0);
+            diffs = sd.diffs + idx;
 
-                /* Add new diffs and determine bit width needed to represent */
-                for (idx = diffcount; idx < 7 && inputidx < (samplecount - 1); idx++, inputidx++) {
-                    diffs[idx] = *(input + inputidx + 1) - *(input + inputidx);
-                    BITWIDTH(diffs[idx], bitwidth[idx]);
-                    diffcount++;
-                }
-            }
-
-            /* Determine optimal packing by checking, in-order:
+            /* Determine optimal packing, the first of these that fits:
              * 7 x 4-bit differences
              * 6 x 5-bit differences
              * 5 x 6-bit differences
@@ -438,12 +542,10 @@ int msr_encode_steim2(int32_t *input, int samplecount, int32_t *output, int outp
              * 3 x 10-bit differences
              * 2 x 15-bit differences
              * 1 x 30-bit difference */
-
-            packedsamples = 0;
+            packedsamples = steim_packing(sd.classes + idx, steim2_limits, STEIM2_PACKINGS);
 
             /* 7 x 4-bit differences */
-            if (diffcount == 7 && bitwidth[0] <= 4 && bitwidth[1] <= 4 && bitwidth[2] <= 4 &&
-                bitwidth[3] <= 4 && bitwidth[4] <= 4 && bitwidth[5] <= 4 && bitwidth[6] <= 4) {
+            if (packedsamples == 7) {
                 if (encodedebug)
                     ms_log(1, "  W%02d: 11,10=7x4b  %d  %d  %d  %d  %d  %d  %d\n", widx, diffs[0], diffs[1],
                            diffs[2], diffs[3], diffs[4], diffs[5], diffs[6]);
@@ -462,12 +564,9 @@ int msr_encode_steim2(int32_t *input, int samplecount, int32_t *output, int outp
 
                 /* 2-bit nibble is 0b11 (0x3) */
                 frameptr[0] |= 0x3 << (30 - 2 * widx);
-
-                packedsamples = 7;
             }
             /* 6 x 5-bit differences */
-            else if (diffcount >= 6 && bitwidth[0] <= 5 && bitwidth[1] <= 5 && bitwidth[2] <= 5 &&
-                     bitwidth[3] <= 5 && bitwidth[4] <= 5 && bitwidth[5] <= 5) {
+            else if (packedsamples == 6) {
                 if (encodedebug)
                     ms_log(1, "  W%02d: 11,01=6x5b  %d  %d  %d  %d  %d  %d\n", widx, diffs[0], diffs[1],
                            diffs[2], diffs[3], diffs[4], diffs[5]);
@@ -485,12 +584,9 @@ int msr_encode_steim2(int32_t *input, int samplecount, int32_t *output, int outp
 
                 /* 2-bit nibble is 0b11 (0x3) */
                 frameptr[0] |= 0x3 << (30 - 2 * widx);
-
-                packedsamples = 6;
             }
             /* 5 x 6-bit differences */
-            else if (diffcount >= 5 && bitwidth[0] <= 6 && bitwidth[1] <= 6 && bitwidth[2] <= 6 &&
-                     bitwidth[3] <= 6 && bitwidth[4] <= 6) {
+            else if (packedsamples == 5) {
                 if (encodedebug)
                     ms_log(1, "  W%02d: 11,00=5x6b  %d  %d  %d  %d  %d\n", widx, diffs[0], diffs[1], diffs[2],
                            diffs[3], diffs[4]);
@@ -506,12 +602,9 @@ int msr_encode_steim2(int32_t *input, int samplecount, int32_t *output, int outp
 
                 /* 2-bit nibble is 0b11 (0x3) */
                 frameptr[0] |= 0x3 << (30 - 2 * widx);
-
-                packedsamples = 5;
             }
             /* 4 x 8-bit differences */
-            else if (diffcount >= 4 && bitwidth[0] <= 8 && bitwidth[1] <= 8 && bitwidth[2] <= 8 &&
-                     bitwidth[3] <= 8) {
+            else if (packedsamples == 4) {
                 if (encodedebug)
                     ms_log(1, "  W%02d: 01=4x8b  %d  %d  %d  %d\n", widx, diffs[0], diffs[1], diffs[2],
                            diffs[3]);
@@ -525,11 +618,9 @@ int msr_encode_steim2(int32_t *input, int samplecount, int32_t *output, int outp
 
                 /* 2-bit nibble is 0b01, only need to set 2nd bit */
                 frameptr[0] |= 0x1 << (30 - 2 * widx);
-
-                packedsamples = 4;
             }
             /* 3 x 10-bit differences */
-            else if (diffcount >= 3 && bitwidth[0] <= 10 && bitwidth[1] <= 10 && bitwidth[2] <= 10) {
+            else if (packedsamples == 3) {
                 if (encodedebug)
                     ms_log(1, "  W%02d: 10,11=3x10b  %d  %d  %d\n", widx, diffs[0], diffs[1], diffs[2]);
 
@@ -543,11 +634,9 @@ int msr_encode_steim2(int32_t *input, int samplecount, int32_t *output, int outp
 
                 /* 2-bit nibble is 0b10 (0x2) */
                 frameptr[0] |= 0x2 << (30 - 2 * widx);
-
-                packedsamples = 3;
             }
             /* 2 x 15-bit differences */
-            else if (diffcount >= 2 && bitwidth[0] <= 15 && bitwidth[1] <= 15) {
+            else if (packedsamples == 2) {
                 if (encodedebug) ms_log(1, "  W%02d: 10,10=2x15b  %d  %d\n", widx, diffs[0], diffs[1]);
 
                 /* Mask the values, shift to proper location and set in word */
@@ -559,11 +648,9 @@ int msr_encode_steim2(int32_t *input, int samplecount, int32_t *output, int outp
 
                 /* 2-bit nibble is 0b10 (0x2) */
                 frameptr[0] |= 0x2 << (30 - 2 * widx);
-
-                packedsamples = 2;
             }
             /* 1 x 30-bit difference */
-            else if (diffcount >= 1 && bitwidth[0] <= 30) {
+            else if (packedsamples == 1) {
                 if (encodedebug) ms_log(1, "  W%02d: 10,01=1x30b  %d\n", widx, diffs[0]);
 
                 /* Mask the value and set in word */
@@ -574,8 +661,6 @@ int msr_encode_steim2(int32_t *input, int samplecount, int32_t *output, int outp
 
                 /* 2-bit nibble is 0b10 (0x2) */
                 frameptr[0] |= 0x2 << (30 - 2 * widx);
-
-                packedsamples = 1;
             } else {
                 ms_log(2, "msr_encode_steim2(%s): Unable to represent difference in <= 30 bits\n", srcname);
                 return -1;
@@ -584,7 +669,6 @@ int msr_encode_steim2(int32_t *input, int samplecount, int32_t *output, int outp
             /* Swap encoded word except for 4x8-bit samples */
             if (swapflag && packedsamples != 4) ms_gswap4a(&frameptr[widx]);
 
-            diffcount -= packedsamples;
             outputsamples += packedsamples;
         } /* Done with words in frame */
 
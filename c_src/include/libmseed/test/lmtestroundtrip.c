@@ -0,0 +1,75 @@
+/***************************************************************************
+ * lmtestroundtrip.c
+ *
+ * A program for libmseed Steim round trip tests.  The records of a file
+ * are decoded and their samples encoded again with the encoding and byte
+ * order of the record, the data frames produced must be identical to
+ * those read.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libmseed.h"
+#include "packdata.h"
+
+static void print_stderr(const char *message);
+
+int main(int argc, char **argv) {
+    MSRecord *msr = 0;
+    int32_t *samples;
+    int32_t *frames;
+    int32_t diff0;
+    int datalength;
+    int swapflag;
+    int nsamples;
+    int identical;
+    int failed = 0;
+    int retcode;
+
+    ms_loginit(print_stderr, NULL, print_stderr, NULL);
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: lmtestroundtrip file\n");
+        return 1;
+    }
+
+    while ((retcode = ms_readmsr(&msr, argv[1], -1, NULL, NULL, 1, 1, 0)) == MS_NOERROR) {
+        if (msr->encoding != DE_STEIM1 && msr->encoding != DE_STEIM2) continue;
+
+        datalength = msr->reclen - msr->fsdh->data_offset;
+        swapflag = (msr->byteorder != ms_bigendianhost());
+
+        if (!(frames = (int32_t *)malloc(datalength))) {
+            fprintf(stderr, "Cannot allocate buffer\n");
+            return 1;
+        }
+
+        /* The test records are encoded without compression history */
+        diff0 = 0;
+
+        samples = (int32_t *)msr->datasamples;
+
+        if (msr->encoding == DE_STEIM1)
+            nsamples = msr_encode_steim1(samples, msr->numsamples, frames, datalength, diff0, swapflag);
+        else
+            nsamples = msr_encode_steim2(samples, msr->numsamples, frames, datalength, diff0, "", swapflag);
+
+        identical = (nsamples == msr->numsamples &&
+                     !memcmp(frames, msr->record + msr->fsdh->data_offset, datalength));
+        if (!identical) failed = 1;
+
+        printf("%lld samples, Steim%d, %s: %s\n", (long long)msr->numsamples,
+               (msr->encoding == DE_STEIM1) ? 1 : 2, (msr->byteorder) ? "big endian" : "little endian",
+               (identical) ? "frames identical" : "frames differ");
+
+        free(frames);
+    }
+
+    ms_readmsr(&msr, NULL, 0, NULL, NULL, 0, 0, 0);
+
+    return failed;
+}
+
+static void print_stderr(const char *message) { fprintf(stderr, "%s", message); }
@@ -13,6 +13,11 @@
 #include "libmseed.h"
 #include "unpackdata.h"
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#define STEIM_SIMD
+#include <immintrin.h>
+#endif
+
 /* Control for printing debugging information */
 int decodedebug = 0;
 
@@ -140,6 +145,150 @@ int msr_decode_float64(double *input, int samplecount, double *output, int outpu
     return idx;
 } /* End of msr_decode_float64() */
 
+/* Room for the differences of one frame, 15 words of at most 7, plus
+   the lanes the vector decoders store past the last difference. */
+#define STEIM_FRAME_DIFFS 120
+
+/************************************************************************
+ * steim_integrate:
+ *
+ * Integrate count differences onto the previous sample and place the
+ * samples in the supplied buffer.
+ ************************************************************************/
+#ifdef STEIM_SIMD
+static void steim_integrate(const int32_t *diff, int count, int32_t *output, int32_t prev) {
+    __m128i carry = _mm_set1_epi32(prev);
+    __m128i x;
+    int idx;
+
+    /* Prefix sum of four differences at a time, in two shift-and-add steps */
+    for (idx = 0; idx + 4 <= count; idx += 4) {
+        x = _mm_loadu_si128((const __m128i *)(diff + idx));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi32(x, carry);
+        _mm_storeu_si128((__m128i *)(output + idx), x);
+        carry = _mm_shuffle_epi32(x, 0xFF);
+    }
+
+    prev = _mm_cvtsi128_si32(carry);
+    for (; idx < count; idx++) output[idx] = prev = (int32_t)((uint32_t)prev + (uint32_t)diff[idx]);
+}
+#else
+static void steim_integrate(const int32_t *diff, int count, int32_t *output, int32_t prev) {
+    int idx;
+
+    for (idx = 0; idx < count; idx++) output[idx] = prev = (int32_t)((uint32_t)prev + (uint32_t)diff[idx]);
+}
+#endif
+
+/************************************************************************
+ * steim1_frame_diffs:
+ *
+ * Decode the differences of the words of a Steim1 frame, starting at
+ * word startnibble, until at least maxdiffs are decoded.  The nibble
+ * word, frame[0], must already be in host byte order.
+ *
+ * Return number of differences decoded.
+ ************************************************************************/
+static int steim1_frame_diffs(uint32_t *frame, int startnibble, int maxdiffs, int32_t *diff, int swapflag) {
+    int count = 0;
+    int nibble;
+    int widx;
+    int idx;
+
+    union dword {
+        int8_t d8[4];
+        int16_t d16[2];
+        int32_t d32;
+    } *word;
+
+    for (widx = startnibble; widx < 16 && count < maxdiffs; widx++) {
+        /* W0: the first 32-bit contains 16 x 2-bit nibbles for each word */
+        nibble = EXTRACTBITRANGE(frame[0], (30 - (2 * widx)), 2);
+
+        word = (union dword *)&frame[widx];
+
+        switch (nibble) {
+            case 0: /* 00: Special flag, no differences */
+                if (decodedebug) ms_log(1, "  W%02d: 00=special\n", widx);
+                break;
+
+            case 1: /* 01: Four 1-byte differences */
+                for (idx = 0; idx < 4; idx++) diff[count++] = word->d8[idx];
+
+                if (decodedebug)
+                    ms_log(1, "  W%02d: 01=4x8b  %d  %d  %d  %d\n", widx, word->d8[0], word->d8[1],
+                           word->d8[2], word->d8[3]);
+                break;
+
+            case 2: /* 10: Two 2-byte differences */
+                if (swapflag) {
+                    ms_gswap2a(&word->d16[0]);
+                    ms_gswap2a(&word->d16[1]);
+                }
+
+                for (idx = 0; idx < 2; idx++) diff[count++] = word->d16[idx];
+
+                if (decodedebug) ms_log(1, "  W%02d: 10=2x16b  %d  %d\n", widx, word->d16[0], word->d16[1]);
+                break;
+
+            case 3: /* 11: One 4-byte difference */
+                if (swapflag) ms_gswap4a(&word->d32);
+
+                diff[count++] = word->d32;
+
+                if (decodedebug) ms_log(1, "  W%02d: 11=1x32b  %d\n", widx, word->d32);
+                break;
+        } /* Done with decoding 32-bit word based on nibble */
+    } /* Done looping over nibbles and 32-bit words */
+
+    return count;
+} /* End of steim1_frame_diffs() */
+
+#ifdef STEIM_SIMD
+/************************************************************************
+ * steim1_frame_diffs_ssse3:
+ *
+ * As steim1_frame_diffs, but expand each word into four 32-bit lanes
+ * with a byte shuffle selected by its nibble and the swap flag, then
+ * sign extend the lanes with an arithmetic shift.
+ ************************************************************************/
+__attribute__((target("ssse3"))) static int steim1_frame_diffs_ssse3(uint32_t *frame, int startnibble,
+                                                                      int maxdiffs, int32_t *diff,
+                                                                      int swapflag) {
+    /* Bytes of the word moved to the top of each lane, -1 clears a byte */
+    static const int8_t shuffles[2][4][16] __attribute__((aligned(16))) = {
+        {{-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+         {-1, -1, -1, 0, -1, -1, -1, 1, -1, -1, -1, 2, -1, -1, -1, 3},
+         {-1, -1, 0, 1, -1, -1, 2, 3, -1, -1, -1, -1, -1, -1, -1, -1},
+         {0, 1, 2, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1}},
+        {{-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+         {-1, -1, -1, 0, -1, -1, -1, 1, -1, -1, -1, 2, -1, -1, -1, 3},
+         {-1, -1, 1, 0, -1, -1, 3, 2, -1, -1, -1, -1, -1, -1, -1, -1},
+         {3, 2, 1, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1}}};
+    static const int shifts[4] = {0, 24, 16, 0};
+    static const int counts[4] = {0, 4, 2, 1};
+    const int8_t(*shuffle)[16] = shuffles[swapflag != 0];
+    int count = 0;
+    int nibble;
+    int widx;
+    __m128i lanes;
+
+    for (widx = startnibble; widx < 16 && count < maxdiffs; widx++) {
+        nibble = (frame[0] >> (30 - (2 * widx))) & 3;
+
+        lanes = _mm_shuffle_epi8(_mm_cvtsi32_si128((int)frame[widx]),
+                                 _mm_load_si128((const __m128i *)shuffle[nibble]));
+        lanes = _mm_sra_epi32(lanes, _mm_cvtsi32_si128(shifts[nibble]));
+        _mm_storeu_si128((__m128i *)(diff + count), lanes);
+        count += counts[nibble];
+    }
+
+    return count;
+} /* End of steim1_frame_diffs_ssse3() */
+#endif
+
 /************************************************************************
  * msr_decode_steim1:
  *
@@ -152,21 +301,14 @@ int msr_decode_steim1(int32_t *input, int inputlength, int samplecount, int32_t
                       char *srcname, int swapflag) {
     int32_t *outputptr = output; /* Pointer to next output sample location */
     uint32_t frame[16];          /* Frame, 16 x 32-bit quantities = 64 bytes */
-    int32_t X0 = 0;              /* Forward integration constant, aka first sample */
-    int32_t Xn = 0;              /* Reverse integration constant, aka last sample */
+    int32_t diff[STEIM_FRAME_DIFFS];
+    int32_t X0 = 0; /* Forward integration constant, aka first sample */
+    int32_t Xn = 0; /* Reverse integration constant, aka last sample */
     int maxframes = inputlength / 64;
     int frameidx;
     int startnibble;
-    int nibble;
-    int widx;
     int diffcount;
-    int idx;
-
-    union dword {
-        int8_t d8[4];
-        int16_t d16[2];
-        int32_t d32;
-    } *word;
+    int (*frame_diffs)(uint32_t *, int, int, int32_t *, int) = steim1_frame_diffs;
 
     if (inputlength <= 0) return 0;
 
@@ -176,6 +318,11 @@ int msr_decode_steim1(int32_t *input, int inputlength, int samplecount, int32_t
         ms_log(1, "Decoding %d Steim1 frames, swapflag: %d, srcname: %s\n", maxframes, swapflag,
                (srcname) ? srcname : "");
 
+#ifdef STEIM_SIMD
+    /* The scalar decoder is kept for debugging, it logs every word */
+    if (!decodedebug && __builtin_cpu_supports("ssse3")) frame_diffs = steim1_frame_diffs_ssse3;
+#endif
+
     for (frameidx = 0; frameidx < maxframes && samplecount > 0; frameidx++) {
         /* Copy frame, each is 16x32-bit quantities = 64 bytes */
         memcpy(frame, input + (16 * frameidx), 64);
@@ -203,63 +350,18 @@ int msr_decode_steim1(int32_t *input, int inputlength, int samplecount, int32_t
         /* Swap 32-bit word containing the nibbles */
         if (swapflag) ms_gswap4a(&frame[0]);
 
-        /* Decode each 32-bit word according to nibble */
-        for (widx = startnibble; widx < 16 && samplecount > 0; widx++) {
-            /* W0: the first 32-bit contains 16 x 2-bit nibbles for each word */
-            nibble = EXTRACTBITRANGE(frame[0], (30 - (2 * widx)), 2);
-
-            word = (union dword *)&frame[widx];
-            diffcount = 0;
-
-            switch (nibble) {
-                case 0: /* 00: Special flag, no differences */
-                    if (decodedebug) ms_log(1, "  W%02d: 00=special\n", widx);
-                    break;
-
-                case 1: /* 01: Four 1-byte differences */
-                    diffcount = 4;
-
-                    if (decodedebug)
-                        ms_log(1, "  W%02d: 01=4x8b  %d  %d  %d  %d\n", widx, word->d8[0], word->d8[1],
-                               word->d8[2], word->d8[3]);
-                    break;
-
-                case 2: /* 10: Two 2-byte differences */
-                    diffcount = 2;
-
-                    if (swapflag) {
-                        ms_gswap2a(&word->d16[0]);
-                        ms_gswap2a(&word->d16[1]);
-                    }
-
-                    if (decodedebug)
-                        ms_log(1, "  W%02d: 10=2x16b  %d  %d\n", widx, word->d16[0], word->d16[1]);
-                    break;
-
-                case 3: /* 11: One 4-byte difference */
-                    diffcount = 1;
-                    if (swapflag) ms_gswap4a(&word->d32);
-
-                    if (decodedebug) ms_log(1, "  W%02d: 11=1x32b  %d\n", widx, word->d32);
-                    break;
-            } /* Done with decoding 32-bit word based on nibble */
-
-            /* Apply accumulated differences to calculate output samples */
-            if (diffcount > 0) {
-                for (idx = 0; idx < diffcount && samplecount > 0; idx++, outputptr++) {
-                    if (outputptr == output) /* Ignore first difference, instead store X0 */
-                        *outputptr = X0;
-                    else if (diffcount == 4) /* Otherwise store difference from previous sample */
-                        *outputptr = *(outputptr - 1) + word->d8[idx];
-                    else if (diffcount == 2)
-                        *outputptr = *(outputptr - 1) + word->d16[idx];
-                    else if (diffcount == 1)
-                        *outputptr = *(outputptr - 1) + word->d32;
-
-                    samplecount--;
-                }
-            }
-        } /* Done looping over nibbles and 32-bit words */
+        diffcount = frame_diffs(frame, startnibble, samplecount, diff, swapflag);
+        if (diffcount > samplecount) diffcount = samplecount;
+
+        /* Apply accumulated differences to calculate output samples */
+        if (diffcount > 0) {
+            if (outputptr == output) /* Ignore first difference, instead store X0 */
+                diff[0] = X0;
+
+            steim_integrate(diff, diffcount, outputptr, (outputptr == output) ? 0 : *(outputptr - 1));
+            outputptr += diffcount;
+            samplecount -= diffcount;
+        }
     } /* Done looping over frames */
 
     /* Check data integrity by comparing last sample to Xn (reverse integration constant) */
@@ -271,6 +373,219 @@ int msr_decode_steim1(int32_t *input, int inputlength, int samplecount, int32_t
     return (outputptr - output);
 } /* End of msr_decode_steim1() */
 
+/************************************************************************
+ * steim2_frame_diffs:
+ *
+ * Decode the differences of the words of a Steim2 frame, starting at
+ * word startnibble, until at least maxdiffs are decoded.  The nibble
+ * word, frame[0], must already be in host byte order.
+ *
+ * Return number of differences decoded, -1 on error.
+ ************************************************************************/
+static int steim2_frame_diffs(uint32_t *frame, int startnibble, int maxdiffs, int32_t *diffs, int swapflag,
+                              char *srcname) {
+    int32_t *diff;
+    int32_t semask;
+    int count = 0;
+    int nibble;
+    int widx;
+    int diffcount;
+    int dnib;
+    int idx;
+
+    union dword {
+        int8_t d8[4];
+        int32_t d32;
+    } *word;
+
+    for (widx = startnibble; widx < 16 && count < maxdiffs; widx++) {
+        /* W0: the first 32-bit quantity contains 16 x 2-bit nibbles */
+        nibble = EXTRACTBITRANGE(frame[0], (30 - (2 * widx)), 2);
+        diff = diffs + count;
+        diffcount = 0;
+
+        switch (nibble) {
+            case 0: /* nibble=00: Special flag, no differences */
+                if (decodedebug) ms_log(1, "  W%02d: 00=special\n", widx);
+
+                break;
+            case 1: /* nibble=01: Four 1-byte differences */
+                diffcount = 4;
+
+                word = (union dword *)&frame[widx];
+                for (idx = 0; idx < diffcount; idx++) {
+                    diff[idx] = word->d8[idx];
+                }
+
+                if (decodedebug)
+                    ms_log(1, "  W%02d: 01=4x8b  %d  %d  %d  %d\n", widx, diff[0], diff[1], diff[2], diff[3]);
+                break;
+
+            case 2: /* nibble=10: Must consult dnib, the high order two bits */
+                if (swapflag) ms_gswap4a(&frame[widx]);
+                dnib = EXTRACTBITRANGE(frame[widx], 30, 2);
+
+                switch (dnib) {
+                    case 0: /* nibble=10, dnib=00: Error, undefined value */
+                        ms_log(2, "%s: Impossible Steim2 dnib=00 for nibble=10\n", srcname);
+
+                        return -1;
+                        break;
+
+                    case 1: /* nibble=10, dnib=01: One 30-bit difference */
+                        diffcount = 1;
+                        semask = 1U << (30 - 1); /* Sign extension from bit 30 */
+                        diff[0] = EXTRACTBITRANGE(frame[widx], 0, 30);
+                        diff[0] = (diff[0] ^ semask) - semask;
+
+                        if (decodedebug) ms_log(1, "  W%02d: 10,01=1x30b  %d\n", widx, diff[0]);
+                        break;
+
+                    case 2: /* nibble=10, dnib=10: Two 15-bit differences */
+                        diffcount = 2;
+                        semask = 1U << (15 - 1); /* Sign extension from bit 15 */
+                        for (idx = 0; idx < diffcount; idx++) {
+                            diff[idx] = EXTRACTBITRANGE(frame[widx], (15 - idx * 15), 15);
+                            diff[idx] = (diff[idx] ^ semask) - semask;
+                        }
+
+                        if (decodedebug) ms_log(1, "  W%02d: 10,10=2x15b  %d  %d\n", widx, diff[0], diff[1]);
+                        break;
+
+                    case 3: /* nibble=10, dnib=11: Three 10-bit differences */
+                        diffcount = 3;
+                        semask = 1U << (10 - 1); /* Sign extension from bit 10 */
+                        for (idx = 0; idx < diffcount; idx++) {
+                            diff[idx] = EXTRACTBITRANGE(frame[widx], (20 - idx * 10), 10);
+                            diff[idx] = (diff[idx] ^ semask) - semask;
+                        }
+
+                        if (decodedebug)
+                            ms_log(1, "  W%02d: 10,11=3x10b  %d  %d  %d\n", widx, diff[0], diff[1], diff[2]);
+                        break;
+                }
+
+                break;
+
+            case 3: /* nibble=11: Must consult dnib, the high order two bits */
+                if (swapflag) ms_gswap4a(&frame[widx]);
+                dnib = EXTRACTBITRANGE(frame[widx], 30, 2);
+
+                switch (dnib) {
+                    case 0: /* nibble=11, dnib=00: Five 6-bit differences */
+                        diffcount = 5;
+                        semask = 1U << (6 - 1); /* Sign extension from bit 6 */
+                        for (idx = 0; idx < diffcount; idx++) {
+                            diff[idx] = EXTRACTBITRANGE(frame[widx], (24 - idx * 6), 6);
+                            diff[idx] = (diff[idx] ^ semask) - semask;
+                        }
+
+                        if (decodedebug)
+                            ms_log(1, "  W%02d: 11,00=5x6b  %d  %d  %d  %d  %d\n", widx, diff[0], diff[1],
+                                   diff[2], diff[3], diff[4]);
+                        break;
+
+                    case 1: /* nibble=11, dnib=01: Six 5-bit differences */
+                        diffcount = 6;
+                        semask = 1U << (5 - 1); /* Sign extension from bit 5 */
+                        for (idx = 0; idx < diffcount; idx++) {
+                            diff[idx] = EXTRACTBITRANGE(frame[widx], (25 - idx * 5), 5);
+                            diff[idx] = (diff[idx] ^ semask) - semask;
+                        }
+
+                        if (decodedebug)
+                            ms_log(1, "  W%02d: 11,01=6x5b  %d  %d  %d  %d  %d  %d\n", widx, diff[0], diff[1],
+                                   diff[2], diff[3], diff[4], diff[5]);
+                        break;
+
+                    case 2: /* nibble=11, dnib=10: Seven 4-bit differences */
+                        diffcount = 7;
+                        semask = 1U << (4 - 1); /* Sign extension from bit 4 */
+                        for (idx = 0; idx < diffcount; idx++) {
+                            diff[idx] = EXTRACTBITRANGE(frame[widx], (24 - idx * 4), 4);
+                            diff[idx] = (diff[idx] ^ semask) - semask;
+                        }
+
+                        if (decodedebug)
+                            ms_log(1, "  W%02d: 11,10=7x4b  %d  %d  %d  %d  %d  %d  %d\n", widx, diff[0],
+                                   diff[1], diff[2], diff[3], diff[4], diff[5], diff[6]);
+                        break;
+
+                    case 3: /* nibble=11, dnib=11: Error, undefined value */
+                        ms_log(2, "%s: Impossible Steim2 dnib=11 for nibble=11\n", srcname);
+
+                        return -1;
+                        break;
+                }
+
+                break;
+        } /* Done with decoding 32-bit word based on nibble */
+
+        count += diffcount;
+    } /* Done looping over nibbles and 32-bit words */
+
+    return count;
+} /* End of steim2_frame_diffs() */
+
+#ifdef STEIM_SIMD
+/************************************************************************
+ * steim2_frame_diffs_avx2:
+ *
+ * As steim2_frame_diffs, but look up the count and width of the
+ * differences of each word by its nibble and dnib, then extract all of
+ * them at once with per-lane variable shifts.  The Steim2 fields are
+ * not byte aligned, so a byte shuffle cannot expand them.
+ ************************************************************************/
+__attribute__((target("avx2"))) static int steim2_frame_diffs_avx2(uint32_t *frame, int startnibble,
+                                                                    int maxdiffs, int32_t *diff,
+                                                                    int swapflag, char *srcname) {
+    /* Count and width of the differences by nibble and dnib, a count of -1
+       marks an undefined dnib.  For nibble=01 the top bits are data. */
+    static const struct {
+        int8_t count;
+        int8_t bits;
+    } layouts[16] = {{0, 0},  {0, 0},  {0, 0},  {0, 0},  {4, 8}, {4, 8}, {4, 8}, {4, 8},
+                     {-1, 0}, {1, 30}, {2, 15}, {3, 10}, {5, 6}, {6, 5}, {7, 4}, {-1, 0}};
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    int count = 0;
+    int nibble;
+    int widx;
+    int layout;
+    int bits;
+    uint32_t value;
+    __m256i shift;
+    __m256i lanes;
+
+    for (widx = startnibble; widx < 16 && count < maxdiffs; widx++) {
+        nibble = (frame[0] >> (30 - (2 * widx))) & 3;
+
+        /* Four 1-byte differences are in byte order, the others in word order */
+        value = frame[widx];
+        if (swapflag || nibble == 1) value = __builtin_bswap32(value);
+
+        layout = (nibble << 2) | (value >> 30);
+        if (layouts[layout].count < 0) {
+            ms_log(2, "%s: Impossible Steim2 dnib=%s for nibble=%s\n", srcname, (nibble == 2) ? "00" : "11",
+                   (nibble == 2) ? "10" : "11");
+
+            return -1;
+        }
+
+        /* Difference idx of count is at bits*(count-idx-1) from the bottom,
+           shift it to the top, then arithmetic shift it back down. */
+        bits = layouts[layout].bits;
+        shift = _mm256_add_epi32(_mm256_set1_epi32(32 - bits * layouts[layout].count),
+                                 _mm256_mullo_epi32(lane, _mm256_set1_epi32(bits)));
+        lanes = _mm256_sllv_epi32(_mm256_set1_epi32((int)value), shift);
+        lanes = _mm256_sra_epi32(lanes, _mm_cvtsi32_si128(32 - bits));
+        _mm256_storeu_si256((__m256i *)(diff + count), lanes);
+        count += layouts[layout].count;
+    }
+
+    return count;
+} /* End of steim2_frame_diffs_avx2() */
+#endif
+
 /************************************************************************
  * msr_decode_steim2:
  *
@@ -283,23 +598,14 @@ int msr_decode_steim2(int32_t *input, int inputlength, int samplecount, int32_t
                       char *srcname, int swapflag) {
     int32_t *outputptr = output; /* Pointer to next output sample location */
     uint32_t frame[16];          /* Frame, 16 x 32-bit quantities = 64 bytes */
-    int32_t X0 = 0;              /* Forward integration constant, aka first sample */
-    int32_t Xn = 0;              /* Reverse integration constant, aka last sample */
-    int32_t diff[7];
-    int32_t semask;
+    int32_t diff[STEIM_FRAME_DIFFS];
+    int32_t X0 = 0; /* Forward integration constant, aka first sample */
+    int32_t Xn = 0; /* Reverse integration constant, aka last sample */
     int maxframes = inputlength / 64;
     int frameidx;
     int startnibble;
-    int nibble;
-    int widx;
     int diffcount;
-    int dnib;
-    int idx;
-
-    union dword {
-        int8_t d8[4];
-        int32_t d32;
-    } *word;
+    int (*frame_diffs)(uint32_t *, int, int, int32_t *, int, char *) = steim2_frame_diffs;
 
     if (inputlength <= 0) return 0;
 
@@ -309,6 +615,11 @@ int msr_decode_steim2(int32_t *input, int inputlength, int samplecount, int32_t
         ms_log(1, "Decoding %d Steim2 frames, swapflag: %d, srcname: %s\n", maxframes, swapflag,
                (srcname) ? srcname : "");
 
+#ifdef STEIM_SIMD
+    /* The scalar decoder is kept for debugging, it logs every word */
+    if (!decodedebug && __builtin_cpu_supports("avx2")) frame_diffs = steim2_frame_diffs_avx2;
+#endif
+
     for (frameidx = 0; frameidx < maxframes && samplecount > 0; frameidx++) {
         /* Copy frame, each is 16x32-bit quantities = 64 bytes */
         memcpy(frame, input + (16 * frameidx), 64);
@@ -336,144 +647,19 @@ int msr_decode_steim2(int32_t *input, int inputlength, int samplecount, int32_t
         /* Swap 32-bit word containing the nibbles */
         if (swapflag) ms_gswap4a(&frame[0]);
 
-        /* Decode each 32-bit word according to nibble */
-        for (widx = startnibble; widx < 16 && samplecount > 0; widx++) {
-            /* W0: the first 32-bit quantity contains 16 x 2-bit nibbles */
-            nibble = EXTRACTBITRANGE(frame[0], (30 - (2 * widx)), 2);
-            diffcount = 0;
-
-            switch (nibble) {
-                case 0: /* nibble=00: Special flag, no differences */
-                    if (decodedebug) ms_log(1, "  W%02d: 00=special\n", widx);
-
-                    break;
-                case 1: /* nibble=01: Four 1-byte differences */
-                    diffcount = 4;
-
-                    word = (union dword *)&frame[widx];
-                    for (idx = 0; idx < diffcount; idx++) {
-                        diff[idx] = word->d8[idx];
-                    }
-
-                    if (decodedebug)
-                        ms_log(1, "  W%02d: 01=4x8b  %d  %d  %d  %d\n", widx, diff[0], diff[1], diff[2],
-                               diff[3]);
-                    break;
-
-                case 2: /* nibble=10: Must consult dnib, the high order two bits */
-                    if (swapflag) ms_gswap4a(&frame[widx]);
-                    dnib = EXTRACTBITRANGE(frame[widx], 30, 2);
-
-                    switch (dnib) {
-                        case 0: /* nibble=10, dnib=00: Error, undefined value */
-                            ms_log(2, "%s: Impossible Steim2 dnib=00 for nibble=10\n", srcname);
-
-                            return -1;
-                            break;
-
-                        case 1: /* nibble=10, dnib=01: One 30-bit difference */
-                            diffcount = 1;
-                            semask = 1U << (30 - 1); /* Sign extension from bit 30 */
-                            diff[0] = EXTRACTBITRANGE(frame[widx], 0, 30);
-                            diff[0] = (diff[0] ^ semask) - semask;
-
-                            if (decodedebug) ms_log(1, "  W%02d: 10,01=1x30b  %d\n", widx, diff[0]);
-                            break;
-
-                        case 2: /* nibble=10, dnib=10: Two 15-bit differences */
-                            diffcount = 2;
-                            semask = 1U << (15 - 1); /* Sign extension from bit 15 */
-                            for (idx = 0; idx < diffcount; idx++) {
-                                diff[idx] = EXTRACTBITRANGE(frame[widx], (15 - idx * 15), 15);
-                                diff[idx] = (diff[idx] ^ semask) - semask;
-                            }
-
-                            if (decodedebug)
-                                ms_log(1, "  W%02d: 10,10=2x15b  %d  %d\n", widx, diff[0], diff[1]);
-                            break;
-
-                        case 3: /* nibble=10, dnib=11: Three 10-bit differences */
-                            diffcount = 3;
-                            semask = 1U << (10 - 1); /* Sign extension from bit 10 */
-                            for (idx = 0; idx < diffcount; idx++) {
-                                diff[idx] = EXTRACTBITRANGE(frame[widx], (20 - idx * 10), 10);
-                                diff[idx] = (diff[idx] ^ semask) - semask;
-                            }
-
-                            if (decodedebug)
-                                ms_log(1, "  W%02d: 10,11=3x10b  %d  %d  %d\n", widx, diff[0], diff[1],
-                                       diff[2]);
-                            break;
-                    }
-
-                    break;
-
-                case 3: /* nibble=11: Must consult dnib, the high order two bits */
-                    if (swapflag) ms_gswap4a(&frame[widx]);
-                    dnib = EXTRACTBITRANGE(frame[widx], 30, 2);
-
-                    switch (dnib) {
-                        case 0: /* nibble=11, dnib=00: Five 6-bit differences */
-                            diffcount = 5;
-                            semask = 1U << (6 - 1); /* Sign extension from bit 6 */
-                            for (idx = 0; idx < diffcount; idx++) {
-                                diff[idx] = EXTRACTBITRANGE(frame[widx], (24 - idx * 6), 6);
-                                diff[idx] = (diff[idx] ^ semask) - semask;
-                            }
-
-                            if (decodedebug)
-                                ms_log(1, "  W%02d: 11,00=5x6b  %d  %d  %d  %d  %d\n", widx, diff[0], diff[1],
-                                       diff[2], diff[3], diff[4]);
-                            break;
-
-                        case 1: /* nibble=11, dnib=01: Six 5-bit differences */
-                            diffcount = 6;
-                            semask = 1U << (5 - 1); /* Sign extension from bit 5 */
-                            for (idx = 0; idx < diffcount; idx++) {
-                                diff[idx] = EXTRACTBITRANGE(frame[widx], (25 - idx * 5), 5);
-                                diff[idx] = (diff[idx] ^ semask) - semask;
-                            }
-
-                            if (decodedebug)
-                                ms_log(1, "  W%02d: 11,01=6x5b  %d  %d  %d  %d  %d  %d\n", widx, diff[0],
-                                       diff[1], diff[2], diff[3], diff[4], diff[5]);
-                            break;
-
-                        case 2: /* nibble=11, dnib=10: Seven 4-bit differences */
-                            diffcount = 7;
-                            semask = 1U << (4 - 1); /* Sign extension from bit 4 */
-                            for (idx = 0; idx < diffcount; idx++) {
-                                diff[idx] = EXTRACTBITRANGE(frame[widx], (24 - idx * 4), 4);
-                                diff[idx] = (diff[idx] ^ semask) - semask;
-                            }
-
-                            if (decodedebug)
-                                ms_log(1, "  W%02d: 11,10=7x4b  %d  %d  %d  %d  %d  %d  %d\n", widx, diff[0],
-                                       diff[1], diff[2], diff[3], diff[4], diff[5], diff[6]);
-                            break;
-
-                        case 3: /* nibble=11, dnib=11: Error, undefined value */
-                            ms_log(2, "%s: Impossible Steim2 dnib=11 for nibble=11\n", srcname);
-
-                            return -1;
-                            break;
-                    }
-
-                    break;
-            } /* Done with decoding 32-bit word based on nibble */
-
-            /* Apply differences to calculate output samples */
-            if (diffcount > 0) {
-                for (idx = 0; idx < diffcount && samplecount > 0; idx++, outputptr++) {
-                    if (outputptr == output) /* Ignore first difference, instead store X0 */
-                        *outputptr = X0;
-                    else /* Otherwise store difference from previous sample */
-                        *outputptr = *(outputptr - 1) + diff[idx];
-
-                    samplecount--;
-                }
-            }
-        } /* Done looping over nibbles and 32-bit words */
+        diffcount = frame_diffs(frame, startnibble, samplecount, diff, swapflag, srcname);
+        if (diffcount < 0) return -1;
+        if (diffcount > samplecount) diffcount = samplecount;
+
+        /* Apply differences to calculate output samples */
+        if (diffcount > 0) {
+            if (outputptr == output) /* Ignore first difference, instead store X0 */
+                diff[0] = X0;
+
+            steim_integrate(diff, diffcount, outputptr, (outputptr == output) ? 0 : *(outputptr - 1));
+            outputptr += diffcount;
+            samplecount -= diffcount;
+        }
     } /* Done looping over frames */
 
     /* Check data integrity by comparing last sample to Xn (reverse integration constant) */
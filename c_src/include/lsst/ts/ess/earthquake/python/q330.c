@@ -21,33 +21,224 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 #include "libclient.h"
 #include "libmsgs.h"
 #include "libstrucs.h"
 #include "q330.h"
 
-tpar_create creation_info;
-tcontext station_context;
-uint64_t q330id_serial_id;
-string250 q330id_address;
-int q330id_baseport;
-bool debug = false;
+/* Size exponent of archival miniseed records, which bounds the aminiseed ring slots. */
+#define AMINI_EXPONENT 14
+
+/* Number of bytes written to signal the event fd. An eventfd takes a 64 bit counter, a pipe a single byte. */
+#ifdef __linux__
+#define EVENT_SIZE sizeof(uint64_t)
+#else
+#define EVENT_SIZE 1
+#endif
+
+/**
+ * Ring slot for a miniseed or aminiseed record. The strings and the record data are copied into the slot,
+ * since lib330 reuses the buffers as soon as the callback returns.
+ */
+typedef struct {
+    tminiseed rec;
+    string9 station_name;
+    string2 location;
+    string3 channel;
+    byte data[];
+} tminiseed_slot;
+
+/**
+ * Ring slot for a message record.
+ */
+typedef struct {
+    tmsg rec;
+    string95 result;
+    string95 suffix;
+} tmsg_slot;
+
+/**
+ * Variable-length record for one second data: the compact header followed by only the valid samples. The
+ * sample_offset of the header is unused. The latency slot and receive time are kept to add the latency of the
+ * record to the lib330 histograms when it is popped.
+ */
+typedef struct {
+    tonesec_header header;
+    double recv_time;
+    word latency_slot;
+    longint samples[];
+} tonesec_record;
+
+/**
+ * Ring slot for a state record.
+ */
+typedef struct {
+    tstate rec;
+    string9 station_name;
+    string63 state_name;
+} tstate_slot;
+
+#define AMINISEED_SLOT_SIZE (sizeof(tminiseed_slot) + (1 << AMINI_EXPONENT))
+#define MINISEED_SLOT_SIZE (sizeof(tminiseed_slot) + LIB_REC_SIZE)
+
+/**
+ * Everything needed to serve one Q330: the lib330 context, the rings the callbacks queue records in and the
+ * latest record of each stream.
+ */
+struct tq330_handle {
+    tspsc_ring aminiseed_ring;
+    tspsc_ring message_ring;
+    tspsc_ring miniseed_ring;
+    tspsc_ring onesec_ring;
+    tspsc_ring state_ring;
+    tspsc_ring triad_ring;
+    _Alignas(RING_CACHE_LINE) unsigned char aminiseed_storage[AMINISEED_RING_SIZE * AMINISEED_SLOT_SIZE];
+    _Alignas(RING_CACHE_LINE) unsigned char miniseed_storage[MINISEED_RING_SIZE * MINISEED_SLOT_SIZE];
+    _Alignas(RING_CACHE_LINE) unsigned char onesec_storage[ONESEC_RING_BYTES];
+    tmsg_slot message_storage[MESSAGE_RING_SIZE];
+    tstate_slot state_storage[STATE_RING_SIZE];
+    ttriad triad_storage[TRIAD_RING_SIZE];
+    ttriad_assembler triads;
+    /* Each handle has its own arena, so a Q330 that pins many blocks can't starve the others. */
+    tsample_arena arena;
+    _Atomic uint32_t arena_refcounts[ARENA_BLOCKS];
+    longint arena_samples[ARENA_BLOCKS * MAX_RATE];
+
+    tpar_create creation_info;
+    _Atomic(tcontext) station_context; /* NIL until lib_create_context returned and after it was destroyed */
+    _Atomic bool lib_running;          /* libthread did not make its last callback yet */
+    uint64_t q330id_serial_id;
+    string250 q330id_address;
+    int q330id_baseport;
+    bool debug;
+
+    string95 result;
+    string63 state_name;
+    tminiseed aminiseed;
+    tmsg message;
+    tminiseed miniseed;
+    tonesec onesec;
+    tstate state;
+
+    tq330_callback aminiseed_callback;
+    tq330_callback message_callback;
+    tq330_callback miniseed_callback;
+    tq330_callback secdata_callback;
+    tq330_callback state_callback;
+    bool assemble_triads;
+    tq330_callback triad_callback;
+    void *user;
+    bool decode_thread;
+    word window;
+    word ack_count;
+    word ack_timeout;
+
+    int event_fds[2];           /* read and write end of the event fd, the same fd for an eventfd */
+    _Atomic bool event_pending; /* the event fd was signalled and not cleared yet */
+};
 
-string95 result;
-string63 state_name;
-tminiseed aminiseed;
-tmsg message;
-tminiseed miniseed;
-tonesec onesec;
-tstate state;
+/* The open handles, which the lib330 callbacks are checked against. */
+static _Atomic(pq330_handle) handles[Q330_MAX_HANDLES];
+
+/**
+ * Convenience function to look up the handle a lib330 callback is made for.
+ *
+ * The handle is taken from the host_ptr of the context, which is set before lib330 can call back, so
+ * callbacks made before lib_create_context returned are not lost.
+ *
+ * @param context The context of the callback.
+ * @return The handle or NULL if the context does not belong to an open handle.
+ */
+pq330_handle find_handle(tcontext context) {
+    if (context == NIL) {
+        return NULL;
+    }
+    pq330_handle owner = ((pq330)context)->par_create.host_ptr;
+    for (int i = 0; i < Q330_MAX_HANDLES; i++) {
+        pq330_handle handle = atomic_load_explicit(&handles[i], memory_order_acquire);
+        if (handle && handle == owner) {
+            return handle;
+        }
+    }
+    return NULL;
+}
 
-void (*aminiseed_callback_)();
-void (*message_callback_)();
-void (*miniseed_callback_)();
-void (*secdata_callback_)();
-void (*state_callback_)();
+/**
+ * Convenience function to add the time since the data packet of a onesec record was received to the LS_POP
+ * latency histogram of its LCQ, as the record is taken from the ring.
+ *
+ * @param handle The handle of the Q330.
+ * @param record The record being popped.
+ */
+void record_pop_latency(pq330_handle handle, const tonesec_record *record) {
+    if (handle->station_context != NIL) {
+        lib_add_latency(handle->station_context, LS_POP, record->latency_slot, record->recv_time);
+    }
+}
+
+/**
+ * Convenience function to make the event fd of a handle readable after records were queued.
+ *
+ * The fd is only written to when it was not signalled already since the consumer last cleared it, so the
+ * producer makes at most one system call per wakeup of the consumer.
+ *
+ * @param handle The handle of the Q330.
+ */
+void signal_event(pq330_handle handle) {
+    if (handle->event_fds[1] < 0 || atomic_exchange(&handle->event_pending, true)) {
+        return;
+    }
+    uint64_t value = 1;
+    while (write(handle->event_fds[1], &value, EVENT_SIZE) < 0 && errno == EINTR) {
+    }
+}
+
+/**
+ * Queue a miniseed or aminiseed record.
+ *
+ * @param ring The ring to queue the record in.
+ * @param data Pointer to the tminiseed_call struct.
+ * @param max_size The maximum size of the record data that fits in a slot.
+ */
+void push_miniseed(tspsc_ring *ring, tminiseed_call *data, word max_size) {
+    tminiseed_slot *slot;
+    if (data->data_size > max_size) {
+        atomic_fetch_add_explicit(&ring->oversize, 1, memory_order_relaxed);
+        return;
+    }
+    slot = ring_reserve(ring);
+    if (slot == NULL) {
+        return;
+    }
+    memcpy(slot->station_name, data->station_name, sizeof(string9));
+    memcpy(slot->location, data->location, sizeof(string2));
+    memcpy(slot->channel, data->channel, sizeof(string3));
+    memcpy(slot->data, data->data_address, data->data_size);
+    slot->rec.station_name = slot->station_name;
+    slot->rec.location = slot->location;
+    slot->rec.chan_number = data->chan_number;
+    slot->rec.channel = slot->channel;
+    slot->rec.rate = data->rate;
+    slot->rec.cl_session = data->cl_session;
+    slot->rec.cl_offset = data->cl_offset;
+    slot->rec.timestamp = data->timestamp;
+    slot->rec.filter_bits = data->filter_bits;
+    slot->rec.packet_class = data->packet_class;
+    slot->rec.miniseed_action = data->miniseed_action;
+    slot->rec.data_size = data->data_size;
+    slot->rec.data_address = slot->data;
+    ring_commit(ring);
+}
 
 /**
  * Callback for an aminiseed event.
@@ -56,24 +247,30 @@ void (*state_callback_)();
  */
 void my_aminiseed_callback(pointer p) {
     tminiseed_call *data = (tminiseed_call *)p;
-    if (debug) {
+    pq330_handle handle = find_handle(data->context);
+    if (handle == NULL) {
+        return;
+    }
+    if (handle->debug) {
         printf("[Q330] my_aminiseed_callback: %s %s %s\n", data->station_name, data->location, data->channel);
     }
-    aminiseed.station_name = data->station_name;
-    aminiseed.location = data->location;
-    aminiseed.chan_number = data->chan_number;
-    aminiseed.channel = data->channel;
-    aminiseed.rate = data->rate;
-    aminiseed.cl_session = data->cl_session;
-    aminiseed.cl_offset = data->cl_offset;
-    aminiseed.timestamp = data->timestamp;
-    aminiseed.filter_bits = data->filter_bits;
-    aminiseed.packet_class = data->packet_class;
-    aminiseed.miniseed_action = data->miniseed_action;
-    aminiseed.data_size = data->data_size;
-    aminiseed.data_address = data->data_address;
-    if (aminiseed_callback_) {
-        aminiseed_callback_();
+    handle->aminiseed.station_name = data->station_name;
+    handle->aminiseed.location = data->location;
+    handle->aminiseed.chan_number = data->chan_number;
+    handle->aminiseed.channel = data->channel;
+    handle->aminiseed.rate = data->rate;
+    handle->aminiseed.cl_session = data->cl_session;
+    handle->aminiseed.cl_offset = data->cl_offset;
+    handle->aminiseed.timestamp = data->timestamp;
+    handle->aminiseed.filter_bits = data->filter_bits;
+    handle->aminiseed.packet_class = data->packet_class;
+    handle->aminiseed.miniseed_action = data->miniseed_action;
+    handle->aminiseed.data_size = data->data_size;
+    handle->aminiseed.data_address = data->data_address;
+    push_miniseed(&handle->aminiseed_ring, data, 1 << AMINI_EXPONENT);
+    signal_event(handle);
+    if (handle->aminiseed_callback) {
+        handle->aminiseed_callback(handle->user);
     }
 }
 
@@ -84,19 +281,33 @@ void my_aminiseed_callback(pointer p) {
  */
 void my_msg_callback(pointer p) {
     tmsg_call *data = (tmsg_call *)p;
-    lib_get_msg(data->code, &result);
-    if (debug) {
+    pq330_handle handle = find_handle(data->context);
+    if (handle == NULL) {
+        return;
+    }
+    lib_get_msg(data->code, &handle->result);
+    if (handle->debug) {
         printf("[Q330] my_msg_callback: msgcount='%d' code='%d' timestamp='%u' datatime='%d' msg='%s%s'.\n",
-               data->msgcount, data->code, data->timestamp, data->datatime, result, data->suffix);
+               data->msgcount, data->code, data->timestamp, data->datatime, handle->result, data->suffix);
+    }
+    handle->message.msgcount = data->msgcount;
+    handle->message.code = data->code;
+    handle->message.timestamp = data->timestamp;
+    handle->message.datatime = data->datatime;
+    handle->message.result = handle->result;
+    handle->message.suffix = data->suffix;
+    tmsg_slot *slot = ring_reserve(&handle->message_ring);
+    if (slot) {
+        slot->rec = handle->message;
+        strcpy(slot->result, handle->result);
+        strcpy(slot->suffix, data->suffix);
+        slot->rec.result = slot->result;
+        slot->rec.suffix = slot->suffix;
+        ring_commit(&handle->message_ring);
+        signal_event(handle);
     }
-    message.msgcount = data->msgcount;
-    message.code = data->code;
-    message.timestamp = data->timestamp;
-    message.datatime = data->datatime;
-    message.result = result;
-    message.suffix = data->suffix;
-    if (message_callback_) {
-        message_callback_();
+    if (handle->message_callback) {
+        handle->message_callback(handle->user);
     }
 }
 
@@ -107,27 +318,41 @@ void my_msg_callback(pointer p) {
  */
 void my_miniseed_callback(pointer p) {
     tminiseed_call *data = (tminiseed_call *)p;
-    if (debug) {
+    pq330_handle handle = find_handle(data->context);
+    if (handle == NULL) {
+        return;
+    }
+    if (handle->debug) {
         printf("[Q330] my_miniseed_callback: %s %s %s\n", data->station_name, data->location, data->channel);
     }
-    miniseed.station_name = data->station_name;
-    miniseed.location = data->location;
-    miniseed.chan_number = data->chan_number;
-    miniseed.channel = data->channel;
-    miniseed.rate = data->rate;
-    miniseed.cl_session = data->cl_session;
-    miniseed.cl_offset = data->cl_offset;
-    miniseed.timestamp = data->timestamp;
-    miniseed.filter_bits = data->filter_bits;
-    miniseed.packet_class = data->packet_class;
-    miniseed.miniseed_action = data->miniseed_action;
-    miniseed.data_size = data->data_size;
-    miniseed.data_address = data->data_address;
-    if (miniseed_callback_) {
-        miniseed_callback_();
+    handle->miniseed.station_name = data->station_name;
+    handle->miniseed.location = data->location;
+    handle->miniseed.chan_number = data->chan_number;
+    handle->miniseed.channel = data->channel;
+    handle->miniseed.rate = data->rate;
+    handle->miniseed.cl_session = data->cl_session;
+    handle->miniseed.cl_offset = data->cl_offset;
+    handle->miniseed.timestamp = data->timestamp;
+    handle->miniseed.filter_bits = data->filter_bits;
+    handle->miniseed.packet_class = data->packet_class;
+    handle->miniseed.miniseed_action = data->miniseed_action;
+    handle->miniseed.data_size = data->data_size;
+    handle->miniseed.data_address = data->data_address;
+    push_miniseed(&handle->miniseed_ring, data, LIB_REC_SIZE);
+    signal_event(handle);
+    if (handle->miniseed_callback) {
+        handle->miniseed_callback(handle->user);
     }
 }
 
+/**
+ * Convenience function to get the number of valid samples in one second of data.
+ *
+ * @param rate The sampling rate, negative for seconds per sample.
+ * @return The number of samples.
+ */
+int32_t get_num_samples(integer rate) { return rate < 0 ? 1 : rate; }
+
 /**
  * Callback for an secdata event.
  *
@@ -135,37 +360,75 @@ void my_miniseed_callback(pointer p) {
  */
 void my_secdata_callback(pointer p) {
     tonesec_call *data = (tonesec_call *)p;
-    if (debug) {
-        printf("[Q330] my_secdata_callback: %s %s", data->station_name, data->location);
+    pq330_handle handle = find_handle(data->context);
+    if (handle == NULL) {
+        return;
     }
-    onesec.total_size = data->total_size;
-    onesec.station_name = data->station_name;
-    onesec.location = data->location;
-    onesec.chan_number = data->chan_number;
-    onesec.channel = data->channel;
-    onesec.padding = data->padding;
-    onesec.rate = data->rate;
-    onesec.cl_session = data->cl_session;
-    onesec.reserved = data->reserved;
-    onesec.cl_offset = data->cl_offset;
-    onesec.timestamp = data->timestamp;
-    onesec.filter_bits = data->filter_bits;
-    onesec.qual_perc = data->qual_perc;
-    onesec.activity_flags = data->activity_flags;
-    onesec.io_flags = data->io_flags;
-    onesec.data_quality_flags = data->data_quality_flags;
-    onesec.src_channel = data->src_channel;
-    onesec.src_subchan = data->src_subchan;
-    int32_t num_samples = data->rate;
-    if (data->rate < 0) {
-        num_samples = 1;
+    if (handle->debug) {
+        printf("[Q330] my_secdata_callback: %s %s", data->station_name, data->location);
     }
-    for (int i = 0; i < num_samples; i++) {
-        onesec.samples[i] = data->samples[i];
+    int32_t num_samples = get_num_samples(data->rate);
+    if (handle->assemble_triads) {
+        int queued = triad_add(&handle->triads, data->timestamp, data->rate, data->chan_number,
+                               data->station_name, data->location, data->channel, data->samples, num_samples);
+        if (queued > 0) {
+            signal_event(handle);
+            if (handle->triad_callback) {
+                handle->triad_callback(handle->user);
+            }
+        }
+    } else {
+        tonesec_record *record = ring_reserve_record(&handle->onesec_ring,
+                                                     sizeof(tonesec_record) + num_samples * sizeof(longint));
+        if (record) {
+            tonesec_header *header = &record->header;
+            header->timestamp = data->timestamp;
+            header->cl_offset = data->cl_offset;
+            header->sample_offset = 0;
+            header->sample_count = num_samples;
+            header->rate = data->rate;
+            header->cl_session = data->cl_session;
+            header->filter_bits = data->filter_bits;
+            header->qual_perc = data->qual_perc;
+            header->activity_flags = data->activity_flags;
+            header->io_flags = data->io_flags;
+            header->data_quality_flags = data->data_quality_flags;
+            header->chan_number = data->chan_number;
+            header->src_channel = data->src_channel;
+            header->src_subchan = data->src_subchan;
+            memcpy(header->station_name, data->station_name, sizeof(string9));
+            memcpy(header->location, data->location, sizeof(string2));
+            memcpy(header->channel, data->channel, sizeof(string3));
+            record->recv_time = data->recv_time;
+            record->latency_slot = data->latency_slot;
+            memcpy(record->samples, data->samples, num_samples * sizeof(longint));
+            ring_commit_record(&handle->onesec_ring);
+            signal_event(handle);
+        }
     }
 
-    if (secdata_callback_) {
-        secdata_callback_();
+    /* The full-size onesec struct is only needed by clients reading it with get_onesec from the callback. */
+    if (handle->secdata_callback) {
+        handle->onesec.total_size = data->total_size;
+        handle->onesec.station_name = data->station_name;
+        handle->onesec.location = data->location;
+        handle->onesec.chan_number = data->chan_number;
+        handle->onesec.channel = data->channel;
+        handle->onesec.padding = data->padding;
+        handle->onesec.rate = data->rate;
+        handle->onesec.cl_session = data->cl_session;
+        handle->onesec.reserved = data->reserved;
+        handle->onesec.cl_offset = data->cl_offset;
+        handle->onesec.timestamp = data->timestamp;
+        handle->onesec.filter_bits = data->filter_bits;
+        handle->onesec.qual_perc = data->qual_perc;
+        handle->onesec.activity_flags = data->activity_flags;
+        handle->onesec.io_flags = data->io_flags;
+        handle->onesec.data_quality_flags = data->data_quality_flags;
+        handle->onesec.src_channel = data->src_channel;
+        handle->onesec.src_subchan = data->src_subchan;
+        memcpy(handle->onesec.samples, data->samples, num_samples * sizeof(longint));
+        handle->secdata_callback(handle->user);
     }
 }
 
@@ -176,101 +439,613 @@ void my_secdata_callback(pointer p) {
  */
 void my_state_callback(pointer p) {
     tstate_call *data = (tstate_call *)p;
+    pq330_handle handle = find_handle(data->context);
+    if (handle == NULL) {
+        return;
+    }
     enum tlibstate state_info = data->info;
-    lib_get_statestr(state_info, &state_name);
-    if (debug) {
-        printf("[Q330] my_state_callback: '%u' == '%s'\n", data->info, state_name);
+    lib_get_statestr(state_info, &handle->state_name);
+    if (handle->debug) {
+        printf("[Q330] my_state_callback: '%u' == '%s'\n", data->info, handle->state_name);
+    }
+    handle->state.state_type = data->state_type;
+    handle->state.station_name = data->station_name;
+    handle->state.subtype = data->subtype;
+    handle->state.info = data->info;
+    handle->state.state_name = handle->state_name;
+    tstate_slot *slot = ring_reserve(&handle->state_ring);
+    if (slot) {
+        slot->rec = handle->state;
+        memcpy(slot->station_name, data->station_name, sizeof(string9));
+        strcpy(slot->state_name, handle->state_name);
+        slot->rec.station_name = slot->station_name;
+        slot->rec.state_name = slot->state_name;
+        ring_commit(&handle->state_ring);
+        signal_event(handle);
     }
-    state.state_type = data->state_type;
-    state.station_name = data->station_name;
-    state.subtype = data->subtype;
-    state.info = data->info;
-    state.state_name = state_name;
-    if (state_callback_) {
-        state_callback_();
+    if (handle->state_callback) {
+        handle->state_callback(handle->user);
+    }
+    if (data->state_type == ST_STATE && data->info == LIBSTATE_TERM) {
+        /* libthread uses neither the handle nor the context after this callback. */
+        atomic_store_explicit(&handle->lib_running, false, memory_order_release);
     }
 }
 
 /**
  * Get the latest aminiseed.
  *
+ * @param handle The handle of the Q330.
  * @return The latest aminiseed as a tminiseed struct.
  */
-tminiseed get_aminiseed() { return aminiseed; }
+tminiseed get_aminiseed(pq330_handle handle) { return handle->aminiseed; }
 
 /**
  * Get the latest message.
  *
+ * @param handle The handle of the Q330.
  * @return The latest message as a tmesg struct.
  */
-tmsg get_message() { return message; }
+tmsg get_message(pq330_handle handle) { return handle->message; }
 
 /**
  * Get the latest miniseed.
  *
+ * @param handle The handle of the Q330.
  * @return The latest miniseed as a tminiseed struct.
  */
-tminiseed get_miniseed() { return miniseed; }
+tminiseed get_miniseed(pq330_handle handle) { return handle->miniseed; }
 
 /**
  * Get the latest onesec.
  *
+ * @param handle The handle of the Q330.
  * @return The latest onesec as a tonesec struct.
  */
-tonesec get_onesec() { return onesec; }
+tonesec get_onesec(pq330_handle handle) { return handle->onesec; }
 
 /**
  * Get the latest state.
  *
+ * @param handle The handle of the Q330.
  * @return The latest state as a tstate struct.
  */
-tstate get_state() { return state; }
+tstate get_state(pq330_handle handle) { return handle->state; }
+
+/**
+ * Pop up to max_count records from a ring.
+ *
+ * The slots stay held by the consumer until the next pop on the same ring, so the strings and data the
+ * popped records point to remain valid until then.
+ *
+ * @param ring The ring to pop from.
+ * @param records Array of at least max_count records to copy into.
+ * @param record_size The size of one record, which is the first member of each slot.
+ * @param max_count The maximum number of records to pop.
+ * @return The number of records popped.
+ */
+int pop_batch(tspsc_ring *ring, void *records, size_t record_size, int max_count) {
+    if (max_count <= 0) {
+        ring_release(ring);
+        return 0;
+    }
+    uint32_t count = ring_acquire(ring, max_count);
+    for (uint32_t i = 0; i < count; i++) {
+        memcpy((unsigned char *)records + i * record_size, ring_slot(ring, i), record_size);
+    }
+    return count;
+}
+
+/**
+ * Pop the oldest queued aminiseed.
+ *
+ * @param handle The handle of the Q330.
+ * @param aminiseed The tminiseed struct to fill.
+ * @return True if a record was popped, false if none was pending.
+ */
+bool q330_pop_aminiseed(pq330_handle handle, tminiseed *aminiseed) {
+    return pop_batch(&handle->aminiseed_ring, aminiseed, sizeof(tminiseed), 1) == 1;
+}
+
+/**
+ * Pop the oldest queued message.
+ *
+ * @param handle The handle of the Q330.
+ * @param message The tmsg struct to fill.
+ * @return True if a record was popped, false if none was pending.
+ */
+bool q330_pop_message(pq330_handle handle, tmsg *message) {
+    return pop_batch(&handle->message_ring, message, sizeof(tmsg), 1) == 1;
+}
+
+/**
+ * Pop the oldest queued miniseed.
+ *
+ * @param handle The handle of the Q330.
+ * @param miniseed The tminiseed struct to fill.
+ * @return True if a record was popped, false if none was pending.
+ */
+bool q330_pop_miniseed(pq330_handle handle, tminiseed *miniseed) {
+    return pop_batch(&handle->miniseed_ring, miniseed, sizeof(tminiseed), 1) == 1;
+}
+
+/**
+ * Pop the oldest queued onesec.
+ *
+ * @param handle The handle of the Q330.
+ * @param onesec The tonesec struct to fill.
+ * @return True if a record was popped, false if none was pending.
+ */
+bool q330_pop_onesec(pq330_handle handle, tonesec *onesec) {
+    return q330_pop_batch_onesec(handle, onesec, 1) == 1;
+}
+
+/**
+ * Pop the oldest queued state.
+ *
+ * @param handle The handle of the Q330.
+ * @param state The tstate struct to fill.
+ * @return True if a record was popped, false if none was pending.
+ */
+bool q330_pop_state(pq330_handle handle, tstate *state) {
+    return pop_batch(&handle->state_ring, state, sizeof(tstate), 1) == 1;
+}
+
+/**
+ * Pop up to max_count queued aminiseeds, oldest first.
+ *
+ * @param handle The handle of the Q330.
+ * @param aminiseeds Array of at least max_count tminiseed structs to fill.
+ * @param max_count The maximum number of records to pop.
+ * @return The number of records popped.
+ */
+int q330_pop_batch_aminiseed(pq330_handle handle, tminiseed *aminiseeds, int max_count) {
+    return pop_batch(&handle->aminiseed_ring, aminiseeds, sizeof(tminiseed), max_count);
+}
+
+/**
+ * Pop up to max_count queued messages, oldest first.
+ *
+ * @param handle The handle of the Q330.
+ * @param messages Array of at least max_count tmsg structs to fill.
+ * @param max_count The maximum number of records to pop.
+ * @return The number of records popped.
+ */
+int q330_pop_batch_message(pq330_handle handle, tmsg *messages, int max_count) {
+    return pop_batch(&handle->message_ring, messages, sizeof(tmsg), max_count);
+}
+
+/**
+ * Pop up to max_count queued miniseeds, oldest first.
+ *
+ * @param handle The handle of the Q330.
+ * @param miniseeds Array of at least max_count tminiseed structs to fill.
+ * @param max_count The maximum number of records to pop.
+ * @return The number of records popped.
+ */
+int q330_pop_batch_miniseed(pq330_handle handle, tminiseed *miniseeds, int max_count) {
+    return pop_batch(&handle->miniseed_ring, miniseeds, sizeof(tminiseed), max_count);
+}
+
+/**
+ * Pop up to max_count queued onesecs, oldest first.
+ *
+ * @param handle The handle of the Q330.
+ * @param onesecs Array of at least max_count tonesec structs to fill.
+ * @param max_count The maximum number of records to pop.
+ * @return The number of records popped.
+ */
+int q330_pop_batch_onesec(pq330_handle handle, tonesec *onesecs, int max_count) {
+    int count = 0;
+    uint32_t size;
+    tonesec_record *record;
+    ring_release(&handle->onesec_ring);
+    while (count < max_count && (record = ring_peek_record(&handle->onesec_ring, &size)) != NULL) {
+        tonesec *onesec = &onesecs[count++];
+        tonesec_header *header = &record->header;
+        onesec->total_size = sizeof(tonesec_call);
+        onesec->station_name = header->station_name;
+        onesec->location = header->location;
+        onesec->chan_number = header->chan_number;
+        onesec->channel = header->channel;
+        onesec->padding = 0;
+        onesec->rate = header->rate;
+        onesec->cl_session = header->cl_session;
+        onesec->reserved = 0;
+        onesec->cl_offset = header->cl_offset;
+        onesec->timestamp = header->timestamp;
+        onesec->filter_bits = header->filter_bits;
+        onesec->qual_perc = header->qual_perc;
+        onesec->activity_flags = header->activity_flags;
+        onesec->io_flags = header->io_flags;
+        onesec->data_quality_flags = header->data_quality_flags;
+        onesec->src_channel = header->src_channel;
+        onesec->src_subchan = header->src_subchan;
+        memcpy(onesec->samples, record->samples, header->sample_count * sizeof(longint));
+        record_pop_latency(handle, record);
+        ring_take_record(&handle->onesec_ring, size);
+    }
+    return count;
+}
+
+/**
+ * Pop up to max_count queued states, oldest first.
+ *
+ * @param handle The handle of the Q330.
+ * @param states Array of at least max_count tstate structs to fill.
+ * @param max_count The maximum number of records to pop.
+ * @return The number of records popped.
+ */
+int q330_pop_batch_state(pq330_handle handle, tstate *states, int max_count) {
+    return pop_batch(&handle->state_ring, states, sizeof(tstate), max_count);
+}
+
+/**
+ * Pop the oldest queued triad.
+ *
+ * The consumer owns the arena blocks of the components present and must call q330_release_samples for each
+ * of their sample offsets once it is done with the samples.
+ *
+ * @param handle The handle of the Q330.
+ * @param triad The ttriad struct to fill.
+ * @return True if a triad was popped, false if none was pending.
+ */
+bool q330_pop_triad(pq330_handle handle, ttriad *triad) {
+    return pop_batch(&handle->triad_ring, triad, sizeof(ttriad), 1) == 1;
+}
+
+/**
+ * Pop up to max_count queued triads, oldest first. See q330_pop_triad for releasing their samples.
+ *
+ * @param handle The handle of the Q330.
+ * @param triads Array of at least max_count ttriad structs to fill.
+ * @param max_count The maximum number of triads to pop.
+ * @return The number of triads popped.
+ */
+int q330_pop_batch_triad(pq330_handle handle, ttriad *triads, int max_count) {
+    return pop_batch(&handle->triad_ring, triads, sizeof(ttriad), max_count);
+}
+
+/**
+ * Get the counters of the triad assembler.
+ *
+ * @param handle The handle of the Q330.
+ * @return The counters as a ttriad_stats struct.
+ */
+ttriad_stats q330_get_triad_stats(pq330_handle handle) { return triad_get_stats(&handle->triads); }
+
+/**
+ * Drain as many queued onesecs as fit into a caller supplied buffer, oldest first.
+ *
+ * Only the valid samples are copied, back to back, into the sample array of the buffer and a compact header
+ * is written for each record. The ring slots are released right away since nothing in the buffer points
+ * into them.
+ *
+ * @param handle The handle of the Q330.
+ * @param buffer The buffer to drain into. Its sample_count is set to the number of samples written.
+ * @param max_records The maximum number of records, which is the capacity of the header array.
+ * @return The number of records drained.
+ */
+int q330_drain_onesec(pq330_handle handle, tonesec_buffer *buffer, int max_records) {
+    int records = 0;
+    longword offset = 0;
+    uint32_t size;
+    tonesec_record *record;
+    ring_release(&handle->onesec_ring);
+    while (records < max_records && (record = ring_peek_record(&handle->onesec_ring, &size)) != NULL) {
+        longword num_samples = record->header.sample_count;
+        if (offset + num_samples > buffer->max_samples) {
+            break;
+        }
+        buffer->headers[records] = record->header;
+        buffer->headers[records].sample_offset = offset;
+        memcpy(buffer->samples + offset, record->samples, num_samples * sizeof(longint));
+        offset += num_samples;
+        records++;
+        record_pop_latency(handle, record);
+        ring_take_record(&handle->onesec_ring, size);
+    }
+    ring_release(&handle->onesec_ring);
+    buffer->sample_count = offset;
+    return records;
+}
+
+/**
+ * Drain queued onesecs into blocks of the sample arena, oldest first.
+ *
+ * Each drained record gets its own arena block with a reference count of one. The sample_offset in the
+ * header is the offset of the block in the arena returned by q330_get_arena, so the consumer can view the
+ * samples in place. The consumer must call q330_release_samples with that offset once it is done with them.
+ * Draining stops early when the arena is exhausted, leaving the remaining records queued.
+ *
+ * @param handle The handle of the Q330.
+ * @param headers Array with room for max_records headers.
+ * @param max_records The maximum number of records to drain.
+ * @return The number of records drained.
+ */
+int q330_drain_onesec_arena(pq330_handle handle, tonesec_header *headers, int max_records) {
+    int records = 0;
+    uint32_t size;
+    tonesec_record *record;
+    ring_release(&handle->onesec_ring);
+    while (records < max_records && (record = ring_peek_record(&handle->onesec_ring, &size)) != NULL) {
+        int32_t offset = arena_alloc(&handle->arena);
+        if (offset < 0) {
+            break;
+        }
+        headers[records] = record->header;
+        headers[records].sample_offset = offset;
+        memcpy(handle->arena_samples + offset, record->samples, record->header.sample_count * sizeof(longint));
+        records++;
+        record_pop_latency(handle, record);
+        ring_take_record(&handle->onesec_ring, size);
+    }
+    ring_release(&handle->onesec_ring);
+    return records;
+}
+
+/**
+ * Get the samples of the arena of a handle. The array doesn't move while the handle is open, so it can be
+ * mapped once by the consumer.
+ *
+ * @param handle The handle of the Q330.
+ * @return A pointer to the first of q330_get_arena_size samples.
+ */
+longint *q330_get_arena(pq330_handle handle) { return handle->arena_samples; }
+
+/**
+ * Get the size of the arena.
+ *
+ * @return The number of samples in the arena.
+ */
+longword q330_get_arena_size() { return ARENA_BLOCKS * MAX_RATE; }
+
+/**
+ * Add a reference to an arena block.
+ *
+ * @param handle The handle of the Q330.
+ * @param sample_offset The sample_offset of a header filled by q330_drain_onesec_arena.
+ */
+void q330_retain_samples(pq330_handle handle, longword sample_offset) {
+    arena_retain(&handle->arena, sample_offset);
+}
+
+/**
+ * Drop a reference to an arena block, returning it to the arena when it was the last one.
+ *
+ * @param handle The handle of the Q330.
+ * @param sample_offset The sample_offset of a header filled by q330_drain_onesec_arena.
+ */
+void q330_release_samples(pq330_handle handle, longword sample_offset) {
+    arena_release(&handle->arena, sample_offset);
+}
+
+/**
+ * Get the counters of the sample arena of a handle.
+ *
+ * @param handle The handle of the Q330.
+ * @return The counters as a tarena_stats struct.
+ */
+tarena_stats q330_get_arena_stats(pq330_handle handle) { return arena_get_stats(&handle->arena); }
+
+/**
+ * Convenience function to look up the ring of a stream.
+ *
+ * @param handle The handle of the Q330.
+ * @param stream The stream.
+ * @return A pointer to the ring of the stream.
+ */
+tspsc_ring *get_ring(pq330_handle handle, enum tq330_stream stream) {
+    switch (stream) {
+        case Q330_STREAM_AMINISEED:
+            return &handle->aminiseed_ring;
+        case Q330_STREAM_MESSAGE:
+            return &handle->message_ring;
+        case Q330_STREAM_MINISEED:
+            return &handle->miniseed_ring;
+        case Q330_STREAM_ONESEC:
+            return &handle->onesec_ring;
+        case Q330_STREAM_TRIAD:
+            return &handle->triad_ring;
+        default:
+            return &handle->state_ring;
+    }
+}
+
+/**
+ * Get the counters of the ring of a stream. The onesec ring holds variable-length records, so its capacity,
+ * count and high-water mark are in bytes.
+ *
+ * @param handle The handle of the Q330.
+ * @param stream The stream.
+ * @return The counters as a tring_stats struct.
+ */
+tring_stats q330_get_ring_stats(pq330_handle handle, enum tq330_stream stream) {
+    return ring_get_stats(get_ring(handle, stream));
+}
+
+/**
+ * Get the highest number of records, or bytes for the onesec stream, that were pending at once in the ring of
+ * a stream.
+ *
+ * @param handle The handle of the Q330.
+ * @param stream The stream.
+ * @return The high-water mark.
+ */
+uint32_t q330_get_high_water(pq330_handle handle, enum tq330_stream stream) {
+    return atomic_load_explicit(&get_ring(handle, stream)->high_water, memory_order_relaxed);
+}
+
+/**
+ * Get the counters of the datagrams lib330 read from the data port of the Q330. The data port is read in
+ * batches of up to RECV_BATCH_SIZE datagrams, so the number of packets per read shows how far behind the
+ * lib330 thread is, for instance while the Q330 replays its buffer after a link outage.
+ *
+ * @param handle The handle of the Q330.
+ * @return The counters as a trecvstat struct, which are all zero if there is no station context.
+ */
+trecvstat q330_get_recv_stats(pq330_handle handle) {
+    trecvstat stats;
+    memset(&stats, 0, sizeof(stats));
+    if (handle->station_context != NIL) {
+        lib_get_recvstat(handle->station_context, &stats);
+    }
+    return stats;
+}
+
+/**
+ * Get the goodput of the data port, the data added to the sliding window as opposed to everything the Q330
+ * sent including resent packets, and how often lib330 acknowledged. Updated about once a second.
+ *
+ * @param handle The handle of the Q330.
+ * @return The counters as a tgoodput struct, which are all zero if there is no station context.
+ */
+tgoodput q330_get_goodput(pq330_handle handle) {
+    tgoodput goodput;
+    memset(&goodput, 0, sizeof(goodput));
+    if (handle->station_context != NIL) {
+        lib_get_goodput(handle->station_context, &goodput);
+    }
+    return goodput;
+}
+
+/**
+ * Get a file descriptor that becomes readable when records were queued, so the consumer can wait for them
+ * with select, poll or an event loop instead of polling the rings. It is an eventfd on Linux and the read end
+ * of a pipe elsewhere. The consumer must call q330_clear_event before popping the records.
+ *
+ * @param handle The handle of the Q330.
+ * @return The file descriptor or -1 if it could not be created.
+ */
+int q330_get_event_fd(pq330_handle handle) { return handle->event_fds[0]; }
+
+/**
+ * Make the event fd unreadable again until more records are queued. Records queued before this call may not
+ * signal the fd again, so the consumer must pop all pending records after clearing it.
+ *
+ * @param handle The handle of the Q330.
+ */
+void q330_clear_event(pq330_handle handle) {
+    if (handle->event_fds[0] < 0) {
+        return;
+    }
+    atomic_exchange(&handle->event_pending, false);
+    uint64_t value;
+    while (read(handle->event_fds[0], &value, EVENT_SIZE) > 0) {
+    }
+}
+
+/**
+ * Convenience function to create the non-blocking event fd of a handle.
+ *
+ * @param handle The handle of the Q330.
+ */
+void open_event_fd(pq330_handle handle) {
+    handle->event_fds[0] = -1;
+    handle->event_fds[1] = -1;
+#ifdef __linux__
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd >= 0) {
+        handle->event_fds[0] = fd;
+        handle->event_fds[1] = fd;
+    }
+#else
+    int fds[2];
+    if (pipe(fds) == 0) {
+        for (int i = 0; i < 2; i++) {
+            fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+            fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+            handle->event_fds[i] = fds[i];
+        }
+    }
+#endif
+    if (handle->debug && handle->event_fds[0] < 0) {
+        printf("[Q330] Creating the event fd failed: %s\n", strerror(errno));
+    }
+}
+
+/**
+ * Convenience function to close the event fd of a handle.
+ *
+ * @param handle The handle of the Q330.
+ */
+void close_event_fd(pq330_handle handle) {
+    if (handle->event_fds[1] >= 0 && handle->event_fds[1] != handle->event_fds[0]) {
+        close(handle->event_fds[1]);
+    }
+    if (handle->event_fds[0] >= 0) {
+        close(handle->event_fds[0]);
+    }
+    handle->event_fds[0] = -1;
+    handle->event_fds[1] = -1;
+}
+
+/**
+ * Convenience function to set up empty rings for all streams.
+ *
+ * @param handle The handle of the Q330.
+ */
+void init_rings(pq330_handle handle) {
+    ring_init(&handle->aminiseed_ring, handle->aminiseed_storage, AMINISEED_RING_SIZE, AMINISEED_SLOT_SIZE);
+    ring_init(&handle->message_ring, handle->message_storage, MESSAGE_RING_SIZE, sizeof(tmsg_slot));
+    ring_init(&handle->miniseed_ring, handle->miniseed_storage, MINISEED_RING_SIZE, MINISEED_SLOT_SIZE);
+    ring_init(&handle->onesec_ring, handle->onesec_storage, ONESEC_RING_BYTES, 1);
+    ring_init(&handle->state_ring, handle->state_storage, STATE_RING_SIZE, sizeof(tstate_slot));
+    ring_init(&handle->triad_ring, handle->triad_storage, TRIAD_RING_SIZE, sizeof(ttriad));
+}
 
 /**
  * Convenience function to create a creation_info struct.
+ *
+ * @param handle The handle of the Q330.
  */
-void create_creation_info() {
-    memcpy(creation_info.q330id_serial, &q330id_serial_id, sizeof(uint64_t));
-    creation_info.q330id_dataport = LP_TEL1;
-    strncpy(creation_info.q330id_station, "UNKN", 5);
-    creation_info.host_timezone = 0;
-    strcpy(creation_info.host_software, "UNKNOWN");
-    strcpy(creation_info.opt_contfile, "");
-    creation_info.opt_verbose =
+void create_creation_info(pq330_handle handle) {
+    tpar_create *creation_info = &handle->creation_info;
+    memcpy(creation_info->q330id_serial, &handle->q330id_serial_id, sizeof(uint64_t));
+    creation_info->q330id_dataport = LP_TEL1;
+    strncpy(creation_info->q330id_station, "UNKN", 5);
+    creation_info->host_timezone = 0;
+    strcpy(creation_info->host_software, "UNKNOWN");
+    strcpy(creation_info->opt_contfile, "");
+    creation_info->opt_verbose =
             VERB_SDUMP | VERB_RETRY | VERB_REGMSG | VERB_LOGEXTRA | VERB_AUXMSG | VERB_PACKET;
-    creation_info.opt_zoneadjust = 0;
-    creation_info.opt_secfilter = OSF_ALL;
-    creation_info.opt_client_msgs = 10;
+    creation_info->opt_zoneadjust = 0;
+    creation_info->opt_secfilter = OSF_ALL;
+    creation_info->opt_client_msgs = 10;
+    creation_info->opt_decode_thread = handle->decode_thread;
 #ifndef OMIT_SEED
-    creation_info.opt_compat = 0;
-    creation_info.opt_minifilter = OMF_ALL;
-    creation_info.opt_aminifilter = 0;
-    creation_info.amini_exponent = 14;
-    creation_info.amini_512highest = -1000;
-    creation_info.mini_embed = 0;
-    creation_info.mini_separate = 1;
-    creation_info.mini_firchain = 0;
-    creation_info.call_minidata = my_miniseed_callback;
-    creation_info.call_aminidata = my_aminiseed_callback;
+    creation_info->opt_compat = 0;
+    creation_info->opt_minifilter = OMF_ALL;
+    creation_info->opt_aminifilter = 0;
+    creation_info->amini_exponent = AMINI_EXPONENT;
+    creation_info->amini_512highest = -1000;
+    creation_info->mini_embed = 0;
+    creation_info->mini_separate = 1;
+    creation_info->mini_firchain = 0;
+    creation_info->call_minidata = my_miniseed_callback;
+    creation_info->call_aminidata = my_aminiseed_callback;
 #endif
-    creation_info.resp_err = LIBERR_NOERR;
-    creation_info.call_state = my_state_callback;
-    creation_info.call_messages = my_msg_callback;
-    creation_info.call_secdata = my_secdata_callback;
-    creation_info.call_lowlatency = NULL;
-    creation_info.call_baler = NULL;
-    creation_info.file_owner = NULL;
+    creation_info->resp_err = LIBERR_NOERR;
+    creation_info->call_state = my_state_callback;
+    creation_info->call_messages = my_msg_callback;
+    creation_info->call_secdata = my_secdata_callback;
+    creation_info->call_lowlatency = NULL;
+    creation_info->call_baler = NULL;
+    creation_info->file_owner = NULL;
+    creation_info->host_ptr = handle;
 }
 
 /**
  * Convenience function to create a registration_info struct.
+ *
+ * @param handle The handle of the Q330.
  */
-tpar_register create_registration_info() {
+tpar_register create_registration_info(pq330_handle handle) {
     tpar_register registration_info;
     uint64_t auth = strtoll("0", NULL, 16);
     memcpy(registration_info.q330id_auth, &auth, sizeof(uint64_t));
-    strcpy(registration_info.q330id_address, q330id_address);
-    registration_info.q330id_baseport = q330id_baseport;
+    strcpy(registration_info.q330id_address, handle->q330id_address);
+    registration_info.q330id_baseport = handle->q330id_baseport;
     // This is “HOST_ETH” for Ethernet, “HOST_SER” for serial, or “HOST_TCP” for TCP using Tunnel330.
     registration_info.host_mode = HOST_ETH;
     strcpy(registration_info.host_interface, "");
@@ -287,120 +1062,270 @@ tpar_register create_registration_info() {
     registration_info.opt_regattempts = 0;
     registration_info.opt_ipexpire = 0;
     registration_info.opt_buflevel = 0;
+    registration_info.opt_q330_cont = 0;
+    registration_info.opt_dss_memory = 0;
+    registration_info.opt_window = handle->window;
+    registration_info.opt_ack_cnt = handle->ack_count;
+    registration_info.opt_ack_to = handle->ack_timeout;
     return registration_info;
 }
 
 /**
- * Convenience function to initialize the lib330 library.
+ * Open a handle to serve one Q330.
+ *
+ * Each handle has its own lib330 context, rings and callbacks, so one process can serve several Q330s. The
+ * rings of a handle have a single consumer, so only one thread at a time may pop or drain records of a
+ * handle, while different handles can be consumed by different threads.
+ *
+ * @param qinit The initialization data of the Q330.
+ * @return The handle or NULL if Q330_MAX_HANDLES handles are open already or memory ran out.
  */
-void q330_init(tinit qinit) {
-    debug = qinit.debug;
-    if (debug) {
-        printf("[Q330] Set debug to %d\n", debug);
+pq330_handle q330_open(tinit qinit) {
+    pq330_handle handle = aligned_alloc(RING_CACHE_LINE, sizeof(struct tq330_handle));
+    if (handle == NULL) {
+        return NULL;
+    }
+    memset(handle, 0, sizeof(struct tq330_handle));
+    handle->debug = qinit.debug;
+    if (handle->debug) {
+        printf("[Q330] Set debug to %d\n", handle->debug);
+    }
+    handle->q330id_serial_id = qinit.serial_id;
+    if (handle->debug) {
+        printf("[Q330] Set serial id '0x%llX'.\n", handle->q330id_serial_id);
     }
-    q330id_serial_id = qinit.serial_id;
-    if (debug) {
-        printf("[Q330] Set serial id '0x%llX'.\n", q330id_serial_id);
+    strcpy(handle->q330id_address, qinit.hostname);
+    if (handle->debug) {
+        printf("[Q330] Set hostname '%s'.\n", handle->q330id_address);
     }
-    strcpy(q330id_address, qinit.hostname);
-    if (debug) {
-        printf("[Q330] Set hostname '%s'.\n", q330id_address);
+    handle->q330id_baseport = qinit.baseport;
+    if (handle->debug) {
+        printf("[Q330] Setting baseport '%d'.\n", handle->q330id_baseport);
     }
-    q330id_baseport = qinit.baseport;
-    if (debug) {
-        printf("[Q330] Setting baseport '%d'.\n", q330id_baseport);
+    handle->aminiseed_callback = qinit.aminiseed_callback;
+    handle->message_callback = qinit.message_callback;
+    handle->miniseed_callback = qinit.miniseed_callback;
+    handle->secdata_callback = qinit.secdata_callback;
+    handle->state_callback = qinit.state_callback;
+    handle->assemble_triads = qinit.assemble_triads;
+    handle->triad_callback = qinit.triad_callback;
+    handle->user = qinit.user;
+    handle->decode_thread = qinit.decode_thread;
+    handle->window = qinit.window;
+    handle->ack_count = qinit.ack_count;
+    handle->ack_timeout = qinit.ack_timeout;
+    init_rings(handle);
+    handle->arena.samples = handle->arena_samples;
+    handle->arena.refcounts = handle->arena_refcounts;
+    handle->arena.blocks = ARENA_BLOCKS;
+    handle->arena.block_samples = MAX_RATE;
+    triad_init(&handle->triads, &handle->triad_ring, &handle->arena, TRIAD_TIMEOUT);
+    open_event_fd(handle);
+
+    for (int i = 0; i < Q330_MAX_HANDLES; i++) {
+        pq330_handle expected = NULL;
+        if (atomic_compare_exchange_strong(&handles[i], &expected, handle)) {
+            return handle;
+        }
     }
-    aminiseed_callback_ = qinit.aminiseed_callback;
-    message_callback_ = qinit.message_callback;
-    miniseed_callback_ = qinit.miniseed_callback;
-    secdata_callback_ = qinit.secdata_callback;
-    state_callback_ = qinit.state_callback;
+    close_event_fd(handle);
+    free(handle);
+    return NULL;
+}
+
+/**
+ * Close a handle, destroying its lib330 context if that is still open. The handle is only freed once libthread
+ * made its last callback. No records of the handle may be used after this.
+ *
+ * @param handle The handle of the Q330.
+ */
+void q330_close(pq330_handle handle) {
+    if (handle->station_context != NIL) {
+        q330_destroy_context(handle);
+    }
+    triad_reset(&handle->triads);
+    close_event_fd(handle);
+    for (int i = 0; i < Q330_MAX_HANDLES; i++) {
+        pq330_handle expected = handle;
+        if (atomic_compare_exchange_strong(&handles[i], &expected, NULL)) {
+            break;
+        }
+    }
+    free(handle);
 }
 
 /**
  * Convenience function to convert the q330id_serial 32 bit int array to a 64 bit int.
+ *
+ * @param handle The handle of the Q330.
  */
-uint64_t q330_get_serial_id() {
-    uint32_t leastSignificantWord = creation_info.q330id_serial[0];
-    uint32_t mostSignificantWord = creation_info.q330id_serial[1];
+uint64_t q330_get_serial_id(pq330_handle handle) {
+    uint32_t leastSignificantWord = handle->creation_info.q330id_serial[0];
+    uint32_t mostSignificantWord = handle->creation_info.q330id_serial[1];
     uint64_t ser_id = (uint64_t)mostSignificantWord << 32 | leastSignificantWord;
     return ser_id;
 }
 
 /**
  * Convenience function to create the lib330 connection context.
+ *
+ * @param handle The handle of the Q330.
  */
-void q330_create_context() {
-    create_creation_info();
-    if (debug) {
-        printf("[Q330] Creating context for Q330 with serial number 0x%llX.\n", q330_get_serial_id());
+void q330_create_context(pq330_handle handle) {
+    create_creation_info(handle);
+    /* Return the samples of triads left over from an earlier context to the arena. */
+    triad_reset(&handle->triads);
+    init_rings(handle);
+    if (handle->debug) {
+        printf("[Q330] Creating context for Q330 with serial number 0x%llX.\n", q330_get_serial_id(handle));
+    }
+    /* libthread may call back before lib_create_context returns. */
+    atomic_store_explicit(&handle->lib_running, true, memory_order_release);
+    tcontext context;
+    lib_create_context(&context, &handle->creation_info);
+    if (context == NIL) {
+        atomic_store_explicit(&handle->lib_running, false, memory_order_release);
     }
-    lib_create_context(&station_context, &creation_info);
-    if (debug) {
-        printf("[Q330] Context creation error code %d\n", creation_info.resp_err);
+    atomic_store_explicit(&handle->station_context, context, memory_order_release);
+    if (handle->debug) {
+        printf("[Q330] Context creation error code %d\n", handle->creation_info.resp_err);
     }
 }
 
 /**
  * Convenience function to perform a ping without registering with the Q330 earthquake sensor.
+ *
+ * @param handle The handle of the Q330.
  */
-void q330_unregistered_ping() {
-    tpar_register registration_info = create_registration_info();
-    if (debug) {
-        printf("[Q330] Pinging Q330 with serial number 0x%llX.\n", q330_get_serial_id());
+void q330_unregistered_ping(pq330_handle handle) {
+    tpar_register registration_info = create_registration_info(handle);
+    if (handle->debug) {
+        printf("[Q330] Pinging Q330 with serial number 0x%llX.\n", q330_get_serial_id(handle));
     }
-    enum tliberr errcode = lib_unregistered_ping(station_context, &registration_info);
-    if (debug) {
+    enum tliberr errcode = lib_unregistered_ping(handle->station_context, &registration_info);
+    if (handle->debug) {
         printf("[Q330] Ping error code %d\n", errcode);
     }
 }
 
 /**
  * Convenience function to register with the Q330 earthquake sensor.
+ *
+ * @param handle The handle of the Q330.
  */
-void q330_register() {
-    tpar_register registration_info = create_registration_info();
-    if (debug) {
-        printf("[Q330] Registering with Q330 with serial number 0x%llX.\n", q330_get_serial_id());
+void q330_register(pq330_handle handle) {
+    tpar_register registration_info = create_registration_info(handle);
+    if (handle->debug) {
+        printf("[Q330] Registering with Q330 with serial number 0x%llX.\n", q330_get_serial_id(handle));
     }
-    enum tliberr errcode = lib_register(station_context, &registration_info);
-    if (debug) {
+    enum tliberr errcode = lib_register(handle->station_context, &registration_info);
+    if (handle->debug) {
         printf("[Q330] Registration error code %d\n", errcode);
     }
 }
 
 /**
  * Convenience function to change the state of the Q330 earthquake sensor.
+ *
+ * @param handle The handle of the Q330.
+ */
+void q330_change_state(pq330_handle handle, enum tlibstate new_state) {
+    lib_change_state(handle->station_context, new_state, LIBERR_NOERR);
+}
+
+/**
+ * Write the configuration and every data port packet received from the Q330 to a capture file, which
+ * q330_replay or bench_replay can replay later without the Q330. The configuration is written right away if it
+ * has been read already, otherwise when it is.
+ *
+ * @param handle The handle of the Q330.
+ * @param path The path of the capture file, which is overwritten, or NULL or "" to stop capturing.
+ * @return LIBERR_NOERR or the error code if the file could not be created.
  */
-void q330_change_state(enum tlibstate new_state) {
-    lib_change_state(station_context, new_state, LIBERR_NOERR);
+enum tliberr q330_start_capture(pq330_handle handle, const char *path) {
+    if (handle->station_context == NIL) {
+        return LIBERR_INVCTX;
+    }
+    return lib_capture(handle->station_context, (pchar)path);
 }
 
 /**
- * Convenience function to destroy the lib330 connection context.
+ * Replay a capture through the lib330 data path as if it came from the Q330, so the records are queued the same
+ * way. The context must have been created and not be registered. It is idle again when the replay has finished,
+ * which q330_get_replay_stats shows.
+ *
+ * @param handle The handle of the Q330.
+ * @param path The path of the capture file.
+ * @param speed The multiple of the rate the packets were captured at, or 0 to replay as fast as possible.
+ * @return LIBERR_NOERR, LIBERR_PAR if the file is not a capture or LIBERR_PERM if the context is not idle.
+ */
+enum tliberr q330_replay(pq330_handle handle, const char *path, double speed) {
+    if (handle->station_context == NIL) {
+        return LIBERR_INVCTX;
+    }
+    tpar_register registration_info = create_registration_info(handle);
+    return lib_replay(handle->station_context, &registration_info, (pchar)path, speed);
+}
+
+/**
+ * Get the statistics of the running or last replay.
+ *
+ * @param handle The handle of the Q330.
+ * @return The statistics as a treplaystat struct, which are all zero if there is no station context.
  */
-void q330_destroy_context() {
-    if (debug) {
-        printf("[Q330] Destroying context for Q330 with serial number 0x%llX.\n", q330_get_serial_id());
+treplaystat q330_get_replay_stats(pq330_handle handle) {
+    treplaystat stats;
+    memset(&stats, 0, sizeof(stats));
+    if (handle->station_context != NIL) {
+        lib_get_replaystat(handle->station_context, &stats);
     }
-    pq330 q330;
-    pmem_manager pm, pmn;
-    q330 = station_context;
-    station_context = NIL;
-    pthread_mutex_destroy(addr(q330->mutex));
-    pthread_mutex_destroy(addr(q330->msgmutex));
-    pm = q330->memory_head;
-    while (pm) {
-        pmn = pm->next;
-        free(pm->base);
-        free(pm);
-        pm = pmn;
+    return stats;
+}
+
+/**
+ * Get the latency histograms of the LCQs. Each stage is measured from the time the data packet was read from
+ * the data port: decompression, the one second and miniseed callbacks and the consumer popping the one second
+ * data from the ring. Bin i of a histogram starts at lib_latency_floor(i) microseconds.
+ *
+ * @param handle The handle of the Q330.
+ * @param stats The tlatencystat struct to fill, which is large enough to allocate rather than put on the stack.
+ * @return LIBERR_NOERR or LIBERR_INVCTX if there is no station context.
+ */
+enum tliberr q330_get_latency_stats(pq330_handle handle, tlatencystat *stats) {
+    if (handle->station_context == NIL) {
+        return LIBERR_INVCTX;
+    }
+    return lib_get_latency_stats(handle->station_context, stats);
+}
+
+/**
+ * Convenience function to wait until libthread made its last callback. libthread is detached, so it can't be
+ * joined.
+ *
+ * @param handle The handle of the Q330.
+ */
+void wait_for_libthread(pq330_handle handle) {
+    while (atomic_load_explicit(&handle->lib_running, memory_order_acquire)) {
+        usleep(1000);
+    }
+}
+
+/**
+ * Convenience function to destroy the lib330 connection context. If libthread is still running, it is told
+ * to terminate first, and the context is only destroyed once it did.
+ *
+ * @param handle The handle of the Q330.
+ */
+void q330_destroy_context(pq330_handle handle) {
+    if (handle->debug) {
+        printf("[Q330] Destroying context for Q330 with serial number 0x%llX.\n", q330_get_serial_id(handle));
     }
-    pm = q330->thrmem_head;
-    while (pm) {
-        pmn = pm->next;
-        free(pm->base);
-        free(pm);
-        pm = pmn;
+    tcontext context = atomic_load_explicit(&handle->station_context, memory_order_acquire);
+    if (atomic_load_explicit(&handle->lib_running, memory_order_acquire)) {
+        lib_change_state(context, LIBSTATE_TERM, LIBERR_NOERR);
+        wait_for_libthread(handle);
     }
+    atomic_store_explicit(&handle->station_context, NIL, memory_order_release);
+    /* This also closes any capture or replay and frees the latency statistics. */
+    lib_destroy_context(&context);
 }
@@ -26,6 +26,49 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include "q330_arena.h"
+#include "q330_ring.h"
+#include "q330_triad.h"
+
+/* Capacities of the per-stream rings, which must be powers of two. */
+#define AMINISEED_RING_SIZE 16
+#define MESSAGE_RING_SIZE 64
+#define MINISEED_RING_SIZE 256
+#define STATE_RING_SIZE 64
+#define TRIAD_RING_SIZE 64
+/* The onesec ring holds variable-length records, so its capacity is in bytes. */
+#define ONESEC_RING_BYTES (1 << 20)
+
+/* Seconds of data time after which a triad with missing components is queued anyway. */
+#define TRIAD_TIMEOUT 2.0
+
+/* Number of blocks in the sample arena of each handle, each of which holds the samples of one onesec record. */
+#define ARENA_BLOCKS 512
+
+/* Maximum number of Q330s served at once by one process. */
+#define Q330_MAX_HANDLES 32
+
+/**
+ * The streams for which records are queued for the consumer.
+ */
+enum tq330_stream {
+    Q330_STREAM_AMINISEED,
+    Q330_STREAM_MESSAGE,
+    Q330_STREAM_MINISEED,
+    Q330_STREAM_ONESEC,
+    Q330_STREAM_STATE,
+    Q330_STREAM_TRIAD
+};
+
+/**
+ * Opaque handle of one Q330, returned by q330_open and passed to all other calls.
+ */
+typedef struct tq330_handle *pq330_handle;
+
+/**
+ * Callback signalling that a record is available, called with the user cookie of the handle.
+ */
+typedef void (*tq330_callback)(void *user);
 
 /**
  * Structure with Q330 initialization data, which can be passed from Python.
@@ -35,11 +78,18 @@ typedef struct { /* parameters to initialize Q330 */
     string250 hostname;
     word baseport;
     bool debug;
-    void *aminiseed_callback;
-    void *message_callback;
-    void *miniseed_callback;
-    void *secdata_callback;
-    void *state_callback;
+    tq330_callback aminiseed_callback;
+    tq330_callback message_callback;
+    tq330_callback miniseed_callback;
+    tq330_callback secdata_callback;
+    tq330_callback state_callback;
+    bool assemble_triads; /* queue one second data as triads instead of onesec records */
+    tq330_callback triad_callback;
+    void *user;         /* cookie passed to the callbacks */
+    bool decode_thread; /* decode data packets in a separate lib330 thread */
+    word window;        /* data port window to program into the Q330, 0 to keep its own */
+    word ack_count;     /* acknowledge every this many packets, 0 for the Q330's value */
+    word ack_timeout;   /* acknowledge timeout in 0.1 seconds, 0 for the Q330's value */
 } tinit;
 
 /**
@@ -101,6 +151,41 @@ typedef struct {         /* for 1 second and low latency callback */
     longint samples[MAX_RATE]; /* decompressed samples */
 } tonesec;
 
+/**
+ * Compact header of one second data. It is followed by the valid samples in the variable-length records that
+ * are queued. When drained into a tonesec_buffer or the sample arena, the samples of the record are
+ * sample_count consecutive entries of the sample array starting at sample_offset.
+ */
+typedef struct {
+    double timestamp;        /* time of data, corrected for any filtering */
+    double cl_offset;        /* closed loop time offset */
+    longword sample_offset;  /* index of the first sample in the sample array */
+    longword sample_count;   /* number of valid samples */
+    integer rate;            /* sampling rate */
+    longword cl_session;     /* closed loop session number */
+    word filter_bits;        /* OSF_xxx bits */
+    word qual_perc;          /* time quality percentage */
+    word activity_flags;     /* same as in Miniseed */
+    word io_flags;           /* same as in Miniseed */
+    word data_quality_flags; /* same as in Miniseed */
+    byte chan_number;        /* channel number according to tokens */
+    byte src_channel;        /* source blockette channel */
+    byte src_subchan;        /* source blockette sub-channel */
+    string9 station_name;    /* network and station */
+    string2 location;
+    string3 channel;
+} tonesec_header;
+
+/**
+ * Caller supplied buffer to drain one second data into, which can be passed from Python.
+ */
+typedef struct {
+    tonesec_header *headers; /* array with room for max_records headers */
+    longint *samples;        /* contiguous array for the samples of all records */
+    longword max_samples;    /* capacity of the sample array, at least MAX_RATE */
+    longword sample_count;   /* number of samples written by the last drain */
+} tonesec_buffer;
+
 /**
  * Structure with Q330 state data. A subset of data from the tstate_call
  * libclient struct, which can be passed to Python.
@@ -114,17 +199,48 @@ typedef struct {                 /* format for state callback */
     char *state_name; /* string representation of state_type */
 } tstate;
 
-void q330_init(tinit qinit);
-uint64_t q330_get_serial_id();
-tminiseed get_aminiseed();
-tmsg get_message();
-tminiseed get_miniseed();
-tonesec get_onesec();
-tstate get_state();
-void q330_create_context();
-void q330_unregistered_ping();
-void q330_register();
-void q330_change_state(enum tlibstate new_state);
-void q330_destroy_context();
+pq330_handle q330_open(tinit qinit);
+void q330_close(pq330_handle handle);
+uint64_t q330_get_serial_id(pq330_handle handle);
+tminiseed get_aminiseed(pq330_handle handle);
+tmsg get_message(pq330_handle handle);
+tminiseed get_miniseed(pq330_handle handle);
+tonesec get_onesec(pq330_handle handle);
+tstate get_state(pq330_handle handle);
+bool q330_pop_aminiseed(pq330_handle handle, tminiseed *aminiseed);
+bool q330_pop_message(pq330_handle handle, tmsg *message);
+bool q330_pop_miniseed(pq330_handle handle, tminiseed *miniseed);
+bool q330_pop_onesec(pq330_handle handle, tonesec *onesec);
+bool q330_pop_state(pq330_handle handle, tstate *state);
+int q330_pop_batch_aminiseed(pq330_handle handle, tminiseed *aminiseeds, int max_count);
+int q330_pop_batch_message(pq330_handle handle, tmsg *messages, int max_count);
+int q330_pop_batch_miniseed(pq330_handle handle, tminiseed *miniseeds, int max_count);
+int q330_pop_batch_onesec(pq330_handle handle, tonesec *onesecs, int max_count);
+int q330_pop_batch_state(pq330_handle handle, tstate *states, int max_count);
+bool q330_pop_triad(pq330_handle handle, ttriad *triad);
+int q330_pop_batch_triad(pq330_handle handle, ttriad *triads, int max_count);
+ttriad_stats q330_get_triad_stats(pq330_handle handle);
+int q330_drain_onesec(pq330_handle handle, tonesec_buffer *buffer, int max_records);
+int q330_drain_onesec_arena(pq330_handle handle, tonesec_header *headers, int max_records);
+longint *q330_get_arena(pq330_handle handle);
+longword q330_get_arena_size();
+void q330_retain_samples(pq330_handle handle, longword sample_offset);
+void q330_release_samples(pq330_handle handle, longword sample_offset);
+tarena_stats q330_get_arena_stats(pq330_handle handle);
+tring_stats q330_get_ring_stats(pq330_handle handle, enum tq330_stream stream);
+uint32_t q330_get_high_water(pq330_handle handle, enum tq330_stream stream);
+trecvstat q330_get_recv_stats(pq330_handle handle);
+tgoodput q330_get_goodput(pq330_handle handle);
+enum tliberr q330_start_capture(pq330_handle handle, const char *path);
+enum tliberr q330_replay(pq330_handle handle, const char *path, double speed);
+treplaystat q330_get_replay_stats(pq330_handle handle);
+enum tliberr q330_get_latency_stats(pq330_handle handle, tlatencystat *stats);
+int q330_get_event_fd(pq330_handle handle);
+void q330_clear_event(pq330_handle handle);
+void q330_create_context(pq330_handle handle);
+void q330_unregistered_ping(pq330_handle handle);
+void q330_register(pq330_handle handle);
+void q330_change_state(pq330_handle handle, enum tlibstate new_state);
+void q330_destroy_context(pq330_handle handle);
 
 #endif  // !q330_h
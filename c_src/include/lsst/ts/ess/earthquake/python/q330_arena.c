@@ -0,0 +1,97 @@
+/*
+ * This file is part of ts_ess_earthquake.
+ *
+ * Developed for the Vera C. Rubin Observatory Telescope and Site Systems.
+ * This product includes software developed by the LSST Project
+ * (https://www.lsst.org).
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "q330_arena.h"
+
+/**
+ * Allocate a free block with a reference count of one.
+ *
+ * @param arena The arena.
+ * @return The sample offset of the block in the arena or -1 if all blocks are in use.
+ */
+int32_t arena_alloc(tsample_arena *arena) {
+    uint32_t start = atomic_load_explicit(&arena->next, memory_order_relaxed);
+    for (uint32_t i = 0; i < arena->blocks; i++) {
+        uint32_t block = (start + i) % arena->blocks;
+        uint32_t expected = 0;
+        if (atomic_compare_exchange_strong_explicit(&arena->refcounts[block], &expected, 1,
+                                                    memory_order_acquire, memory_order_relaxed)) {
+            atomic_store_explicit(&arena->next, (block + 1) % arena->blocks, memory_order_relaxed);
+            atomic_fetch_add_explicit(&arena->in_use, 1, memory_order_relaxed);
+            return block * arena->block_samples;
+        }
+    }
+    atomic_fetch_add_explicit(&arena->exhausted, 1, memory_order_relaxed);
+    return -1;
+}
+
+/**
+ * Add a reference to a block.
+ *
+ * @param arena The arena.
+ * @param sample_offset The sample offset of the block as returned by arena_alloc.
+ */
+void arena_retain(tsample_arena *arena, uint32_t sample_offset) {
+    uint32_t block = sample_offset / arena->block_samples;
+    if (block < arena->blocks) {
+        atomic_fetch_add_explicit(&arena->refcounts[block], 1, memory_order_relaxed);
+    }
+}
+
+/**
+ * Drop a reference to a block. The block is free again when the last reference is dropped.
+ *
+ * @param arena The arena.
+ * @param sample_offset The sample offset of the block as returned by arena_alloc.
+ */
+void arena_release(tsample_arena *arena, uint32_t sample_offset) {
+    uint32_t block = sample_offset / arena->block_samples;
+    if (block >= arena->blocks) {
+        return;
+    }
+    uint32_t refcount = atomic_load_explicit(&arena->refcounts[block], memory_order_relaxed);
+    while (refcount > 0) {
+        if (atomic_compare_exchange_weak_explicit(&arena->refcounts[block], &refcount, refcount - 1,
+                                                  memory_order_release, memory_order_relaxed)) {
+            if (refcount == 1) {
+                atomic_fetch_sub_explicit(&arena->in_use, 1, memory_order_relaxed);
+            }
+            return;
+        }
+    }
+}
+
+/**
+ * Get a snapshot of the arena counters.
+ *
+ * @param arena The arena.
+ * @return The counters as a tarena_stats struct.
+ */
+tarena_stats arena_get_stats(tsample_arena *arena) {
+    tarena_stats stats;
+    stats.blocks = arena->blocks;
+    stats.block_samples = arena->block_samples;
+    stats.in_use = atomic_load_explicit(&arena->in_use, memory_order_relaxed);
+    stats.exhausted = atomic_load_explicit(&arena->exhausted, memory_order_relaxed);
+    return stats;
+}
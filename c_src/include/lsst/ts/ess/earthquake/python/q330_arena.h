@@ -0,0 +1,65 @@
+/*
+ * This file is part of ts_ess_earthquake.
+ *
+ * Developed for the Vera C. Rubin Observatory Telescope and Site Systems.
+ * This product includes software developed by the LSST Project
+ * (https://www.lsst.org).
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef q330_arena_h
+#define q330_arena_h
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/**
+ * Pinned arena of fixed-size sample blocks with a reference count per block.
+ *
+ * The samples live in one contiguous array that never moves, so a consumer can map the whole arena once
+ * (e.g. as a numpy array) and address a block by its sample offset. A block is free when its reference
+ * count is zero. Allocation and release are lock-free.
+ *
+ * An arena is set up by pointing it to its storage and setting blocks and block_samples, with everything
+ * else zeroed, which leaves all blocks free.
+ */
+typedef struct {
+    int32_t *samples;            /* blocks * block_samples samples */
+    _Atomic uint32_t *refcounts; /* reference count per block */
+    uint32_t blocks;             /* number of blocks */
+    uint32_t block_samples;      /* number of samples per block */
+    _Atomic uint32_t next;       /* block to try first on the next allocation */
+    _Atomic uint32_t in_use;     /* number of blocks with a non-zero reference count */
+    _Atomic uint64_t exhausted;  /* number of allocations that failed because all blocks were in use */
+} tsample_arena;
+
+/**
+ * Snapshot of the counters of an arena, which can be passed to Python.
+ */
+typedef struct {
+    uint32_t blocks;        /* number of blocks */
+    uint32_t block_samples; /* number of samples per block */
+    uint32_t in_use;        /* number of blocks in use */
+    uint64_t exhausted;     /* number of allocations that failed because all blocks were in use */
+} tarena_stats;
+
+int32_t arena_alloc(tsample_arena *arena);
+void arena_retain(tsample_arena *arena, uint32_t sample_offset);
+void arena_release(tsample_arena *arena, uint32_t sample_offset);
+tarena_stats arena_get_stats(tsample_arena *arena);
+
+#endif  // !q330_arena_h
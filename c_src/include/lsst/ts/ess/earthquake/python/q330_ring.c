@@ -0,0 +1,248 @@
+/*
+ * This file is part of ts_ess_earthquake.
+ *
+ * Developed for the Vera C. Rubin Observatory Telescope and Site Systems.
+ * This product includes software developed by the LSST Project
+ * (https://www.lsst.org).
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "q330_ring.h"
+
+/**
+ * Initialize a ring on top of caller supplied storage.
+ *
+ * @param ring The ring to initialize.
+ * @param storage Memory for capacity * slot_size bytes.
+ * @param capacity The number of slots, which must be a power of two.
+ * @param slot_size The size of one slot in bytes.
+ */
+void ring_init(tspsc_ring *ring, void *storage, uint32_t capacity, size_t slot_size) {
+    ring->capacity = capacity;
+    ring->slot_size = slot_size;
+    ring->slots = storage;
+    ring_reset(ring);
+}
+
+/**
+ * Discard all pending records and clear the counters.
+ *
+ * This may only be called while neither the producer nor the consumer is
+ * using the ring.
+ *
+ * @param ring The ring to reset.
+ */
+void ring_reset(tspsc_ring *ring) {
+    atomic_store(&ring->head, 0);
+    atomic_store(&ring->tail, 0);
+    atomic_store(&ring->pushed, 0);
+    atomic_store(&ring->overruns, 0);
+    atomic_store(&ring->oversize, 0);
+    atomic_store(&ring->high_water, 0);
+    ring->held = 0;
+    ring->reserved = 0;
+}
+
+/**
+ * Get the slot the producer should fill next.
+ *
+ * @param ring The ring.
+ * @return A pointer to the free slot or NULL if the ring is full, in which
+ *         case the overrun counter is incremented.
+ */
+void *ring_reserve(tspsc_ring *ring) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= ring->capacity) {
+        atomic_fetch_add_explicit(&ring->overruns, 1, memory_order_relaxed);
+        return NULL;
+    }
+    return ring->slots + (size_t)(head & (ring->capacity - 1)) * ring->slot_size;
+}
+
+/**
+ * Convenience function to advance the head and update the counters.
+ *
+ * @param ring The ring.
+ * @param amount The number of slots or bytes to advance the head by.
+ */
+static void ring_publish(tspsc_ring *ring, uint32_t amount) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed) + amount;
+    atomic_store_explicit(&ring->head, head, memory_order_release);
+    atomic_fetch_add_explicit(&ring->pushed, 1, memory_order_relaxed);
+    uint32_t pending = head - atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (pending > atomic_load_explicit(&ring->high_water, memory_order_relaxed)) {
+        atomic_store_explicit(&ring->high_water, pending, memory_order_relaxed);
+    }
+}
+
+/**
+ * Publish the slot previously returned by ring_reserve to the consumer.
+ *
+ * @param ring The ring.
+ */
+void ring_commit(tspsc_ring *ring) { ring_publish(ring, 1); }
+
+/**
+ * Convenience function to get the number of ring bytes taken by a record, including its size prefix.
+ *
+ * @param size The size of the record in bytes.
+ * @return The number of bytes.
+ */
+static uint32_t record_footprint(uint32_t size) {
+    return RING_RECORD_ALIGN + ((size + RING_RECORD_ALIGN - 1) & ~(uint32_t)(RING_RECORD_ALIGN - 1));
+}
+
+/**
+ * Get room for a variable-length record, which the producer should fill next.
+ *
+ * Records never straddle the end of the ring. When the remainder of the ring is too small, it is marked
+ * unused and the record starts at the beginning of the ring.
+ *
+ * @param ring The ring, which needs a slot size of one byte.
+ * @param size The size of the record in bytes.
+ * @return A pointer to size bytes, aligned to RING_RECORD_ALIGN, or NULL if the ring is full, in which case
+ *         the overrun counter is incremented.
+ */
+void *ring_reserve_record(tspsc_ring *ring, uint32_t size) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t total = record_footprint(size);
+    uint32_t pos = head & (ring->capacity - 1);
+    uint32_t skip = ring->capacity - pos < total ? ring->capacity - pos : 0;
+    /* The size is checked first, as the footprint of a size close to UINT32_MAX wraps around. */
+    if (size > ring->capacity - RING_RECORD_ALIGN || head - tail + skip + total > ring->capacity) {
+        atomic_fetch_add_explicit(&ring->overruns, 1, memory_order_relaxed);
+        return NULL;
+    }
+    if (skip) {
+        *(uint32_t *)(ring->slots + pos) = RING_WRAP_MARKER;
+        pos = 0;
+    }
+    *(uint32_t *)(ring->slots + pos) = size;
+    ring->reserved = skip + total;
+    return ring->slots + pos + RING_RECORD_ALIGN;
+}
+
+/**
+ * Publish the record previously returned by ring_reserve_record to the consumer.
+ *
+ * @param ring The ring.
+ */
+void ring_commit_record(tspsc_ring *ring) { ring_publish(ring, ring->reserved); }
+
+/**
+ * Get the first pending record that the consumer does not hold yet, without holding it.
+ *
+ * @param ring The ring, which needs a slot size of one byte.
+ * @param size Set to the size of the record in bytes.
+ * @return A pointer to the record or NULL if no more records are pending.
+ */
+void *ring_peek_record(tspsc_ring *ring, uint32_t *size) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail + ring->held == head) {
+        return NULL;
+    }
+    uint32_t pos = (tail + ring->held) & (ring->capacity - 1);
+    if (*(uint32_t *)(ring->slots + pos) == RING_WRAP_MARKER) {
+        /* The marker is published together with the record that follows it. */
+        ring->held += ring->capacity - pos;
+        pos = 0;
+    }
+    *size = *(uint32_t *)(ring->slots + pos);
+    return ring->slots + pos + RING_RECORD_ALIGN;
+}
+
+/**
+ * Hold the record returned by the last ring_peek_record, so the next peek returns the record after it.
+ *
+ * @param ring The ring.
+ * @param size The size of the record as returned by ring_peek_record.
+ */
+void ring_take_record(tspsc_ring *ring, uint32_t size) { ring->held += record_footprint(size); }
+
+/**
+ * Release the slots held by the consumer and hold up to max_count new ones.
+ *
+ * @param ring The ring.
+ * @param max_count The maximum number of slots to hold.
+ * @return The number of slots now held, which can be accessed with ring_slot.
+ */
+uint32_t ring_acquire(tspsc_ring *ring, uint32_t max_count) {
+    ring_release(ring);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t available = atomic_load_explicit(&ring->head, memory_order_acquire) - tail;
+    ring->held = available < max_count ? available : max_count;
+    return ring->held;
+}
+
+/**
+ * Get one of the slots held by the consumer.
+ *
+ * @param ring The ring.
+ * @param index The index of the slot, less than the value returned by ring_acquire.
+ * @return A pointer to the slot.
+ */
+void *ring_slot(tspsc_ring *ring, uint32_t index) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    return ring->slots + (size_t)((tail + index) & (ring->capacity - 1)) * ring->slot_size;
+}
+
+/**
+ * Keep only the first count slots held by the consumer. The others are left pending and will be acquired
+ * again.
+ *
+ * @param ring The ring.
+ * @param count The number of slots to keep holding, at most the value returned by ring_acquire.
+ */
+void ring_hold(tspsc_ring *ring, uint32_t count) {
+    if (count < ring->held) {
+        ring->held = count;
+    }
+}
+
+/**
+ * Hand the slots held by the consumer back to the producer.
+ *
+ * @param ring The ring.
+ */
+void ring_release(tspsc_ring *ring) {
+    if (ring->held) {
+        uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        atomic_store_explicit(&ring->tail, tail + ring->held, memory_order_release);
+        ring->held = 0;
+    }
+}
+
+/**
+ * Get a snapshot of the ring counters.
+ *
+ * @param ring The ring.
+ * @return The counters as a tring_stats struct.
+ */
+tring_stats ring_get_stats(tspsc_ring *ring) {
+    tring_stats stats;
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    stats.capacity = ring->capacity;
+    stats.count = atomic_load_explicit(&ring->head, memory_order_acquire) - tail;
+    stats.high_water = atomic_load_explicit(&ring->high_water, memory_order_relaxed);
+    stats.pushed = atomic_load_explicit(&ring->pushed, memory_order_relaxed);
+    stats.overruns = atomic_load_explicit(&ring->overruns, memory_order_relaxed);
+    stats.oversize = atomic_load_explicit(&ring->oversize, memory_order_relaxed);
+    return stats;
+}
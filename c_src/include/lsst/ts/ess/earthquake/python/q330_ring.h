@@ -0,0 +1,92 @@
+/*
+ * This file is part of ts_ess_earthquake.
+ *
+ * Developed for the Vera C. Rubin Observatory Telescope and Site Systems.
+ * This product includes software developed by the LSST Project
+ * (https://www.lsst.org).
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef q330_ring_h
+#define q330_ring_h
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RING_CACHE_LINE 64
+/* Variable-length records are prefixed by their size and padded to this alignment. */
+#define RING_RECORD_ALIGN 8
+/* Size prefix marking the unused end of a record ring, the next record starts at the beginning. */
+#define RING_WRAP_MARKER UINT32_MAX
+
+/**
+ * Fixed-capacity, lock-free single-producer/single-consumer ring of
+ * fixed-size slots.
+ *
+ * The producer (the lib330 thread) never blocks: when the ring is full the
+ * new record is dropped and counted as an overrun. The consumer releases the
+ * slots it has popped lazily, at the start of its next pop, so data pointed to
+ * by a popped record stays valid until the consumer pops again.
+ *
+ * A ring with a slot size of one byte can instead hold variable-length records,
+ * see ring_reserve_record. Then head, tail, held, capacity and high_water count
+ * bytes rather than slots, so the number of records a ring holds scales with
+ * their actual size.
+ */
+typedef struct {
+    _Alignas(RING_CACHE_LINE) _Atomic uint32_t head; /* next slot to write, owned by the producer */
+    _Atomic uint64_t pushed;                          /* number of records accepted */
+    _Atomic uint64_t overruns;                        /* number of records dropped because the ring was full */
+    _Atomic uint64_t oversize;                        /* number of records dropped because they exceed a slot */
+    _Atomic uint32_t high_water;                      /* highest number of records pending at once */
+    uint32_t reserved;                                /* bytes taken by the last reserved record */
+    _Alignas(RING_CACHE_LINE) _Atomic uint32_t tail;  /* next slot to read, owned by the consumer */
+    uint32_t held;                                    /* slots popped but not yet released */
+    _Alignas(RING_CACHE_LINE) uint32_t capacity;      /* number of slots, a power of two */
+    size_t slot_size;                                 /* size of one slot in bytes */
+    unsigned char *slots;                             /* capacity * slot_size bytes of storage */
+} tspsc_ring;
+
+/**
+ * Snapshot of the counters of a ring, which can be passed to Python.
+ */
+typedef struct {
+    uint32_t capacity;   /* number of slots */
+    uint32_t count;      /* number of records pending */
+    uint32_t high_water; /* highest number of records pending at once */
+    uint64_t pushed;     /* number of records accepted */
+    uint64_t overruns;   /* number of records dropped because the ring was full */
+    uint64_t oversize;   /* number of records dropped because they exceed a slot */
+} tring_stats;
+
+void ring_init(tspsc_ring *ring, void *storage, uint32_t capacity, size_t slot_size);
+void ring_reset(tspsc_ring *ring);
+void *ring_reserve(tspsc_ring *ring);
+void ring_commit(tspsc_ring *ring);
+uint32_t ring_acquire(tspsc_ring *ring, uint32_t max_count);
+void *ring_slot(tspsc_ring *ring, uint32_t index);
+void ring_hold(tspsc_ring *ring, uint32_t count);
+void *ring_reserve_record(tspsc_ring *ring, uint32_t size);
+void ring_commit_record(tspsc_ring *ring);
+void *ring_peek_record(tspsc_ring *ring, uint32_t *size);
+void ring_take_record(tspsc_ring *ring, uint32_t size);
+void ring_release(tspsc_ring *ring);
+tring_stats ring_get_stats(tspsc_ring *ring);
+
+#endif  // !q330_ring_h
@@ -0,0 +1,222 @@
+/*
+ * This file is part of ts_ess_earthquake.
+ *
+ * Developed for the Vera C. Rubin Observatory Telescope and Site Systems.
+ * This product includes software developed by the LSST Project
+ * (https://www.lsst.org).
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+#include "q330_triad.h"
+
+/**
+ * Initialize an assembler without any pending triads.
+ *
+ * @param assembler The assembler to initialize.
+ * @param ring The ring of ttriad slots to queue the triads in.
+ * @param arena The arena to copy the samples into.
+ * @param timeout The number of seconds of data time after which a partial triad is queued.
+ */
+void triad_init(ttriad_assembler *assembler, tspsc_ring *ring, tsample_arena *arena, double timeout) {
+    assembler->ring = ring;
+    assembler->arena = arena;
+    assembler->timeout = timeout;
+    memset(assembler->pending, 0, sizeof(assembler->pending));
+    atomic_store(&assembler->complete, 0);
+    atomic_store(&assembler->partial, 0);
+    atomic_store(&assembler->dropped, 0);
+}
+
+/**
+ * Convenience function to release the arena blocks of the components of a triad.
+ *
+ * @param assembler The assembler.
+ * @param triad The triad.
+ */
+static void release_components(ttriad_assembler *assembler, ttriad *triad) {
+    for (int i = 0; i < TRIAD_COMPONENTS; i++) {
+        if (triad->components & (1 << i)) {
+            arena_release(assembler->arena, triad->sample_offset[i]);
+        }
+    }
+}
+
+/**
+ * Discard the pending triads and the queued triads the consumer did not pop yet, returning their arena
+ * blocks.
+ *
+ * This may only be called while neither the producer nor the consumer is using the ring.
+ *
+ * @param assembler The assembler.
+ */
+void triad_reset(ttriad_assembler *assembler) {
+    for (int band = 0; band < TRIAD_MAX_BANDS; band++) {
+        release_components(assembler, &assembler->pending[band]);
+    }
+    memset(assembler->pending, 0, sizeof(assembler->pending));
+    uint32_t count = ring_acquire(assembler->ring, assembler->ring->capacity);
+    for (uint32_t i = 0; i < count; i++) {
+        release_components(assembler, ring_slot(assembler->ring, i));
+    }
+    ring_release(assembler->ring);
+}
+
+/**
+ * Convenience function to queue the pending triad of a band and start a new one.
+ *
+ * @param assembler The assembler.
+ * @param triad The pending triad, which needs at least one component.
+ * @return 1 if the triad was queued, 0 if it was dropped because the ring is full.
+ */
+static int queue_triad(ttriad_assembler *assembler, ttriad *triad) {
+    ttriad *slot = ring_reserve(assembler->ring);
+    if (slot == NULL) {
+        /* The ring counts the overrun. */
+        release_components(assembler, triad);
+        triad->components = 0;
+        return 0;
+    }
+    *slot = *triad;
+    ring_commit(assembler->ring);
+    if (triad->components == TRIAD_COMPLETE) {
+        atomic_fetch_add_explicit(&assembler->complete, 1, memory_order_relaxed);
+    } else {
+        atomic_fetch_add_explicit(&assembler->partial, 1, memory_order_relaxed);
+    }
+    triad->components = 0;
+    return 1;
+}
+
+/**
+ * Convenience function to find the pending triad of a band, claiming a free one if the band is new.
+ *
+ * @param assembler The assembler.
+ * @param station_name The network and station.
+ * @param location The location.
+ * @param channel The channel name, of which the first two characters are the band.
+ * @return The pending triad or NULL if all bands are taken.
+ */
+static ttriad *find_band(ttriad_assembler *assembler, const char *station_name, const char *location,
+                         const char *channel) {
+    ttriad *free_triad = NULL;
+    for (int band = 0; band < TRIAD_MAX_BANDS; band++) {
+        ttriad *triad = &assembler->pending[band];
+        if (triad->band[0] == '\0') {
+            if (free_triad == NULL) {
+                free_triad = triad;
+            }
+        } else if (strncmp(triad->band, channel, 2) == 0 &&
+                   strncmp(triad->station_name, station_name, sizeof(triad->station_name)) == 0 &&
+                   strncmp(triad->location, location, sizeof(triad->location)) == 0) {
+            return triad;
+        }
+    }
+    if (free_triad) {
+        strncpy(free_triad->station_name, station_name, sizeof(free_triad->station_name) - 1);
+        strncpy(free_triad->location, location, sizeof(free_triad->location) - 1);
+        memcpy(free_triad->band, channel, 2);
+    }
+    return free_triad;
+}
+
+/**
+ * Add the one second data of one component.
+ *
+ * Channels of which the third character is not E, N or Z are not part of a triad and are ignored.
+ *
+ * @param assembler The assembler.
+ * @param timestamp The time of the data.
+ * @param rate The sampling rate.
+ * @param chan_number The channel number according to tokens.
+ * @param station_name The network and station.
+ * @param location The location.
+ * @param channel The channel name.
+ * @param samples The valid samples.
+ * @param sample_count The number of valid samples, at most the block size of the arena.
+ * @return The number of triads queued.
+ */
+int triad_add(ttriad_assembler *assembler, double timestamp, int32_t rate, uint8_t chan_number,
+              const char *station_name, const char *location, const char *channel, const int32_t *samples,
+              uint32_t sample_count) {
+    int queued = 0;
+    for (int band = 0; band < TRIAD_MAX_BANDS; band++) {
+        ttriad *triad = &assembler->pending[band];
+        if (triad->components && timestamp - triad->timestamp >= assembler->timeout) {
+            queued += queue_triad(assembler, triad);
+        }
+    }
+
+    int component;
+    switch (channel[0] && channel[1] ? channel[2] : '\0') {
+        case 'E':
+            component = TRIAD_EAST;
+            break;
+        case 'N':
+            component = TRIAD_NORTH;
+            break;
+        case 'Z':
+            component = TRIAD_ZENITH;
+            break;
+        default:
+            return queued;
+    }
+    ttriad *triad = find_band(assembler, station_name, location, channel);
+    if (triad == NULL || sample_count > assembler->arena->block_samples) {
+        atomic_fetch_add_explicit(&assembler->dropped, 1, memory_order_relaxed);
+        return queued;
+    }
+    if (triad->components && (triad->timestamp != timestamp || triad->components & (1 << component))) {
+        queued += queue_triad(assembler, triad);
+    }
+    int32_t offset = arena_alloc(assembler->arena);
+    if (offset < 0) {
+        atomic_fetch_add_explicit(&assembler->dropped, 1, memory_order_relaxed);
+        return queued;
+    }
+    memcpy(assembler->arena->samples + offset, samples, sample_count * sizeof(int32_t));
+    if (triad->components == 0) {
+        triad->timestamp = timestamp;
+        triad->rate = rate;
+        memset(triad->sample_count, 0, sizeof(triad->sample_count));
+        memset(triad->sample_offset, 0, sizeof(triad->sample_offset));
+        memset(triad->chan_number, 0, sizeof(triad->chan_number));
+    }
+    triad->sample_count[component] = sample_count;
+    triad->sample_offset[component] = offset;
+    triad->chan_number[component] = chan_number;
+    triad->components |= 1 << component;
+    if (triad->components == TRIAD_COMPLETE) {
+        queued += queue_triad(assembler, triad);
+    }
+    return queued;
+}
+
+/**
+ * Get a snapshot of the assembler counters.
+ *
+ * @param assembler The assembler.
+ * @return The counters as a ttriad_stats struct.
+ */
+ttriad_stats triad_get_stats(ttriad_assembler *assembler) {
+    ttriad_stats stats;
+    stats.complete = atomic_load_explicit(&assembler->complete, memory_order_relaxed);
+    stats.partial = atomic_load_explicit(&assembler->partial, memory_order_relaxed);
+    stats.dropped = atomic_load_explicit(&assembler->dropped, memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,95 @@
+/*
+ * This file is part of ts_ess_earthquake.
+ *
+ * Developed for the Vera C. Rubin Observatory Telescope and Site Systems.
+ * This product includes software developed by the LSST Project
+ * (https://www.lsst.org).
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef q330_triad_h
+#define q330_triad_h
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "q330_arena.h"
+#include "q330_ring.h"
+
+/* The components of a triad, in the order of its arrays. */
+#define TRIAD_EAST 0
+#define TRIAD_NORTH 1
+#define TRIAD_ZENITH 2
+#define TRIAD_COMPONENTS 3
+/* Mask of a triad with all components present. */
+#define TRIAD_COMPLETE ((1 << TRIAD_COMPONENTS) - 1)
+/* Maximum number of bands, e.g. "HH" or "LH", a station is assembled for. */
+#define TRIAD_MAX_BANDS 16
+
+/**
+ * The east, north and zenith samples of one band for one timestamp, which can be passed to Python. The
+ * samples of each component are sample_count[i] consecutive entries of the sample arena starting at
+ * sample_offset[i]. A component that is missing has its bit in components cleared and no samples.
+ */
+typedef struct {
+    double timestamp;                          /* time of data, corrected for any filtering */
+    int32_t rate;                              /* sampling rate */
+    uint32_t sample_count[TRIAD_COMPONENTS];   /* number of valid samples per component */
+    uint32_t sample_offset[TRIAD_COMPONENTS];  /* arena offset of the samples per component */
+    uint8_t chan_number[TRIAD_COMPONENTS];     /* channel number according to tokens per component */
+    uint8_t components;                        /* bit mask of the components present */
+    char station_name[10];                     /* network and station */
+    char location[3];
+    char band[3]; /* first two characters of the channel names */
+} ttriad;
+
+/**
+ * Snapshot of the counters of an assembler, which can be passed to Python.
+ */
+typedef struct {
+    uint64_t complete; /* number of triads queued with all components */
+    uint64_t partial;  /* number of triads queued with missing components */
+    uint64_t dropped;  /* number of components dropped for lack of a band or arena block */
+} ttriad_stats;
+
+/**
+ * Assembler of the one second data of the components of each band into triads.
+ *
+ * A triad is queued as soon as all of its components arrived. It is queued with missing components when a
+ * component with a different timestamp arrives for its band, or when data that is at least timeout seconds
+ * newer arrives for any band. The timeout is in data time, so it needs no timer. The assembler is used by the
+ * producer of its ring only.
+ */
+typedef struct {
+    tspsc_ring *ring;                  /* ring of ttriad the triads are queued in */
+    tsample_arena *arena;              /* arena the samples are copied into */
+    double timeout;                    /* seconds of data time after which a partial triad is queued */
+    ttriad pending[TRIAD_MAX_BANDS];   /* triad being assembled per band, a free band has an empty name */
+    _Atomic uint64_t complete;         /* number of triads queued with all components */
+    _Atomic uint64_t partial;          /* number of triads queued with missing components */
+    _Atomic uint64_t dropped;          /* number of components dropped */
+} ttriad_assembler;
+
+void triad_init(ttriad_assembler *assembler, tspsc_ring *ring, tsample_arena *arena, double timeout);
+void triad_reset(ttriad_assembler *assembler);
+int triad_add(ttriad_assembler *assembler, double timestamp, int32_t rate, uint8_t chan_number,
+              const char *station_name, const char *location, const char *channel, const int32_t *samples,
+              uint32_t sample_count);
+ttriad_stats triad_get_stats(ttriad_assembler *assembler);
+
+#endif  // !q330_triad_h
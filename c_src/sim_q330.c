@@ -0,0 +1,828 @@
+/*
+ * This file is part of ts_ess_earthquake.
+ *
+ * Developed for the Vera C. Rubin Observatory Telescope and Site Systems.
+ * This product includes software developed by the LSST Project
+ * (https://www.lsst.org).
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Simulator of one logical port of a Q330, so lib330 can be tested and
+ * benchmarked on loopback without a digitizer.
+ *
+ * The control port answers what lib330 sends from registration to
+ * LIBSTATE_RUNWAIT: the server challenge and acknowledge, the combined
+ * fixed values, global, logical port and sensor control structures, the GPS
+ * IDs, the status structures and the memory reads of the DP tokens, and the
+ * structures of a status dump as zeros. The
+ * tokens describe one LCQ per simulated channel. After the DT_OPEN of
+ * LIBSTATE_RUN the data port sends one second of compressed sine waves per
+ * data sequence number through the sliding window, resending what is not
+ * acknowledged, with optional random and periodic packet losses so recovery
+ * can be measured too. A window programmed with C1_SLOG replaces the -w one.
+ *
+ * Usage: sim_q330 [-p baseport] [-d dataport] [-c channels] [-r rate[,rate...]]
+ *                 [-x speed] [-w window] [-k ackcount[:acktimeout]] [-t resend_ms]
+ *                 [-l loss_percent] [-b period:burst] [-s NET-STA] [-n seconds] [-v]
+ *
+ * The control port is baseport + 2 * dataport and the data port the one after
+ * it, as on a Q330. A speed of 1, the default, generates one second of data
+ * per second, 10 ten seconds per second and 0 as much as the window allows.
+ * With -b every period packets sent, the first burst are dropped.
+ *
+ * lib330 treats 127.0.0.1 as a baler announcement on loopback, register with
+ * another loopback address such as 127.0.0.2 instead.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "libstrucs.h"
+#include "libslider.h"
+#include "libtokens.h"
+#include "libcvrt.h"
+#include "q330cvrt.h"
+#include "libsupport.h"
+
+#define SIM_FREQ_BIT 4 /* frequency bit of all simulated channels */
+#define SIM_AMPLITUDE 10000.0 /* counts */
+#define SIM_PERIOD 10.0 /* seconds of the sine wave of the first channel */
+#define MAX_PENDING 8 /* packets of one data second, a timing blockette and up to six channels */
+#define SIM_MAX_RATE 250 /* highest rate a single DC_COMP blockette holds */
+#define STAT_INTERVAL 10.0 /* seconds between statistics lines */
+
+typedef struct {
+    byte buf[QDP_HDR_LTH + MAXDATA];
+    integer lth;
+    double sent; /* 0 until sent, monotonic seconds otherwise */
+    bool acked;
+} tsimpkt;
+
+static struct {
+    /* options */
+    word baseport;
+    integer dataport;
+    integer channels;
+    integer rates[CHANNELS];
+    double speed;
+    word window;
+    word ack_cnt;
+    word ack_to;
+    double resend;
+    double loss;
+    longword burst_period;
+    longword burst;
+    char network[3];
+    char station[6];
+    double duration;
+    bool verbose;
+    /* sockets and registration */
+    int csock;
+    int dsock;
+    struct sockaddr_in dataaddr;
+    bool registered;
+    bool dataopen;
+    word ctrlseq;
+    crc_table_type crc_table;
+    byte tokens[MAXSEG * 4];
+    integer toklth;
+    /* sliding window, indexed by sequence modulo WINBUFS */
+    tsimpkt win[WINBUFS];
+    word lowseq; /* oldest sequence not acknowledged */
+    word nextseq; /* sequence of the next new packet */
+    /* data generation */
+    tsimpkt pending[MAX_PENDING];
+    integer npending;
+    integer pendidx;
+    longword seconds; /* data seconds generated */
+    longword first_time; /* seconds since 2000 of the first data second */
+    longint prev[CHANNELS];
+    /* statistics */
+    longword sent;
+    longword resent;
+    longword dropped;
+    longword acked;
+    longword badcrc;
+    unsigned int seed;
+} sim;
+
+static volatile sig_atomic_t running = 1;
+
+static void stop_handler(int sig) { running = 0; }
+
+static double mono(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* Store the header and the CRC of the lth bytes of payload following it. */
+static integer finish_qdp(byte *buf, byte cmd, integer lth, word seq, word ack) {
+    pbyte p = buf;
+    storeqdphdr(&p, cmd, lth, seq, ack);
+    p = buf;
+    storelongint(&p, gcrccalc(&sim.crc_table, buf + 4, QDP_HDR_LTH + lth - 4));
+    return QDP_HDR_LTH + lth;
+}
+
+static void send_control(struct sockaddr_in *to, byte cmd, byte *payload, integer lth, word ack) {
+    byte buf[QDP_HDR_LTH + MAXDATA];
+    memcpy(buf + QDP_HDR_LTH, payload, lth);
+    lth = finish_qdp(buf, cmd, lth, sim.ctrlseq++, ack);
+    sendto(sim.csock, buf, lth, 0, (struct sockaddr *)to, sizeof(*to));
+}
+
+static void send_cack(struct sockaddr_in *to, word ack) { send_control(to, C1_CACK, NULL, 0, ack); }
+
+static void send_cerr(struct sockaddr_in *to, word code, word ack) {
+    byte payload[2];
+    pbyte p = payload;
+    storeword(&p, code);
+    send_control(to, C1_CERR, payload, 2, ack);
+}
+
+/* A structure lib330 only logs, all zeros. */
+static void send_empty(struct sockaddr_in *to, byte cmd, integer lth, word ack) {
+    byte payload[MAXDATA];
+    memset(payload, 0, lth);
+    send_control(to, cmd, payload, lth, ack);
+}
+
+static char band_code(integer rate) {
+    if (rate >= 80) {
+        return 'H';
+    }
+    return rate >= 10 ? 'B' : 'L';
+}
+
+/* The DP tokens, the version, the station and one LCQ per channel. */
+static void build_tokens(void) {
+    pbyte p = sim.tokens;
+    storebyte(&p, TF_VERSION);
+    storebyte(&p, T_VER);
+    storebyte(&p, TF_NET_STAT);
+    storeblock(&p, 2, sim.network);
+    storeblock(&p, 5, sim.station);
+    for (integer c = 0; c < sim.channels; c++) {
+        char seedname[3] = {band_code(sim.rates[c]), 'H', "ZNE"[c % 3]};
+        storebyte(&p, T1_LCQ);
+        storebyte(&p, 15); /* size, including itself */
+        storeblock(&p, 2, c < 3 ? "00" : "10");
+        storeblock(&p, 3, seedname);
+        storebyte(&p, c + 1);
+        storebyte(&p, DC_D32 | c);
+        storebyte(&p, SIM_FREQ_BIT);
+        storelongword(&p, 0);
+        storeint16(&p, sim.rates[c]);
+    }
+    sim.toklth = p - sim.tokens;
+}
+
+/* Raw logical port programming, the part lib330 looks at. */
+static void store_log(pbyte *p) {
+    storeword(p, sim.dataport);
+    storeword(p, 0); /* flags */
+    storeword(p, 0); /* perc */
+    storeword(p, 576); /* mtu */
+    storeword(p, 0); /* grp_cnt */
+    storeword(p, sim.resend * 20 + 0.5); /* rsnd_max in 0.1 seconds */
+    storeword(p, 0); /* grp_to */
+    storeword(p, sim.resend * 10 + 0.5); /* rsnd_min */
+    storeword(p, sim.window);
+    storeword(p, sim.lowseq); /* dataseq, where lib330 expects the window to start */
+    for (integer c = 0; c < CHANNELS; c++) {
+        storeword(p, c < sim.channels ? 1 << SIM_FREQ_BIT : 0);
+    }
+    storeword(p, sim.ack_cnt);
+    storeword(p, sim.ack_to);
+    storelongword(p, 0); /* olddata */
+    storeword(p, 0); /* eth_throttle */
+    storeword(p, 0); /* full_alert */
+    storeword(p, 0); /* auto_filter */
+    storeword(p, 0); /* man_filter */
+    storelongword(p, 0); /* spare */
+}
+
+static void send_fgls(struct sockaddr_in *to, word ack) {
+    byte payload[8 + RAW_FIXED_SIZE + RAW_GLOBAL_SIZE + 32 + RAW_LOG_SIZE];
+    memset(payload, 0, sizeof(payload));
+    pbyte p = payload;
+    storeword(&p, 8 + RAW_FIXED_SIZE); /* global */
+    storeword(&p, 8 + RAW_FIXED_SIZE + RAW_GLOBAL_SIZE); /* sensor control */
+    storeword(&p, 8 + RAW_FIXED_SIZE + RAW_GLOBAL_SIZE + 32); /* logical port */
+    p = payload + 8 + RAW_FIXED_SIZE + RAW_GLOBAL_SIZE + 32;
+    store_log(&p);
+    send_control(to, C1_FGLS, payload, sizeof(payload), ack);
+}
+
+/* The requested status structures lib330 asks for, others are left out of
+   the returned bitmap. */
+static void send_status(struct sockaddr_in *to, longword request, word ack) {
+    byte payload[MAXDATA];
+    memset(payload, 0, sizeof(payload));
+    pbyte p = payload + 4;
+    longword have = 0;
+    longword dsn = sim.seconds;
+    for (integer bit = SRB_GLB; bit <= SRB_LOG4; bit++) {
+        if ((request & make_bitmap(bit)) == 0) {
+            continue;
+        }
+        pbyte pstart = p;
+        switch (bit) {
+            case SRB_GLB:
+                p += 2;
+                storeword(&p, PLL_LOCK | CQ_3D); /* clock_qual */
+                p += 4;
+                storelongword(&p, sim.first_time - 1); /* sec_offset */
+                p = pstart + 48;
+                storelongword(&p, dsn); /* cur_sequence */
+                break;
+            case SRB_GST:
+                p += 84;
+                break;
+            case SRB_PWR:
+                p += 20;
+                break;
+            case SRB_BOOM:
+                p += 32;
+                break;
+            case SRB_PLL:
+                p += 28;
+                break;
+            case SRB_GSAT:
+            case SRB_ARP:
+                storeword(&p, 0); /* count */
+                storeword(&p, 4); /* blk_size */
+                break;
+            case SRB_LOG1:
+            case SRB_LOG2:
+            case SRB_LOG3:
+            case SRB_LOG4:
+                storelongword(&p, sim.sent);
+                storelongword(&p, sim.resent);
+                storelongword(&p, 0); /* fill */
+                storelongword(&p, sim.nextseq);
+                storelongword(&p, (word)(sim.nextseq - sim.lowseq)); /* pack_used */
+                storelongword(&p, (word)(sim.lowseq - 1)); /* last_ack */
+                storeword(&p, 0); /* phy_num */
+                storeword(&p, bit - SRB_LOG1);
+                storeword(&p, 0); /* retran */
+                storeword(&p, 0); /* flags */
+                break;
+            default:
+                continue;
+        }
+        have |= make_bitmap(bit);
+    }
+    pbyte pmap = payload;
+    storelongword(&pmap, have);
+    send_control(to, C1_STAT, payload, p - payload, ack);
+}
+
+/* One segment of the tokens, segments start MAXSEG + OVERHEAD apart. */
+static void send_memory(struct sockaddr_in *to, pbyte p, word ack) {
+    tmem req;
+    loadmemhdr(&p, &req);
+    integer segtotal = (sim.toklth + MAXSEG - 1) / MAXSEG;
+    integer segnum = req.start / (MAXSEG + OVERHEAD) + 1;
+    if ((req.memtype != MT_CFG1 + sim.dataport) || (segnum > segtotal)) {
+        send_cerr(to, CERR_SNV, ack);
+        return;
+    }
+    integer lth = sim.toklth - (segnum - 1) * MAXSEG;
+    if (lth > MAXSEG) {
+        lth = MAXSEG;
+    }
+    byte payload[12 + MAXSEG];
+    tmem hdr = {req.start, lth + 4, req.memtype};
+    pbyte q = payload;
+    storememhdr(&q, &hdr);
+    storeword(&q, segnum);
+    storeword(&q, segtotal);
+    storeblock(&q, lth, sim.tokens + (segnum - 1) * MAXSEG);
+    send_control(to, C1_MEM, payload, q - payload, ack);
+}
+
+static void control_packet(byte *buf, integer lth, struct sockaddr_in *from) {
+    tqdp hdr;
+    pbyte p = buf;
+    loadqdphdr(&p, &hdr);
+    if ((hdr.datalength + QDP_HDR_LTH > lth) || (hdr.crc != gcrccalc(&sim.crc_table, buf + 4, lth - 4))) {
+        sim.badcrc++;
+        return;
+    }
+    if (sim.verbose) {
+        printf("Control command %02X, sequence %d\n", hdr.command, hdr.sequence);
+    }
+    byte payload[MAXDATA];
+    pbyte q = payload;
+    switch (hdr.command) {
+        case C1_RQSRV:
+            storelongword(&q, rand_r(&sim.seed));
+            storelongword(&q, rand_r(&sim.seed)); /* challenge */
+            storelongword(&q, ntohl(from->sin_addr.s_addr));
+            storeword(&q, ntohs(from->sin_port));
+            storeword(&q, 0);
+            send_control(from, C1_SRVCH, payload, q - payload, hdr.sequence);
+            return;
+        case C1_SRVRSP:
+            if (!sim.registered) {
+                printf("Registered from port %d\n", ntohs(from->sin_port));
+            }
+            sim.registered = true;
+            send_cack(from, hdr.sequence);
+            return;
+        case C1_PING:
+            if (loadword(&p) != 0) {
+                send_cerr(from, CERR_PAR, hdr.sequence);
+                return;
+            }
+            storeword(&q, 1); /* ping response */
+            storeword(&q, loadword(&p));
+            send_control(from, C1_PING, payload, q - payload, hdr.sequence);
+            return;
+    }
+    if (!sim.registered) {
+        send_cerr(from, CERR_NOTR, hdr.sequence);
+        return;
+    }
+    switch (hdr.command) {
+        case C1_DSRV:
+            printf("Deregistered\n");
+            sim.registered = false;
+            sim.dataopen = false;
+            send_cack(from, hdr.sequence);
+            break;
+        case C1_RQFGLS:
+            send_fgls(from, hdr.sequence);
+            break;
+        case C1_RQLOG:
+            store_log(&q);
+            send_control(from, C1_LOG, payload, q - payload, hdr.sequence);
+            break;
+        case C1_RQGID:
+            send_empty(from, C1_GID, 9 * 32, hdr.sequence);
+            break;
+        case C2_RQGPS:
+            send_empty(from, C2_GPS, 60, hdr.sequence);
+            break;
+        case C1_RQMAN:
+            send_empty(from, C1_MAN, 84, hdr.sequence);
+            break;
+        case C1_RQDCP:
+            send_empty(from, C1_DCP, 2 * CHANNELS * 4, hdr.sequence);
+            break;
+        case C1_RQSTAT:
+            send_status(from, loadlongword(&p), hdr.sequence);
+            break;
+        case C1_RQMEM:
+            send_memory(from, p, hdr.sequence);
+            break;
+        case C1_SLOG: {
+            tlog log;
+            loadlog(&p, &log);
+            if ((log.window >= 1) && (log.window <= WINWRAP) && (log.window != sim.window)) {
+                printf("Window changed from %d to %d\n", sim.window, log.window);
+                sim.window = log.window;
+            }
+            send_cack(from, hdr.sequence);
+            break;
+        }
+        case C1_UMSG:
+        case C1_WEB:
+            send_cack(from, hdr.sequence);
+            break;
+        default:
+            send_cerr(from, CERR_PAR, hdr.sequence);
+            break;
+    }
+}
+
+/* Send or resend a packet of the window, unless the loss pattern drops it. */
+static void transmit(tsimpkt *pkt, double t) {
+    longword count = sim.sent + sim.resent;
+    if (pkt->sent != 0) {
+        sim.resent++;
+    } else {
+        sim.sent++;
+    }
+    pkt->sent = t;
+    if (((sim.burst_period) && ((count % sim.burst_period) < sim.burst)) ||
+        ((sim.loss > 0) && (rand_r(&sim.seed) < sim.loss * 0.01 * RAND_MAX))) {
+        sim.dropped++;
+        return;
+    }
+    sendto(sim.dsock, pkt->buf, pkt->lth, 0, (struct sockaddr *)&sim.dataaddr, sizeof(sim.dataaddr));
+}
+
+static bool fits(longint *diffs, integer count, integer bits) {
+    longint limit = 1 << (bits - 1);
+    for (integer i = 0; i < count; i++) {
+        if ((diffs[i] < -limit) || (diffs[i] >= limit)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Compress one second of a channel into a DC_COMP blockette, returns its
+   length. Each block holds as many differences as fit, padded with zeros at
+   the end of the second. */
+static integer build_blockette(integer c, byte *blk) {
+    static const integer samps[4] = {4, 3, 2, 1};
+    static const integer bits[4] = {8, 10, 15, 30};
+    static const longword dnib[4] = {0, 3, 2, 1};
+    integer rate = sim.rates[c];
+    longint diffs[SIM_MAX_RATE + 4];
+    longword words[SIM_MAX_RATE];
+    byte codes[SIM_MAX_RATE];
+    longint last = sim.prev[c];
+    for (integer i = 0; i < rate; i++) {
+        double t = ((double)sim.seconds * rate + i) / rate;
+        longint sample = lround(SIM_AMPLITUDE * sin(2 * M_PI * t / (SIM_PERIOD + c)));
+        diffs[i] = sample - last;
+        last = sample;
+    }
+    memset(diffs + rate, 0, 4 * sizeof(longint));
+    integer blocks = 0;
+    integer i = 0;
+    while (i < rate) {
+        integer k = 0;
+        while ((k < 3) && !fits(diffs + i, samps[k], bits[k])) {
+            k++;
+        }
+        longword w = dnib[k] << 30;
+        for (integer j = 0; j < samps[k]; j++) {
+            w |= ((longword)diffs[i + j] & ((1U << bits[k]) - 1)) << (bits[k] * (samps[k] - 1 - j));
+        }
+        words[blocks] = w;
+        codes[blocks] = k == 0 ? 1 : 2;
+        blocks++;
+        i += samps[k];
+    }
+    integer mapwords = (blocks + 7) / 8;
+    integer offset = (10 + 2 * mapwords + 3) & ~3;
+    integer size = offset + 4 * blocks;
+    memset(blk, 0, offset);
+    pbyte p = blk;
+    storebyte(&p, DC_COMP | c);
+    storebyte(&p, SIM_FREQ_BIT);
+    storeword(&p, size);
+    storelongint(&p, sim.prev[c]);
+    storeword(&p, offset);
+    for (integer m = 0; m < mapwords; m++) {
+        word map = 0;
+        for (integer b = 0; b < 8; b++) {
+            map = (map << 2) | ((m * 8 + b < blocks) ? codes[m * 8 + b] : 0);
+        }
+        storeword(&p, map);
+    }
+    p = blk + offset;
+    for (integer b = 0; b < blocks; b++) {
+        storelongword(&p, words[b]);
+    }
+    sim.prev[c] = last;
+    return size;
+}
+
+/* Split the next data second in packets of at most MAXDATA bytes, the first
+   starting with the timing blockette. Sequence numbers are given when the
+   packets enter the window. */
+static void generate_second(void) {
+    longword dsn = sim.seconds + 1;
+    byte blk[80 + 4 * SIM_MAX_RATE];
+    sim.npending = 0;
+    sim.pendidx = 0;
+    tsimpkt *pkt = &sim.pending[0];
+    pbyte p = pkt->buf + QDP_HDR_LTH;
+    storelongword(&p, dsn);
+    storebyte(&p, DC_MN232);
+    storebyte(&p, PLL_LOCK | CQ_3D); /* clock quality */
+    storeword(&p, 0); /* minutes since loss */
+    storelongint(&p, sim.first_time - 1); /* seconds offset, time = dsn + offset */
+    storelongint(&p, 0); /* usec offset */
+    for (integer c = 0; c < sim.channels; c++) {
+        integer size = build_blockette(c, blk);
+        if (size > MAXDATA - 4) {
+            fprintf(stderr, "One second of channel %d does not fit in a packet.\n", c + 1);
+            exit(1);
+        }
+        if (p - (pkt->buf + QDP_HDR_LTH) + size > MAXDATA) {
+            pkt->lth = p - pkt->buf;
+            sim.npending++;
+            pkt = &sim.pending[sim.npending];
+            p = pkt->buf + QDP_HDR_LTH;
+            storelongword(&p, dsn);
+        }
+        storeblock(&p, size, blk);
+    }
+    pkt->lth = p - pkt->buf;
+    sim.npending++;
+    sim.seconds++;
+}
+
+/* Move pending packets into the window while it has room. */
+static void fill_window(double t) {
+    while (((word)(sim.nextseq - sim.lowseq) < sim.window) && (sim.pendidx < sim.npending)) {
+        tsimpkt *pkt = &sim.win[sim.nextseq % WINBUFS];
+        tsimpkt *src = &sim.pending[sim.pendidx++];
+        memcpy(pkt->buf, src->buf, src->lth);
+        pkt->lth = finish_qdp(pkt->buf, DT_DATA, src->lth - QDP_HDR_LTH, sim.nextseq, 0);
+        pkt->sent = 0;
+        pkt->acked = false;
+        sim.nextseq++;
+        transmit(pkt, t);
+    }
+}
+
+/* lib330 acknowledges everything up to the header's acknowledge field, and
+   bit i of the map the packet that many after it. */
+static void process_dack(pbyte p, word lowack) {
+    longword acks[4];
+    p += 4; /* throttle and spare */
+    for (integer i = 0; i < 4; i++) {
+        acks[i] = loadlongword(&p);
+    }
+    for (word seq = sim.lowseq; seq != sim.nextseq; seq++) {
+        tsimpkt *pkt = &sim.win[seq % WINBUFS];
+        word d = seq - lowack;
+        if ((d == 0) || (d >= 0x8000) || ((d < WINBUFS) && (acks[d >> 5] & (1U << (d & 31))))) {
+            if (!pkt->acked) {
+                pkt->acked = true;
+                sim.acked++;
+            }
+        }
+    }
+    while ((sim.lowseq != sim.nextseq) && sim.win[sim.lowseq % WINBUFS].acked) {
+        sim.lowseq++;
+    }
+}
+
+static void data_packet(byte *buf, integer lth, struct sockaddr_in *from) {
+    tqdp hdr;
+    pbyte p = buf;
+    loadqdphdr(&p, &hdr);
+    if ((hdr.datalength + QDP_HDR_LTH > lth) || (hdr.crc != gcrccalc(&sim.crc_table, buf + 4, lth - 4))) {
+        sim.badcrc++;
+        return;
+    }
+    if (!sim.registered) {
+        return;
+    }
+    switch (hdr.command) {
+        case DT_OPEN:
+            if (sim.verbose || !sim.dataopen) {
+                printf("Data port opened from port %d, resending from %d\n", ntohs(from->sin_port), sim.lowseq);
+            }
+            sim.dataaddr = *from;
+            sim.dataopen = true;
+            for (word seq = sim.lowseq; seq != sim.nextseq; seq++) {
+                sim.win[seq % WINBUFS].sent = -1; /* resend now */
+            }
+            break;
+        case DT_DACK:
+            if (hdr.datalength >= 24) {
+                process_dack(p, hdr.acknowledge);
+            }
+            break;
+    }
+}
+
+static void read_socket(int sock, bool control) {
+    byte buf[2048];
+    struct sockaddr_in from;
+    socklen_t fromlth;
+    for (;;) {
+        fromlth = sizeof(from);
+        ssize_t lth = recvfrom(sock, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *)&from, &fromlth);
+        if (lth < 0) {
+            return;
+        }
+        if (lth < QDP_HDR_LTH) {
+            continue;
+        }
+        if (control) {
+            control_packet(buf, lth, &from);
+        } else {
+            data_packet(buf, lth, &from);
+        }
+    }
+}
+
+static void run_data(double t, double start) {
+    for (word seq = sim.lowseq; seq != sim.nextseq; seq++) {
+        tsimpkt *pkt = &sim.win[seq % WINBUFS];
+        if (!pkt->acked && (t - pkt->sent >= sim.resend)) {
+            transmit(pkt, t);
+        }
+    }
+    for (;;) {
+        fill_window(t);
+        if ((sim.pendidx < sim.npending) || ((word)(sim.nextseq - sim.lowseq) >= sim.window)) {
+            return;
+        }
+        if ((sim.speed > 0) && (sim.seconds >= (t - start) * sim.speed + 1)) {
+            return;
+        }
+        generate_second();
+    }
+}
+
+static int open_port(word port) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(port);
+    if (bind(sock, (struct sockaddr *)&local, sizeof(local)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static void print_stats(double elapsed) {
+    printf("%.1f s: %u seconds of data, %u packets sent, %u resent, %u dropped, %u acknowledged, window %d\n",
+           elapsed, (unsigned int)sim.seconds, (unsigned int)sim.sent, (unsigned int)sim.resent,
+           (unsigned int)sim.dropped, (unsigned int)sim.acked, (word)(sim.nextseq - sim.lowseq));
+    fflush(stdout);
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage: sim_q330 [-p baseport] [-d dataport] [-c channels] [-r rate[,rate...]]\n"
+            "                [-x speed] [-w window] [-k ackcount[:acktimeout]] [-t resend_ms]\n"
+            "                [-l loss_percent] [-b period:burst] [-s NET-STA] [-n seconds] [-v]\n");
+}
+
+int main(int argc, char *argv[]) {
+    sim.baseport = 6330;
+    sim.dataport = LP_TEL1;
+    sim.channels = 3;
+    sim.rates[0] = 100;
+    integer nrates = 1;
+    sim.speed = 1;
+    sim.window = 64;
+    sim.ack_cnt = 1;
+    sim.ack_to = 1;
+    sim.resend = 0.5;
+    strcpy(sim.network, "XX");
+    strcpy(sim.station, "SIM  ");
+    sim.seed = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:d:c:r:x:w:k:t:l:b:s:n:v")) != -1) {
+        switch (opt) {
+            case 'p':
+                sim.baseport = atoi(optarg);
+                break;
+            case 'd':
+                sim.dataport = atoi(optarg) - 1;
+                break;
+            case 'c':
+                sim.channels = atoi(optarg);
+                break;
+            case 'r':
+                nrates = 0;
+                for (char *s = strtok(optarg, ","); s && (nrates < CHANNELS); s = strtok(NULL, ",")) {
+                    sim.rates[nrates++] = atoi(s);
+                }
+                break;
+            case 'x':
+                sim.speed = atof(optarg);
+                break;
+            case 'w':
+                sim.window = atoi(optarg);
+                break;
+            case 'k': {
+                int count = 0, timeout = sim.ack_to;
+                sscanf(optarg, "%d:%d", &count, &timeout);
+                sim.ack_cnt = count;
+                sim.ack_to = timeout;
+                break;
+            }
+            case 't':
+                sim.resend = atof(optarg) * 0.001;
+                break;
+            case 'l':
+                sim.loss = atof(optarg);
+                break;
+            case 'b': {
+                unsigned int period = 0, burst = 0;
+                sscanf(optarg, "%u:%u", &period, &burst);
+                sim.burst_period = period;
+                sim.burst = burst;
+                break;
+            }
+            case 's': {
+                char net[3] = "", sta[6] = "";
+                if (sscanf(optarg, "%2[^-]-%5s", net, sta) != 2) {
+                    usage();
+                    return 2;
+                }
+                snprintf(sim.network, sizeof(sim.network), "%-2s", net);
+                snprintf(sim.station, sizeof(sim.station), "%-5s", sta);
+                break;
+            }
+            case 'n':
+                sim.duration = atof(optarg);
+                break;
+            case 'v':
+                sim.verbose = true;
+                break;
+            default:
+                usage();
+                return 2;
+        }
+    }
+    for (integer c = nrates; c < CHANNELS; c++) {
+        sim.rates[c] = sim.rates[nrates - 1];
+    }
+    bool valid = (optind == argc) && (sim.dataport >= LP_TEL1) && (sim.dataport <= LP_TEL4) &&
+                 (sim.channels >= 1) && (sim.channels <= CHANNELS) && (sim.window >= 1) &&
+                 (sim.window <= WINWRAP) && (sim.resend > 0) && (sim.speed >= 0);
+    for (integer c = 0; c < sim.channels; c++) {
+        valid = valid && (sim.rates[c] >= 1) && (sim.rates[c] <= SIM_MAX_RATE);
+    }
+    if (!valid) {
+        usage();
+        return 2;
+    }
+
+    gcrcinit(&sim.crc_table);
+    build_tokens();
+    sim.first_time = (longword)now();
+    sim.lowseq = 1;
+    sim.nextseq = 1;
+    for (integer c = 0; c < sim.channels; c++) {
+        sim.prev[c] = lround(SIM_AMPLITUDE * sin(2 * M_PI * (-1.0 / sim.rates[c]) / (SIM_PERIOD + c)));
+    }
+    word cport = sim.baseport + 2 * (sim.dataport + 1);
+    sim.csock = open_port(cport);
+    sim.dsock = open_port(cport + 1);
+    if ((sim.csock < 0) || (sim.dsock < 0)) {
+        fprintf(stderr, "Could not bind UDP ports %d and %d: %s\n", cport, cport + 1, strerror(errno));
+        return 1;
+    }
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+    printf("Simulating %s-%s Data%d on UDP ports %d and %d, %d channels\n", sim.network, sim.station,
+           sim.dataport + 1, cport, cport + 1, sim.channels);
+    fflush(stdout);
+
+    double start = mono();
+    double next_stat = start + STAT_INTERVAL;
+    double data_start = 0;
+    struct pollfd fds[2] = {{sim.csock, POLLIN, 0}, {sim.dsock, POLLIN, 0}};
+    while (running) {
+        bool streaming = sim.registered && sim.dataopen;
+        poll(fds, 2, streaming ? 1 : 50);
+        read_socket(sim.csock, true);
+        read_socket(sim.dsock, false);
+        double t = mono();
+        if (sim.registered && sim.dataopen) {
+            if (data_start == 0) {
+                data_start = t;
+            }
+            run_data(t, data_start);
+        }
+        if (t >= next_stat) {
+            print_stats(t - start);
+            next_stat += STAT_INTERVAL;
+        }
+        if ((sim.duration > 0) && (t - start >= sim.duration)) {
+            break;
+        }
+    }
+    print_stats(mono() - start);
+    close(sim.csock);
+    close(sim.dsock);
+    return 0;
+}
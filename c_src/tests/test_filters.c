@@ -0,0 +1,481 @@
+/*
+ * This file is part of ts_ess_earthquake.
+ *
+ * Developed for the Vera C. Rubin Observatory Telescope and Site Systems.
+ * This product includes software developed by the LSST Project
+ * (https://www.lsst.org).
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Tests of the lib330 FIR and IIR filters against the code they replaced: mac_and_shift, which shifted the FIR
+ * history after every output sample, and the IIR sections in direct form I.
+ *
+ * libfilters.c is included to reach the FIR kernels and to set up filters without a lib330 station. The scalar
+ * FIR kernel sums in the same order as mac_and_shift and must match it exactly. The vector kernels and the
+ * transposed direct form II sections only round differently, so they must match within a tolerance.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libfilters.c"
+
+#define CHECK(condition)                                                                      \
+    do {                                                                                      \
+        if (!(condition)) {                                                                   \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);     \
+            exit(1);                                                                          \
+        }                                                                                     \
+    } while (0)
+
+/* Number of input samples each filter is run over. */
+#define SAMPLES 5000
+/* Largest IIR output difference, relative to the largest output. */
+#define IIR_TOLERANCE 1.0E-9
+
+static tfloat input[SAMPLES];
+
+/* A random sample of a 24 bit digitizer. */
+static tfloat random_sample(void) { return (tfloat)(rand() % (1 << 24) - (1 << 23)); }
+
+static void fill_input(void) {
+    for (int i = 0; i < SAMPLES; i++) {
+        input[i] = random_sample();
+    }
+}
+
+/* The FIR filter as it was, of which the last fcount samples start at fbuf and end at f. */
+typedef struct {
+    tfloat fbuf[FIRMAXSIZE];
+    pfloat f;
+    pfloat fcoef;
+    longint flen;
+    longint fdec;
+    longint fcount;
+} told_fir;
+
+static void old_fir_init(told_fir *pf, pfloat coef, longint len, longint decimation) {
+    memset(pf, 0, sizeof(*pf));
+    pf->f = pf->fbuf;
+    pf->fcoef = coef;
+    pf->flen = len;
+    pf->fdec = decimation;
+    while (pf->fcount < pf->flen - 1) {
+        *(pf->f) = 0.0;
+        pf->f++;
+        pf->fcount++;
+    }
+}
+
+static tfloat old_mac_and_shift(told_fir *pf) {
+    tfloat accum = 0.0;
+    pfloat pv = pf->fbuf;
+    pfloat pc = pf->fcoef;
+    for (longint i = 0; i <= pf->flen - 1; i++) {
+        accum = (*pv) * (*pc) + accum;
+        pv++;
+        pc++;
+    }
+    pc = pf->fbuf;
+    pv = pf->fbuf + pf->fdec;
+    for (longint i = pf->fdec; i <= pf->flen - 1; i++) {
+        *pc = *pv;
+        pc++;
+        pv++;
+    }
+    return accum;
+}
+
+/* Add one sample as libsample.c did, returns 1 and the output in out if one was due. */
+static int old_fir_step(told_fir *pf, tfloat sample, tfloat *out) {
+    *(pf->f) = sample;
+    pf->f++;
+    pf->fcount++;
+    if (pf->fcount < pf->flen) {
+        return 0;
+    }
+    *out = old_mac_and_shift(pf);
+    pf->f -= pf->fdec;
+    pf->fcount -= pf->fdec;
+    return 1;
+}
+
+/* Set up a FIR filter as create_fir does, with the given kernel. */
+static void fir_init(pfir_packet pf, pfloat coef, longint len, longint decimation, tfirdot dot) {
+    memset(pf, 0, sizeof(*pf));
+    pf->fbuf = calloc(2 * len, sizeof(tfloat));
+    CHECK(pf->fbuf != NULL);
+    pf->fcoef = coef;
+    pf->flen = len;
+    pf->fdec = decimation;
+    pf->fdot = dot;
+    while (pf->fcount < pf->flen - 1) {
+        fir_add(pf, 0.0);
+    }
+}
+
+static int fir_step(pfir_packet pf, tfloat sample, tfloat *out) {
+    fir_add(pf, sample);
+    if (pf->fcount < pf->flen) {
+        return 0;
+    }
+    *out = fir_mac(pf);
+    return 1;
+}
+
+/* The filter lengths and decimations tested, including lengths that leave a remainder for every kernel. */
+static const longint fir_lengths[] = {1, 2, 3, 5, 16, 17, 31, 64, 200, 389, FIRMAXSIZE};
+static const longint fir_decimations[] = {1, 2, 5, 10};
+#define FIR_LENGTHS (sizeof(fir_lengths) / sizeof(fir_lengths[0]))
+#define FIR_DECIMATIONS (sizeof(fir_decimations) / sizeof(fir_decimations[0]))
+
+static void random_coefficients(pfloat coef, longint len) {
+    for (longint i = 0; i < len; i++) {
+        coef[i] = (tfloat)rand() / RAND_MAX - 0.5;
+    }
+}
+
+/*
+ * Run the old filter and a new one with the given kernel over the input and compare every output sample. The
+ * difference may be at most tolerance times the sum of the absolute products.
+ */
+static void compare_fir(tfirdot dot, double tolerance) {
+    tfloat coef[FIRMAXSIZE];
+    for (size_t l = 0; l < FIR_LENGTHS; l++) {
+        for (size_t d = 0; d < FIR_DECIMATIONS; d++) {
+            longint len = fir_lengths[l];
+            longint decimation = fir_decimations[d];
+            if (decimation > len) {
+                continue;
+            }
+            random_coefficients(coef, len);
+            told_fir old;
+            tfir_packet fir;
+            old_fir_init(&old, coef, len, decimation);
+            fir_init(&fir, coef, len, decimation, dot);
+            for (int i = 0; i < SAMPLES; i++) {
+                double magnitude = 0.0;
+                for (longint j = 0; j < len - 1; j++) {
+                    magnitude += fabs(old.fbuf[j] * coef[j]);
+                }
+                magnitude += fabs(input[i] * coef[len - 1]);
+                tfloat expected, actual;
+                int due = old_fir_step(&old, input[i], &expected);
+                CHECK(fir_step(&fir, input[i], &actual) == due);
+                if (due) {
+                    if (tolerance == 0.0) {
+                        CHECK(actual == expected);
+                    } else {
+                        CHECK(fabs(actual - expected) <= tolerance * magnitude);
+                    }
+                }
+                CHECK(fir.fcount == old.fcount);
+            }
+            free(fir.fbuf);
+        }
+    }
+}
+
+/* The scalar kernel sums in the same order as mac_and_shift. */
+static void test_fir_scalar(void) { compare_fir(fir_dot_scalar, 0.0); }
+
+/* The vector kernels sum in a different order, which only changes the rounding. */
+static void test_fir_simd(void) {
+#ifdef FIR_SIMD
+    compare_fir(fir_dot_sse2, 1.0E-14);
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        compare_fir(fir_dot_avx2, 1.0E-14);
+    }
+#endif
+}
+
+/* Feeding blocks with fir_fill, as process_derived does, gives the same output as feeding single samples. */
+static void test_fir_fill(void) {
+    tfloat coef[FIRMAXSIZE];
+    tfloat expected[SAMPLES], actual[SAMPLES];
+    for (size_t l = 0; l < FIR_LENGTHS; l++) {
+        for (size_t d = 0; d < FIR_DECIMATIONS; d++) {
+            longint len = fir_lengths[l];
+            longint decimation = fir_decimations[d];
+            if (decimation > len) {
+                continue;
+            }
+            random_coefficients(coef, len);
+            told_fir old;
+            tfir_packet fir;
+            old_fir_init(&old, coef, len, decimation);
+            fir_init(&fir, coef, len, decimation, fir_dot_scalar);
+            int outputs = 0;
+            for (int i = 0; i < SAMPLES; i++) {
+                outputs += old_fir_step(&old, input[i], &expected[outputs]);
+            }
+            int produced = 0;
+            int i = 0;
+            while (i < SAMPLES) {
+                int block = 1 + rand() % 250;
+                if (block > SAMPLES - i) {
+                    block = SAMPLES - i;
+                }
+                int stop = i + block;
+                while (i < stop) {
+                    i += fir_fill(&fir, &input[i], stop - i);
+                    if (fir.fcount >= fir.flen) {
+                        CHECK(produced < outputs);
+                        actual[produced++] = fir_mac(&fir);
+                    }
+                }
+            }
+            CHECK(produced == outputs);
+            CHECK(memcmp(actual, expected, outputs * sizeof(tfloat)) == 0);
+            CHECK(fir.fcount == old.fcount);
+            free(fir.fbuf);
+        }
+    }
+}
+
+/*
+ * The continuity file keeps the FIR history in the layout of the old filter, so history saved by the old
+ * filter continues in the new one and the other way around.
+ */
+static void test_fir_continuity(void) {
+    tfloat coef[FIRMAXSIZE];
+    tfloat saved[FIRMAXSIZE];
+    for (size_t l = 0; l < FIR_LENGTHS; l++) {
+        longint len = fir_lengths[l];
+        longint decimation = len > 1 ? len / 2 : 1;
+        random_coefficients(coef, len);
+        int split = SAMPLES / 2 + rand() % len;
+        tfloat expected, actual;
+
+        /* Old to new */
+        told_fir old;
+        tfir_packet fir;
+        old_fir_init(&old, coef, len, decimation);
+        fir_init(&fir, coef, len, decimation, fir_dot_scalar);
+        for (int i = 0; i < split; i++) {
+            old_fir_step(&old, input[i], &expected);
+        }
+        memcpy(saved, old.fbuf, len * sizeof(tfloat));
+        fir_load(&fir, saved, old.fcount);
+        for (int i = split; i < SAMPLES; i++) {
+            int due = old_fir_step(&old, input[i], &expected);
+            CHECK(fir_step(&fir, input[i], &actual) == due);
+            CHECK(!due || actual == expected);
+        }
+
+        /* New to old */
+        fir_save(&fir, saved);
+        for (longint j = 0; j < fir.fcount; j++) {
+            CHECK(saved[j] == old.fbuf[j]);
+        }
+        old_fir_init(&old, coef, len, decimation);
+        memcpy(old.fbuf, saved, len * sizeof(tfloat));
+        old.fcount = fir.fcount;
+        old.f = old.fbuf + old.fcount;
+        for (int i = 0; i < SAMPLES; i++) {
+            int due = old_fir_step(&old, input[i], &expected);
+            CHECK(fir_step(&fir, input[i], &actual) == due);
+            CHECK(!due || actual == expected);
+        }
+        free(fir.fbuf);
+    }
+}
+
+/* An IIR section as it was, with x and y shifted after every sample. */
+typedef struct {
+    integer poles;
+    tvector a;
+    tvector b;
+    tvector x;
+    tvector y;
+} told_section;
+
+typedef struct {
+    integer sects;
+    told_section filt[MAXSECTIONS + 1];
+} told_iir;
+
+static tfloat old_scalar_product(tvector *a, tvector *b, integer vector_length, integer offset) {
+    double multiply_accum = 0;
+    for (integer counter = offset; counter <= (vector_length + offset - 1); counter++) {
+#ifdef CHK_IIR_UNDERFLOW
+        if (fabs((*b)[counter]) < 1.0E-20) {
+            (*b)[counter] = 0.0;
+        }
+#endif
+        multiply_accum = multiply_accum + (*a)[counter] * (*b)[counter];
+    }
+    return multiply_accum;
+}
+
+static void old_time_shift(tvector *filter_history, integer length, integer shift) {
+    length = length - shift;
+    integer index = length - 1;
+    do {
+        (*filter_history)[index + shift] = (*filter_history)[index];
+        index--;
+        length--;
+    } while (length != 0);
+}
+
+static double old_recursive_filter(told_section *f, double s) {
+    f->x[0] = s;
+    f->y[0] = old_scalar_product(&f->x, &f->a, f->poles + 1, 0) + old_scalar_product(&f->y, &f->b, f->poles, 1);
+    old_time_shift(&f->x, f->poles + 1, 1);
+    old_time_shift(&f->y, f->poles + 1, 1);
+    return f->y[0];
+}
+
+static double old_multi_section_filter(told_iir *resp, double s) {
+    for (integer sect = 1; sect <= resp->sects; sect++) {
+        s = old_recursive_filter(&resp->filt[sect], s);
+    }
+#ifdef CHK_IIR_UNDERFLOW
+    if (fabs(s) < 1.0E-20) {
+        s = s > 0 ? 1.0E-20 : -1.0E-20;
+    }
+#endif
+    return s;
+}
+
+/* The Butterworth sections of the IIR filters tested, as poles, highpass and corner ratio. */
+typedef struct {
+    integer sects;
+    tsection_base filt[MAXSECTIONS + 1];
+} tiir_case;
+
+static const tiir_case iir_cases[] = {
+    {1, {{0}, {2, FALSE, 0, 0.1f}}},
+    {1, {{0}, {1, TRUE, 0, 0.02f}}},
+    {2, {{0}, {4, TRUE, 0, 0.01f}, {2, FALSE, 0, 0.25f}}},
+    {3, {{0}, {3, FALSE, 0, 0.2f}, {2, TRUE, 0, 0.05f}, {8, FALSE, 0, 0.3f}}},
+};
+#define IIR_CASES (sizeof(iir_cases) / sizeof(iir_cases[0]))
+
+/* Set up the old and new filter as create_iir does, with a gain of 2. */
+static void iir_init(const tiir_case *c, told_iir *old, piirfilter iir) {
+    memset(old, 0, sizeof(*old));
+    memset(iir, 0, sizeof(*iir));
+    old->sects = c->sects;
+    iir->sects = c->sects;
+    for (integer i = 1; i <= c->sects; i++) {
+        tsection_base base = c->filt[i];
+        calc_section(&base);
+        old->filt[i].poles = base.poles;
+        iir->filt[i].poles = base.poles;
+        for (integer j = 0; j <= base.poles; j++) {
+            double a = i == 1 ? base.a[j] * 2.0 : base.a[j];
+            old->filt[i].a[j] = a;
+            old->filt[i].b[j] = base.b[j];
+            iir->filt[i].a[j] = a;
+            iir->filt[i].b[j] = base.b[j];
+        }
+    }
+}
+
+/* Largest output of the old filter so far, which the tolerance is relative to. */
+static double iir_scale;
+
+static void check_iir(double actual, double expected) {
+    if (fabs(expected) > iir_scale) {
+        iir_scale = fabs(expected);
+    }
+    CHECK(fabs(actual - expected) <= IIR_TOLERANCE * iir_scale);
+}
+
+/* Filtering sample by sample and in blocks of any size matches direct form I. */
+static void test_iir_blocks(void) {
+    static tfloat data[SAMPLES];
+    for (size_t n = 0; n < IIR_CASES; n++) {
+        told_iir old;
+        tiirfilter by_sample, by_block;
+        iir_init(&iir_cases[n], &old, &by_sample);
+        iir_init(&iir_cases[n], &old, &by_block);
+        iir_scale = 0.0;
+        memcpy(data, input, sizeof(data));
+        int i = 0;
+        while (i < SAMPLES) {
+            int count = 1 + rand() % 200;
+            if (count > SAMPLES - i) {
+                count = SAMPLES - i;
+            }
+            iir_block(&by_block, &data[i], count);
+            i += count;
+        }
+        for (i = 0; i < SAMPLES; i++) {
+            double expected = old_multi_section_filter(&old, input[i]);
+            check_iir(multi_section_filter(&by_sample, input[i]), expected);
+            check_iir(data[i], expected);
+        }
+    }
+}
+
+/*
+ * The continuity file keeps the IIR history in the layout of the old x and y vectors, so history saved by the
+ * old filter continues in the new one and the other way around.
+ */
+static void test_iir_continuity(void) {
+    for (size_t n = 0; n < IIR_CASES; n++) {
+        told_iir old;
+        tiirfilter iir;
+        iir_init(&iir_cases[n], &old, &iir);
+        iir_scale = 0.0;
+        int split = SAMPLES / 2 + rand() % 100;
+
+        /* Old to new */
+        for (int i = 0; i < split; i++) {
+            old_multi_section_filter(&old, input[i]);
+        }
+        for (integer sect = 1; sect <= old.sects; sect++) {
+            iir_load(&iir.filt[sect], &old.filt[sect].x, &old.filt[sect].y);
+        }
+        for (int i = split; i < SAMPLES; i++) {
+            check_iir(multi_section_filter(&iir, input[i]), old_multi_section_filter(&old, input[i]));
+        }
+
+        /* New to old */
+        for (integer sect = 1; sect <= old.sects; sect++) {
+            tvector x, y;
+            iir_save(&iir.filt[sect], &x, &y);
+            for (integer j = 0; j <= old.filt[sect].poles; j++) {
+                CHECK(fabs(x[j] - old.filt[sect].x[j]) <= IIR_TOLERANCE * iir_scale + IIR_TOLERANCE * fabs(x[j]));
+                CHECK(fabs(y[j] - old.filt[sect].y[j]) <= IIR_TOLERANCE * iir_scale);
+            }
+            memcpy(old.filt[sect].x, x, sizeof(tvector));
+            memcpy(old.filt[sect].y, y, sizeof(tvector));
+        }
+        for (int i = 0; i < SAMPLES; i++) {
+            check_iir(multi_section_filter(&iir, input[i]), old_multi_section_filter(&old, input[i]));
+        }
+    }
+}
+
+int main(void) {
+    srand(330);
+    fill_input();
+    test_fir_scalar();
+    test_fir_simd();
+    test_fir_fill();
+    test_fir_continuity();
+    test_iir_blocks();
+    test_iir_continuity();
+    printf("test_filters passed\n");
+    return 0;
+}
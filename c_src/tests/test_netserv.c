@@ -0,0 +1,194 @@
+/*
+ * This file is part of ts_ess_earthquake.
+ *
+ * Developed for the Vera C. Rubin Observatory Telescope and Site Systems.
+ * This product includes software developed by the LSST Project
+ * (https://www.lsst.org).
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Tests of how the lib330 netserver sends its buffer to a client that falls behind.
+ *
+ * libnetserv.c is included to drive send_next_buffers directly, without the netserver thread, over a
+ * socket pair, so it is known exactly how far behind the client is when records are sent.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "libnetserv.c"
+
+#define CHECK(condition)                                                                      \
+    do {                                                                                      \
+        if (!(condition)) {                                                                   \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);     \
+            exit(1);                                                                          \
+        }                                                                                     \
+    } while (0)
+
+/* Number of records in the netserver buffer, of which RECORDS - RECORDS / 16 may be pending for a client. */
+#define RECORDS 32
+#define USABLE (RECORDS - RECORDS / 16)
+
+static tnsstr server;
+static tnsclient *client = &server.clients[0];
+static int peer;          /* the client's end of the socket pair */
+static longword written;  /* records passed to lib_ns_send */
+static longword received; /* sequence number of the next record the client expects */
+
+static void write_records(int count) {
+    completed_record rec;
+    for (int i = 0; i < count; i++) {
+        memcpy(rec, &written, sizeof(written));
+        for (int j = sizeof(written); j < LIB_REC_SIZE; j++) {
+            rec[j] = (byte)(written + j);
+        }
+        lib_ns_send(&server, &rec);
+        written++;
+    }
+}
+
+/* Check a record read by the client, which must be the next one or come after a gap of skipped records. */
+static void check_record(const completed_record *rec, longword gap) {
+    longword seq;
+    memcpy(&seq, *rec, sizeof(seq));
+    CHECK(seq == received + gap);
+    for (int j = sizeof(seq); j < LIB_REC_SIZE; j++) {
+        CHECK((*rec)[j] == (byte)(seq + j));
+    }
+    received = seq + 1;
+}
+
+/* Read count records, which must already have been sent. */
+static void read_records(int count, longword gap) {
+    completed_record rec;
+    for (int i = 0; i < count; i++) {
+        CHECK(recv(peer, rec, LIB_REC_SIZE, MSG_WAITALL) == LIB_REC_SIZE);
+        check_record((const completed_record *)&rec, i ? 0 : gap);
+    }
+}
+
+static void set_up(void) {
+    int fds[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL, 0) | O_NONBLOCK);
+    peer = fds[1];
+
+    memset(&server, 0, sizeof(server));
+    create_mutex(&server);
+    server.ns_par.record_count = RECORDS;
+    server.ns_par.nsbuf = malloc(sizeof(tnsbuf));
+    CHECK(server.ns_par.nsbuf != NULL);
+    /* There is no netserver thread, so lib_ns_send needn't wake it. */
+    atomic_store(&server.wake_pending, TRUE);
+    server.max_clients = 1;
+    server.clientcount = 1;
+    client->sockpath = fds[0];
+    client->haveclient = TRUE;
+}
+
+/* A client that keeps up gets every record. */
+static void test_keeping_up(void) {
+    write_records(10);
+    CHECK(send_next_buffers(&server, client, FALSE));
+    CHECK(!send_next_buffers(&server, client, FALSE));
+    read_records(10, 0);
+    CHECK(client->sent == 10 && client->drops == 0);
+    CHECK(server.resume == written);
+}
+
+/* A client more than USABLE records behind skips to the oldest record that can't be written over yet. */
+static void test_skip(void) {
+    write_records(100);
+    CHECK(send_next_buffers(&server, client, FALSE));
+    read_records(USABLE, 100 - USABLE);
+    CHECK(received == written);
+
+    tns_stats stats;
+    lib_ns_stats(&server, &stats);
+    CHECK(stats.count == 1);
+    CHECK(stats.records == written);
+    CHECK(stats.clients[0].sent == 10 + USABLE);
+    CHECK(stats.clients[0].drops == 100 - USABLE);
+    CHECK(stats.clients[0].lag == 0);
+}
+
+/* Sends that stop in the middle of a record resume where they stopped. */
+static void test_partial_sends(void) {
+    int size = 4096;
+    CHECK(setsockopt(client->sockpath, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) == 0);
+    write_records(USABLE);
+    longword first = received;
+    static completed_record recs[USABLE];
+    size_t have = 0;
+    int full = 0;
+    for (int i = 0; i < 10000 && have < sizeof(recs); i++) {
+        client->sockfull = FALSE; /* as when select says there is room */
+        send_next_buffers(&server, client, FALSE);
+        if (client->sockfull) {
+            full++;
+        }
+        ssize_t n = recv(peer, (byte *)recs + have, sizeof(recs) - have, MSG_DONTWAIT);
+        if (n > 0) {
+            have += n;
+        }
+    }
+    CHECK(have == sizeof(recs));
+    CHECK(full > 0);
+    for (int i = 0; i < USABLE; i++) {
+        check_record((const completed_record *)&recs[i], 0);
+    }
+    CHECK(received == first + USABLE);
+    CHECK(client->next == written && client->offset == 0);
+    CHECK(client->drops == 100 - USABLE);
+}
+
+/* A client stopped in the middle of a record can't skip, so it is disconnected once the record is written
+ * over. */
+static void test_overwrite(void) {
+    write_records(1);
+    client->offset = 100; /* as if a send had stopped 100 bytes into the record */
+    write_records(RECORDS);
+    client->sockfull = FALSE;
+    CHECK(send_next_buffers(&server, client, FALSE));
+    CHECK(!client->haveclient);
+    CHECK(server.clientcount == 0);
+    CHECK(client->drops == 100 - USABLE);
+    CHECK(server.resume == client->next);
+
+    /* The client sees its stream end. */
+    byte buf[4096];
+    ssize_t n;
+    while ((n = recv(peer, buf, sizeof(buf), 0)) > 0) {
+    }
+    CHECK(n == 0);
+}
+
+int main(void) {
+    set_up();
+    test_keeping_up();
+    test_skip();
+    test_partial_sends();
+    test_overwrite();
+    close(peer);
+    free(server.ns_par.nsbuf);
+    printf("test_netserv passed\n");
+    return 0;
+}
@@ -0,0 +1,106 @@
+/*
+ * This file is part of ts_ess_earthquake.
+ *
+ * Developed for the Vera C. Rubin Observatory Telescope and Site Systems.
+ * This product includes software developed by the LSST Project
+ * (https://www.lsst.org).
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Tests of the libq330 sample arena.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "q330_arena.h"
+
+#define CHECK(condition)                                                                      \
+    do {                                                                                      \
+        if (!(condition)) {                                                                   \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);     \
+            exit(1);                                                                          \
+        }                                                                                     \
+    } while (0)
+
+#define BLOCKS 4
+#define BLOCK_SAMPLES 10
+
+static int32_t samples[BLOCKS * BLOCK_SAMPLES];
+static _Atomic uint32_t refcounts[BLOCKS];
+
+/* Allocate every block, run out and get the blocks back once the last reference is dropped. */
+static void test_alloc_release(void) {
+    tsample_arena arena = {
+            .samples = samples,
+            .refcounts = refcounts,
+            .blocks = BLOCKS,
+            .block_samples = BLOCK_SAMPLES,
+    };
+    for (int32_t i = 0; i < BLOCKS; i++) {
+        CHECK(arena_alloc(&arena) == i * BLOCK_SAMPLES);
+    }
+    tarena_stats stats = arena_get_stats(&arena);
+    CHECK(stats.blocks == BLOCKS);
+    CHECK(stats.block_samples == BLOCK_SAMPLES);
+    CHECK(stats.in_use == BLOCKS);
+    CHECK(stats.exhausted == 0);
+
+    CHECK(arena_alloc(&arena) == -1);
+    CHECK(arena_alloc(&arena) == -1);
+    CHECK(arena_get_stats(&arena).exhausted == 2);
+
+    /* A retained block stays in use until both references are dropped. */
+    arena_retain(&arena, 1 * BLOCK_SAMPLES);
+    arena_release(&arena, 1 * BLOCK_SAMPLES);
+    CHECK(arena_get_stats(&arena).in_use == BLOCKS);
+    CHECK(arena_alloc(&arena) == -1);
+    arena_release(&arena, 1 * BLOCK_SAMPLES);
+    CHECK(arena_get_stats(&arena).in_use == BLOCKS - 1);
+    CHECK(refcounts[1] == 0);
+
+    /* Releasing a free block or an offset outside the arena changes nothing. */
+    arena_release(&arena, 1 * BLOCK_SAMPLES);
+    arena_release(&arena, BLOCKS * BLOCK_SAMPLES);
+    arena_retain(&arena, BLOCKS * BLOCK_SAMPLES);
+    CHECK(arena_get_stats(&arena).in_use == BLOCKS - 1);
+    CHECK(refcounts[1] == 0);
+
+    /* The freed block is reused by the next allocation. */
+    CHECK(arena_alloc(&arena) == 1 * BLOCK_SAMPLES);
+    CHECK(refcounts[1] == 1);
+    CHECK(arena_alloc(&arena) == -1);
+
+    for (int32_t i = 0; i < BLOCKS; i++) {
+        arena_release(&arena, i * BLOCK_SAMPLES);
+    }
+    stats = arena_get_stats(&arena);
+    CHECK(stats.in_use == 0);
+    CHECK(stats.exhausted == 4);
+
+    /* The search resumes after the last allocated block. */
+    CHECK(arena_alloc(&arena) == 2 * BLOCK_SAMPLES);
+    CHECK(arena_alloc(&arena) == 3 * BLOCK_SAMPLES);
+    CHECK(arena_alloc(&arena) == 0);
+    CHECK(arena_get_stats(&arena).in_use == 3);
+}
+
+int main(void) {
+    test_alloc_release();
+    printf("test_q330_arena passed\n");
+    return 0;
+}
@@ -0,0 +1,274 @@
+/*
+ * This file is part of ts_ess_earthquake.
+ *
+ * Developed for the Vera C. Rubin Observatory Telescope and Site Systems.
+ * This product includes software developed by the LSST Project
+ * (https://www.lsst.org).
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Tests of the libq330 handles, driven through the lib330 callbacks with fake contexts.
+ *
+ * q330.c is included to set the context of a handle without a lib330 station.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "q330.c"
+
+#define CHECK(condition)                                                                      \
+    do {                                                                                      \
+        if (!(condition)) {                                                                   \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);     \
+            exit(1);                                                                          \
+        }                                                                                     \
+    } while (0)
+
+/* Callbacks made for one handle, counted per stream. */
+typedef struct {
+    int messages;
+    int states;
+} tcounts;
+
+static void count_message(void *user) { ((tcounts *)user)->messages++; }
+
+static void count_state(void *user) { ((tcounts *)user)->states++; }
+
+static pq330_handle open_handle(uint64_t serial_id, tcounts *counts) {
+    tinit qinit;
+    memset(&qinit, 0, sizeof(qinit));
+    qinit.serial_id = serial_id;
+    strcpy(qinit.hostname, "127.0.0.1");
+    qinit.message_callback = count_message;
+    qinit.state_callback = count_state;
+    qinit.user = counts;
+    return q330_open(qinit);
+}
+
+/* A context that belongs to a handle as far as the callbacks can tell, without a lib330 station. */
+static tcontext fake_context(pq330_handle handle) {
+    pq330 q330 = calloc(1, sizeof(tq330));
+    CHECK(q330 != NULL);
+    q330->par_create.host_ptr = handle;
+    return q330;
+}
+
+static void send_message(tcontext context, word code) {
+    tmsg_call call;
+    memset(&call, 0, sizeof(call));
+    call.context = context;
+    call.code = code;
+    call.msgcount = code;
+    strcpy(call.suffix, "suffix");
+    my_msg_callback(&call);
+}
+
+static void send_state(tcontext context, longword info) {
+    tstate_call call;
+    memset(&call, 0, sizeof(call));
+    call.context = context;
+    call.state_type = ST_STATE;
+    strcpy(call.station_name, "TEST");
+    call.info = info;
+    my_state_callback(&call);
+}
+
+/*
+ * Two handles keep their own rings and callbacks, and callbacks for an unknown context are ignored. The
+ * station_context of the handles is not set, as while lib_create_context has not returned yet.
+ */
+static void test_two_handles(void) {
+    tcounts counts[2] = {{0, 0}, {0, 0}};
+    pq330_handle first = open_handle(1, &counts[0]);
+    pq330_handle second = open_handle(2, &counts[1]);
+    CHECK(first != NULL && second != NULL);
+    tcontext contexts[3] = {fake_context(first), fake_context(second), fake_context(NULL)};
+
+    send_message(contexts[0], 1);
+    send_message(contexts[1], 2);
+    send_message(contexts[1], 3);
+    send_state(contexts[0], LIBSTATE_IDLE);
+    send_message(contexts[2], 4);
+    send_state(contexts[2], LIBSTATE_IDLE);
+    send_message(NIL, 5);
+
+    CHECK(counts[0].messages == 1 && counts[0].states == 1);
+    CHECK(counts[1].messages == 2 && counts[1].states == 0);
+    CHECK(q330_get_ring_stats(first, Q330_STREAM_MESSAGE).count == 1);
+    CHECK(q330_get_ring_stats(second, Q330_STREAM_MESSAGE).count == 2);
+    CHECK(q330_get_ring_stats(first, Q330_STREAM_STATE).count == 1);
+    CHECK(q330_get_ring_stats(second, Q330_STREAM_STATE).count == 0);
+
+    tmsg message;
+    CHECK(q330_pop_message(first, &message) && message.code == 1);
+    CHECK(strcmp(message.suffix, "suffix") == 0);
+    CHECK(!q330_pop_message(first, &message));
+    CHECK(q330_pop_message(second, &message) && message.code == 2);
+    CHECK(q330_pop_message(second, &message) && message.code == 3);
+    CHECK(!q330_pop_message(second, &message));
+    tstate state;
+    CHECK(q330_pop_state(first, &state) && state.info == LIBSTATE_IDLE);
+    CHECK(strcmp(state.station_name, "TEST") == 0);
+    CHECK(!q330_pop_state(second, &state));
+
+    /* Without a lib330 station there is no context to destroy on close. */
+    q330_close(first);
+    q330_close(second);
+    for (int i = 0; i < 3; i++) {
+        free(contexts[i]);
+    }
+}
+
+/* Only Q330_MAX_HANDLES handles can be open at once, and a closed slot can be used again. */
+static void test_handle_limit(void) {
+    tcounts counts = {0, 0};
+    pq330_handle opened[Q330_MAX_HANDLES];
+    for (int i = 0; i < Q330_MAX_HANDLES; i++) {
+        opened[i] = open_handle(i, &counts);
+        CHECK(opened[i] != NULL);
+    }
+    CHECK(open_handle(Q330_MAX_HANDLES, &counts) == NULL);
+
+    q330_close(opened[5]);
+    opened[5] = open_handle(Q330_MAX_HANDLES, &counts);
+    CHECK(opened[5] != NULL);
+    CHECK(q330_get_ring_stats(opened[5], Q330_STREAM_MESSAGE).count == 0);
+    tcontext context = fake_context(opened[5]);
+    send_message(context, 5);
+    CHECK(counts.messages == 1);
+    CHECK(open_handle(Q330_MAX_HANDLES + 1, &counts) == NULL);
+
+    for (int i = 0; i < Q330_MAX_HANDLES; i++) {
+        q330_close(opened[i]);
+    }
+    free(context);
+}
+
+/* A miniseed record too large for a slot is counted as oversize, not as an overrun of the ring. */
+static void test_oversize_miniseed(void) {
+    tcounts counts = {0, 0};
+    pq330_handle handle = open_handle(1, &counts);
+    CHECK(handle != NULL);
+    tcontext context = fake_context(handle);
+    static byte record[LIB_REC_SIZE + 1];
+    tminiseed_call call;
+    memset(&call, 0, sizeof(call));
+    call.context = context;
+    strcpy(call.station_name, "TEST");
+    strcpy(call.channel, "HHZ");
+    call.data_address = record;
+    call.data_size = LIB_REC_SIZE + 1;
+    my_miniseed_callback(&call);
+    call.data_size = LIB_REC_SIZE;
+    my_miniseed_callback(&call);
+
+    tring_stats stats = q330_get_ring_stats(handle, Q330_STREAM_MINISEED);
+    CHECK(stats.pushed == 1);
+    CHECK(stats.overruns == 0);
+    CHECK(stats.oversize == 1);
+    tminiseed miniseed;
+    CHECK(q330_pop_miniseed(handle, &miniseed) && miniseed.data_size == LIB_REC_SIZE);
+    CHECK(!q330_pop_miniseed(handle, &miniseed));
+
+    q330_close(handle);
+    free(context);
+}
+
+static void *terminate_libthread(void *context) {
+    usleep(20000);
+    send_state(context, LIBSTATE_TERM);
+    return NULL;
+}
+
+/* A handle waits for the LIBSTATE_TERM callback, which is the last callback libthread makes. */
+static void test_wait_for_libthread(void) {
+    tcounts counts = {0, 0};
+    pq330_handle handle = open_handle(1, &counts);
+    CHECK(handle != NULL);
+    tcontext context = fake_context(handle);
+    atomic_store(&handle->lib_running, true);
+    send_state(context, LIBSTATE_IDLE);
+    CHECK(atomic_load(&handle->lib_running));
+
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, terminate_libthread, context) == 0);
+    wait_for_libthread(handle);
+    CHECK(counts.states == 2);
+    tstate state;
+    CHECK(q330_pop_state(handle, &state) && state.info == LIBSTATE_IDLE);
+    CHECK(q330_pop_state(handle, &state) && state.info == LIBSTATE_TERM);
+    pthread_join(thread, NULL);
+
+    q330_close(handle);
+    free(context);
+}
+
+/* Add one second of E, N and Z samples of a band to the triad assembler of a handle, as lib330 would. */
+static void add_second(pq330_handle handle, double timestamp) {
+    int32_t samples[MAX_RATE] = {0};
+    static const char *channels[] = {"HHE", "HHN", "HHZ"};
+    for (int i = 0; i < 3; i++) {
+        triad_add(&handle->triads, timestamp, MAX_RATE, i, "TEST", "00", channels[i], samples, MAX_RATE);
+    }
+}
+
+/* A handle whose consumer holds on to all its samples exhausts only its own arena. */
+static void test_arena_exhaustion(void) {
+    tcounts counts[2] = {{0, 0}, {0, 0}};
+    pq330_handle first = open_handle(1, &counts[0]);
+    pq330_handle second = open_handle(2, &counts[1]);
+    CHECK(first != NULL && second != NULL);
+    CHECK(q330_get_arena(first) != q330_get_arena(second));
+
+    /* Pop the triads of the first handle without releasing their samples. */
+    ttriad triads[TRIAD_RING_SIZE];
+    for (int t = 0; t < ARENA_BLOCKS / 3 + 10; t++) {
+        add_second(first, t);
+        add_second(second, t);
+        q330_pop_batch_triad(first, triads, TRIAD_RING_SIZE);
+        int count = q330_pop_batch_triad(second, triads, TRIAD_RING_SIZE);
+        for (int i = 0; i < count; i++) {
+            for (int c = 0; c < 3; c++) {
+                q330_release_samples(second, triads[i].sample_offset[c]);
+            }
+        }
+    }
+
+    tarena_stats stats = q330_get_arena_stats(first);
+    CHECK(stats.in_use == ARENA_BLOCKS);
+    CHECK(stats.exhausted > 0);
+    CHECK(q330_get_triad_stats(first).dropped == stats.exhausted);
+    stats = q330_get_arena_stats(second);
+    CHECK(stats.in_use == 0);
+    CHECK(stats.exhausted == 0);
+    CHECK(q330_get_triad_stats(second).dropped == 0);
+
+    q330_close(first);
+    q330_close(second);
+}
+
+int main(void) {
+    test_two_handles();
+    test_handle_limit();
+    test_oversize_miniseed();
+    test_wait_for_libthread();
+    test_arena_exhaustion();
+    printf("test_q330_handle passed\n");
+    return 0;
+}
@@ -0,0 +1,262 @@
+/*
+ * This file is part of ts_ess_earthquake.
+ *
+ * Developed for the Vera C. Rubin Observatory Telescope and Site Systems.
+ * This product includes software developed by the LSST Project
+ * (https://www.lsst.org).
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Tests of the libq330 single-producer/single-consumer ring.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "q330_ring.h"
+
+#define CHECK(condition)                                                                      \
+    do {                                                                                      \
+        if (!(condition)) {                                                                   \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);     \
+            exit(1);                                                                          \
+        }                                                                                     \
+    } while (0)
+
+/* Number of records the producer thread queues. */
+#define THREAD_RECORDS 1000000
+
+static void push(tspsc_ring *ring, uint32_t value) {
+    uint32_t *slot = ring_reserve(ring);
+    CHECK(slot != NULL);
+    *slot = value;
+    ring_commit(ring);
+}
+
+/* Fill the ring, overrun it and pop in batches across the end of the storage. */
+static void test_wrap_and_overrun(void) {
+    uint32_t storage[4];
+    tspsc_ring ring;
+    ring_init(&ring, storage, 4, sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < 4; i++) {
+        push(&ring, i);
+    }
+    CHECK(ring_reserve(&ring) == NULL);
+    CHECK(ring_reserve(&ring) == NULL);
+    tring_stats stats = ring_get_stats(&ring);
+    CHECK(stats.capacity == 4);
+    CHECK(stats.count == 4);
+    CHECK(stats.high_water == 4);
+    CHECK(stats.pushed == 4);
+    CHECK(stats.overruns == 2);
+
+    /* The popped slots stay held, so the producer can't reuse them yet. */
+    CHECK(ring_acquire(&ring, 3) == 3);
+    for (uint32_t i = 0; i < 3; i++) {
+        CHECK(*(uint32_t *)ring_slot(&ring, i) == i);
+    }
+    CHECK(ring_reserve(&ring) == NULL);
+    CHECK(ring_get_stats(&ring).overruns == 3);
+
+    /* Keeping only the first slot leaves the other two pending. */
+    ring_hold(&ring, 1);
+    ring_release(&ring);
+    CHECK(ring_get_stats(&ring).count == 3);
+    push(&ring, 4);
+
+    /* Slots 1 to 4 wrap around the end of the storage. */
+    CHECK(ring_acquire(&ring, 10) == 4);
+    for (uint32_t i = 0; i < 4; i++) {
+        CHECK(*(uint32_t *)ring_slot(&ring, i) == i + 1);
+    }
+    CHECK(ring_acquire(&ring, 10) == 0);
+    stats = ring_get_stats(&ring);
+    CHECK(stats.count == 0);
+    CHECK(stats.high_water == 4);
+    CHECK(stats.pushed == 5);
+    CHECK(stats.overruns == 3);
+
+    ring_reset(&ring);
+    stats = ring_get_stats(&ring);
+    CHECK(stats.count == 0 && stats.high_water == 0 && stats.pushed == 0 && stats.overruns == 0);
+    CHECK(stats.oversize == 0);
+}
+
+/* The head and tail counters wrap around at 2^32 without losing records. */
+static void test_counter_wrap(void) {
+    uint32_t storage[8];
+    tspsc_ring ring;
+    ring_init(&ring, storage, 8, sizeof(uint32_t));
+    atomic_store(&ring.head, UINT32_MAX - 2);
+    atomic_store(&ring.tail, UINT32_MAX - 2);
+
+    uint32_t next = 0;
+    for (uint32_t i = 0; i < 20; i++) {
+        push(&ring, i);
+        if (i % 3 == 2) {
+            uint32_t count = ring_acquire(&ring, 8);
+            for (uint32_t j = 0; j < count; j++) {
+                CHECK(*(uint32_t *)ring_slot(&ring, j) == next++);
+            }
+        }
+    }
+    uint32_t count = ring_acquire(&ring, 8);
+    for (uint32_t j = 0; j < count; j++) {
+        CHECK(*(uint32_t *)ring_slot(&ring, j) == next++);
+    }
+    ring_release(&ring);
+    CHECK(next == 20);
+    CHECK(ring_get_stats(&ring).count == 0);
+    /* Held slots count as pending until the next acquire releases them. */
+    CHECK(ring_get_stats(&ring).high_water == 6);
+}
+
+/* Reserve a record of size bytes filled with value and commit it. Return its offset in the storage. */
+static size_t push_record(tspsc_ring *ring, unsigned char *storage, uint32_t size, unsigned char value) {
+    unsigned char *record = ring_reserve_record(ring, size);
+    CHECK(record != NULL);
+    memset(record, value, size);
+    ring_commit_record(ring);
+    return record - storage;
+}
+
+/* Peek at the next record, check its position, size and contents and take it. */
+static void take_record(tspsc_ring *ring, unsigned char *storage, size_t offset, uint32_t size,
+                        unsigned char value) {
+    uint32_t record_size = 0;
+    unsigned char *record = ring_peek_record(ring, &record_size);
+    CHECK(record == storage + offset);
+    CHECK(record_size == size);
+    for (uint32_t i = 0; i < size; i++) {
+        CHECK(record[i] == value);
+    }
+    ring_take_record(ring, record_size);
+}
+
+/* Variable-length records fill the tail exactly, wrap behind a marker and are refused when too large. */
+static void test_records(void) {
+    static _Alignas(RING_RECORD_ALIGN) unsigned char storage[128];
+    tspsc_ring ring;
+    uint32_t size;
+    ring_init(&ring, storage, sizeof(storage), 1);
+    CHECK(ring_peek_record(&ring, &size) == NULL);
+
+    /* 8 + 104 bytes, then 8 + 8 bytes that exactly fill the end of the storage. */
+    CHECK(push_record(&ring, storage, 100, 0xa1) == 8);
+    CHECK(push_record(&ring, storage, 8, 0xb2) == 120);
+    CHECK(ring_get_stats(&ring).count == 128);
+    CHECK(ring_reserve_record(&ring, 1) == NULL);
+    CHECK(ring_get_stats(&ring).overruns == 1);
+
+    take_record(&ring, storage, 8, 100, 0xa1);
+    take_record(&ring, storage, 120, 8, 0xb2);
+    CHECK(ring_peek_record(&ring, &size) == NULL);
+    /* Taken records stay held until they are released. */
+    CHECK(ring_reserve_record(&ring, 1) == NULL);
+    ring_release(&ring);
+    CHECK(ring_get_stats(&ring).count == 0);
+
+    /* Leave 32 bytes at the end, too few for the next record, which goes to the start. */
+    CHECK(push_record(&ring, storage, 88, 0xc3) == 8);
+    take_record(&ring, storage, 8, 88, 0xc3);
+    ring_release(&ring);
+    CHECK(push_record(&ring, storage, 40, 0xd4) == 8);
+    uint32_t marker;
+    memcpy(&marker, storage + 96, sizeof(marker));
+    CHECK(marker == RING_WRAP_MARKER);
+    /* The skipped end counts as pending until the record after it is released. */
+    CHECK(ring_get_stats(&ring).count == 32 + 48);
+    take_record(&ring, storage, 8, 40, 0xd4);
+    CHECK(ring_peek_record(&ring, &size) == NULL);
+    ring_release(&ring);
+    CHECK(ring_get_stats(&ring).count == 0);
+
+    /* A record larger than the ring never fits, including sizes whose footprint would wrap around. */
+    CHECK(ring_reserve_record(&ring, 121) == NULL);
+    CHECK(ring_reserve_record(&ring, UINT32_MAX - 3) == NULL);
+    CHECK(ring_reserve_record(&ring, UINT32_MAX) == NULL);
+
+    tring_stats stats = ring_get_stats(&ring);
+    CHECK(stats.count == 0);
+    CHECK(stats.high_water == 128);
+    CHECK(stats.pushed == 4);
+    CHECK(stats.overruns == 5);
+
+    /* An empty ring takes a record of its full size once the head is back at the start. */
+    CHECK(push_record(&ring, storage, 72, 0xe5) == 56);
+    take_record(&ring, storage, 56, 72, 0xe5);
+    ring_release(&ring);
+    CHECK(push_record(&ring, storage, 120, 0xf6) == 8);
+    take_record(&ring, storage, 8, 120, 0xf6);
+    ring_release(&ring);
+    CHECK(ring_get_stats(&ring).count == 0);
+}
+
+static void *producer(void *p) {
+    tspsc_ring *ring = p;
+    for (uint32_t i = 0; i < THREAD_RECORDS;) {
+        uint32_t *slot = ring_reserve(ring);
+        if (slot) {
+            *slot = i++;
+            ring_commit(ring);
+        } else {
+            sched_yield(); /* let the consumer run on a single CPU */
+        }
+    }
+    return NULL;
+}
+
+/* A consumer thread sees every record of a producer thread once and in order. */
+static void test_threads(void) {
+    static uint32_t storage[64];
+    tspsc_ring ring;
+    ring_init(&ring, storage, 64, sizeof(uint32_t));
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, producer, &ring) == 0);
+
+    uint32_t next = 0;
+    while (next < THREAD_RECORDS) {
+        uint32_t count = ring_acquire(&ring, 16);
+        if (count == 0) {
+            sched_yield();
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            CHECK(*(uint32_t *)ring_slot(&ring, i) == next);
+            next++;
+        }
+    }
+    ring_release(&ring);
+    pthread_join(thread, NULL);
+
+    tring_stats stats = ring_get_stats(&ring);
+    CHECK(stats.count == 0);
+    CHECK(stats.pushed == THREAD_RECORDS);
+    CHECK(stats.high_water <= 64);
+}
+
+int main(void) {
+    test_wrap_and_overrun();
+    test_counter_wrap();
+    test_records();
+    test_threads();
+    printf("test_q330_ring passed\n");
+    return 0;
+}
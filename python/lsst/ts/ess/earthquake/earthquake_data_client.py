@@ -100,6 +100,36 @@ properties:
     description: Timeout for connecting to the TCP/IP interface (sec).
     type: number
     default: 60.0
+  decode_thread:
+    description: >-
+      Decode the data packets in a separate thread, so slow processing
+      does not delay the acknowledgements to the earthquake sensor.
+    type: boolean
+    default: false
+  window:
+    description: >-
+      Data port window to program into the earthquake sensor, up to 127
+      packets, or 0 to keep the window it is programmed with. A larger window
+      keeps high latency links busy.
+    type: integer
+    minimum: 0
+    maximum: 127
+    default: 0
+  ack_count:
+    description: >-
+      Acknowledge every this many data packets, or 0 to use the value the
+      earthquake sensor is programmed with. Missing packets are always
+      acknowledged at once.
+    type: integer
+    minimum: 0
+    default: 0
+  ack_timeout:
+    description: >-
+      Longest time to wait before acknowledging data packets, in units of 0.1
+      seconds, or 0 to use the value the earthquake sensor is programmed with.
+    type: integer
+    minimum: 0
+    default: 0
   sensor_name:
     description: The name of the sensor.
     type: string
@@ -26,20 +26,27 @@ import ctypes
 import logging
 import pathlib
 import platform
-import queue
 import types
 from collections.abc import Callable
 
+import numpy as np
 from lsst.ts import salobj, utils
 
 from .q330_utils import (
     ChannelDataHolder,
+    Q330Handle,
+    Q330Stream,
+    TArenaStats,
     TInit,
     TLibState,
     TMsg,
-    TOnesec,
+    TGoodput,
+    TRecvStat,
+    TRingStats,
     TState,
     TStateType,
+    TTriad,
+    TTriadStats,
 )
 
 EXTENSIONS = {"Linux": "so", "Darwin": "dylib"}
@@ -48,9 +55,12 @@ EXTENSIONS = {"Linux": "so", "Darwin": "dylib"}
 # convert the Q330 timestamps to Unix time.
 JAN_FIRST_2000 = 946684800.0
 
-# Wait time [s] for the telemetry task.
+# Maximum wait time [s] for new data before the telemetry task checks anyway.
 TELEMETRY_WAIT = 1.0
 
+# Maximum number of triads to pop from libq330 in one call.
+TRIAD_BATCH_SIZE = 64
+
 # Wait time [s] for the telemetry thread to be stopped.
 THREAD_STOP_WAIT = 5.0
 
@@ -91,8 +101,6 @@ class Q330Connector:
         The callback for message events.
     miniseed_callback : `ctypes.CFUNCTYPE`[`ctypes.c_void_p`]
         The callback for miniseed events.
-    secdata_callback : `ctypes.CFUNCTYPE`[`ctypes.c_void_p`]
-        The callback for secdata events.
     state_callback : `ctypes.CFUNCTYPE`[`ctypes.c_void_p`]
         The callback for state events.
     """
@@ -119,16 +127,25 @@ class Q330Connector:
 
         self.log.debug("Setting up libq330.")
         self.q330_state: TState | None = None
+        # The libq330 handle of the Q330, which is open while connected.
+        self.handle: Q330Handle | None = None
 
         self.aminiseed_callback = self._get_aminiseed_callback()
         self.message_callback = self._get_message_callback()
         self.miniseed_callback = self._get_miniseed_callback()
-        self.secdata_callback = self._get_secdata_callback()
         self.state_callback = self._get_state_callback()
 
+        self.libq330.q330_open.restype = Q330Handle
         self.libq330.get_message.restype = TMsg
-        self.libq330.get_onesec.restype = TOnesec
         self.libq330.get_state.restype = TState
+        self.libq330.q330_get_ring_stats.restype = TRingStats
+        self.libq330.q330_get_recv_stats.restype = TRecvStat
+        self.libq330.q330_get_goodput.restype = TGoodput
+        self.libq330.q330_get_arena.restype = ctypes.POINTER(ctypes.c_int32)
+        self.libq330.q330_get_arena_size.restype = ctypes.c_uint32
+        self.libq330.q330_get_arena_stats.restype = TArenaStats
+        self.libq330.q330_get_triad_stats.restype = TTriadStats
+        self.libq330.q330_get_event_fd.restype = ctypes.c_int
         self.log.debug("Done setting up libq330.")
 
         # Initialize the telemetry topics.
@@ -136,19 +153,20 @@ class Q330Connector:
             topic: salobj.topics.WriteTopic = self._get_topic_for_name(topic_name)
             topic.set(sensorName=self.config.sensor_name, location=self.config.location)
 
-        # Dict holding the earthquake data until the telemetry can be sent.
-        self.channel_data = dict()
-        for topic_name in ["BH", "BL", "HH", "HL", "LH", "LL", "UH", "VH"]:
-            self.channel_data[topic_name] = ChannelDataHolder(
-                topic_name="",
-                timestamp=0.0,
-                accelerationEastWest=[],
-                accelerationNorthSouth=[],
-                accelerationZenith=[],
-            )
-
-        # Telemetry processing Queue.
-        self.telemetry_queue: queue.Queue = queue.Queue()
+        # Triads to pop from libq330 into, a numpy view on the sample arena of
+        # the libq330 handle, which is created on first use after connecting,
+        # and the number of triads and components libq330 has dropped so far.
+        self.triads = (TTriad * TRIAD_BATCH_SIZE)()
+        self.arena: np.ndarray | None = None
+        self.triad_overruns = 0
+        self.triads_dropped = 0
+        self.arena_exhausted = 0
+
+        # The libq330 fd that becomes readable when new data is queued, which
+        # is watched by the event loop while connected, and the event set when
+        # it became readable.
+        self.event_fd = -1
+        self.data_available = asyncio.Event()
 
     def _get_topic_for_name(self, topic_name: str) -> salobj.topics.WriteTopic:
         """Convenience method to look up the SAL topic for a topic name.
@@ -184,8 +202,8 @@ class Q330Connector:
     def _get_aminiseed_callback(self) -> Callable:
         """Closure for getting the aminiseed callback."""
 
-        @ctypes.CFUNCTYPE(ctypes.c_void_p)
-        def aminiseed_callback() -> None:
+        @ctypes.CFUNCTYPE(ctypes.c_void_p, ctypes.c_void_p)
+        def aminiseed_callback(user: int | None) -> None:
             """Callback method for aminiseed data.
 
             This method is never expected to be called due to the way the Q330
@@ -198,14 +216,14 @@ class Q330Connector:
     def _get_message_callback(self) -> Callable:
         """Closure for getting the message callback."""
 
-        @ctypes.CFUNCTYPE(ctypes.c_void_p)
-        def message_callback() -> None:
+        @ctypes.CFUNCTYPE(ctypes.c_void_p, ctypes.c_void_p)
+        def message_callback(user: int | None) -> None:
             """Callback method for message data.
 
             Only log the received message data at DEBUG level and do not
             process further.
             """
-            message = self.libq330.get_message()
+            message = self.libq330.get_message(self.handle)
             self.log.debug(
                 f"{message.msgcount=}, {message.code=}, "
                 f"message.timestamp={message.timestamp}={self._timestamp_to_tai(message.timestamp)}, "
@@ -218,8 +236,8 @@ class Q330Connector:
     def _get_miniseed_callback(self) -> Callable:
         """Closure for getting the miniseed callback."""
 
-        @ctypes.CFUNCTYPE(ctypes.c_void_p)
-        def miniseed_callback() -> None:
+        @ctypes.CFUNCTYPE(ctypes.c_void_p, ctypes.c_void_p)
+        def miniseed_callback(user: int | None) -> None:
             """Callback method for miniseed data.
 
             The data is not useful for our purposes so it is ignored.
@@ -228,108 +246,139 @@ class Q330Connector:
 
         return miniseed_callback
 
-    def _get_secdata_callback(self) -> Callable:
-        """Closure for getting the secdata callback."""
+    def _get_arena(self) -> np.ndarray:
+        """Get a numpy view on the sample arena of the libq330 handle.
 
-        @ctypes.CFUNCTYPE(ctypes.c_void_p)
-        def secdata_callback() -> None:
-            """Callback method for onesec data.
+        The arena doesn't move while the handle is open, so the view only
+        needs to be created once per connection.
 
-            Process the onesec data which contains the earthquake telemetry
-            data. The data get prepared for processing and then passed on to
-            the _process_samples method.
-            """
-            one_sec = self.libq330.get_onesec()
-            num_samples = one_sec.rate
-            sample_rate = one_sec.rate
-            if num_samples < 0:
-                num_samples = 1
-                sample_rate = -1.0 / one_sec.rate
-            start_date = self._timestamp_to_tai(one_sec.timestamp)
-            end_date = start_date + (num_samples - 1) / sample_rate
-            samples: list[float] = []
-            sample_num = 0
-            channel_name = one_sec.channel.decode("utf-8")
-            for sample in one_sec.samples:
-                samples.append(sample)
-                sample_num += 1
-                if sample_num >= num_samples:
-                    break
-            self.log.debug(
-                f"station_name={one_sec.station_name.decode('utf-8')}, "
-                f"location={one_sec.location.decode('utf-8')}, "
-                f"chan_number={one_sec.chan_number}, "
-                f"channel={channel_name}, "
-                f"rate={one_sec.rate}, "
-                f"{sample_rate=}, "
-                f"start_date={one_sec.timestamp}={start_date}, "
-                f"end_date={end_date}, "
-                f"samples={', '.join(map(str, samples))}."
+        Returns
+        -------
+        `np.ndarray`
+            The samples of the whole arena, without copying them.
+        """
+        if self.arena is None:
+            self.arena = np.ctypeslib.as_array(
+                self.libq330.q330_get_arena(self.handle),
+                shape=(self.libq330.q330_get_arena_size(),),
             )
-            self._process_samples(start_date, channel_name, samples)
+        return self.arena
 
-        return secdata_callback
+    def _triad_to_channel_data(
+        self, triad: TTriad, arena: np.ndarray
+    ) -> ChannelDataHolder:
+        """Convert a triad popped from libq330 to channel data.
 
-    def _process_samples(
-        self, timestamp: float, channel_name: str, samples: list[float]
-    ) -> None:
-        """Process the onesec samples.
+        The samples are copied out of the libq330 sample arena and the arena
+        blocks of the triad are released, so its sample offsets are no longer
+        valid afterwards.
 
         Parameters
         ----------
-        timestamp : `float`
-            TAI time in Unix seconds for the first sample.
-        channel_name : `ChannelName`
-            The channel name.
-        samples : `list`[`float`]
-            The samples to process.
+        triad : `TTriad`
+            The triad.
+        arena : `np.ndarray`
+            The view on the libq330 sample arena.
 
-        Notes
+        Returns
         -------
-        The E, N and Z components of earthquake data are received in separate
-        messages. The data for the three components is collected and queued for
-        sending as telemetry when channel data with a newer timestamp is
-        received.
+        ChannelDataHolder
+            The channel data, of which the components are copies of the
+            samples in the libq330 sample arena. A missing component is an
+            empty array.
         """
-        topic_name = channel_name[:2]
-        if topic_name in ["BH", "BL", "HH", "HL", "LH", "LL", "UH", "VH"]:
-            if self.channel_data[topic_name].timestamp != timestamp:
-                cdh = self.channel_data[topic_name]
-                if cdh.topic_name:
-                    self.log.debug(
-                        f"Appending [{cdh.topic_name=}, {cdh.timestamp=}, "
-                        f"{cdh.accelerationEastWest=}, {cdh.accelerationNorthSouth=}, "
-                        f"{cdh.accelerationZenith=}] telemetry."
-                    )
-                    self.telemetry_queue.put(cdh)
-                self.channel_data[topic_name] = ChannelDataHolder(
-                    topic_name=topic_name,
-                    timestamp=timestamp,
-                    accelerationEastWest=[],
-                    accelerationNorthSouth=[],
-                    accelerationZenith=[],
+        components: list[np.ndarray] = []
+        for index in range(3):
+            if triad.components & (1 << index):
+                start = triad.sample_offset[index]
+                components.append(
+                    arena[start : start + triad.sample_count[index]].copy()
                 )
-            match channel_name[2]:
-                case "E":
-                    self.channel_data[topic_name].accelerationEastWest = samples
-                case "N":
-                    self.channel_data[topic_name].accelerationNorthSouth = samples
-                case "Z":
-                    self.channel_data[topic_name].accelerationZenith = samples
-                case _:
-                    self.log.error(f"Unknown channel {channel_name}.")
+                self.libq330.q330_release_samples(self.handle, start)
+            else:
+                components.append(np.zeros(0, dtype=arena.dtype))
+        return ChannelDataHolder(
+            topic_name=triad.band.decode("utf-8"),
+            timestamp=self._timestamp_to_tai(triad.timestamp),
+            accelerationEastWest=components[0],
+            accelerationNorthSouth=components[1],
+            accelerationZenith=components[2],
+        )
+
+    def _pop_triads(self) -> list[ChannelDataHolder]:
+        """Pop all triads queued by libq330.
+
+        libq330 assembles the E, N and Z components of each band into triads,
+        which are queued once all components arrived or a timeout expired. The
+        samples are read via a numpy view on the libq330 sample arena and
+        copied, after which the arena blocks go back to libq330. Triads and
+        components that were dropped by libq330 are reported here.
+
+        Returns
+        -------
+        list[ChannelDataHolder]
+            The channel data of the triads for which a telemetry topic exists.
+        """
+        arena = self._get_arena()
+        channel_data: list[ChannelDataHolder] = []
+        while True:
+            count = self.libq330.q330_pop_batch_triad(
+                self.handle, self.triads, TRIAD_BATCH_SIZE
+            )
+            if count == 0:
+                break
+            for triad in self.triads[:count]:
+                cdh = self._triad_to_channel_data(triad, arena)
+                if cdh.topic_name in TOPIC_NAME_DICT:
+                    channel_data.append(cdh)
+
+        stats = self.libq330.q330_get_ring_stats(self.handle, Q330Stream.TRIAD.value)
+        if stats.overruns > self.triad_overruns:
+            self.log.warning(
+                f"libq330 dropped {stats.overruns - self.triad_overruns} triads; "
+                f"ring capacity={stats.capacity}, "
+                f"high water mark={stats.high_water}."
+            )
+        self.triad_overruns = stats.overruns
+
+        triad_stats = self.libq330.q330_get_triad_stats(self.handle)
+        if triad_stats.dropped > self.triads_dropped:
+            self.log.warning(
+                f"libq330 dropped {triad_stats.dropped - self.triads_dropped} "
+                "components for lack of a band or sample arena block."
+            )
+        self.triads_dropped = triad_stats.dropped
+
+        arena_stats = self.libq330.q330_get_arena_stats(self.handle)
+        if arena_stats.exhausted > self.arena_exhausted:
+            self.log.warning(
+                f"libq330 sample arena exhausted; {arena_stats.in_use} of "
+                f"{arena_stats.blocks} blocks in use."
+            )
+        self.arena_exhausted = arena_stats.exhausted
+        return channel_data
+
+    def _on_data_available(self) -> None:
+        """Event loop reader callback for the libq330 event fd.
+
+        The fd is cleared right away, since the event loop keeps calling this
+        method as long as it is readable. The data queued so far is popped
+        after the event is set.
+        """
+        self.libq330.q330_clear_event(self.handle)
+        self.data_available.set()
 
     def _get_state_callback(self) -> Callable:
         """Closure for getting the state callback."""
 
-        @ctypes.CFUNCTYPE(ctypes.c_void_p)
-        def state_callback() -> None:
+        @ctypes.CFUNCTYPE(ctypes.c_void_p, ctypes.c_void_p)
+        def state_callback(user: int | None) -> None:
             """Callback method for state data.
 
             Receive the state data and use the Lib330 library to start the data
             flow when the LIBSTATE_RUNWAIT `TLibState` is encountered.
             """
-            self.q330_state = self.libq330.get_state()
+            self.q330_state = self.libq330.get_state(self.handle)
             assert self.q330_state is not None
             if self.q330_state.state_type == 0:
                 self.log.debug(
@@ -340,7 +389,9 @@ class Q330Connector:
                     f"state_name={self.q330_state.state_name.decode('utf-8')}."
                 )
                 if self.q330_state.info == TLibState.LIBSTATE_RUNWAIT:
-                    self.libq330.q330_change_state(TLibState.LIBSTATE_RUN.value)
+                    self.libq330.q330_change_state(
+                        self.handle, TLibState.LIBSTATE_RUN.value
+                    )
                     self.log.debug("Telemetry stream started.")
 
         return state_callback
@@ -348,9 +399,9 @@ class Q330Connector:
     async def connect(self) -> None:
         """Connect to the earthquake sensor.
 
-        Before connecting, the lib330 library is initialized and a connection
-        context is created. Connecting is performed by sending a register
-        request to the earthquake sensor.
+        Before connecting, a libq330 handle is opened for the earthquake
+        sensor and a connection context is created. Connecting is performed
+        by sending a register request to the earthquake sensor.
         """
         self.log.debug("connect.")
         serial_id = int(self.config.serial_id, 16)
@@ -363,72 +414,114 @@ class Q330Connector:
             aminiseed_callback=self.aminiseed_callback,
             message_callback=self.message_callback,
             miniseed_callback=self.miniseed_callback,
-            secdata_callback=self.secdata_callback,
             state_callback=self.state_callback,
+            assemble_triads=True,
+            decode_thread=self.config.decode_thread,
+            window=self.config.window,
+            ack_count=self.config.ack_count,
+            ack_timeout=self.config.ack_timeout,
         )
-        self.libq330.q330_init(init)
-        self.libq330.q330_create_context()
-        self.libq330.q330_register()
+        self.handle = self.libq330.q330_open(init)
+        if self.handle.value is None:
+            self.handle = None
+            raise ConnectionError("libq330 cannot serve any more Q330s.")
+        self.event_fd = self.libq330.q330_get_event_fd(self.handle)
+        if self.event_fd >= 0:
+            asyncio.get_running_loop().add_reader(
+                self.event_fd, self._on_data_available
+            )
+        else:
+            self.log.warning(
+                f"libq330 has no event fd; polling every {TELEMETRY_WAIT} s instead."
+            )
+        self.libq330.q330_create_context(self.handle)
+        self.triad_overruns = 0
+        self.triads_dropped = 0
+        self.arena_exhausted = 0
+        self.libq330.q330_register(self.handle)
 
     async def process_telemetry(self) -> None:
         """Process pending telemetry.
 
-        Check the queue for pending telemetry and write it if there is any.
+        Wait until libq330 signals that new data is queued, for at most
+        TELEMETRY_WAIT seconds, then pop the triads assembled by libq330 and
+        write their telemetry.
         """
-        self.log.debug(f"Length of telemetry queue = {self.telemetry_queue.qsize()}")
-        while not self.telemetry_queue.empty():
-            try:
-                cdh = self.telemetry_queue.get(False)
-
-                # Convert the telemetry to float if necessary, otherwise keep
-                # the array.
-                if len(cdh.accelerationEastWest) == 1:
-                    acceleration_east_west = cdh.accelerationEastWest[0]
-                else:
-                    acceleration_east_west = cdh.accelerationEastWest
-                if len(cdh.accelerationNorthSouth) == 1:
-                    acceleration_north_south = cdh.accelerationNorthSouth[0]
-                else:
-                    acceleration_north_south = cdh.accelerationNorthSouth
-                if len(cdh.accelerationZenith) == 1:
-                    acceleration_zenith = cdh.accelerationZenith[0]
-                else:
-                    acceleration_zenith = cdh.accelerationZenith
-
-                self.log.debug(
-                    f"Writing [{cdh.topic_name=}, {cdh.timestamp=}, "
-                    f"{acceleration_east_west=}, {acceleration_north_south=}, "
-                    f"{acceleration_zenith=}] telemetry."
-                )
+        try:
+            await asyncio.wait_for(self.data_available.wait(), TELEMETRY_WAIT)
+        except TimeoutError:
+            pass
+        self.data_available.clear()
+        channel_data = self._pop_triads() if self.handle is not None else []
+        self.log.debug(f"Number of triads = {len(channel_data)}")
+        for cdh in channel_data:
+            # Convert the telemetry to float if necessary, otherwise keep
+            # the array.
+            if len(cdh.accelerationEastWest) == 1:
+                acceleration_east_west = float(cdh.accelerationEastWest[0])
+            else:
+                acceleration_east_west = cdh.accelerationEastWest
+            if len(cdh.accelerationNorthSouth) == 1:
+                acceleration_north_south = float(cdh.accelerationNorthSouth[0])
+            else:
+                acceleration_north_south = cdh.accelerationNorthSouth
+            if len(cdh.accelerationZenith) == 1:
+                acceleration_zenith = float(cdh.accelerationZenith[0])
+            else:
+                acceleration_zenith = cdh.accelerationZenith
 
-                topic = self._get_topic_for_name(cdh.topic_name)
-                await topic.set_write(
-                    timestamp=cdh.timestamp,
-                    accelerationEastWest=acceleration_east_west,
-                    accelerationNorthSouth=acceleration_north_south,
-                    accelerationZenith=acceleration_zenith,
-                )
-            except queue.Empty:
-                self.log.debug("No telemetry available. Waiting.")
+            self.log.debug(
+                f"Writing [{cdh.topic_name=}, {cdh.timestamp=}, "
+                f"{acceleration_east_west=}, {acceleration_north_south=}, "
+                f"{acceleration_zenith=}] telemetry."
+            )
 
-        await asyncio.sleep(TELEMETRY_WAIT)
+            topic = self._get_topic_for_name(cdh.topic_name)
+            await topic.set_write(
+                timestamp=cdh.timestamp,
+                accelerationEastWest=acceleration_east_west,
+                accelerationNorthSouth=acceleration_north_south,
+                accelerationZenith=acceleration_zenith,
+            )
 
     async def disconnect(self) -> None:
         """Disconnect from the earthquake sensor.
 
         Disconnecting is performed by first sending an IDLE state to the
         earthquake sensor and then a TERM state. The final step is instructing
-        the lib330 library to destroy the conneciton context.
+        the lib330 library to destroy the conneciton context and closing the
+        libq330 handle.
         """
         self.log.debug("disconnect.")
 
         if self.q330_state is not None:
             self.log.debug("Trying to disconnect from the Q330 device in a clean way.")
-            self.libq330.q330_change_state(TLibState.LIBSTATE_IDLE.value)
+            self.libq330.q330_change_state(self.handle, TLibState.LIBSTATE_IDLE.value)
             while self.q330_state.info != TLibState.LIBSTATE_IDLE:
                 await asyncio.sleep(1.0)
-            self.libq330.q330_change_state(TLibState.LIBSTATE_TERM.value)
+            self.libq330.q330_change_state(self.handle, TLibState.LIBSTATE_TERM.value)
             while self.q330_state.info != TLibState.LIBSTATE_TERM:
                 await asyncio.sleep(1.0)
-            self.libq330.q330_destroy_context()
+            recv_stats = self.libq330.q330_get_recv_stats(self.handle)
+            self.log.debug(
+                f"Read {recv_stats.packets} data packets in {recv_stats.reads} "
+                f"batches, at most {recv_stats.largest} at once and "
+                f"{recv_stats.full} full batches."
+            )
+            goodput = self.libq330.q330_get_goodput(self.handle)
+            self.log.debug(
+                f"Added {goodput.packets} data packets to the window with a "
+                f"window of {goodput.window}, {goodput.duplicates} duplicates, "
+                f"{goodput.outside} outside of the window, {goodput.dacks} "
+                f"acknowledgements of which {goodput.immediate} immediate."
+            )
+            self.libq330.q330_destroy_context(self.handle)
             self.q330_state = None
+
+        if self.event_fd >= 0:
+            asyncio.get_running_loop().remove_reader(self.event_fd)
+            self.event_fd = -1
+        if self.handle is not None:
+            self.libq330.q330_close(self.handle)
+            self.handle = None
+            self.arena = None
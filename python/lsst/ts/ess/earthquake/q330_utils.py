@@ -21,12 +21,22 @@
 
 __all__ = [
     "ChannelDataHolder",
+    "Q330Handle",
+    "TArenaStats",
+    "TGoodput",
     "TInit",
     "TMiniseed",
     "TMsg",
     "TOnesec",
+    "TOnesecBuffer",
+    "TOnesecHeader",
+    "TRecvStat",
+    "TRingStats",
     "TState",
+    "TTriad",
+    "TTriadStats",
     "OSF",
+    "Q330Stream",
     "TLibState",
     "TMiniseedAction",
     "TPacketClass",
@@ -37,6 +47,8 @@ import ctypes
 import enum
 from dataclasses import dataclass
 
+import numpy as np
+
 
 @dataclass
 class ChannelDataHolder:
@@ -48,25 +60,35 @@ class ChannelDataHolder:
         The name of the topic to write the data to.
     timestamp : `float`
         The timestamp of the data.
-    accelerationEastWest : `list`[`float`]
+    accelerationEastWest : `np.ndarray`
         The e-component of the data.
-    accelerationNorthSouth : `list`[`float`]
+    accelerationNorthSouth : `np.ndarray`
         The n-component of the data.
-    accelerationZenith : `list`[`float`]
+    accelerationZenith : `np.ndarray`
         The z-component of the data.
 
     Notes
     -----
-    The data for the individual components is received in separate messages.
-    This class is used to collect all component data until all three have
-    arrived so the telemetry for the whole channel can be processed in one go.
+    The data for the individual components is received in separate messages,
+    which libq330 assembles into a triad per band and timestamp. This class
+    holds the data of one triad so the telemetry for the whole channel can be
+    processed in one go. The component data are copied out of the libq330
+    sample arena, so the arena blocks can be released right away.
     """
 
     topic_name: str
     timestamp: float
-    accelerationEastWest: list[float]
-    accelerationNorthSouth: list[float]
-    accelerationZenith: list[float]
+    accelerationEastWest: np.ndarray
+    accelerationNorthSouth: np.ndarray
+    accelerationZenith: np.ndarray
+
+
+class Q330Handle(ctypes.c_void_p):
+    """Opaque handle of one Q330 returned by libq330.
+
+    Being a subclass of `ctypes.c_void_p`, it is not converted to an int
+    when returned, so it can be passed back to libq330 as is.
+    """
 
 
 class TInit(ctypes.Structure):
@@ -92,6 +114,23 @@ class TInit(ctypes.Structure):
         The callback for secdata events.
     state_callback : `ctypes.CFUNCTYPE`[`ctypes.c_void_p`]
         The callback for state events.
+    assemble_triads : `ctypes.c_bool`
+        Queue the one second data as E/N/Z triads instead of onesec records?
+    triad_callback : `ctypes.CFUNCTYPE`[`ctypes.c_void_p`]
+        The callback for queued triads.
+    user : `ctypes.c_void_p`
+        Cookie passed to the callbacks.
+    decode_thread : `ctypes.c_bool`
+        Decode the data packets in a separate lib330 thread?
+    window : `ctypes.c_uint16`
+        The data port window to program into the Q330, 0 to keep its own; a
+        16 bit unsigned integer.
+    ack_count : `ctypes.c_uint16`
+        Acknowledge every this many data packets, 0 for the value of the Q330;
+        a 16 bit unsigned integer.
+    ack_timeout : `ctypes.c_uint16`
+        The acknowledge timeout in 0.1 seconds, 0 for the value of the Q330; a
+        16 bit unsigned integer.
     """
 
     _fields_ = [
@@ -99,11 +138,18 @@ class TInit(ctypes.Structure):
         ("hostname", ctypes.c_char * 250),
         ("baseport", ctypes.c_uint16),
         ("debug", ctypes.c_bool),
-        ("aminiseed_callback", ctypes.CFUNCTYPE(ctypes.c_void_p)),
-        ("message_callback", ctypes.CFUNCTYPE(ctypes.c_void_p)),
-        ("miniseed_callback", ctypes.CFUNCTYPE(ctypes.c_void_p)),
-        ("secdata_callback", ctypes.CFUNCTYPE(ctypes.c_void_p)),
-        ("state_callback", ctypes.CFUNCTYPE(ctypes.c_void_p)),
+        ("aminiseed_callback", ctypes.CFUNCTYPE(ctypes.c_void_p, ctypes.c_void_p)),
+        ("message_callback", ctypes.CFUNCTYPE(ctypes.c_void_p, ctypes.c_void_p)),
+        ("miniseed_callback", ctypes.CFUNCTYPE(ctypes.c_void_p, ctypes.c_void_p)),
+        ("secdata_callback", ctypes.CFUNCTYPE(ctypes.c_void_p, ctypes.c_void_p)),
+        ("state_callback", ctypes.CFUNCTYPE(ctypes.c_void_p, ctypes.c_void_p)),
+        ("assemble_triads", ctypes.c_bool),
+        ("triad_callback", ctypes.CFUNCTYPE(ctypes.c_void_p, ctypes.c_void_p)),
+        ("user", ctypes.c_void_p),
+        ("decode_thread", ctypes.c_bool),
+        ("window", ctypes.c_uint16),
+        ("ack_count", ctypes.c_uint16),
+        ("ack_timeout", ctypes.c_uint16),
     ]
 
 
@@ -274,6 +320,225 @@ class TOnesec(ctypes.Structure):
     ]
 
 
+class TArenaStats(ctypes.Structure):
+    """TArenaStats struct.
+
+    Parameters
+    ----------
+    blocks : `ctypes.c_uint32`
+        The number of blocks in the arena; a 32 bit unsigned integer.
+    block_samples : `ctypes.c_uint32`
+        The number of samples per block; a 32 bit unsigned integer.
+    in_use : `ctypes.c_uint32`
+        The number of blocks in use; a 32 bit unsigned integer.
+    exhausted : `ctypes.c_uint64`
+        The number of times no free block was available; a 64 bit unsigned
+        integer.
+    """
+
+    _fields_ = [
+        ("blocks", ctypes.c_uint32),
+        ("block_samples", ctypes.c_uint32),
+        ("in_use", ctypes.c_uint32),
+        ("exhausted", ctypes.c_uint64),
+    ]
+
+
+class TOnesecHeader(ctypes.Structure):
+    """TOnesecHeader struct.
+
+    Parameters
+    ----------
+    timestamp : `ctypes.c_double`
+        The timestamp [sec since 1 January 2000]; a double.
+    cl_offset : `ctypes.c_double`
+        The closed loop time offset; a double.
+    sample_offset : `ctypes.c_uint32`
+        The index of the first sample in the sample array of the
+        `TOnesecBuffer` or in the sample arena; a 32 bit unsigned integer.
+    sample_count : `ctypes.c_uint32`
+        The number of samples; a 32 bit unsigned integer.
+    rate : `ctypes.c_int32`
+        The sampling rate in samples per second if positive or seconds per
+        sample if negative; a 32 bit signed integer.
+    cl_session : `ctypes.c_uint32`
+        The closed loop session number; a 32 bit unsigned integer.
+    filter_bits : `ctypes.c_uint16`
+        Bitmask of `OSF` enum values; a 16 bit unsigned integer.
+    qual_perc : `ctypes.c_uint16`
+        The clock quality percentage; a 16 bit unsigned integer.
+    activity_flags : `ctypes.c_uint16`
+        Activity flag bitmask; a 16 bit unsigned integer.
+    io_flags : `ctypes.c_uint16`
+        IO flag bitmask; a 16 bit unsigned integer.
+    data_quality_flags : `ctypes.c_uint16`
+        Data quality flag bitmask; a 16 bit unsigned integer.
+    chan_number : `ctypes.c_byte`
+        The channel number; a byte.
+    src_channel : `ctypes.c_byte`
+        The source blockette channel; a byte.
+    src_subchan : `ctypes.c_byte`
+        The source blockette sub-channel; a byte.
+    station_name : `ctypes.c_char` * 10
+        The name of the sensor; a string of length up to 9 characters.
+    location : `ctypes.c_char` * 3
+        The location of the sensor; a string of length up to 2 characters.
+    channel : `ctypes.c_char` * 4
+        The channel; a string of length of always 3 characters.
+    """
+
+    _fields_ = [
+        ("timestamp", ctypes.c_double),
+        ("cl_offset", ctypes.c_double),
+        ("sample_offset", ctypes.c_uint32),
+        ("sample_count", ctypes.c_uint32),
+        ("rate", ctypes.c_int32),
+        ("cl_session", ctypes.c_uint32),
+        ("filter_bits", ctypes.c_uint16),
+        ("qual_perc", ctypes.c_uint16),
+        ("activity_flags", ctypes.c_uint16),
+        ("io_flags", ctypes.c_uint16),
+        ("data_quality_flags", ctypes.c_uint16),
+        ("chan_number", ctypes.c_byte),
+        ("src_channel", ctypes.c_byte),
+        ("src_subchan", ctypes.c_byte),
+        ("station_name", ctypes.c_char * 10),
+        ("location", ctypes.c_char * 3),
+        ("channel", ctypes.c_char * 4),
+    ]
+
+
+class TOnesecBuffer(ctypes.Structure):
+    """TOnesecBuffer struct.
+
+    Parameters
+    ----------
+    headers : `ctypes.POINTER`[`TOnesecHeader`]
+        Array to receive one header per drained record.
+    samples : `ctypes.POINTER`[`ctypes.c_int32`]
+        Array to receive the samples of all drained records back to back.
+    max_samples : `ctypes.c_uint32`
+        The capacity of the sample array, which needs to be at least 1000; a
+        32 bit unsigned integer.
+    sample_count : `ctypes.c_uint32`
+        The number of samples written by the last drain; a 32 bit unsigned
+        integer.
+    """
+
+    _fields_ = [
+        ("headers", ctypes.POINTER(TOnesecHeader)),
+        ("samples", ctypes.POINTER(ctypes.c_int32)),
+        ("max_samples", ctypes.c_uint32),
+        ("sample_count", ctypes.c_uint32),
+    ]
+
+
+class TRecvStat(ctypes.Structure):
+    """TRecvStat struct.
+
+    Parameters
+    ----------
+    reads : `ctypes.c_uint32`
+        The number of reads of the data port that returned at least one
+        datagram; a 32 bit unsigned integer.
+    packets : `ctypes.c_uint32`
+        The number of datagrams read; a 32 bit unsigned integer.
+    largest : `ctypes.c_uint32`
+        The most datagrams returned by a single read; a 32 bit unsigned
+        integer.
+    full : `ctypes.c_uint32`
+        The number of reads that filled the whole batch; a 32 bit unsigned
+        integer.
+    """
+
+    _fields_ = [
+        ("reads", ctypes.c_uint32),
+        ("packets", ctypes.c_uint32),
+        ("largest", ctypes.c_uint32),
+        ("full", ctypes.c_uint32),
+    ]
+
+
+class TGoodput(ctypes.Structure):
+    """TGoodput struct.
+
+    Parameters
+    ----------
+    packets : `ctypes.c_uint32`
+        The number of data packets added to the sliding window; a 32 bit
+        unsigned integer.
+    duplicates : `ctypes.c_uint32`
+        The number of data packets that were already in the window; a 32 bit
+        unsigned integer.
+    outside : `ctypes.c_uint32`
+        The number of data packets outside of the window; a 32 bit unsigned
+        integer.
+    dacks : `ctypes.c_uint32`
+        The number of acknowledgements sent; a 32 bit unsigned integer.
+    immediate : `ctypes.c_uint32`
+        The number of acknowledgements sent at once because a packet went
+        missing or a missing one arrived; a 32 bit unsigned integer.
+    bytes : `ctypes.c_double`
+        The data bytes of the packets added to the window; a double.
+    received : `ctypes.c_double`
+        The data bytes of all data packets; a double.
+    goodput : `ctypes.c_double`
+        The bytes per second added to the window during the last interval of
+        about one second; a double.
+    efficiency : `ctypes.c_float`
+        The percentage of the bytes received during the last interval that
+        were added to the window; a float.
+    window : `ctypes.c_uint16`
+        The data port window the Q330 is programmed with; a 16 bit unsigned
+        integer.
+    """
+
+    _fields_ = [
+        ("packets", ctypes.c_uint32),
+        ("duplicates", ctypes.c_uint32),
+        ("outside", ctypes.c_uint32),
+        ("dacks", ctypes.c_uint32),
+        ("immediate", ctypes.c_uint32),
+        ("bytes", ctypes.c_double),
+        ("received", ctypes.c_double),
+        ("goodput", ctypes.c_double),
+        ("efficiency", ctypes.c_float),
+        ("window", ctypes.c_uint16),
+    ]
+
+
+class TRingStats(ctypes.Structure):
+    """TRingStats struct.
+
+    Parameters
+    ----------
+    capacity : `ctypes.c_uint32`
+        The number of records the ring can hold; a 32 bit unsigned integer.
+    count : `ctypes.c_uint32`
+        The number of records pending; a 32 bit unsigned integer.
+    high_water : `ctypes.c_uint32`
+        The highest number of records that were pending at once; a 32 bit
+        unsigned integer.
+    pushed : `ctypes.c_uint64`
+        The number of records queued; a 64 bit unsigned integer.
+    overruns : `ctypes.c_uint64`
+        The number of records dropped because the ring was full; a 64 bit
+        unsigned integer.
+    oversize : `ctypes.c_uint64`
+        The number of records dropped because they are larger than a slot; a
+        64 bit unsigned integer.
+    """
+
+    _fields_ = [
+        ("capacity", ctypes.c_uint32),
+        ("count", ctypes.c_uint32),
+        ("high_water", ctypes.c_uint32),
+        ("pushed", ctypes.c_uint64),
+        ("overruns", ctypes.c_uint64),
+        ("oversize", ctypes.c_uint64),
+    ]
+
+
 class TState(ctypes.Structure):
     """TState struct.
 
@@ -305,6 +570,69 @@ class TState(ctypes.Structure):
     ]
 
 
+class TTriad(ctypes.Structure):
+    """TTriad struct.
+
+    Parameters
+    ----------
+    timestamp : `ctypes.c_double`
+        The time of the data, corrected for any filtering; a double.
+    rate : `ctypes.c_int32`
+        The sampling rate; a 32 bit integer.
+    sample_count : `ctypes.c_uint32` * 3
+        The number of valid samples of the E, N and Z components.
+    sample_offset : `ctypes.c_uint32` * 3
+        The offsets of the samples of the E, N and Z components in the
+        libq330 sample arena.
+    chan_number : `ctypes.c_uint8` * 3
+        The channel numbers of the E, N and Z components.
+    components : `ctypes.c_uint8`
+        Bit mask of the components present, with bit 0 for E, bit 1 for N
+        and bit 2 for Z.
+    station_name : `ctypes.c_char` * 10
+        The network and station.
+    location : `ctypes.c_char` * 3
+        The location.
+    band : `ctypes.c_char` * 3
+        The first two characters of the channel names.
+    """
+
+    _fields_ = [
+        ("timestamp", ctypes.c_double),
+        ("rate", ctypes.c_int32),
+        ("sample_count", ctypes.c_uint32 * 3),
+        ("sample_offset", ctypes.c_uint32 * 3),
+        ("chan_number", ctypes.c_uint8 * 3),
+        ("components", ctypes.c_uint8),
+        ("station_name", ctypes.c_char * 10),
+        ("location", ctypes.c_char * 3),
+        ("band", ctypes.c_char * 3),
+    ]
+
+
+class TTriadStats(ctypes.Structure):
+    """TTriadStats struct.
+
+    Parameters
+    ----------
+    complete : `ctypes.c_uint64`
+        The number of triads queued with all components; a 64 bit unsigned
+        integer.
+    partial : `ctypes.c_uint64`
+        The number of triads queued with missing components; a 64 bit
+        unsigned integer.
+    dropped : `ctypes.c_uint64`
+        The number of components dropped for lack of a band or arena block;
+        a 64 bit unsigned integer.
+    """
+
+    _fields_ = [
+        ("complete", ctypes.c_uint64),
+        ("partial", ctypes.c_uint64),
+        ("dropped", ctypes.c_uint64),
+    ]
+
+
 class OSF(enum.IntEnum):
     """One second filtering bit masks."""
 
@@ -314,6 +642,23 @@ class OSF(enum.IntEnum):
     OSF_EP = 8  # bit set to send 1hz Environmental Processor data
 
 
+class Q330Stream(enum.IntEnum):
+    """Enum representing the tq330_stream C enum.
+
+    Notes
+    -----
+    The values need to be explicitly defined since C enum values start at 0 and
+    Python enum.auto() starts at 1.
+    """
+
+    AMINISEED = 0
+    MESSAGE = 1
+    MINISEED = 2
+    ONESEC = 3
+    STATE = 4
+    TRIAD = 5
+
+
 class TLibState(enum.IntEnum):
     """Enum representing the tlibstate C enum.
 
@@ -53,6 +53,10 @@ class EarthquakeDataClientTestCase(unittest.IsolatedAsyncioTestCase):
                 port=6330,
                 serial_id="0123456789ABCDEF",
                 max_read_timeouts=5,
+                decode_thread=False,
+                window=0,
+                ack_count=0,
+                ack_timeout=0,
                 connect_timeout=1,
                 sensor_name="UnitTest",
                 location="UnitTest",
@@ -68,10 +72,12 @@ class EarthquakeDataClientTestCase(unittest.IsolatedAsyncioTestCase):
             self.earthquake_data_client.q330_connector.libq330.q330_change_state = (
                 self.mock_set_libq330_state
             )
+            q330_connector = self.earthquake_data_client.q330_connector
+            q330_connector.libq330.q330_get_event_fd.return_value = -1
 
             await self.earthquake_data_client.connect()
             await self.earthquake_data_client.disconnect()
 
-    def mock_set_libq330_state(self, new_value: int) -> None:
+    def mock_set_libq330_state(self, handle: object, new_value: int) -> None:
         self.earthquake_data_client.q330_connector.q330_state = earthquake.TState()
         self.earthquake_data_client.q330_connector.q330_state.info = new_value
@@ -19,60 +19,285 @@
 # You should have received a copy of the GNU General Public License
 # along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
+import asyncio
+import ctypes
 import logging
+import os
+import time
 import types
 import unittest
 from unittest import mock
 
+import numpy as np
+import pytest
 from lsst.ts import salobj
 from lsst.ts.ess import earthquake
+from lsst.ts.ess.earthquake import q330_connector
+
+TOPIC_NAMES = [
+    "tel_earthquakeBroadBandHighGain",
+    "tel_earthquakeBroadBandLowGain",
+    "tel_earthquakeHighBroadBandHighGain",
+    "tel_earthquakeHighBroadBandLowGain",
+    "tel_earthquakeLongPeriodHighGain",
+    "tel_earthquakeLongPeriodLowGain",
+    "tel_earthquakeUltraLongPeriodHighGain",
+    "tel_earthquakeVeryLongPeriodHighGain",
+]
+
+# Number of samples in the fake libq330 sample arena.
+ARENA_SIZE = 64
+
+
+def make_triad(
+    band: str, timestamp: float, components: dict[int, tuple[int, int]]
+) -> earthquake.TTriad:
+    """Make a triad as libq330 queues it.
+
+    Parameters
+    ----------
+    band : `str`
+        The band of the triad.
+    timestamp : `float`
+        The Q330 timestamp of the triad.
+    components : `dict`[`int`, `tuple`[`int`, `int`]]
+        The sample offset and count of each component present, by component
+        index: 0 for E, 1 for N and 2 for Z.
+
+    Returns
+    -------
+    `earthquake.TTriad`
+        The triad.
+    """
+    triad = earthquake.TTriad(timestamp=timestamp, rate=1, band=band.encode("utf-8"))
+    for index, (sample_offset, sample_count) in components.items():
+        triad.components |= 1 << index
+        triad.sample_offset[index] = sample_offset
+        triad.sample_count[index] = sample_count
+    return triad
 
 
 class Q330ConnectorTestCase(unittest.IsolatedAsyncioTestCase):
-    @mock.patch("lsst.ts.ess.earthquake.q330_connector.ctypes.CDLL", mock.MagicMock())
-    async def test_q330_connector(self) -> None:
+    def setUp(self) -> None:
         if hasattr(salobj, "set_random_topic_subname"):
             salobj.set_random_topic_subname()
         else:
             salobj.set_random_lsst_dds_partition_prefix()
+
+    @mock.patch("lsst.ts.ess.earthquake.q330_connector.ctypes.CDLL", mock.MagicMock())
+    async def test_q330_connector(self) -> None:
         async with salobj.make_mock_write_topics(
-            name="ESS",
-            attr_names=[
-                "tel_earthquakeBroadBandHighGain",
-                "tel_earthquakeBroadBandLowGain",
-                "tel_earthquakeHighBroadBandHighGain",
-                "tel_earthquakeHighBroadBandLowGain",
-                "tel_earthquakeLongPeriodHighGain",
-                "tel_earthquakeLongPeriodLowGain",
-                "tel_earthquakeUltraLongPeriodHighGain",
-                "tel_earthquakeVeryLongPeriodHighGain",
-            ],
+            name="ESS", attr_names=TOPIC_NAMES
         ) as topics:
-            config = types.SimpleNamespace(
-                host="127.0.0.1",
-                port=6330,
-                serial_id="0123456789ABCDEF",
-                max_read_timeouts=5,
-                sensor_name="UnitTest",
-                location="UnitTest",
+            self.make_q330_connector(topics)
+            self.q330_connector.libq330.q330_get_event_fd.return_value = -1
+
+            await self.q330_connector.connect()
+            await self.q330_connector.disconnect()
+
+    @mock.patch("lsst.ts.ess.earthquake.q330_connector.ctypes.CDLL", mock.MagicMock())
+    async def test_event_fd(self) -> None:
+        async with salobj.make_mock_write_topics(
+            name="ESS", attr_names=TOPIC_NAMES
+        ) as topics:
+            self.make_q330_connector(topics)
+            libq330 = self.q330_connector.libq330
+            self.set_triads([])
+            read_fd, write_fd = os.pipe()
+            try:
+                libq330.q330_get_event_fd.return_value = read_fd
+                # Like libq330, make the fd unreadable again when cleared.
+                libq330.q330_clear_event.side_effect = lambda handle: os.read(
+                    read_fd, 1
+                )
+                await self.q330_connector.connect()
+                self.q330_connector.data_available.clear()
+
+                loop = asyncio.get_running_loop()
+                loop.call_later(0.1, os.write, write_fd, b"x")
+                start = time.monotonic()
+                await self.q330_connector.process_telemetry()
+                assert time.monotonic() - start < q330_connector.TELEMETRY_WAIT / 2
+                libq330.q330_clear_event.assert_called_once_with(
+                    self.q330_connector.handle
+                )
+
+                await self.q330_connector.disconnect()
+                assert not loop.remove_reader(read_fd)
+            finally:
+                os.close(read_fd)
+                os.close(write_fd)
+
+    @mock.patch("lsst.ts.ess.earthquake.q330_connector.ctypes.CDLL", mock.MagicMock())
+    async def test_triads(self) -> None:
+        async with salobj.make_mock_write_topics(
+            name="ESS", attr_names=TOPIC_NAMES
+        ) as topics:
+            self.make_q330_connector(topics)
+            self.set_triads(
+                [
+                    make_triad("BH", 100.0, {0: (0, 3), 1: (10, 3), 2: (20, 3)}),
+                    make_triad("LH", 101.0, {0: (30, 1), 2: (40, 1)}),
+                    make_triad("XX", 102.0, {0: (50, 2)}),
+                ]
+            )
+            await self.q330_connector.process_telemetry()
+
+            # The samples were copied, so reusing the arena doesn't change them.
+            self.arena[:] = [-1] * ARENA_SIZE
+            assert set(self.written_topics) == {"BH", "LH"}
+            self.check_written(
+                "BH",
+                timestamp=self.q330_connector._timestamp_to_tai(100.0),
+                accelerationEastWest=[0, 1, 2],
+                accelerationNorthSouth=[10, 11, 12],
+                accelerationZenith=[20, 21, 22],
             )
-            log = logging.getLogger(type(self).__name__)
-            self.q330_connector = earthquake.Q330Connector(
-                config=config, topics=topics, log=log
+            # The missing N component is written as an empty array.
+            self.check_written(
+                "LH",
+                timestamp=self.q330_connector._timestamp_to_tai(101.0),
+                accelerationEastWest=30.0,
+                accelerationNorthSouth=[],
+                accelerationZenith=40.0,
             )
-            assert self.q330_connector is not None
 
-            self.q330_connector.q330_state = earthquake.TState()
-            self.q330_connector.q330_state.info = (
-                earthquake.TLibState.LIBSTATE_RUNWAIT.value
+            # The blocks of the unknown band are released as well.
+            assert self.q330_connector.libq330.q330_release_samples.call_args_list == [
+                mock.call(self.q330_connector.handle, offset)
+                for offset in [0, 10, 20, 30, 40, 50]
+            ]
+
+    @mock.patch("lsst.ts.ess.earthquake.q330_connector.ctypes.CDLL", mock.MagicMock())
+    async def test_triads_write_failure(self) -> None:
+        async with salobj.make_mock_write_topics(
+            name="ESS", attr_names=TOPIC_NAMES
+        ) as topics:
+            self.make_q330_connector(topics)
+            self.set_triads(
+                [
+                    make_triad("BH", 100.0, {0: (0, 3), 1: (10, 3), 2: (20, 3)}),
+                    make_triad("LH", 101.0, {0: (30, 1), 2: (40, 1)}),
+                ]
             )
+            self.write_error = RuntimeError("Write failed.")
 
-            self.q330_connector.libq330 = mock.MagicMock()
-            self.q330_connector.libq330.q330_change_state = self.mock_set_libq330_state
+            with pytest.raises(RuntimeError):
+                await self.q330_connector.process_telemetry()
 
-            await self.q330_connector.connect()
-            await self.q330_connector.disconnect()
+            # All blocks went back before the first write.
+            assert set(self.written_topics) == {"BH"}
+            assert self.q330_connector.libq330.q330_release_samples.call_args_list == [
+                mock.call(self.q330_connector.handle, offset)
+                for offset in [0, 10, 20, 30, 40]
+            ]
+
+    def make_q330_connector(self, topics: salobj.Controller) -> None:
+        """Make a Q330Connector with a mock libq330.
+
+        Parameters
+        ----------
+        topics : `salobj.Controller`
+            The telemetry topics.
+        """
+        config = types.SimpleNamespace(
+            host="127.0.0.1",
+            port=6330,
+            serial_id="0123456789ABCDEF",
+            max_read_timeouts=5,
+            decode_thread=False,
+            window=0,
+            ack_count=0,
+            ack_timeout=0,
+            sensor_name="UnitTest",
+            location="UnitTest",
+        )
+        log = logging.getLogger(type(self).__name__)
+        self.q330_connector = earthquake.Q330Connector(
+            config=config, topics=topics, log=log
+        )
+        assert self.q330_connector is not None
+
+        self.q330_connector.q330_state = earthquake.TState()
+        self.q330_connector.q330_state.info = (
+            earthquake.TLibState.LIBSTATE_RUNWAIT.value
+        )
+
+        self.q330_connector.libq330 = mock.MagicMock()
+        self.q330_connector.libq330.q330_change_state = self.mock_set_libq330_state
+
+    def set_triads(self, triads: list[earthquake.TTriad]) -> None:
+        """Make the mock libq330 queue triads with samples in a fake arena.
+
+        The samples of the arena equal their offset. The telemetry topics are
+        replaced by mocks, which are collected in written_topics by band when
+        used.
+
+        Parameters
+        ----------
+        triads : `list`[`earthquake.TTriad`]
+            The triads to pop, all in one batch.
+        """
+        self.arena = (ctypes.c_int32 * ARENA_SIZE)(*range(ARENA_SIZE))
+        self.written_topics: dict[str, mock.MagicMock] = {}
+        self.write_error: Exception | None = None
+        pending = list(triads)
+
+        def pop_batch_triad(
+            handle: earthquake.Q330Handle, batch: ctypes.Array, max_count: int
+        ) -> int:
+            count = min(len(pending), max_count)
+            for index in range(count):
+                batch[index] = pending.pop(0)
+            return count
+
+        def get_topic_for_name(topic_name: str) -> mock.MagicMock:
+            topic = mock.MagicMock()
+            topic.set_write = mock.AsyncMock(side_effect=self.write_error)
+            self.written_topics[topic_name] = topic
+            return topic
+
+        libq330 = self.q330_connector.libq330
+        libq330.q330_get_arena.return_value = ctypes.cast(
+            self.arena, ctypes.POINTER(ctypes.c_int32)
+        )
+        libq330.q330_get_arena_size.return_value = ARENA_SIZE
+        libq330.q330_pop_batch_triad.side_effect = pop_batch_triad
+        libq330.q330_get_ring_stats.return_value = earthquake.TRingStats()
+        libq330.q330_get_triad_stats.return_value = earthquake.TTriadStats()
+        libq330.q330_get_arena_stats.return_value = earthquake.TArenaStats()
+        self.q330_connector._get_topic_for_name = get_topic_for_name
+        self.q330_connector.handle = earthquake.Q330Handle(1)
+        self.q330_connector.data_available.set()
+
+    def check_written(
+        self, band: str, timestamp: float, **expected: float | list[int]
+    ) -> None:
+        """Check the telemetry written for a band.
+
+        Parameters
+        ----------
+        band : `str`
+            The band of the triad.
+        timestamp : `float`
+            The expected TAI timestamp.
+        **expected : `float` | `list`[`int`]
+            The expected value of each acceleration component, a float for a
+            single sample and otherwise the samples, which must have been
+            written as a numpy array.
+        """
+        set_write = self.written_topics[band].set_write
+        set_write.assert_awaited_once()
+        kwargs = set_write.call_args.kwargs
+        assert set(kwargs) == {"timestamp", *expected}
+        assert kwargs["timestamp"] == timestamp
+        for name, value in expected.items():
+            if isinstance(value, float):
+                assert kwargs[name] == value
+            else:
+                assert isinstance(kwargs[name], np.ndarray)
+                np.testing.assert_array_equal(kwargs[name], value)
 
-    def mock_set_libq330_state(self, new_value: int) -> None:
+    def mock_set_libq330_state(self, handle: object, new_value: int) -> None:
         self.q330_connector.q330_state = earthquake.TState()
         self.q330_connector.q330_state.info = new_value